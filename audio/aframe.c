@@ -19,6 +19,7 @@
 #include <libavutil/mem.h>
 
 #include "common/common.h"
+#include "common/perf_counters.h"
 
 #include "chmap.h"
 #include "fmt-conversion.h"
@@ -53,6 +54,7 @@ struct mp_aframe *mp_aframe_create(void)
         abort();
     talloc_set_destructor(frame, free_frame);
     mp_aframe_reset(frame);
+    mp_perf_inc(MP_PERF_FRAMES_ALLOCATED);
     return frame;
 }
 
@@ -497,6 +499,7 @@ bool mp_aframe_copy_samples(struct mp_aframe *dst, int dst_offset,
         memcpy(d[n] + dst_offset * sstride, s[n] + src_offset * sstride,
                samples * sstride);
     }
+    mp_perf_add(MP_PERF_PCM_BYTES_FILTER, planes * samples * sstride);
 
     return true;
 }
@@ -39,6 +39,7 @@
 #include "audio/format.h"
 #include "common/common.h"
 #include "common/msg.h"
+#include "common/perf_counters.h"
 #include "filters/f_autoconvert.h"
 #include "filters/filter_internal.h"
 #include "filters/user_filters.h"
@@ -124,6 +125,7 @@ static bool fill_queue(struct priv *s)
     if (bytes_copy > 0) {
         uint8_t **planes = mp_aframe_get_data_ro(s->in);
         memcpy(s->buf_queue + s->bytes_queued, planes[0] + offset, bytes_copy);
+        mp_perf_add(MP_PERF_PCM_BYTES_SCALETEMPO, bytes_copy);
         s->bytes_queued += bytes_copy;
         offset += bytes_copy;
         bytes_needed -= bytes_copy;
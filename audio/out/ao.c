@@ -128,6 +128,9 @@ const struct m_sub_options ao_conf = {
         OPT_STRING("audio-client-name", audio_client_name, UPDATE_AUDIO),
         OPT_DOUBLE("audio-buffer", audio_buffer, M_OPT_MIN | M_OPT_MAX,
                    .min = 0, .max = 10),
+        OPT_FLAG("audio-low-latency", audio_low_latency, UPDATE_AUDIO),
+        OPT_DOUBLE("audio-latency-target", audio_latency_target, M_OPT_MIN,
+                   .min = 0),
         {0}
     },
     .size = sizeof(OPT_BASE_STRUCT),
@@ -162,6 +165,7 @@ static struct ao *ao_alloc(bool probing, struct mpv_global *global,
         .wakeup_ctx = wakeup_ctx,
         .log = mp_log_new(ao, log, name),
         .def_buffer = opts->audio_buffer,
+        .low_latency = opts->audio_low_latency,
         .client_name = talloc_strdup(ao, opts->audio_client_name),
     };
     talloc_free(opts);
@@ -380,6 +384,18 @@ double ao_get_delay(struct ao *ao)
     return ao->api->get_delay(ao);
 }
 
+// Like ao_get_delay(), but split the result into the audio still queued in the
+// AO's own soft buffer (*soft), and what was already handed to the audio
+// driver and device (*device). Both are in seconds.
+void ao_get_delay_split(struct ao *ao, double *soft, double *device)
+{
+    double total = ao_get_delay(ao);
+    double buffered = ao->api->get_soft_delay ? ao->api->get_soft_delay(ao) : 0;
+    buffered = MPCLAMP(buffered, 0, total);
+    *soft = buffered;
+    *device = total - buffered;
+}
+
 // Return free size of the internal audio buffer. This controls how much audio
 // the core should decode and try to queue with ao_play().
 int ao_get_space(struct ao *ao)
@@ -39,6 +39,7 @@
 #include "options/m_config.h"
 #include "options/m_option.h"
 #include "common/msg.h"
+#include "common/perf_counters.h"
 #include "osdep/endian.h"
 
 #include <alsa/asoundlib.h>
@@ -795,10 +796,17 @@ static int init_device(struct ao *ao, int mode)
     snd_pcm_hw_params_copy(hwparams_backup, alsa_hwparams);
 
     // Cargo-culted buffer settings; might still be useful for PulseAudio.
+    int buffer_time = opts->buffer_time;
+    if (ao->low_latency && (!buffer_time || buffer_time > 20000)) {
+        // 20ms in 4 periods of 5ms
+        buffer_time = 20000;
+        MP_VERBOSE(ao, "low latency: limiting buffer time to %dus\n",
+                   buffer_time);
+    }
     err = 0;
-    if (opts->buffer_time) {
+    if (buffer_time) {
         err = snd_pcm_hw_params_set_buffer_time_near
-                (p->alsa, alsa_hwparams, &(unsigned int){opts->buffer_time}, NULL);
+                (p->alsa, alsa_hwparams, &(unsigned int){buffer_time}, NULL);
         CHECK_ALSA_WARN("Unable to set buffer time near");
     }
     if (err >= 0 && opts->frags) {
@@ -1130,8 +1138,10 @@ static int play(struct ao *ao, void **data, int samples, int flags)
             } else if (res == -EPIPE) {
                 // For some reason, writing a smaller fragment at the end
                 // immediately underruns.
-                if (!(flags & AOPLAY_FINAL_CHUNK))
+                if (!(flags & AOPLAY_FINAL_CHUNK)) {
                     MP_WARN(ao, "Device underrun detected.\n");
+                    mp_perf_inc(MP_PERF_AO_UNDERRUNS);
+                }
             } else {
                 MP_ERR(ao, "Write error: %s\n", snd_strerror(res));
             }
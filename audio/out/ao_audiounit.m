@@ -70,6 +70,8 @@ static bool init_audiounit(struct ao *ao)
     [instance setMode:AVAudioSessionModeMoviePlayback error:nil];
     [instance setActive:YES error:nil];
     [instance setPreferredOutputNumberOfChannels:prefChannels error:nil];
+    if (ao->low_latency)
+        [instance setPreferredIOBufferDuration:0.005 error:nil];
 
     AudioComponentDescription desc = (AudioComponentDescription) {
         .componentType         = kAudioUnitType_Output,
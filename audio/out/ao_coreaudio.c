@@ -292,6 +292,9 @@ static bool init_audiounit(struct ao *ao, AudioStreamBasicDescription asbd)
     CHECK_CA_ERROR_L(coreaudio_error_audiounit,
                      "can't link audio unit to selected device");
 
+    if (ao->low_latency)
+        ca_set_low_latency(ao, p->device);
+
     p->hw_latency_us = ca_get_hardware_latency(ao);
 
     AURenderCallbackStruct render_cb = (AURenderCallbackStruct) {
@@ -384,6 +384,9 @@ static int init(struct ao *ao)
         MP_WARN(ao, "Using spdif passthrough hack. This could produce noise.\n");
     }
 
+    if (ao->low_latency)
+        ca_set_low_latency(ao, p->device);
+
     p->hw_latency_us = ca_get_device_latency_us(ao, p->device);
     MP_VERBOSE(ao, "base latency: %d microseconds\n", (int)p->hw_latency_us);
 
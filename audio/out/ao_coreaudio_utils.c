@@ -443,6 +443,25 @@ int64_t ca_get_device_latency_us(struct ao *ao, AudioDeviceID device)
     return ca_frames_to_us(ao, latency_frames);
 }
 
+// For --audio-low-latency: make the device's I/O buffer (the period in which
+// the render callback is called) about 5 ms, within the range it supports.
+void ca_set_low_latency(struct ao *ao, AudioDeviceID device)
+{
+    AudioValueRange range;
+    OSStatus err = CA_GET(device, kAudioDevicePropertyBufferFrameSizeRange,
+                          &range);
+    CHECK_CA_ERROR("cannot get device buffer size range");
+
+    uint32_t frames = MPCLAMP(ao->samplerate / 200, range.mMinimum,
+                              range.mMaximum);
+    err = CA_SET(device, kAudioDevicePropertyBufferFrameSize, &frames);
+    CHECK_CA_ERROR("cannot set device buffer size");
+    MP_VERBOSE(ao, "Device buffer set to %d frames.\n", (int)frames);
+
+coreaudio_error:
+    return;
+}
+
 static OSStatus ca_change_format_listener(
     AudioObjectID object, uint32_t n_addresses,
     const AudioObjectPropertyAddress addresses[],
@@ -106,6 +106,11 @@ static int init(struct ao *ao)
 
     priv->latency = priv->latency_sec * ao->samplerate;
 
+    if (ao->low_latency) {
+        priv->outburst = MPMIN(priv->outburst, 64);
+        priv->bufferlen = MPMIN(priv->bufferlen, 0.02);
+    }
+
     // A "buffer" for this many seconds of audio
     int bursts = (int)(ao->samplerate * priv->bufferlen + 1) / priv->outburst;
     priv->buffersize = priv->outburst * bursts + priv->latency;
@@ -75,6 +75,8 @@ struct ao {
 
     int buffer;
     double def_buffer;
+    bool low_latency;           // --audio-low-latency: small device buffer,
+                                // no extra soft buffering
     void *api_priv;
 };
 
@@ -155,6 +157,9 @@ struct ao_driver {
     int (*play)(struct ao *ao, void **data, int samples, int flags);
     // push based: see ao_get_delay()
     double (*get_delay)(struct ao *ao);
+    // api only: the part of get_delay() that is still in the generic soft
+    // buffer of the push/pull wrapper (see ao_get_delay_split())
+    double (*get_soft_delay)(struct ao *ao);
     // push based: block until all queued audio is played (optional)
     void (*drain)(struct ao *ao);
     // Optional. Return true if audio has stopped in any way.
@@ -25,6 +25,7 @@
 
 #include "common/msg.h"
 #include "common/common.h"
+#include "common/perf_counters.h"
 
 #include "input/input.h"
 
@@ -106,6 +107,7 @@ static int play(struct ao *ao, void **data, int samples, int flags)
         int r = mp_ring_write(p->buffers[n], data[n], write_bytes);
         assert(r == write_bytes);
     }
+    mp_perf_add(MP_PERF_PCM_BYTES_AO, write_bytes * ao->num_planes);
 
     int state = atomic_load(&p->state);
     if (!IS_PLAYING(state)) {
@@ -143,6 +145,8 @@ int ao_read_data(struct ao *ao, void **data, int samples, int64_t out_time_us)
     bool need_wakeup = false;
     int bytes = 0;
 
+    mp_perf_inc(MP_PERF_AO_WAKEUPS);
+
     // Play silence in states other than AO_STATE_PLAY.
     if (!atomic_compare_exchange_strong(&p->state, &(int){AO_STATE_PLAY},
                                         AO_STATE_BUSY))
@@ -156,6 +160,9 @@ int ao_read_data(struct ao *ao, void **data, int samples, int64_t out_time_us)
     if (buffered_bytes < bytes && !atomic_load(&p->draining))
         atomic_fetch_add(&p->underflow, (bytes - buffered_bytes) / ao->sstride);
 
+    if (buffered_bytes < full_bytes && !atomic_load(&p->draining))
+        mp_perf_inc(MP_PERF_AO_UNDERRUNS);
+
     if (bytes > 0)
         atomic_store(&p->end_time_us, out_time_us);
 
@@ -246,6 +253,12 @@ static double get_delay(struct ao *ao)
     return mp_ring_buffered(p->buffers[0]) / (double)ao->bps + driver_delay;
 }
 
+static double get_soft_delay(struct ao *ao)
+{
+    struct ao_pull_state *p = ao->api_priv;
+    return mp_ring_buffered(p->buffers[0]) / (double)ao->bps;
+}
+
 static void reset(struct ao *ao)
 {
     struct ao_pull_state *p = ao->api_priv;
@@ -330,6 +343,7 @@ const struct ao_driver ao_api_pull = {
     .get_space = get_space,
     .play = play,
     .get_delay = get_delay,
+    .get_soft_delay = get_soft_delay,
     .get_eof = get_eof,
     .pause = pause,
     .resume = resume,
@@ -30,6 +30,8 @@
 
 #include "common/msg.h"
 #include "common/common.h"
+#include "common/perf_counters.h"
+#include "common/tracing.h"
 
 #include "input/input.h"
 
@@ -105,6 +107,15 @@ static double get_delay(struct ao *ao)
     return delay;
 }
 
+static double get_soft_delay(struct ao *ao)
+{
+    struct ao_push_state *p = ao->api_priv;
+    pthread_mutex_lock(&p->lock);
+    double delay = mp_audio_buffer_seconds(p->buffer);
+    pthread_mutex_unlock(&p->lock);
+    return delay;
+}
+
 static void reset(struct ao *ao)
 {
     struct ao_push_state *p = ao->api_priv;
@@ -193,7 +204,7 @@ static int unlocked_get_space(struct ao *ao)
         int soft_buffered = mp_audio_buffer_samples(p->buffer);
         // The extra margin helps avoiding too many wakeups if the AO is fully
         // byte based and doesn't do proper chunked processing.
-        int min_buffer = ao->buffer + 64;
+        int min_buffer = ao->buffer + (ao->low_latency ? 0 : 64);
         int missing = min_buffer - device_buffered - soft_buffered;
         missing = (missing + align - 1) / align * align;
         // But always keep the device's buffer filled as much as we can.
@@ -239,6 +250,7 @@ static int play(struct ao *ao, void **data, int samples, int flags)
     bool is_final = flags & AOPLAY_FINAL_CHUNK;
 
     mp_audio_buffer_append(p->buffer, data, samples);
+    mp_perf_add(MP_PERF_PCM_BYTES_AO, samples * ao->sstride * ao->num_planes);
 
     bool got_data = write_samples > 0 || p->paused || p->final_chunk != is_final;
 
@@ -282,6 +294,7 @@ static bool realloc_silence(struct ao *ao, int samples)
 static void ao_play_data(struct ao *ao)
 {
     struct ao_push_state *p = ao->api_priv;
+    mp_tracing_begin("ao play_data");
     int space = ao->driver->get_space(ao);
     bool play_silence = p->paused || (ao->stream_silence && !p->still_playing);
     space = MPMAX(space, 0);
@@ -349,6 +362,8 @@ static void ao_play_data(struct ao *ao)
         ao->wakeup_cb(ao->wakeup_ctx); // request more data
     MP_TRACE(ao, "in=%d flags=%d space=%d r=%d wa/pl=%d/%d needed=%d more=%d\n",
              max, flags, space, r, p->wait_on_ao, p->still_playing, needed, more);
+    mp_tracing_counter("ao buffered samples", mp_audio_buffer_samples(p->buffer));
+    mp_tracing_end("ao play_data");
 }
 
 static void *playthread(void *arg)
@@ -358,6 +373,7 @@ static void *playthread(void *arg)
     mpthread_set_name("ao");
     pthread_mutex_lock(&p->lock);
     while (!p->terminate) {
+        mp_perf_inc(MP_PERF_AO_WAKEUPS);
         bool blocked = ao->driver->initially_blocked && !p->initial_unblocked;
         bool playing = (!p->paused || ao->stream_silence) && !blocked;
         if (playing)
@@ -365,6 +381,7 @@ static void *playthread(void *arg)
 
         if (!p->need_wakeup) {
             MP_STATS(ao, "start audio wait");
+            mp_tracing_begin("ao wait");
             if (!p->wait_on_ao || !playing) {
                 // Avoid busy waiting, because the audio API will still report
                 // that it needs new data, even if we're not ready yet, or if
@@ -413,6 +430,7 @@ static void *playthread(void *arg)
                     }
                 }
             }
+            mp_tracing_end("ao wait");
             MP_STATS(ao, "end audio wait");
         }
         p->need_wakeup = false;
@@ -484,6 +502,7 @@ const struct ao_driver ao_api_push = {
     .get_space = get_space,
     .play = play,
     .get_delay = get_delay,
+    .get_soft_delay = get_soft_delay,
     .pause = audio_pause,
     .resume = resume,
     .drain = drain,
@@ -9,6 +9,9 @@ struct mpv_global {
     struct m_config_shadow *config;
     struct mp_client_api *client_api;
     char *configdir;
+    // Shared pool for short jobs that can run in parallel (bounded to the
+    // number of CPUs). Don't use it for jobs that block for long.
+    struct mp_thread_pool *thread_pool;
 };
 
 #endif
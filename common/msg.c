@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 
 #include "mpa_talloc.h"
@@ -36,6 +37,7 @@
 #include "options/path.h"
 #include "osdep/terminal.h"
 #include "osdep/io.h"
+#include "osdep/threads.h"
 #include "osdep/timer.h"
 
 #include "libmpa/client.h"
@@ -59,15 +61,26 @@ struct mp_log_root {
     bool force_stderr;
     struct mp_log_buffer **buffers;
     int num_buffers;
-    FILE *log_file;
     FILE *stats_file;
-    char *log_path;
     char *stats_path;
+    // --- owner thread only (caller of mp_msg_init() etc.)
+    char *log_path;
+    pthread_t log_file_thread;
+    // --- owner thread only, but used by log_file_thread while it's running
+    FILE *log_file;
+    // --- protected by log_file_lock
+    bool log_file_thread_active; // also termination signal for the thread
+    struct log_file_ring *log_file_rings; // one per thread that logged
     // --- must be accessed atomically
     /* This is incremented every time the msglevels must be reloaded.
      * (This is perhaps better than maintaining a globally accessible and
      * synchronized mp_log tree.) */
     atomic_ulong reload_counter;
+    atomic_bool log_file_open;      // log_file_push() accepts entries
+    atomic_int log_file_pushing;    // threads currently in log_file_push()
+    atomic_ullong log_file_seq;     // sequence number of the next entry
+    atomic_bool log_file_sleeping;  // log_file_thread (about to be) waiting
+    atomic_int log_file_waiters;    // loggers waiting for space in their ring
     // --- protected by mp_msg_lock
     bstr buffer;
 };
@@ -78,7 +91,10 @@ struct mp_log {
     const char *verbose_prefix;
     int level;                  // minimum log level for any outputs
     int terminal_level;         // minimum log level for terminal output
+    int locked_level;           // minimum log level for outputs needing the lock
+    int file_level;             // minimum log level for the log file
     atomic_ulong reload_counter;
+    atomic_bool has_partial;    // partial[0] != '\0'
     char *partial;
 };
 
@@ -93,6 +109,45 @@ struct mp_log_buffer {
 // Protects some (not all) state in mp_log_root
 static pthread_mutex_t mp_msg_lock = PTHREAD_MUTEX_INITIALIZER;
 
+// Protects log_file_thread_active, the list of rings, and the wakeup
+// conditions for the log file writer thread. Loggers only take it on their
+// first message, if the writer thread is sleeping, or if their ring is full.
+// Lock order: mp_msg_lock -> log_file_lock.
+static pthread_mutex_t log_file_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_file_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_file_space = PTHREAD_COND_INITIALIZER;
+
+// Number of entries each thread can queue for the log file writer thread.
+// If the writer falls this far behind, the logging thread waits for it.
+#define LOG_FILE_RING_SIZE 4096
+
+struct log_file_entry {
+    uint64_t seq;       // order in which entries were logged (per root)
+    int64_t time;
+    int level;
+    char *prefix;
+    char *text;         // one or more full lines
+};
+
+// Entries queued by a single thread. Referenced by the root and the thread
+// (see log_thread_get_ring()), and freed when both are done with it.
+struct log_file_ring {
+    struct mp_log_root *root;
+    struct mp_ring *ring;       // struct log_file_entry pointers
+    struct log_file_ring *next; // in root->log_file_rings
+    atomic_int refs;
+    atomic_bool thread_exited;
+    atomic_bool root_gone;
+};
+
+struct log_thread {
+    struct log_file_ring **rings;
+    int num_rings;
+};
+
+static pthread_once_t log_thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_thread_key;
+
 static const struct mp_log null_log = {0};
 struct mp_log *const mp_null_log = (struct mp_log *)&null_log;
 
@@ -117,10 +172,18 @@ static void update_loglevel(struct mp_log *log)
             log->level = mp_msg_find_level(root->msg_levels[n * 2 + 1]);
     }
     log->terminal_level = log->level;
-    for (int n = 0; n < log->root->num_buffers; n++)
-        log->level = MPMAX(log->level, log->root->buffers[n]->level);
-    if (log->root->log_file)
-        log->level = MPMAX(log->level, MSGL_DEBUG);
+    log->locked_level = root->use_terminal ? log->terminal_level : -1;
+    for (int n = 0; n < log->root->num_buffers; n++) {
+        int buffer_level = log->root->buffers[n]->level;
+        if (buffer_level == MP_LOG_BUFFER_MSGL_TERM)
+            buffer_level = log->terminal_level;
+        log->locked_level = MPMAX(log->locked_level, buffer_level);
+    }
+    log->file_level = -1;
+    if (atomic_load(&root->log_file_open))
+        log->file_level = MPMAX(log->terminal_level, MSGL_DEBUG);
+    log->level = MPMAX(log->level, log->locked_level);
+    log->level = MPMAX(log->level, log->file_level);
     if (log->root->stats_file)
         log->level = MPMAX(log->level, MSGL_STATS);
     atomic_store(&log->reload_counter, atomic_load(&log->root->reload_counter));
@@ -281,20 +344,6 @@ static void print_terminal_line(struct mp_log *log, int lev,
     fflush(stream);
 }
 
-static void write_log_file(struct mp_log *log, int lev, char *text)
-{
-    struct mp_log_root *root = log->root;
-
-    if (!root->log_file || lev > MPMAX(MSGL_DEBUG, log->terminal_level))
-        return;
-
-    fprintf(root->log_file, "[%8.3f][%c][%s] %s",
-            (mp_time_us() - MP_START_TIME) / 1e6,
-            mp_log_levels[lev][0],
-            log->verbose_prefix, text);
-    fflush(root->log_file);
-}
-
 static void write_msg_to_buffers(struct mp_log *log, int lev, char *text)
 {
     struct mp_log_root *root = log->root;
@@ -337,11 +386,163 @@ static void dump_stats(struct mp_log *log, int lev, char *text)
         fprintf(root->stats_file, "%"PRId64" %s\n", mp_time_us(), text);
 }
 
+static struct log_file_entry *log_file_entry_new(struct mp_log *log, int lev,
+                                                 int64_t time, char *text)
+{
+    struct log_file_entry *e = talloc_ptrtype(NULL, e);
+    *e = (struct log_file_entry) {
+        .time = time,
+        .level = lev,
+        .prefix = talloc_strdup(e, log->verbose_prefix),
+        .text = talloc_strdup(e, text),
+    };
+    return e;
+}
+
+static void log_file_ring_unref(struct log_file_ring *r)
+{
+    if (atomic_fetch_add(&r->refs, -1) == 1) {
+        while (1) {
+            struct log_file_entry *e = NULL;
+            if (!mp_ring_read(r->ring, (unsigned char *)&e, sizeof(e)))
+                break;
+            talloc_free(e);
+        }
+        talloc_free(r);
+    }
+}
+
+static void log_thread_exit(void *p)
+{
+    struct log_thread *t = p;
+    for (int n = 0; n < t->num_rings; n++) {
+        atomic_store(&t->rings[n]->thread_exited, true);
+        log_file_ring_unref(t->rings[n]);
+    }
+    talloc_free(t);
+}
+
+static void log_thread_key_create(void)
+{
+    pthread_key_create(&log_thread_key, log_thread_exit);
+}
+
+// Return the calling thread's ring for the root, creating it if needed.
+static struct log_file_ring *log_thread_get_ring(struct mp_log_root *root)
+{
+    pthread_once(&log_thread_key_once, log_thread_key_create);
+
+    struct log_thread *t = pthread_getspecific(log_thread_key);
+    if (!t) {
+        t = talloc_zero(NULL, struct log_thread);
+        pthread_setspecific(log_thread_key, t);
+    }
+
+    for (int n = t->num_rings - 1; n >= 0; n--) {
+        struct log_file_ring *r = t->rings[n];
+        if (atomic_load(&r->root_gone)) {
+            // A new root could have the same address, so drop it now.
+            MP_TARRAY_REMOVE_AT(t->rings, t->num_rings, n);
+            log_file_ring_unref(r);
+        } else if (r->root == root) {
+            return r;
+        }
+    }
+
+    struct log_file_ring *r = talloc_ptrtype(NULL, r);
+    *r = (struct log_file_ring){
+        .root = root,
+        .ring = mp_ring_new(r, sizeof(void *) * LOG_FILE_RING_SIZE),
+        .refs = ATOMIC_VAR_INIT(2),
+    };
+    if (!r->ring)
+        abort();
+    MP_TARRAY_APPEND(t, t->rings, t->num_rings, r);
+
+    pthread_mutex_lock(&log_file_lock);
+    r->next = root->log_file_rings;
+    root->log_file_rings = r;
+    pthread_mutex_unlock(&log_file_lock);
+
+    return r;
+}
+
+// Queue the entry for log_file_thread, and take ownership of it. This is
+// lock-free, unless the writer thread needs to be woken up, or has fallen so
+// far behind that the calling thread's ring is full. Then this waits until
+// there is space, so that nothing is lost.
+static void log_file_push(struct mp_log_root *root, struct log_file_entry *e)
+{
+    atomic_fetch_add(&root->log_file_pushing, 1);
+    if (!atomic_load(&root->log_file_open)) {
+        atomic_fetch_add(&root->log_file_pushing, -1);
+        talloc_free(e);
+        return;
+    }
+
+    struct log_file_ring *r = log_thread_get_ring(root);
+    if (mp_ring_available(r->ring) < sizeof(e)) {
+        pthread_mutex_lock(&log_file_lock);
+        atomic_fetch_add(&root->log_file_waiters, 1);
+        while (mp_ring_available(r->ring) < sizeof(e)) {
+            pthread_cond_broadcast(&log_file_wakeup);
+            pthread_cond_wait(&log_file_space, &log_file_lock);
+        }
+        atomic_fetch_add(&root->log_file_waiters, -1);
+        pthread_mutex_unlock(&log_file_lock);
+    }
+
+    // Each thread takes the next number right before writing to its own
+    // ring, so the writer can restore the global order.
+    e->seq = atomic_fetch_add(&root->log_file_seq, 1);
+    mp_ring_write(r->ring, (unsigned char *)&e, sizeof(e));
+
+    // The writer checks the rings after setting sleeping, so either it sees
+    // the entry, or we see that it needs to be woken up.
+    if (atomic_load(&root->log_file_sleeping)) {
+        pthread_mutex_lock(&log_file_lock);
+        pthread_cond_broadcast(&log_file_wakeup);
+        pthread_mutex_unlock(&log_file_lock);
+    }
+    atomic_fetch_add(&root->log_file_pushing, -1);
+}
+
+// Messages which go to the log file only (typically the verbose levels) are
+// formatted and queued by the calling thread without taking mp_msg_lock.
+// Returns false if the message must go through the normal path instead.
+static bool write_log_file_only(struct mp_log *log, int lev,
+                                const char *format, va_list va)
+{
+    if (lev <= log->locked_level || lev > log->file_level ||
+        lev == MSGL_STATUS || lev == MSGL_STATS ||
+        atomic_load(&log->has_partial))
+        return false;
+
+    char *text = talloc_vasprintf(NULL, format, va);
+    size_t len = strlen(text);
+    if (len && text[len - 1] != '\n') {
+        // Partial lines are buffered in the mp_log, under the lock.
+        talloc_free(text);
+        return false;
+    }
+    if (len)
+        log_file_push(log->root, log_file_entry_new(log, lev, mp_time_us(), text));
+    talloc_free(text);
+    return true;
+}
+
 void mp_msg_va(struct mp_log *log, int lev, const char *format, va_list va)
 {
     if (!mp_msg_test(log, lev))
         return; // do not display
 
+    va_list copy;
+    va_copy(copy, va);
+    bool done = write_log_file_only(log, lev, format, copy);
+    va_end(copy);
+    if (done)
+        return;
+
     pthread_mutex_lock(&mp_msg_lock);
 
     struct mp_log_root *root = log->root;
@@ -351,6 +552,7 @@ void mp_msg_va(struct mp_log *log, int lev, const char *format, va_list va)
     if (log->partial[0])
         bstr_xappend_asprintf(root, &root->buffer, "%s", log->partial);
     log->partial[0] = '\0';
+    atomic_store(&log->has_partial, false);
 
     bstr_xappend_vasprintf(root, &root->buffer, format, va);
 
@@ -364,6 +566,9 @@ void mp_msg_va(struct mp_log *log, int lev, const char *format, va_list va)
         if (lev == MSGL_STATUS && root->termosd)
             prepare_status_line(root, text);
 
+        bool to_file = lev <= log->file_level && lev != MSGL_STATUS;
+        int64_t time = to_file ? mp_time_us() : 0;
+
         // Split away each line. Normally we require full lines; buffer partial
         // lines if they happen.
         while (1) {
@@ -374,8 +579,9 @@ void mp_msg_va(struct mp_log *log, int lev, const char *format, va_list va)
             char saved = next[0];
             next[0] = '\0';
             print_terminal_line(log, lev, text, "");
-            write_log_file(log, lev, text);
             write_msg_to_buffers(log, lev, text);
+            if (to_file)
+                log_file_push(root, log_file_entry_new(log, lev, time, text));
             next[0] = saved;
             text = next;
         }
@@ -388,6 +594,7 @@ void mp_msg_va(struct mp_log *log, int lev, const char *format, va_list va)
             if (talloc_get_size(log->partial) < size)
                 log->partial = talloc_realloc(NULL, log->partial, char, size);
             memcpy(log->partial, text, size);
+            atomic_store(&log->has_partial, true);
         }
     }
 
@@ -499,6 +706,209 @@ static void reopen_file(char *opt, char **current_path, FILE **file,
     talloc_free(tmp);
 }
 
+static void write_log_file_entry(struct mp_log_root *root,
+                                 struct log_file_entry *e)
+{
+    char *text = e->text;
+    while (text[0]) {
+        char *end = strchr(text, '\n');
+        int len = end ? end - text + 1 : strlen(text);
+        fprintf(root->log_file, "[%8.3f][%c][%s] %.*s",
+                (e->time - MP_START_TIME) / 1e6,
+                mp_log_levels[e->level][0],
+                e->prefix, len, text);
+        text += len;
+    }
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct log_file_entry *e1 = *(struct log_file_entry **)a;
+    const struct log_file_entry *e2 = *(struct log_file_entry **)b;
+    return e1->seq < e2->seq ? -1 : e1->seq > e2->seq;
+}
+
+struct log_file_writer {
+    struct log_file_entry **pending;    // read from the rings, sorted by seq
+    int num_pending;
+    uint64_t next_seq;                  // seq of the next entry to write
+};
+
+// Move the entries from all rings to w->pending. Rings of exited threads
+// are removed once they're empty. Returns whether anything was read.
+static bool read_log_file_rings(struct mp_log_root *root,
+                                struct log_file_writer *w)
+{
+    bool any = false;
+
+    pthread_mutex_lock(&log_file_lock);
+    for (struct log_file_ring **p = &root->log_file_rings; *p;) {
+        struct log_file_ring *r = *p;
+        // Check before reading, so the last entries are not missed.
+        bool exited = atomic_load(&r->thread_exited);
+        while (1) {
+            struct log_file_entry *e = NULL;
+            if (!mp_ring_read(r->ring, (unsigned char *)&e, sizeof(e)))
+                break;
+            MP_TARRAY_APPEND(NULL, w->pending, w->num_pending, e);
+            any = true;
+        }
+        if (exited) {
+            *p = r->next;
+            log_file_ring_unref(r);
+        } else {
+            p = &r->next;
+        }
+    }
+    if (any && atomic_load(&root->log_file_waiters))
+        pthread_cond_broadcast(&log_file_space);
+    pthread_mutex_unlock(&log_file_lock);
+
+    return any;
+}
+
+// Write the pending entries, as far as there's no gap in the sequence. A gap
+// means another thread took a number, but has not written the entry to its
+// ring yet.
+static void write_log_file_pending(struct mp_log_root *root,
+                                   struct log_file_writer *w)
+{
+    qsort(w->pending, w->num_pending, sizeof(w->pending[0]), compare_entries);
+
+    int n = 0;
+    while (n < w->num_pending && w->pending[n]->seq == w->next_seq) {
+        write_log_file_entry(root, w->pending[n]);
+        talloc_free(w->pending[n]);
+        w->next_seq++;
+        n++;
+    }
+    w->num_pending -= n;
+    memmove(w->pending, w->pending + n, w->num_pending * sizeof(w->pending[0]));
+}
+
+// Drains the rings into root->log_file in the order the messages were logged,
+// so that threads calling mp_msg() never wait on file I/O.
+static void *log_file_thread(void *p)
+{
+    struct mp_log_root *root = p;
+    struct log_file_writer w = {
+        .next_seq = atomic_load(&root->log_file_seq),
+    };
+
+    mpthread_set_name("log-file");
+
+    while (1) {
+        if (read_log_file_rings(root, &w)) {
+            write_log_file_pending(root, &w);
+            continue;
+        }
+
+        fflush(root->log_file);
+
+        pthread_mutex_lock(&log_file_lock);
+        bool active = root->log_file_thread_active;
+        if (active) {
+            // Loggers check sleeping after pushing, so either they see it
+            // and signal the condition, or we see their entry here.
+            atomic_store(&root->log_file_sleeping, true);
+            bool empty = true;
+            for (struct log_file_ring *r = root->log_file_rings; r; r = r->next)
+                empty &= !mp_ring_buffered(r->ring);
+            if (empty)
+                pthread_cond_wait(&log_file_wakeup, &log_file_lock);
+            atomic_store(&root->log_file_sleeping, false);
+        }
+        pthread_mutex_unlock(&log_file_lock);
+
+        // Nothing can be pushed anymore once inactive (see
+        // terminate_log_file_thread()), so this writes everything.
+        if (!active && !read_log_file_rings(root, &w)) {
+            write_log_file_pending(root, &w);
+            break;
+        }
+        write_log_file_pending(root, &w);
+    }
+
+    assert(!w.num_pending);
+    talloc_free(w.pending);
+    return NULL;
+}
+
+static void terminate_log_file_thread(struct mp_log_root *root)
+{
+    if (!root->log_file)
+        return;
+
+    // Stop accepting entries, and wait for loggers which might not have
+    // seen that yet (the writer is still running, so they can't be stuck on
+    // a full ring). After this, the rings contain all remaining entries.
+    atomic_store(&root->log_file_open, false);
+    atomic_fetch_add(&root->reload_counter, 1);
+    while (atomic_load(&root->log_file_pushing))
+        sched_yield();
+
+    bool wait_terminate = false;
+
+    pthread_mutex_lock(&log_file_lock);
+    if (root->log_file_thread_active) {
+        root->log_file_thread_active = false;
+        pthread_cond_broadcast(&log_file_wakeup);
+        wait_terminate = true;
+    }
+    pthread_mutex_unlock(&log_file_lock);
+
+    if (wait_terminate)
+        pthread_join(root->log_file_thread, NULL);
+
+    fclose(root->log_file);
+    root->log_file = NULL;
+}
+
+// Like reopen_file(), but for the log file, which is written asynchronously
+// by log_file_thread.
+static void reopen_log_file(char *opt, struct mpv_global *global)
+{
+    struct mp_log_root *root = global->log->root;
+    void *tmp = talloc_new(NULL);
+
+    char *new_path = mp_get_user_path(tmp, global, opt);
+    if (!new_path)
+        new_path = "";
+
+    char *old_path = root->log_path ? root->log_path : "";
+    if (strcmp(old_path, new_path) == 0)
+        goto done;
+
+    terminate_log_file_thread(root);
+
+    talloc_free(root->log_path);
+    root->log_path = talloc_strdup(NULL, new_path);
+
+    if (!new_path[0])
+        goto done;
+
+    root->log_file = fopen(new_path, "wb");
+    if (!root->log_file) {
+        mp_err(global->log, "Failed to open log file '%s'\n", new_path);
+        goto done;
+    }
+
+    root->log_file_thread_active = true;
+    if (pthread_create(&root->log_file_thread, NULL, log_file_thread, root)) {
+        root->log_file_thread_active = false;
+        fclose(root->log_file);
+        root->log_file = NULL;
+        mp_err(global->log, "Failed to create log file thread.\n");
+        goto done;
+    }
+
+    atomic_store(&root->log_file_open, true);
+    atomic_fetch_add(&root->reload_counter, 1);
+
+done:
+    talloc_free(tmp);
+}
+
 void mp_msg_update_msglevels(struct mpv_global *global, struct MPOpts *opts)
 {
     struct mp_log_root *root = global->log->root;
@@ -521,8 +931,7 @@ void mp_msg_update_msglevels(struct mpv_global *global, struct MPOpts *opts)
     atomic_fetch_add(&root->reload_counter, 1);
     pthread_mutex_unlock(&mp_msg_lock);
 
-    reopen_file(opts->log_file, &root->log_path, &root->log_file,
-                "log", global);
+    reopen_log_file(opts->log_file, global);
 
     reopen_file(opts->dump_stats, &root->stats_path, &root->stats_file,
                 "stats", global);
@@ -541,21 +950,22 @@ bool mp_msg_has_log_file(struct mpv_global *global)
 {
     struct mp_log_root *root = global->log->root;
 
-    pthread_mutex_lock(&mp_msg_lock);
-    bool res = !!root->log_file;
-    pthread_mutex_unlock(&mp_msg_lock);
-
-    return res;
+    return atomic_load(&root->log_file_open);
 }
 
 void mp_msg_uninit(struct mpv_global *global)
 {
     struct mp_log_root *root = global->log->root;
+    terminate_log_file_thread(root);
+    while (root->log_file_rings) {
+        struct log_file_ring *r = root->log_file_rings;
+        root->log_file_rings = r->next;
+        atomic_store(&r->root_gone, true);
+        log_file_ring_unref(r);
+    }
     if (root->stats_file)
         fclose(root->stats_file);
     talloc_free(root->stats_path);
-    if (root->log_file)
-        fclose(root->log_file);
     talloc_free(root->log_path);
     m_option_type_msglevels.free(&root->msg_levels);
     talloc_free(root);
@@ -0,0 +1,110 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "osdep/atomic.h"
+
+#include "perf_counters.h"
+
+const char *const mp_perf_counter_names[MP_PERF_COUNTER_COUNT] = {
+    [MP_PERF_PCM_BYTES_FILTER]          = "pcm-bytes-filter",
+    [MP_PERF_PCM_BYTES_SCALETEMPO]      = "pcm-bytes-scaletempo",
+    [MP_PERF_PCM_BYTES_AO_CHAIN]        = "pcm-bytes-ao-chain",
+    [MP_PERF_PCM_BYTES_AO]              = "pcm-bytes-ao",
+    [MP_PERF_FRAMES_ALLOCATED]          = "frames-allocated",
+    [MP_PERF_PACKETS_ALLOCATED]         = "packets-allocated",
+    [MP_PERF_PACKETS_FREED]             = "packets-freed",
+    [MP_PERF_AO_WAKEUPS]                = "ao-wakeups",
+    [MP_PERF_AO_UNDERRUNS]              = "ao-underruns",
+    [MP_PERF_DEMUX_CACHE_SEEKS]         = "demux-cache-seeks",
+    [MP_PERF_DEMUX_LOW_LEVEL_SEEKS]     = "demux-low-level-seeks",
+    [MP_PERF_FILTER_PROCESS]            = "filter-process",
+    [MP_PERF_LOCK_WAIT_US]              = "lock-wait-us",
+};
+
+struct perf_thread {
+    // --- protected by perf_lock
+    struct perf_thread *next;
+    // --- written by the owner thread only
+    mp_atomic_int64 values[MP_PERF_COUNTER_COUNT];
+};
+
+static pthread_once_t perf_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t perf_key;
+
+// Taken only when a thread adds its first value, when it exits, and when
+// reading the counters.
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// --- protected by perf_lock
+static struct perf_thread *perf_threads;
+static int64_t perf_retired[MP_PERF_COUNTER_COUNT]; // from exited threads
+
+static void thread_exit(void *p)
+{
+    struct perf_thread *t = p;
+
+    pthread_mutex_lock(&perf_lock);
+    for (int n = 0; n < MP_PERF_COUNTER_COUNT; n++)
+        perf_retired[n] += atomic_load(&t->values[n]);
+    for (struct perf_thread **prev = &perf_threads; *prev; prev = &(*prev)->next) {
+        if (*prev == t) {
+            *prev = t->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&perf_lock);
+
+    free(t);
+}
+
+static void create_key(void)
+{
+    pthread_key_create(&perf_key, thread_exit);
+}
+
+void mp_perf_add(enum mp_perf_counter counter, int64_t value)
+{
+    pthread_once(&perf_key_once, create_key);
+
+    struct perf_thread *t = pthread_getspecific(perf_key);
+    if (!t) {
+        t = calloc(1, sizeof(*t));
+        if (!t)
+            return;
+        pthread_mutex_lock(&perf_lock);
+        t->next = perf_threads;
+        perf_threads = t;
+        pthread_mutex_unlock(&perf_lock);
+        pthread_setspecific(perf_key, t);
+    }
+
+    atomic_fetch_add(&t->values[counter], value);
+}
+
+void mp_perf_read(int64_t values[MP_PERF_COUNTER_COUNT])
+{
+    pthread_mutex_lock(&perf_lock);
+    for (int n = 0; n < MP_PERF_COUNTER_COUNT; n++) {
+        values[n] = perf_retired[n];
+        for (struct perf_thread *t = perf_threads; t; t = t->next)
+            values[n] += atomic_load(&t->values[n]);
+    }
+    pthread_mutex_unlock(&perf_lock);
+}
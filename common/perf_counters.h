@@ -0,0 +1,42 @@
+#ifndef MP_PERF_COUNTERS_H
+#define MP_PERF_COUNTERS_H
+
+#include <stdint.h>
+
+// Always-on, process-wide counters for hot paths. Each thread increments its
+// own set of atomics, so adding to a counter never takes a lock or touches a
+// cache line shared with other threads. Reading sums up all threads.
+enum mp_perf_counter {
+    MP_PERF_PCM_BYTES_FILTER,       // mp_aframe_copy_samples()
+    MP_PERF_PCM_BYTES_SCALETEMPO,   // scaletempo input queue
+    MP_PERF_PCM_BYTES_AO_CHAIN,     // decoded frames -> ao_chain->ao_buffer
+    MP_PERF_PCM_BYTES_AO,           // ao_play() -> AO soft buffer/ring
+    MP_PERF_FRAMES_ALLOCATED,       // mp_aframe_create()
+    MP_PERF_PACKETS_ALLOCATED,      // new_demux_packet*()
+    MP_PERF_PACKETS_FREED,
+    MP_PERF_AO_WAKEUPS,             // AO feed thread/callback iterations
+    MP_PERF_AO_UNDERRUNS,
+    MP_PERF_DEMUX_CACHE_SEEKS,      // seeks served from the demuxer cache
+    MP_PERF_DEMUX_LOW_LEVEL_SEEKS,  // seeks executed by the demuxer
+    MP_PERF_FILTER_PROCESS,         // mp_filter_info.process() invocations
+    MP_PERF_LOCK_WAIT_US,           // time waited in mp_dispatch_lock()
+
+    MP_PERF_COUNTER_COUNT
+};
+
+// Names as used by the perf-counters property.
+extern const char *const mp_perf_counter_names[MP_PERF_COUNTER_COUNT];
+
+// Thread-safe.
+void mp_perf_add(enum mp_perf_counter counter, int64_t value);
+
+static inline void mp_perf_inc(enum mp_perf_counter counter)
+{
+    mp_perf_add(counter, 1);
+}
+
+// Write the current totals to values[]. Thread-safe. The counters are not
+// read atomically as a whole, only each value is consistent by itself.
+void mp_perf_read(int64_t values[MP_PERF_COUNTER_COUNT]);
+
+#endif
@@ -16,6 +16,8 @@
  */
 
 #include <assert.h>
+#include <limits.h>
+#include <string.h>
 #include "config.h"
 #include "playlist.h"
 #include "common/common.h"
@@ -35,6 +37,41 @@ struct playlist_entry *playlist_entry_new(const char *filename)
     return e;
 }
 
+struct playlist_strings *playlist_strings_new(void)
+{
+    void *arena = talloc_new_arena(NULL);
+    struct playlist_strings *s = talloc_zero(arena, struct playlist_strings);
+    s->arena = arena;
+    s->refs = 1;
+    return s;
+}
+
+void playlist_strings_unref(struct playlist_strings *s)
+{
+    if (s && --s->refs == 0)
+        talloc_free(s->arena);
+}
+
+static void entry_strings_destroy(void *p)
+{
+    struct playlist_entry *e = p;
+    playlist_strings_unref(e->strings);
+}
+
+// Like playlist_entry_new(), but allocate the filename from s. The caller can
+// allocate more strings (like the title) with s->arena as talloc parent.
+struct playlist_entry *playlist_entry_new_shared(struct playlist_strings *s,
+                                                 bstr filename)
+{
+    struct playlist_entry *e = talloc_zero(NULL, struct playlist_entry);
+    e->strings = s;
+    s->refs++;
+    talloc_set_destructor(e, entry_strings_destroy);
+    char *local_filename = mp_file_url_to_filename(s->arena, filename);
+    e->filename = local_filename ? local_filename : bstrto0(s->arena, filename);
+    return e;
+}
+
 void playlist_entry_add_param(struct playlist_entry *e, bstr name, bstr value)
 {
     struct playlist_param p = {bstrdup(e, name), bstrdup(e, value)};
@@ -49,6 +86,146 @@ void playlist_entry_add_params(struct playlist_entry *e,
         playlist_entry_add_param(e, params[n].name, params[n].value);
 }
 
+// Besides the linked list, entries are kept in an array of blocks with up to
+// BLOCK_SIZE entries each. Changes only move entries within a block (and
+// occasionally split or merge blocks), and finding an entry's position only
+// needs the sizes of the blocks before it.
+#define BLOCK_SIZE 256
+
+struct playlist_block {
+    int index;          // in playlist.blocks
+    int start;          // position of entries[0] (see num_block_starts)
+    int num_entries;
+    struct playlist_entry *entries[BLOCK_SIZE];
+};
+
+static void update_block_entries(struct playlist_block *b, int from)
+{
+    for (int n = from; n < b->num_entries; n++) {
+        b->entries[n]->pl_block = b;
+        b->entries[n]->pl_block_pos = n;
+    }
+}
+
+// Called after blocks[from] and following changed.
+static void update_blocks(struct playlist *pl, int from)
+{
+    for (int n = from; n < pl->num_blocks; n++)
+        pl->blocks[n]->index = n;
+    pl->num_block_starts = MPMIN(pl->num_block_starts, from);
+}
+
+static void update_block_starts(struct playlist *pl, int count)
+{
+    for (; pl->num_block_starts < count; pl->num_block_starts++) {
+        int n = pl->num_block_starts;
+        struct playlist_block *prev = n ? pl->blocks[n - 1] : NULL;
+        pl->blocks[n]->start = prev ? prev->start + prev->num_entries : 0;
+    }
+}
+
+static struct playlist_block *add_block(struct playlist *pl, int index)
+{
+    struct playlist_block *b = talloc_zero(pl, struct playlist_block);
+    MP_TARRAY_INSERT_AT(pl, pl->blocks, pl->num_blocks, index, b);
+    update_blocks(pl, index);
+    return b;
+}
+
+static void remove_block(struct playlist *pl, struct playlist_block *b)
+{
+    int index = b->index;
+    MP_TARRAY_REMOVE_AT(pl->blocks, pl->num_blocks, index);
+    update_blocks(pl, index);
+    talloc_free(b);
+}
+
+// Merge blocks[index + 1] into blocks[index] if both are small. This keeps the
+// number of blocks proportional to the number of entries.
+static void merge_blocks(struct playlist *pl, int index)
+{
+    if (index < 0 || index + 1 >= pl->num_blocks)
+        return;
+    struct playlist_block *b = pl->blocks[index];
+    struct playlist_block *next = pl->blocks[index + 1];
+    if (b->num_entries + next->num_entries > BLOCK_SIZE / 2)
+        return;
+    int from = b->num_entries;
+    memcpy(&b->entries[from], &next->entries[0],
+           next->num_entries * sizeof(b->entries[0]));
+    b->num_entries += next->num_entries;
+    update_block_entries(b, from);
+    remove_block(pl, next);
+}
+
+// Called after add was linked after the given entry.
+static void index_insert(struct playlist *pl, struct playlist_entry *after,
+                         struct playlist_entry *add)
+{
+    struct playlist_block *b;
+    int pos;
+    if (after) {
+        b = after->pl_block;
+        pos = after->pl_block_pos + 1;
+    } else {
+        b = pl->num_blocks ? pl->blocks[0] : add_block(pl, 0);
+        pos = 0;
+    }
+
+    if (b->num_entries == BLOCK_SIZE && pos == BLOCK_SIZE) {
+        // Appending; don't leave half-empty blocks behind.
+        b = add_block(pl, b->index + 1);
+        pos = 0;
+    } else if (b->num_entries == BLOCK_SIZE) {
+        int half = BLOCK_SIZE / 2;
+        struct playlist_block *nb = add_block(pl, b->index + 1);
+        nb->num_entries = BLOCK_SIZE - half;
+        memcpy(&nb->entries[0], &b->entries[half],
+               nb->num_entries * sizeof(b->entries[0]));
+        b->num_entries = half;
+        update_block_entries(nb, 0);
+        if (pos > half) {
+            b = nb;
+            pos -= half;
+        }
+    }
+
+    memmove(&b->entries[pos + 1], &b->entries[pos],
+            (b->num_entries - pos) * sizeof(b->entries[0]));
+    b->entries[pos] = add;
+    b->num_entries += 1;
+    update_block_entries(b, pos);
+
+    pl->num_block_starts = MPMIN(pl->num_block_starts, b->index + 1);
+    pl->num_entries += 1;
+}
+
+// Called before entry is unlinked.
+static void index_remove(struct playlist *pl, struct playlist_entry *entry)
+{
+    struct playlist_block *b = entry->pl_block;
+    int pos = entry->pl_block_pos;
+
+    memmove(&b->entries[pos], &b->entries[pos + 1],
+            (b->num_entries - pos - 1) * sizeof(b->entries[0]));
+    b->num_entries -= 1;
+    update_block_entries(b, pos);
+
+    pl->num_block_starts = MPMIN(pl->num_block_starts, b->index + 1);
+    pl->num_entries -= 1;
+
+    if (!b->num_entries) {
+        remove_block(pl, b);
+    } else {
+        int index = b->index;
+        merge_blocks(pl, index);
+        merge_blocks(pl, index - 1);
+    }
+
+    entry->pl_block = NULL;
+    entry->pl_block_pos = 0;
+}
+
 // Add entry "add" after entry "after".
 // If "after" is NULL, add as first entry.
 // Post condition: add->prev == after
@@ -75,6 +252,7 @@ void playlist_insert(struct playlist *pl, struct playlist_entry *after,
     }
     add->pl = pl;
     talloc_steal(pl, add);
+    index_insert(pl, after, add);
 }
 
 void playlist_add(struct playlist *pl, struct playlist_entry *add)
@@ -91,6 +269,8 @@ static void playlist_unlink(struct playlist *pl, struct playlist_entry *entry)
         pl->current_was_replaced = true;
     }
 
+    index_remove(pl, entry);
+
     if (entry->next) {
         entry->next->prev = entry->prev;
     } else {
@@ -150,19 +330,11 @@ void playlist_add_file(struct playlist *pl, const char *filename)
     playlist_add(pl, playlist_entry_new(filename));
 }
 
-static int playlist_count(struct playlist *pl)
-{
-    int c = 0;
-    for (struct playlist_entry *e = pl->first; e; e = e->next)
-        c++;
-    return c;
-}
-
 void playlist_shuffle(struct playlist *pl)
 {
     struct playlist_entry *save_current = pl->current;
     bool save_replaced = pl->current_was_replaced;
-    int count = playlist_count(pl);
+    int count = pl->num_entries;
     struct playlist_entry **arr = talloc_array(NULL, struct playlist_entry *,
                                                count);
     for (int n = 0; n < count; n++) {
@@ -226,11 +398,20 @@ void playlist_transfer_entries(struct playlist *pl, struct playlist *source_pl)
     if (!add_after)
         add_after = pl->last;
 
+    playlist_transfer_entries_to(pl, add_after, source_pl);
+}
+
+// Like playlist_transfer_entries(), but insert the entries after the given
+// entry (or at the start if after==NULL).
+void playlist_transfer_entries_to(struct playlist *pl,
+                                  struct playlist_entry *after,
+                                  struct playlist *source_pl)
+{
     while (source_pl->first) {
         struct playlist_entry *e = source_pl->first;
         playlist_unlink(source_pl, e);
-        playlist_insert(pl, add_after, e);
-        add_after = e;
+        playlist_insert(pl, after, e);
+        after = e;
     }
 }
 
@@ -247,32 +428,45 @@ void playlist_append_entries(struct playlist *pl, struct playlist *source_pl)
 // Return -1 if e is not on the list, or if e is NULL.
 int playlist_entry_to_index(struct playlist *pl, struct playlist_entry *e)
 {
-    struct playlist_entry *cur = pl->first;
-    int pos = 0;
-    if (!e)
+    if (!e || e->pl != pl)
         return -1;
-    while (cur && cur != e) {
-        cur = cur->next;
-        pos++;
-    }
-    return cur == e ? pos : -1;
+    update_block_starts(pl, e->pl_block->index + 1);
+    return e->pl_block->start + e->pl_block_pos;
 }
 
 int playlist_entry_count(struct playlist *pl)
 {
-    return playlist_entry_to_index(pl, pl->last) + 1;
+    return pl->num_entries;
 }
 
 // Return entry for which playlist_entry_to_index() would return index.
 // Return NULL if not found.
 struct playlist_entry *playlist_entry_from_index(struct playlist *pl, int index)
 {
-    struct playlist_entry *e = pl->first;
-    for (int n = 0; ; n++) {
-        if (!e || n == index)
-            return e;
-        e = e->next;
+    if (index < 0 || index >= pl->num_entries)
+        return NULL;
+    update_block_starts(pl, pl->num_blocks);
+    // Find the last block starting at or before index.
+    int lo = 0, hi = pl->num_blocks - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (pl->blocks[mid]->start <= index) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
     }
+    struct playlist_block *b = pl->blocks[lo];
+    return b->entries[index - b->start];
+}
+
+// Parse the remaining entries, if the playlist is still being loaded.
+void playlist_load_all(struct playlist *pl)
+{
+    if (!pl->loader)
+        return;
+    while (pl->loader->load(pl->loader, pl, INT_MAX)) {}
+    TA_FREEP(&pl->loader);
 }
 
 struct playlist *playlist_parse_file(const char *file, struct mp_cancel *cancel,
@@ -290,6 +484,7 @@ struct playlist *playlist_parse_file(const char *file, struct mp_cancel *cancel,
 
     struct playlist *ret = NULL;
     if (d && d->playlist) {
+        playlist_load_all(d->playlist);
         ret = talloc_zero(NULL, struct playlist);
         playlist_transfer_entries(ret, d->playlist);
         if (d->filetype && strcmp(d->filetype, "hls") == 0) {
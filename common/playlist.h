@@ -21,6 +21,8 @@
 #include <stdbool.h>
 #include "misc/bstr.h"
 
+struct mp_cancel;
+
 struct playlist_param {
     bstr name, value;
 };
@@ -28,6 +30,12 @@ struct playlist_param {
 struct playlist_entry {
     struct playlist_entry *prev, *next;
     struct playlist *pl;
+    // If set, the filename and title are allocated from this.
+    struct playlist_strings *strings;
+
+    // Private to playlist.c (see playlist_entry_to_index()).
+    struct playlist_block *pl_block;
+    int pl_block_pos;
 
     char *filename;
 
@@ -71,6 +79,34 @@ struct playlist {
     bool current_was_replaced;
 
     bool disable_safety;
+
+    // If set, more entries follow, and are loaded on demand (see
+    // playlist_load_all()). Owned by the playlist.
+    struct playlist_loader *loader;
+
+    // --- Private to playlist.c.
+    struct playlist_block **blocks;
+    int num_blocks;
+    int num_block_starts;       // blocks[n]->start is valid for n < this
+    int num_entries;
+};
+
+// Memory shared by the strings of a batch of entries (to avoid a separate
+// allocation for each string). Freed when the last entry using it is freed.
+struct playlist_strings {
+    void *arena;        // ta arena for the strings
+    int refs;
+};
+
+// Parses the remaining entries of a playlist (see demux_playlist.c).
+struct playlist_loader {
+    // Append up to max_entries entries to pl. Return false if there are no
+    // more entries. Can be called from any thread, but not concurrently.
+    bool (*load)(struct playlist_loader *l, struct playlist *pl, int max_entries);
+    void *priv;
+    // If set, load() aborts I/O and returns early when this is triggered. Can
+    // be set once before the first load() call, and must outlive the loader.
+    struct mp_cancel *cancel;
 };
 
 void playlist_entry_add_param(struct playlist_entry *e, bstr name, bstr value);
@@ -80,6 +116,11 @@ void playlist_entry_add_params(struct playlist_entry *e,
 
 struct playlist_entry *playlist_entry_new(const char *filename);
 
+struct playlist_strings *playlist_strings_new(void);
+void playlist_strings_unref(struct playlist_strings *s);
+struct playlist_entry *playlist_entry_new_shared(struct playlist_strings *s,
+                                                 bstr filename);
+
 void playlist_insert(struct playlist *pl, struct playlist_entry *after,
                      struct playlist_entry *add);
 void playlist_add(struct playlist *pl, struct playlist_entry *add);
@@ -95,12 +136,17 @@ struct playlist_entry *playlist_get_next(struct playlist *pl, int direction);
 void playlist_add_base_path(struct playlist *pl, bstr base_path);
 void playlist_add_redirect(struct playlist *pl, const char *redirected_from);
 void playlist_transfer_entries(struct playlist *pl, struct playlist *source_pl);
+void playlist_transfer_entries_to(struct playlist *pl,
+                                  struct playlist_entry *after,
+                                  struct playlist *source_pl);
 void playlist_append_entries(struct playlist *pl, struct playlist *source_pl);
 
 int playlist_entry_to_index(struct playlist *pl, struct playlist_entry *e);
 int playlist_entry_count(struct playlist *pl);
 struct playlist_entry *playlist_entry_from_index(struct playlist *pl, int index);
 
+void playlist_load_all(struct playlist *pl);
+
 struct mp_cancel;
 struct mpv_global;
 struct playlist *playlist_parse_file(const char *file, struct mp_cancel *cancel,
@@ -0,0 +1,333 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "mpa_talloc.h"
+
+#include "common/common.h"
+#include "common/global.h"
+#include "common/msg.h"
+#include "options/path.h"
+#include "osdep/timer.h"
+
+#include "tracing.h"
+
+#define CHUNK_EVENTS 4096
+
+// Events beyond this per thread and recording are counted as dropped.
+#define MAX_THREAD_EVENTS (CHUNK_EVENTS * 256)
+
+struct trace_event {
+    int64_t ts;
+    const char *name;
+    double value;
+    char type;                  // 'B', 'E', 'C' (Chrome trace "ph" field)
+};
+
+struct trace_chunk {
+    struct trace_chunk *next;
+    int num_events;
+    struct trace_event events[CHUNK_EVENTS];
+};
+
+struct trace_thread {
+    // --- protected by trace_lock
+    struct trace_thread *next;
+    int tid;
+    char name[32];
+    bool dead;                  // the thread has exited
+    // --- owner thread only while writing is set, otherwise trace_lock
+    atomic_bool writing;
+    struct trace_chunk *first, *last;
+    int num_events;
+    int64_t dropped;
+};
+
+atomic_bool mp_tracing_active = ATOMIC_VAR_INIT(false);
+
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+
+// Protects the thread list and the recording state below. Never taken when
+// adding events, except on the first event of a thread.
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// --- protected by trace_lock
+static struct mpv_global *trace_owner;
+static char *trace_path;
+static int64_t trace_start_time;
+static struct trace_thread *trace_threads;
+static int trace_next_tid;
+
+static void free_chunks(struct trace_thread *t)
+{
+    while (t->first) {
+        struct trace_chunk *next = t->first->next;
+        free(t->first);
+        t->first = next;
+    }
+    t->last = NULL;
+    t->num_events = 0;
+    t->dropped = 0;
+}
+
+// Called with trace_lock held.
+static void destroy_thread(struct trace_thread *t)
+{
+    for (struct trace_thread **p = &trace_threads; *p; p = &(*p)->next) {
+        if (*p == t) {
+            *p = t->next;
+            break;
+        }
+    }
+    free_chunks(t);
+    free(t);
+}
+
+static void thread_exit(void *p)
+{
+    struct trace_thread *t = p;
+
+    pthread_mutex_lock(&trace_lock);
+    t->dead = true;
+    // Keep it until the trace is written if it recorded anything.
+    if (!t->first)
+        destroy_thread(t);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void create_key(void)
+{
+    pthread_key_create(&trace_key, thread_exit);
+}
+
+static struct trace_thread *get_thread(void)
+{
+    pthread_once(&trace_key_once, create_key);
+
+    struct trace_thread *t = pthread_getspecific(trace_key);
+    if (!t) {
+        t = calloc(1, sizeof(*t));
+        if (!t)
+            return NULL;
+        pthread_mutex_lock(&trace_lock);
+        t->tid = ++trace_next_tid;
+        t->next = trace_threads;
+        trace_threads = t;
+        pthread_mutex_unlock(&trace_lock);
+        pthread_setspecific(trace_key, t);
+    }
+    return t;
+}
+
+void mp_tracing_add_event(char type, const char *name, double value)
+{
+    struct trace_thread *t = get_thread();
+    if (!t)
+        return;
+
+    // Pairs with stop_recording(): either it sees this thread writing and
+    // waits for it, or this sees that recording has stopped.
+    atomic_store(&t->writing, true);
+
+    if (atomic_load(&mp_tracing_active)) {
+        if (t->num_events >= MAX_THREAD_EVENTS) {
+            t->dropped++;
+        } else {
+            struct trace_chunk *c = t->last;
+            if (!c || c->num_events == CHUNK_EVENTS) {
+                c = malloc(sizeof(*c));
+                if (c) {
+                    c->next = NULL;
+                    c->num_events = 0;
+                    if (t->last) {
+                        t->last->next = c;
+                    } else {
+                        t->first = c;
+                    }
+                    t->last = c;
+                }
+            }
+            if (c) {
+                c->events[c->num_events++] = (struct trace_event){
+                    .ts = mp_time_us(),
+                    .name = name,
+                    .value = value,
+                    .type = type,
+                };
+                t->num_events++;
+            }
+        }
+    }
+
+    atomic_store(&t->writing, false);
+}
+
+// Always recorded, since threads are usually named once at startup, before
+// a recording may be started.
+void mp_tracing_set_thread_name(const char *name)
+{
+    struct trace_thread *t = get_thread();
+    if (!t)
+        return;
+
+    pthread_mutex_lock(&trace_lock);
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void write_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// Called with trace_lock held, and no thread writing events.
+static void write_trace(struct mp_log *log, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        mp_err(log, "Failed to open trace file '%s'\n", path);
+        return;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    int64_t num_events = 0;
+    bool first = true;
+    for (struct trace_thread *t = trace_threads; t; t = t->next) {
+        if (!t->first)
+            continue;
+
+        char tname[40];
+        if (t->name[0]) {
+            snprintf(tname, sizeof(tname), "%s", t->name);
+        } else {
+            snprintf(tname, sizeof(tname), "thread %d", t->tid);
+        }
+        fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", t->tid);
+        write_json_string(f, tname);
+        fprintf(f, "}}");
+        first = false;
+
+        for (struct trace_chunk *c = t->first; c; c = c->next) {
+            for (int n = 0; n < c->num_events; n++) {
+                struct trace_event *e = &c->events[n];
+                fprintf(f, ",\n{\"ph\":\"%c\",\"name\":", e->type);
+                write_json_string(f, e->name);
+                fprintf(f, ",\"pid\":1,\"tid\":%d,\"ts\":%"PRId64,
+                        t->tid, e->ts - trace_start_time);
+                if (e->type == 'C')
+                    fprintf(f, ",\"args\":{\"value\":%f}", e->value);
+                fprintf(f, "}");
+            }
+        }
+        num_events += t->num_events;
+
+        if (t->dropped) {
+            mp_warn(log, "Trace: %"PRId64" events dropped on thread '%s'.\n",
+                    t->dropped, tname);
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f)) {
+        mp_err(log, "Failed to write trace file '%s'\n", path);
+    } else {
+        mp_verbose(log, "Wrote %"PRId64" trace events to '%s'.\n",
+                   num_events, path);
+    }
+}
+
+// Called with trace_lock held.
+static void stop_recording(struct mp_log *log)
+{
+    atomic_store(&mp_tracing_active, false);
+
+    // Threads which saw mp_tracing_active set might still be appending.
+    for (struct trace_thread *t = trace_threads; t; t = t->next) {
+        while (atomic_load(&t->writing))
+            sched_yield();
+    }
+
+    write_trace(log, trace_path);
+
+    struct trace_thread *t = trace_threads;
+    while (t) {
+        struct trace_thread *next = t->next;
+        if (t->dead) {
+            destroy_thread(t);
+        } else {
+            free_chunks(t);
+        }
+        t = next;
+    }
+
+    talloc_free(trace_path);
+    trace_path = NULL;
+    trace_owner = NULL;
+}
+
+void mp_tracing_update(struct mpv_global *global, const char *path)
+{
+    void *tmp = talloc_new(NULL);
+
+    char *new_path = NULL;
+    if (path && path[0])
+        new_path = mp_get_user_path(tmp, global, path);
+
+    pthread_mutex_lock(&trace_lock);
+
+    if (trace_owner && trace_owner != global)
+        goto done;
+
+    if (trace_path && new_path && strcmp(trace_path, new_path) == 0)
+        goto done;
+
+    if (trace_path)
+        stop_recording(global->log);
+
+    if (new_path) {
+        trace_path = talloc_strdup(NULL, new_path);
+        trace_owner = global;
+        trace_start_time = mp_time_us();
+        atomic_store(&mp_tracing_active, true);
+        mp_verbose(global->log, "Recording trace to '%s'.\n", trace_path);
+    }
+
+done:
+    pthread_mutex_unlock(&trace_lock);
+    talloc_free(tmp);
+}
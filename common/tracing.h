@@ -0,0 +1,56 @@
+#ifndef MP_TRACING_H
+#define MP_TRACING_H
+
+#include <stdbool.h>
+
+#include "osdep/atomic.h"
+
+struct mpv_global;
+
+// Process-wide recording of begin/end spans and counter values, written out
+// in the Chrome trace event format (chrome://tracing, ui.perfetto.dev) when
+// recording stops. Enabled with --trace-file.
+//
+// Events are appended to per-thread buffers without taking any locks. If
+// tracing is not active, the calls below cost a single relaxed atomic load.
+//
+// name must be a string with static lifetime (usually a literal): only the
+// pointer is stored, and it's read when the trace file is written.
+// Spans must be properly nested within a thread.
+
+extern atomic_bool mp_tracing_active;
+
+void mp_tracing_add_event(char type, const char *name, double value);
+
+static inline bool mp_tracing_enabled(void)
+{
+    return atomic_load_explicit(&mp_tracing_active, memory_order_relaxed);
+}
+
+static inline void mp_tracing_begin(const char *name)
+{
+    if (mp_tracing_enabled())
+        mp_tracing_add_event('B', name, 0);
+}
+
+static inline void mp_tracing_end(const char *name)
+{
+    if (mp_tracing_enabled())
+        mp_tracing_add_event('E', name, 0);
+}
+
+static inline void mp_tracing_counter(const char *name, double value)
+{
+    if (mp_tracing_enabled())
+        mp_tracing_add_event('C', name, value);
+}
+
+// Name the calling thread in the trace output. (Called by mpthread_set_name().)
+void mp_tracing_set_thread_name(const char *name);
+
+// Start recording if path is set, and write the previous recording (if any)
+// to the previous path. Only the first mpv_global to enable tracing owns it;
+// calls from other instances are ignored. path==NULL stops recording.
+void mp_tracing_update(struct mpv_global *global, const char *path);
+
+#endif
@@ -40,6 +40,8 @@
 #define HAVE_GLOB_WIN32 0
 #define HAVE_GLOB 1
 #define HAVE_FCHMOD 1
+#define HAVE_EPOLL 0
+#define HAVE_MEMFD_CREATE 0
 #define HAVE_VT_H 0
 #define HAVE_GBM_H 0
 #define HAVE_GLIBC_THREAD_NAME 0
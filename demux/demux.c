@@ -35,6 +35,8 @@
 #include "mpa_talloc.h"
 #include "common/msg.h"
 #include "common/global.h"
+#include "common/perf_counters.h"
+#include "common/tracing.h"
 #include "misc/thread_tools.h"
 #include "osdep/atomic.h"
 #include "osdep/timer.h"
@@ -45,9 +47,11 @@
 #include "timeline.h"
 #include "stheader.h"
 #include "cue.h"
+#include "probe_cache.h"
 
 // Demuxer list
 extern const demuxer_desc_t demuxer_desc_rawaudio;
+extern const demuxer_desc_t demuxer_desc_pcm;
 extern const demuxer_desc_t demuxer_desc_lavf;
 extern const demuxer_desc_t demuxer_desc_playlist;
 extern const demuxer_desc_t demuxer_desc_null;
@@ -59,6 +63,7 @@ extern const demuxer_desc_t demuxer_desc_timeline;
 
 const demuxer_desc_t *const demuxer_list[] = {
     &demuxer_desc_rawaudio,
+    &demuxer_desc_pcm,
     &demuxer_desc_lavf,
     &demuxer_desc_playlist,
     &demuxer_desc_null,
@@ -75,6 +80,7 @@ struct demux_opts {
     int access_references;
     int seekable_cache;
     int create_ccs;
+    int probe_cache;
 };
 
 #define OPT_BASE_STRUCT struct demux_opts
@@ -96,6 +102,7 @@ const struct m_sub_options demux_conf = {
         OPT_CHOICE("demuxer-seekable-cache", seekable_cache, 0,
                    ({"auto", -1}, {"no", 0}, {"yes", 1})),
         OPT_FLAG("sub-create-cc-track", create_ccs, 0),
+        OPT_FLAG("demuxer-probe-cache", probe_cache, 0),
         {0}
     },
     .size = sizeof(struct demux_opts),
@@ -1565,13 +1572,19 @@ static bool read_packet(struct demux_internal *in)
 
     struct demuxer *demux = in->d_thread;
 
+    mp_tracing_begin("demux read_packet");
+
     bool eof = true;
     if (demux->desc->fill_buffer && !demux_cancel_test(demux))
         eof = demux->desc->fill_buffer(demux) <= 0;
     update_cache(in);
 
+    mp_tracing_end("demux read_packet");
+
     pthread_mutex_lock(&in->lock);
 
+    mp_tracing_counter("demux forward bytes", in->fw_bytes);
+
     if (!in->seeking) {
         if (eof) {
             for (int n = 0; n < in->num_streams; n++) {
@@ -1698,6 +1711,7 @@ static void execute_seek(struct demux_internal *in)
     in->demux_ts = MP_NOPTS_VALUE;
     in->low_level_seeks += 1;
     in->initial_state = false;
+    mp_perf_inc(MP_PERF_DEMUX_LOW_LEVEL_SEEKS);
 
     pthread_mutex_unlock(&in->lock);
 
@@ -2274,12 +2288,16 @@ bool demux_is_network_cached(demuxer_t *demuxer)
     return use_cache;
 }
 
+// If cache_key is set, the result is stored in the probe cache. cached is the
+// current entry for the key (if any).
 static struct demuxer *open_given_type(struct mpv_global *global,
                                        struct mp_log *log,
                                        const struct demuxer_desc *desc,
                                        struct stream *stream,
                                        struct demuxer_params *params,
-                                       enum demux_check check)
+                                       enum demux_check check,
+                                       const char *cache_key,
+                                       struct probe_cache_entry *cached)
 {
     if (mp_cancel_test(stream->cancel))
         return NULL;
@@ -2345,9 +2363,21 @@ static struct demuxer *open_given_type(struct mpv_global *global,
     stream_peek(stream, STREAM_BUFFER_SIZE);
 
     in->d_thread->params = params; // temporary during open()
+    in->d_thread->probe_cache = cached;
     int ret = demuxer->desc->open(in->d_thread, check);
+    in->d_thread->probe_cache = NULL;
     if (ret >= 0) {
         in->d_thread->params = NULL;
+        // Only rewrite the entry if there's something new.
+        if (cache_key && (!cached || in->d_thread->probe_data)) {
+            struct probe_cache_entry e = {
+                .demuxer = (char *)desc->name,
+                .format = (char *)in->d_thread->filetype,
+                .data = in->d_thread->probe_data,
+            };
+            probe_cache_store(global, log, cache_key, &e);
+        }
+        TA_FREEP(&in->d_thread->probe_data);
         if (in->d_thread->filetype)
             mp_verbose(log, "Detected file format: %s (%s)\n",
                        in->d_thread->filetype, desc->desc);
@@ -2383,7 +2413,7 @@ static struct demuxer *open_given_type(struct mpv_global *global,
                 params2.timeline = tl;
                 struct demuxer *sub =
                     open_given_type(global, log, &demuxer_desc_timeline, stream,
-                                    &params2, DEMUX_CHECK_FORCE);
+                                    &params2, DEMUX_CHECK_FORCE, NULL, NULL);
                 if (sub) {
                     demuxer = sub;
                 } else {
@@ -2412,6 +2442,7 @@ struct demuxer *demux_open(struct stream *stream, struct demuxer_params *params,
     const int *check_levels = d_normal;
     const struct demuxer_desc *check_desc = NULL;
     struct mp_log *log = mp_log_new(NULL, global->log, "!demux");
+    void *tmp = talloc_new(NULL);
     struct demuxer *demuxer = NULL;
     char *force_format = params ? params->force_format : NULL;
 
@@ -2434,6 +2465,31 @@ struct demuxer *demux_open(struct stream *stream, struct demuxer_params *params,
         }
     }
 
+    // Try the demuxer that worked last time first. (Segments of timelines are
+    // opened with special parameters, and aren't worth caching.)
+    char *cache_key = NULL;
+    struct probe_cache_entry *cached = NULL;
+    struct demux_opts *opts = mp_get_config_group(tmp, global, &demux_conf);
+    if (opts->probe_cache && !check_desc &&
+        !(params && (params->timeline || params->init_fragment.len)))
+        cache_key = probe_cache_get_key(tmp, stream);
+    if (cache_key)
+        cached = probe_cache_lookup(tmp, global, log, cache_key);
+    if (cached) {
+        for (int n = 0; demuxer_list[n]; n++) {
+            const struct demuxer_desc *desc = demuxer_list[n];
+            if (strcmp(desc->name, cached->demuxer) == 0) {
+                demuxer = open_given_type(global, log, desc, stream, params,
+                                          DEMUX_CHECK_REQUEST, cache_key,
+                                          cached);
+                if (demuxer)
+                    goto done;
+            }
+        }
+        mp_verbose(log, "Probe cache entry is outdated.\n");
+        cached = NULL;
+    }
+
     // Test demuxers from first to last, one pass for each check_levels[] entry
     for (int pass = 0; check_levels[pass] != -1; pass++) {
         enum demux_check level = check_levels[pass];
@@ -2441,19 +2497,25 @@ struct demuxer *demux_open(struct stream *stream, struct demuxer_params *params,
         for (int n = 0; demuxer_list[n]; n++) {
             const struct demuxer_desc *desc = demuxer_list[n];
             if (!check_desc || desc == check_desc) {
-                demuxer = open_given_type(global, log, desc, stream, params, level);
-                if (demuxer) {
-                    talloc_steal(demuxer, log);
-                    log = NULL;
-                    demuxer->in->owns_stream =
-                        params ? !params->does_not_own_stream : true;
+                demuxer = open_given_type(global, log, desc, stream, params,
+                                          level, cache_key, NULL);
+                if (demuxer)
                     goto done;
-                }
             }
         }
     }
 
+    if (cache_key && !mp_cancel_test(stream->cancel))
+        probe_cache_store(global, log, cache_key, NULL);
+
 done:
+    if (demuxer) {
+        talloc_steal(demuxer, log);
+        log = NULL;
+        demuxer->in->owns_stream =
+            params ? !params->does_not_own_stream : true;
+    }
+    talloc_free(tmp);
     talloc_free(log);
     return demuxer;
 }
@@ -2776,6 +2838,7 @@ int demux_seek(demuxer_t *demuxer, double seek_pts, int flags)
 
     if (cache_target) {
         execute_cache_seek(in, cache_target, seek_pts, flags);
+        mp_perf_inc(MP_PERF_DEMUX_CACHE_SEEKS);
     } else {
         switch_to_fresh_cache_range(in);
 
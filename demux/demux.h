@@ -101,6 +101,7 @@ enum demux_event {
 
 struct demuxer;
 struct timeline;
+struct probe_cache_entry;
 
 /**
  * Demuxer description structure
@@ -229,6 +230,11 @@ typedef struct demuxer {
     struct mpv_global *global;
     struct mp_log *log, *glog;
     struct demuxer_params *params;
+    // Set during open() if the probe cache has an entry for this demuxer. The
+    // demuxer can set probe_data to private data, which is stored in the cache
+    // and passed back on the next open (as probe_cache->data).
+    const struct probe_cache_entry *probe_cache;
+    char *probe_data;
 
     // internal to demux.c
     struct demux_internal *in;
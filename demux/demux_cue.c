@@ -41,11 +41,16 @@
 
 struct priv {
     struct cue_file *f;
+    // reopen[n]: whether tl->sources[n] can be reopened by its filename
+    bool *reopen;
+    int num_reopen;
 };
 
-static void add_source(struct timeline *tl, struct demuxer *d)
+static void add_source(struct timeline *tl, struct demuxer *d, bool reopen)
 {
+    struct priv *p = tl->demuxer->priv;
     MP_TARRAY_APPEND(tl, tl->sources, tl->num_sources, d);
+    MP_TARRAY_APPEND(p, p->reopen, p->num_reopen, reopen);
 }
 
 static bool try_open(struct timeline *tl, char *filename)
@@ -59,6 +64,7 @@ static bool try_open(struct timeline *tl, char *filename)
         return false;
 
     struct demuxer *d = demux_open_url(filename, NULL, tl->cancel, tl->global);
+    bool reopen = !!d;
     // Since .bin files are raw PCM data with no headers, we have to explicitly
     // open them. Also, try to avoid to open files that are most likely not .bin
     // files, as that would only play noise. Checking the file extension is
@@ -71,7 +77,7 @@ static bool try_open(struct timeline *tl, char *filename)
         d = demux_open_url(filename, &p, tl->cancel, tl->global);
     }
     if (d) {
-        add_source(tl, d);
+        add_source(tl, d, reopen);
         return true;
     }
     MP_ERR(tl, "Could not open source '%s'!\n", filename);
@@ -136,7 +142,7 @@ static void build_timeline(struct timeline *tl)
 
     void *ctx = talloc_new(NULL);
 
-    add_source(tl, tl->demuxer);
+    add_source(tl, tl->demuxer, false);
 
     struct cue_track *tracks = NULL;
     size_t track_count = 0;
@@ -220,6 +226,24 @@ static void build_timeline(struct timeline *tl)
         starttime += duration;
     }
 
+    // Close all files but the first one (which defines the track layout), and
+    // let demux_timeline open them when they are needed. With one file per
+    // track, this avoids keeping hundreds of files open. (BIN files need a
+    // forced demuxer, so they stay open.)
+    for (int i = 0; i < track_count; i++) {
+        int src = 1 + tracks[i].source;
+        if (src > 1 && p->reopen[src]) {
+            timeline[i].url = talloc_strdup(tl, tl->sources[src]->filename);
+            timeline[i].source = NULL;
+        }
+    }
+    for (int n = tl->num_sources - 1; n > 1; n--) {
+        if (p->reopen[n]) {
+            demux_free(tl->sources[n]);
+            MP_TARRAY_REMOVE_AT(tl->sources, tl->num_sources, n);
+        }
+    }
+
     // apparently we need this to give the last part a non-zero length
     timeline[track_count] = (struct timeline_part) {
         .start = starttime,
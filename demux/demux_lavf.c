@@ -47,6 +47,7 @@
 
 #include "stream/stream.h"
 #include "demux.h"
+#include "probe_cache.h"
 #include "stheader.h"
 #include "options/m_config.h"
 #include "options/m_option.h"
@@ -395,6 +396,15 @@ static char *remove_prefix(char *s, const char *const *prefixes)
 static const char *const prefixes[] =
     {"ffmpeg://", "lavf://", "avdevice://", "av://", NULL};
 
+// Find the format by its full name (e.g. "mov,mp4,m4a,3gp,3g2,mj2").
+static AVInputFormat *find_format_by_name(const char *name)
+{
+    char *first = talloc_strndup(NULL, name, strcspn(name, ","));
+    AVInputFormat *fmt = av_find_input_format(first);
+    talloc_free(first);
+    return fmt && strcmp(fmt->name, name) == 0 ? fmt : NULL;
+}
+
 static int lavf_check_file(demuxer_t *demuxer, enum demux_check check)
 {
     lavf_priv_t *priv = demuxer->priv;
@@ -437,6 +447,11 @@ static int lavf_check_file(demuxer_t *demuxer, enum demux_check check)
             return -1;
         }
     }
+    bool cached_format = false;
+    if (!forced_format && demuxer->probe_cache && demuxer->probe_cache->format) {
+        forced_format = find_format_by_name(demuxer->probe_cache->format);
+        cached_format = !!forced_format;
+    }
 
     AVProbeData avpd = {
         // Disable file-extension matching with normal checks
@@ -473,6 +488,7 @@ static int lavf_check_file(demuxer_t *demuxer, enum demux_check check)
         if (priv->avif) {
             MP_VERBOSE(demuxer, "Found '%s' at score=%d size=%d%s.\n",
                        priv->avif->name, score, avpd.buf_size,
+                       cached_format ? " (cached)" :
                        forced_format ? " (forced)" : "");
 
             for (int n = 0; lavfdopts->hacks && format_hacks[n].ff_name; n++) {
@@ -754,6 +770,135 @@ static void update_metadata(demuxer_t *demuxer)
     }
 }
 
+// Return the result of avformat_find_stream_info() for the probe cache: a line
+// with the global values, and a line with the parameters of each stream.
+static char *get_probe_data(struct demuxer *demuxer)
+{
+    lavf_priv_t *priv = demuxer->priv;
+    AVFormatContext *avfc = priv->avfc;
+
+    char *res = talloc_asprintf(demuxer, "%"PRId64" %"PRId64" %d\n",
+                                avfc->duration, avfc->start_time,
+                                avfc->nb_streams);
+    for (int n = 0; n < avfc->nb_streams; n++) {
+        AVCodecParameters *par = avfc->streams[n]->codecpar;
+        res = talloc_asprintf_append_buffer(res,
+            "%d %s %"PRIu32" %d %"PRId64" %d %d %"PRIu64" %d %d %d %d %d ",
+            par->codec_type, avcodec_get_name(par->codec_id), par->codec_tag,
+            par->format, par->bit_rate, par->sample_rate, par->channels,
+            par->channel_layout, par->block_align, par->frame_size,
+            par->initial_padding, par->width, par->height);
+        for (int i = 0; i < par->extradata_size; i++)
+            res = talloc_asprintf_append_buffer(res, "%02x", par->extradata[i]);
+        res = talloc_strdup_append_buffer(res, "-\n");
+    }
+    return res;
+}
+
+// Stream parameters stored in the probe cache. (Not AVCodecParameters, whose
+// size is not part of the ABI.)
+struct cached_params {
+    uint32_t codec_tag;
+    int format;
+    int64_t bit_rate;
+    int sample_rate;
+    int channels;
+    uint64_t channel_layout;
+    int block_align;
+    int frame_size;
+    int initial_padding;
+    int width, height;
+    bstr extradata;
+};
+
+// Fill in the stream parameters from the probe cache, instead of calling
+// avformat_find_stream_info(). Parameters read from the file headers are kept.
+// Fails if the streams don't match (like with formats without headers).
+static bool apply_probe_data(struct demuxer *demuxer, const char *data)
+{
+    lavf_priv_t *priv = demuxer->priv;
+    AVFormatContext *avfc = priv->avfc;
+    void *tmp = talloc_new(NULL);
+    bool ok = false;
+
+    bstr rest = bstr0(data);
+    char *line = bstrto0(tmp, bstr_getline(rest, &rest));
+    int64_t duration, start_time;
+    int num_streams;
+    if (sscanf(line, "%"SCNd64" %"SCNd64" %d", &duration, &start_time,
+               &num_streams) != 3 || num_streams != avfc->nb_streams)
+        goto done;
+
+    struct cached_params *cached =
+        talloc_zero_array(tmp, struct cached_params, num_streams);
+    for (int n = 0; n < num_streams; n++) {
+        AVCodecParameters *cur = avfc->streams[n]->codecpar;
+        struct cached_params *par = &cached[n];
+        char codec[64];
+        int type, pos = -1;
+        line = bstrto0(tmp, bstr_getline(rest, &rest));
+        sscanf(line,
+            "%d %63s %"SCNu32" %d %"SCNd64" %d %d %"SCNu64" %d %d %d %d %d %n",
+            &type, codec, &par->codec_tag, &par->format, &par->bit_rate,
+            &par->sample_rate, &par->channels, &par->channel_layout,
+            &par->block_align, &par->frame_size, &par->initial_padding,
+            &par->width, &par->height, &pos);
+        const AVCodecDescriptor *desc = avcodec_descriptor_get_by_name(codec);
+        enum AVCodecID id = desc ? desc->id : AV_CODEC_ID_NONE;
+        if (pos < 0 || type != cur->codec_type || id != cur->codec_id)
+            goto done;
+        // Extradata as hex, terminated by "-" (to detect truncated entries).
+        bstr hex = bstr0(line + pos);
+        if (!bstr_eatend0(&hex, "-") ||
+            !bstr_decode_hex(tmp, hex, &par->extradata))
+            goto done;
+    }
+
+    for (int n = 0; n < num_streams; n++) {
+        AVCodecParameters *cur = avfc->streams[n]->codecpar;
+        struct cached_params *par = &cached[n];
+        if (!cur->codec_tag)
+            cur->codec_tag = par->codec_tag;
+        if (cur->format < 0)
+            cur->format = par->format;
+        if (!cur->bit_rate)
+            cur->bit_rate = par->bit_rate;
+        if (!cur->sample_rate)
+            cur->sample_rate = par->sample_rate;
+        if (!cur->channels)
+            cur->channels = par->channels;
+        if (!cur->channel_layout)
+            cur->channel_layout = par->channel_layout;
+        if (!cur->block_align)
+            cur->block_align = par->block_align;
+        if (!cur->frame_size)
+            cur->frame_size = par->frame_size;
+        if (!cur->initial_padding)
+            cur->initial_padding = par->initial_padding;
+        if (!cur->width && !cur->height) {
+            cur->width = par->width;
+            cur->height = par->height;
+        }
+        if (!cur->extradata_size && par->extradata.len) {
+            cur->extradata = av_mallocz(par->extradata.len +
+                                        AV_INPUT_BUFFER_PADDING_SIZE);
+            if (cur->extradata) {
+                memcpy(cur->extradata, par->extradata.start, par->extradata.len);
+                cur->extradata_size = par->extradata.len;
+            }
+        }
+    }
+    if (avfc->duration == AV_NOPTS_VALUE)
+        avfc->duration = duration;
+    if (avfc->start_time == AV_NOPTS_VALUE)
+        avfc->start_time = start_time;
+    ok = true;
+
+done:
+    talloc_free(tmp);
+    return ok;
+}
+
 static int interrupt_cb(void *ctx)
 {
     struct demuxer *demuxer = ctx;
@@ -923,6 +1068,12 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
     }
     if (demuxer->params && demuxer->params->skip_lavf_probing)
         probeinfo = false;
+    if (probeinfo && demuxer->probe_cache && demuxer->probe_cache->data &&
+        apply_probe_data(demuxer, demuxer->probe_cache->data))
+    {
+        MP_VERBOSE(demuxer, "Using cached stream info.\n");
+        probeinfo = false;
+    }
     if (probeinfo) {
         if (avformat_find_stream_info(avfc, NULL) < 0) {
             MP_ERR(demuxer, "av_find_stream_info() failed\n");
@@ -931,6 +1082,7 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
 
         MP_VERBOSE(demuxer, "avformat_find_stream_info() finished after %"PRId64
                    " bytes.\n", stream_tell(priv->stream));
+        demuxer->probe_data = get_probe_data(demuxer);
     }
 
     for (int i = 0; i < avfc->nb_chapters; i++) {
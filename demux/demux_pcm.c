@@ -0,0 +1,381 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Native demuxer for uncompressed WAV (including RF64) and AIFF/AIFC files.
+// Compared to going through libavformat, this avoids the probing, and reads
+// large packets directly into the packet buffers. Seeking is exact to the
+// sample. Anything this can't handle is left to demux_lavf.
+
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <libavutil/intreadwrite.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "stream/stream.h"
+#include "demux.h"
+#include "stheader.h"
+#include "codec_tags.h"
+
+// Maximum size of a packet. Packets are also limited to 1 second of audio.
+#define PACKET_BYTES (64 * 1024)
+
+struct pcm_format {
+    const char *filetype;
+    bool sign, is_float, is_be;
+    int bits;               // size of a sample in the file
+    int channels;
+    uint64_t chmask;        // WAVEFORMATEXTENSIBLE channel mask, or 0
+    int samplerate;
+    int64_t data_start;
+    int64_t data_size;      // -1 if unknown (read until EOF)
+};
+
+struct priv {
+    struct sh_stream *sh;
+    int64_t data_start;
+    int64_t data_end;       // -1 if unknown
+    int block_align;        // bytes per sample frame
+    int samplerate;
+    int read_bytes;
+};
+
+// The headers are parsed from peeked data, so nothing is consumed if the file
+// is rejected (the next demuxer probes from the start, even on pipes). This is
+// the maximum offset of the sample data.
+#define MAX_HEADER_SIZE (1024 * 1024)
+
+// Copy len bytes at offset pos (relative to the current stream position).
+static bool peek_header(struct stream *s, int64_t pos, void *buf, int len)
+{
+    if (pos < 0 || pos + len > MAX_HEADER_SIZE)
+        return false;
+    bstr data = stream_peek(s, pos + len);
+    if (data.len < pos + len)
+        return false;
+    memcpy(buf, data.start + pos, len);
+    return true;
+}
+
+static bool read_chunk_header(struct stream *s, int64_t *pos, char id[4],
+                              uint32_t *size, bool is_be)
+{
+    char buf[8];
+    if (!peek_header(s, *pos, buf, 8))
+        return false;
+    memcpy(id, buf, 4);
+    *size = is_be ? AV_RB32(buf + 4) : AV_RL32(buf + 4);
+    *pos += 8;
+    return true;
+}
+
+// Offset of the chunk following the one with the given size and data offset.
+// Chunks are padded to an even size.
+static int64_t next_chunk(int64_t pos, uint32_t size)
+{
+    return pos + size + (size & 1);
+}
+
+static bool parse_wav(struct demuxer *demuxer, struct pcm_format *fmt)
+{
+    struct stream *s = demuxer->stream;
+    char header[12];
+    if (!peek_header(s, 0, header, 12))
+        return false;
+    bool rf64 = memcmp(header, "RF64", 4) == 0;
+    int64_t rf64_data_size = -1;
+    bool have_fmt = false;
+    fmt->filetype = rf64 ? "rf64" : "wav";
+
+    int64_t pos = 12;
+    while (1) {
+        char id[4];
+        uint32_t size;
+        if (!read_chunk_header(s, &pos, id, &size, false))
+            return false;
+        if (rf64 && memcmp(id, "ds64", 4) == 0 && size >= 28) {
+            char buf[28];
+            if (!peek_header(s, pos, buf, 28))
+                return false;
+            rf64_data_size = AV_RL64(buf + 8);
+        } else if (memcmp(id, "fmt ", 4) == 0 && size >= 16) {
+            char buf[40] = {0};
+            int len = MPMIN(size, sizeof(buf));
+            if (!peek_header(s, pos, buf, len))
+                return false;
+            int tag = AV_RL16(buf);
+            fmt->channels = AV_RL16(buf + 2);
+            fmt->samplerate = AV_RL32(buf + 4);
+            int block_align = AV_RL16(buf + 12);
+            if (tag == 0xFFFE && len >= 40) {
+                // WAVE_FORMAT_EXTENSIBLE: the sub-format GUID starts with the
+                // actual format tag.
+                fmt->chmask = AV_RL32(buf + 20);
+                tag = AV_RL16(buf + 24);
+            }
+            if (tag != 1 && tag != 3) {
+                MP_VERBOSE(demuxer, "Unsupported WAV format 0x%x.\n", tag);
+                return false;
+            }
+            if (fmt->channels < 1 || block_align % fmt->channels)
+                return false;
+            // The container size, which can be larger than the bits field.
+            fmt->bits = block_align / fmt->channels * 8;
+            fmt->is_float = tag == 3;
+            fmt->sign = fmt->is_float || fmt->bits > 8;
+            have_fmt = true;
+        } else if (memcmp(id, "data", 4) == 0) {
+            if (!have_fmt)
+                return false;
+            fmt->data_start = pos;
+            fmt->data_size = size;
+            if (rf64 && size == 0xFFFFFFFF)
+                fmt->data_size = rf64_data_size;
+            // Written by streaming encoders that don't know the size.
+            if (!size || (!rf64 && size == 0xFFFFFFFF))
+                fmt->data_size = -1;
+            return true;
+        }
+        pos = next_chunk(pos, size);
+    }
+}
+
+// 80 bit IEEE 754 extended precision float, as used for the AIFF sample rate.
+static double read_ext80(const char *buf)
+{
+    int exp = AV_RB16(buf);
+    uint64_t mantissa = AV_RB64(buf + 2);
+    if (exp & 0x8000)
+        return -1;
+    return ldexp(mantissa, exp - 16383 - 63);
+}
+
+static bool parse_aiff(struct demuxer *demuxer, struct pcm_format *fmt)
+{
+    struct stream *s = demuxer->stream;
+    char header[12];
+    if (!peek_header(s, 0, header, 12))
+        return false;
+    bool aifc = memcmp(header + 8, "AIFC", 4) == 0;
+    bool have_comm = false;
+    int64_t num_frames = -1;
+    fmt->filetype = aifc ? "aifc" : "aiff";
+    fmt->data_start = -1;
+    fmt->sign = true;
+    fmt->is_be = true;
+
+    // COMM and SSND can be in any order. Both must be within the header size.
+    int64_t pos = 12;
+    while (!have_comm || fmt->data_start < 0) {
+        char id[4];
+        uint32_t size;
+        if (!read_chunk_header(s, &pos, id, &size, true))
+            return false;
+        if (memcmp(id, "COMM", 4) == 0 && size >= 18) {
+            char buf[22] = {0};
+            int len = aifc && size >= 22 ? 22 : 18;
+            if (!peek_header(s, pos, buf, len))
+                return false;
+            fmt->channels = AV_RB16(buf);
+            num_frames = AV_RB32(buf + 2);
+            fmt->bits = (AV_RB16(buf + 6) + 7) / 8 * 8;
+            double rate = read_ext80(buf + 8);
+            fmt->samplerate = rate >= 1 && rate <= INT_MAX ? lrint(rate) : 0;
+            if (len >= 22) {
+                const char *c = buf + 18;
+                if (!memcmp(c, "sowt", 4)) {
+                    fmt->is_be = false;
+                } else if (!memcmp(c, "fl32", 4) || !memcmp(c, "FL32", 4)) {
+                    fmt->is_float = true;
+                    fmt->bits = 32;
+                } else if (!memcmp(c, "fl64", 4) || !memcmp(c, "FL64", 4)) {
+                    fmt->is_float = true;
+                    fmt->bits = 64;
+                } else if (!memcmp(c, "raw ", 4)) {
+                    fmt->sign = false;
+                } else if (memcmp(c, "NONE", 4) && memcmp(c, "twos", 4)) {
+                    MP_VERBOSE(demuxer, "Unsupported AIFC compression "
+                               "'%.4s'.\n", c);
+                    return false;
+                }
+            }
+            have_comm = true;
+        } else if (memcmp(id, "SSND", 4) == 0 && size >= 8) {
+            char buf[8];
+            if (!peek_header(s, pos, buf, 8))
+                return false;
+            uint32_t offset = AV_RB32(buf);
+            if (offset > size - 8)
+                return false;
+            fmt->data_start = pos + 8 + offset;
+            fmt->data_size = size - 8 - offset;
+        }
+        pos = next_chunk(pos, size);
+    }
+
+    if (num_frames >= 0 && fmt->channels > 0) {
+        int64_t size = num_frames * fmt->channels * (fmt->bits / 8);
+        fmt->data_size = MPMIN(fmt->data_size, size);
+    }
+    return true;
+}
+
+static int demux_pcm_open(struct demuxer *demuxer, enum demux_check check)
+{
+    struct stream *s = demuxer->stream;
+
+    // The header is required even if the demuxer is forced.
+    bstr h = stream_peek(s, 12);
+    if (h.len < 12)
+        return -1;
+    struct pcm_format fmt = {0};
+    bool ok;
+    if ((!memcmp(h.start, "RIFF", 4) || !memcmp(h.start, "RF64", 4)) &&
+        !memcmp(h.start + 8, "WAVE", 4))
+    {
+        ok = parse_wav(demuxer, &fmt);
+    } else if (!memcmp(h.start, "FORM", 4) &&
+               (!memcmp(h.start + 8, "AIFF", 4) ||
+                !memcmp(h.start + 8, "AIFC", 4)))
+    {
+        ok = parse_aiff(demuxer, &fmt);
+    } else {
+        return -1;
+    }
+
+    bool valid_bits = fmt.is_float ? fmt.bits == 32 || fmt.bits == 64
+                                   : fmt.bits >= 8 && fmt.bits <= 32;
+    if (!ok || !valid_bits || fmt.samplerate <= 0 || fmt.channels < 1 ||
+        fmt.channels > MP_NUM_CHANNELS)
+        return -1;
+
+    // data_start is relative to the current position. The header is buffered,
+    // so skipping to the data works on unseekable streams too.
+    int64_t base = stream_tell(s);
+    if (!stream_skip(s, fmt.data_start))
+        return -1;
+    fmt.data_start += base;
+
+    struct sh_stream *sh = demux_alloc_sh_stream(STREAM_AUDIO);
+    struct mp_codec_params *c = sh->codec;
+    if (fmt.chmask)
+        mp_chmap_from_waveext(&c->channels, fmt.chmask);
+    if (c->channels.num != fmt.channels)
+        mp_chmap_from_channels(&c->channels, fmt.channels);
+    c->samplerate = fmt.samplerate;
+    c->block_align = fmt.channels * (fmt.bits / 8);
+    c->bitrate = c->block_align * 8 * fmt.samplerate;
+    c->native_tb_num = 1;
+    c->native_tb_den = fmt.samplerate;
+    mp_set_pcm_codec(c, fmt.sign, fmt.is_float, fmt.bits, fmt.is_be);
+    demux_add_sh_stream(demuxer, sh);
+
+    struct priv *p = talloc_ptrtype(demuxer, p);
+    demuxer->priv = p;
+    *p = (struct priv) {
+        .sh = sh,
+        .data_start = fmt.data_start,
+        .data_end = fmt.data_size >= 0 ? fmt.data_start + fmt.data_size : -1,
+        .block_align = c->block_align,
+        .samplerate = fmt.samplerate,
+    };
+    int frames = MPMIN(PACKET_BYTES / p->block_align, fmt.samplerate);
+    p->read_bytes = MPMAX(frames, 1) * p->block_align;
+
+    int64_t end = p->data_end;
+    if (end < 0)
+        end = stream_get_size(s);
+    if (end >= p->data_start) {
+        int64_t num_frames = (end - p->data_start) / p->block_align;
+        demuxer->duration = num_frames / (double)p->samplerate;
+    }
+    demuxer->filetype = fmt.filetype;
+
+    return 0;
+}
+
+static int pcm_fill_buffer(struct demuxer *demuxer)
+{
+    struct priv *p = demuxer->priv;
+    struct stream *s = demuxer->stream;
+
+    int64_t pos = stream_tell(s);
+    int64_t len = p->read_bytes;
+    if (p->data_end >= 0)
+        len = MPMIN(len, p->data_end - pos);
+    len -= len % p->block_align;
+    if (len <= 0)
+        return 0;
+
+    struct demux_packet *dp = new_demux_packet(len);
+    if (!dp) {
+        MP_ERR(demuxer, "Can't read packet.\n");
+        return 1;
+    }
+
+    int got = stream_read(s, dp->buffer, len);
+    got -= got % p->block_align;
+    if (got <= 0) {
+        free_demux_packet(dp);
+        return 0;
+    }
+    demux_packet_shorten(dp, got);
+
+    int64_t frame = (pos - p->data_start) / p->block_align;
+    dp->pos = pos;
+    dp->pts = frame / (double)p->samplerate;
+    dp->duration = got / p->block_align / (double)p->samplerate;
+    dp->keyframe = true;
+    demux_add_packet(p->sh, dp);
+
+    return 1;
+}
+
+static void pcm_seek(struct demuxer *demuxer, double seek_pts, int flags)
+{
+    struct priv *p = demuxer->priv;
+    struct stream *s = demuxer->stream;
+
+    int64_t end = p->data_end >= 0 ? p->data_end : stream_get_size(s);
+    int64_t num_frames = -1;
+    if (end >= p->data_start)
+        num_frames = (end - p->data_start) / p->block_align;
+
+    // Every sample is a seek point, so this lands exactly on the target
+    // (within the precision of the timestamp).
+    double frame = seek_pts * p->samplerate;
+    if (flags & SEEK_FACTOR)
+        frame = seek_pts * MPMAX(num_frames, 0);
+    int64_t target = flags & SEEK_FORWARD ? ceil(frame - 1e-6)
+                                          : floor(frame + 1e-6);
+    if (num_frames >= 0)
+        target = MPMIN(target, num_frames);
+    target = MPMAX(target, 0);
+
+    stream_seek(s, p->data_start + target * p->block_align);
+}
+
+const demuxer_desc_t demuxer_desc_pcm = {
+    .name = "pcm",
+    .desc = "Uncompressed WAV/AIFF",
+    .open = demux_pcm_open,
+    .fill_buffer = pcm_fill_buffer,
+    .seek = pcm_seek,
+};
@@ -15,17 +15,23 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
-#include <dirent.h>
+
+#include <libavutil/md5.h>
 
 #include "config.h"
 #include "common/common.h"
+#include "common/global.h"
 #include "options/options.h"
 #include "common/msg.h"
 #include "common/playlist.h"
+#include "misc/dir_scan.h"
 #include "misc/thread_tools.h"
+#include "options/m_config.h"
+#include "options/m_option.h"
 #include "options/path.h"
 #include "stream/stream.h"
 #include "osdep/io.h"
@@ -33,6 +39,24 @@
 
 #define PROBE_SIZE (8 * 1024)
 
+// Playlists with more data than this after the first entry are parsed lazily:
+// the player starts with the first entry, and loads the rest in the background.
+#define LAZY_MIN_SIZE (64 * 1024)
+
+struct demux_playlist_opts {
+    int dir_snapshot;
+};
+
+#define OPT_BASE_STRUCT struct demux_playlist_opts
+const struct m_sub_options demux_playlist_conf = {
+    .opts = (const struct m_option[]) {
+        OPT_FLAG("directory-snapshot", dir_snapshot, 0),
+        {0}
+    },
+    .size = sizeof(struct demux_playlist_opts),
+};
+#undef OPT_BASE_STRUCT
+
 static bool check_mimetype(struct stream *s, const char *const *list)
 {
     if (s->mime_type) {
@@ -57,6 +81,26 @@ struct pl_parser {
     enum demux_check check_level;
     struct stream *real_stream;
     char *format;
+    // Allocation of new entries' strings.
+    struct playlist_strings *strings;
+    // Parse function for a single line of the playlist body (for formats
+    // which can be parsed incrementally).
+    void (*parse_line)(struct pl_parser *p, bstr line);
+    // Stop parsing the body after this many entries were added to pl.
+    int max_entries;
+    bool suspended;
+    // Lazy loading: the rest of the file is read by the loader from a new
+    // stream, opened from url and seeked to pos (p->s is NULL until then).
+    bool owns_stream;
+    struct mpv_global *global;
+    char *url;
+    int stream_flags;
+    int64_t pos;
+    char *base_path;
+    // m3u: title for the next entry (allocated from strings).
+    char *title;
+    // ini: prefix of the keys containing entries.
+    const char *ini_entry;
 };
 
 static char *pl_get_line0(struct pl_parser *p)
@@ -77,11 +121,11 @@ static bstr pl_get_line(struct pl_parser *p)
     return bstr0(pl_get_line0(p));
 }
 
-static void pl_add(struct pl_parser *p, bstr entry)
+static struct playlist_entry *pl_add(struct pl_parser *p, bstr entry)
 {
-    char *s = bstrto0(NULL, entry);
-    playlist_add_file(p->pl, s);
-    talloc_free(s);
+    struct playlist_entry *e = playlist_entry_new_shared(p->strings, entry);
+    playlist_add(p->pl, e);
+    return e;
 }
 
 static bool pl_eof(struct pl_parser *p)
@@ -89,6 +133,23 @@ static bool pl_eof(struct pl_parser *p)
     return p->error || p->s->eof;
 }
 
+// Parse the rest of the playlist with p->parse_line. If max_entries are
+// reached, parsing can be continued by calling this again.
+// Note that parse_line callbacks must not keep state across added entries
+// (such as m3u titles), as the strings of the next entries may be allocated
+// from different memory.
+static void pl_parse_lines(struct pl_parser *p)
+{
+    p->suspended = false;
+    while (!pl_eof(p)) {
+        if (playlist_entry_count(p->pl) >= p->max_entries) {
+            p->suspended = true;
+            break;
+        }
+        p->parse_line(p, bstr_strip(pl_get_line(p)));
+    }
+}
+
 static bool maybe_text(bstr d)
 {
     for (int n = 0; n < d.len; n++) {
@@ -99,6 +160,21 @@ static bool maybe_text(bstr d)
     return true;
 }
 
+static void parse_m3u_line(struct pl_parser *p, bstr line)
+{
+    if (bstr_eatstart0(&line, "#EXTINF:")) {
+        bstr duration, btitle;
+        if (bstr_split_tok(line, ",", &duration, &btitle) && btitle.len)
+            p->title = bstrto0(p->strings->arena, btitle);
+    } else if (bstr_startswith0(line, "#EXT-X-")) {
+        p->format = "hls";
+    } else if (line.len > 0 && !bstr_startswith0(line, "#")) {
+        struct playlist_entry *e = pl_add(p, line);
+        e->title = p->title;
+        p->title = NULL;
+    }
+}
+
 static int parse_m3u(struct pl_parser *p)
 {
     bstr line = bstr_strip(pl_get_line(p));
@@ -122,30 +198,22 @@ ok:
     if (p->probing)
         return 0;
 
-    char *title = NULL;
-    while (line.len || !pl_eof(p)) {
-        if (bstr_eatstart0(&line, "#EXTINF:")) {
-            bstr duration, btitle;
-            if (bstr_split_tok(line, ",", &duration, &btitle) && btitle.len) {
-                talloc_free(title);
-                title = bstrto0(NULL, btitle);
-            }
-        } else if (bstr_startswith0(line, "#EXT-X-")) {
-            p->format = "hls";
-        } else if (line.len > 0 && !bstr_startswith0(line, "#")) {
-            char *fn = bstrto0(NULL, line);
-            struct playlist_entry *e = playlist_entry_new(fn);
-            talloc_free(fn);
-            e->title = talloc_steal(e, title);
-            title = NULL;
-            playlist_add(p->pl, e);
-        }
-        line = bstr_strip(pl_get_line(p));
-    }
-    talloc_free(title);
+    p->parse_line = parse_m3u_line;
+    // The first line could be an entry of a headerless file.
+    parse_m3u_line(p, line);
+    pl_parse_lines(p);
     return 0;
 }
 
+static void parse_ref_line(struct pl_parser *p, bstr line)
+{
+    if (bstr_case_startswith(line, bstr0("Ref"))) {
+        bstr_split_tok(line, "=", &(bstr){0}, &line);
+        if (line.len)
+            pl_add(p, line);
+    }
+}
+
 static int parse_ref_init(struct pl_parser *p)
 {
     bstr line = bstr_strip(pl_get_line(p));
@@ -167,17 +235,24 @@ static int parse_ref_init(struct pl_parser *p)
         return 0;
     }
 
-    while (!pl_eof(p)) {
-        line = bstr_strip(pl_get_line(p));
-        if (bstr_case_startswith(line, bstr0("Ref"))) {
-            bstr_split_tok(line, "=", &(bstr){0}, &line);
-            if (line.len)
-                pl_add(p, line);
-        }
-    }
+    p->parse_line = parse_ref_line;
+    pl_parse_lines(p);
     return 0;
 }
 
+static void parse_ini_line(struct pl_parser *p, bstr line)
+{
+    bstr key, value;
+    if (bstr_split_tok(line, "=", &key, &value) &&
+        bstr_case_startswith(key, bstr0(p->ini_entry)))
+    {
+        value = bstr_strip(value);
+        if (bstr_startswith0(value, "\"") && bstr_endswith0(value, "\""))
+            value = bstr_splice(value, 1, -1);
+        pl_add(p, value);
+    }
+}
+
 static int parse_ini_thing(struct pl_parser *p, const char *header,
                            const char *entry)
 {
@@ -188,18 +263,9 @@ static int parse_ini_thing(struct pl_parser *p, const char *header,
         return -1;
     if (p->probing)
         return 0;
-    while (!pl_eof(p)) {
-        line = bstr_strip(pl_get_line(p));
-        bstr key, value;
-        if (bstr_split_tok(line, "=", &key, &value) &&
-            bstr_case_startswith(key, bstr0(entry)))
-        {
-            value = bstr_strip(value);
-            if (bstr_startswith0(value, "\"") && bstr_endswith0(value, "\""))
-                value = bstr_splice(value, 1, -1);
-            pl_add(p, value);
-        }
-    }
+    p->ini_entry = entry;
+    p->parse_line = parse_ini_line;
+    pl_parse_lines(p);
     return 0;
 }
 
@@ -213,6 +279,12 @@ static int parse_url(struct pl_parser *p)
     return parse_ini_thing(p, "[InternetShortcut]", "URL");
 }
 
+static void parse_txt_line(struct pl_parser *p, bstr line)
+{
+    if (line.len)
+        pl_add(p, line);
+}
+
 static int parse_txt(struct pl_parser *p)
 {
     if (!p->force)
@@ -220,71 +292,55 @@ static int parse_txt(struct pl_parser *p)
     if (p->probing)
         return 0;
     MP_WARN(p, "Reading plaintext playlist.\n");
-    while (!pl_eof(p)) {
-        bstr line = bstr_strip(pl_get_line(p));
-        if (line.len == 0)
-            continue;
-        pl_add(p, line);
-    }
+    p->parse_line = parse_txt_line;
+    pl_parse_lines(p);
     return 0;
 }
 
-#define MAX_DIR_STACK 20
+#define DIR_SNAPSHOT_DIR "dir_snapshots"
 
-static bool same_st(struct stat *st1, struct stat *st2)
+// Return the snapshot file for the given directory, or NULL if disabled.
+static char *get_dir_snapshot_file(struct pl_parser *p, const char *path)
 {
-    return st1->st_dev == st2->st_dev && st1->st_ino == st2->st_ino;
+    struct mpv_global *global = p->real_stream->global;
+    struct demux_playlist_opts *opts =
+        mp_get_config_group(NULL, global, &demux_playlist_conf);
+    bool enabled = opts->dir_snapshot;
+    talloc_free(opts);
+    if (!enabled)
+        return NULL;
+
+    uint8_t md5[16];
+    av_md5_sum(md5, path, strlen(path));
+    char *name = talloc_strdup(NULL, "");
+    for (int n = 0; n < 16; n++)
+        name = talloc_asprintf_append(name, "%02X", md5[n]);
+
+    mp_mk_config_dir(global, DIR_SNAPSHOT_DIR);
+    char *dir = mp_find_user_config_file(name, global, DIR_SNAPSHOT_DIR);
+    char *res = dir ? mp_path_join(p, dir, name) : NULL;
+    talloc_free(name);
+    return res;
 }
 
-// Return true if this was a readable directory.
-static bool scan_dir(struct pl_parser *p, char *path,
-                     struct stat *dir_stack, int num_dir_stack,
-                     char ***files, int *num_files)
+static bool load_dir(struct playlist_loader *l, struct playlist *pl,
+                     int max_entries)
 {
-    if (strlen(path) >= 8192 || num_dir_stack == MAX_DIR_STACK)
-        return false; // things like mount bind loops
-
-    DIR *dp = opendir(path);
-    if (!dp) {
-        MP_ERR(p, "Could not read directory.\n");
-        return false;
-    }
-
-    struct dirent *ep;
-    while ((ep = readdir(dp))) {
-        if (ep->d_name[0] == '.')
-            continue;
-
-        if (mp_cancel_test(p->s->cancel))
+    struct dir_scan *scan = l->priv;
+    // Stays attached until the scan is freed along with the loader.
+    dir_scan_set_cancel(scan, l->cancel);
+    struct playlist_strings *strings = playlist_strings_new();
+    bool more = true;
+    for (int n = 0; n < max_entries; n++) {
+        const char *file = dir_scan_next(scan);
+        if (!file) {
+            more = false;
             break;
-
-        char *file = mp_path_join(p, path, ep->d_name);
-
-        struct stat st;
-        if (stat(file, &st) == 0 && S_ISDIR(st.st_mode)) {
-            for (int n = 0; n < num_dir_stack; n++) {
-                if (same_st(&dir_stack[n], &st)) {
-                    MP_VERBOSE(p, "Skip recursive entry: %s\n", file);
-                    goto skip;
-                }
-            }
-
-            dir_stack[num_dir_stack] = st;
-            scan_dir(p, file, dir_stack, num_dir_stack + 1, files, num_files);
-        } else {
-            MP_TARRAY_APPEND(p, *files, *num_files, file);
         }
-
-        skip: ;
+        playlist_add(pl, playlist_entry_new_shared(strings, bstr0(file)));
     }
-
-    closedir(dp);
-    return true;
-}
-
-static int cmp_filename(const void *a, const void *b)
-{
-    return strcmp(*(char **)a, *(char **)b);
+    playlist_strings_unref(strings);
+    return more;
 }
 
 static int parse_dir(struct pl_parser *p)
@@ -298,21 +354,30 @@ static int parse_dir(struct pl_parser *p)
     if (!path)
         return -1;
 
-    char **files = NULL;
-    int num_files = 0;
-    struct stat dir_stack[MAX_DIR_STACK];
-
-    scan_dir(p, path, dir_stack, 0, &files, &num_files);
-
-    if (files)
-        qsort(files, num_files, sizeof(files[0]), cmp_filename);
-
-    for (int n = 0; n < num_files; n++)
-        playlist_add_file(p->pl, files[n]);
+    // Subdirectories are scanned in the background. Wait only for the first
+    // file, and let the loader add the others as they become available.
+    struct mpv_global *global = p->real_stream->global;
+    struct dir_scan *scan =
+        dir_scan_create(NULL, p->log, global->thread_pool, path,
+                        get_dir_snapshot_file(p, path));
+    dir_scan_set_cancel(scan, p->real_stream->cancel);
+    const char *file = dir_scan_next(scan);
+    // The demuxer's cancel goes away with it; load_dir() sets the loader's.
+    dir_scan_set_cancel(scan, NULL);
 
     p->add_base = false;
 
-    return num_files > 0 ? 0 : -1;
+    if (!file) {
+        talloc_free(scan);
+        return -1;
+    }
+    playlist_add_file(p->pl, file);
+
+    struct playlist_loader *l = talloc_zero(p->pl, struct playlist_loader);
+    l->load = load_dir;
+    l->priv = talloc_steal(l, scan);
+    p->pl->loader = l;
+    return 0;
 }
 
 #define MIME_TYPES(...) \
@@ -352,6 +417,76 @@ static const struct pl_format *probe_pl(struct pl_parser *p)
     return NULL;
 }
 
+static void parser_destroy(void *ptr)
+{
+    struct pl_parser *p = ptr;
+    if (p->owns_stream)
+        free_stream(p->s);
+}
+
+static bool load_more(struct playlist_loader *l, struct playlist *pl,
+                      int max_entries)
+{
+    struct pl_parser *p = l->priv;
+    if (!p->s) {
+        // Uses the loader's cancel for the whole time the stream is open, so
+        // slow I/O can be aborted at any point.
+        p->s = stream_create(p->url, STREAM_READ | p->stream_flags, l->cancel,
+                             p->global);
+        if (!p->s)
+            return false;
+        p->owns_stream = true;
+        if (!stream_seek(p->s, p->pos)) {
+            MP_ERR(p, "Could not seek to the rest of the playlist.\n");
+            p->error = true;
+        }
+    }
+    p->pl = talloc_zero(NULL, struct playlist);
+    p->strings = playlist_strings_new();
+    p->max_entries = max_entries;
+    pl_parse_lines(p);
+    playlist_strings_unref(p->strings);
+    p->strings = NULL;
+    if (p->add_base)
+        playlist_add_base_path(p->pl, bstr0(p->base_path));
+    playlist_append_entries(pl, p->pl);
+    TA_FREEP(&p->pl);
+    return p->suspended;
+}
+
+// Called after the first entry was parsed, and there is more. Parse the rest
+// now if it's small or can't be read again, otherwise add a loader, which
+// reopens the file and continues at the current position.
+static void continue_parsing(struct demuxer *demuxer, struct pl_parser *p)
+{
+    struct stream *s = p->s;
+    int64_t pos = stream_tell(s);
+    int64_t size = stream_get_size(s);
+    if (!s->seekable || (size >= 0 && size - pos < LAZY_MIN_SIZE)) {
+        p->max_entries = INT_MAX;
+        pl_parse_lines(p);
+        return;
+    }
+
+    MP_VERBOSE(p, "Loading the rest of the playlist on demand.\n");
+    // The demuxer and its stream are gone when the loader runs.
+    p->log = mp_log_new(p, p->log, NULL);
+    p->global = s->global;
+    p->url = talloc_strdup(p, s->url);
+    p->stream_flags = demuxer->params ? demuxer->params->stream_flags : 0;
+    p->pos = pos;
+    p->s = NULL;
+    p->real_stream = NULL;
+    talloc_set_destructor(p, parser_destroy);
+    if (p->add_base)
+        p->base_path = bstrto0(p, mp_dirname(demuxer->filename));
+
+    struct playlist_loader *l = talloc_zero(p->pl, struct playlist_loader);
+    l->load = load_more;
+    l->priv = p;
+    p->pl->loader = l;
+}
+
 static int open_file(struct demuxer *demuxer, enum demux_check check)
 {
     if (!demuxer->access_references)
@@ -361,9 +496,10 @@ static int open_file(struct demuxer *demuxer, enum demux_check check)
 
     struct pl_parser *p = talloc_zero(NULL, struct pl_parser);
     p->log = demuxer->log;
-    p->pl = talloc_zero(p, struct playlist);
+    p->pl = talloc_zero(NULL, struct playlist);
     p->real_stream = demuxer->stream;
     p->add_base = true;
+    p->strings = playlist_strings_new();
 
     bstr probe_buf = stream_peek(demuxer->stream, PROBE_SIZE);
     p->s = open_memory_stream(probe_buf.start, probe_buf.len);
@@ -376,21 +512,38 @@ static int open_file(struct demuxer *demuxer, enum demux_check check)
     free_stream(p->s);
     playlist_clear(p->pl);
     if (!fmt) {
+        playlist_strings_unref(p->strings);
+        talloc_free(p->pl);
         talloc_free(p);
         return -1;
     }
 
     p->probing = false;
     p->error = false;
+    p->suspended = false;
     p->s = demuxer->stream;
     p->utf16 = stream_skip_bom(p->s);
+    // Start with the first entry only, so the player can start playing it.
+    p->max_entries = 1;
     bool ok = fmt->parse(p) >= 0 && !p->error;
+    if (ok && p->suspended) {
+        continue_parsing(demuxer, p);
+        ok = !p->error;
+    }
+    playlist_strings_unref(p->strings);
+    p->strings = NULL;
     if (p->add_base)
         playlist_add_base_path(p->pl, mp_dirname(demuxer->filename));
     demuxer->playlist = talloc_steal(demuxer, p->pl);
     demuxer->filetype = p->format ? p->format : fmt->name;
     demuxer->fully_read = true;
-    talloc_free(p);
+    if (p->pl->loader) {
+        // Owned by the loader now.
+        talloc_steal(p->pl->loader, p);
+        p->pl = NULL;
+    } else {
+        talloc_free(p);
+    }
     return ok ? 0 : -1;
 }
 
@@ -17,12 +17,15 @@
 
 #include "config.h"
 
+#include <limits.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 
 #include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
 #include <libavutil/common.h>
 
 #include "common/av_common.h"
@@ -41,8 +44,14 @@ struct demux_rawaudio_opts {
     struct m_channels channels;
     int samplerate;
     int aformat;
+    double packet_duration;
 };
 
+// Duration of the first packet after opening or seeking. Packets then grow up
+// to --demuxer-rawaudio-packet-duration, so that playback can start quickly,
+// while readahead uses few large packets.
+#define MIN_PACKET_DURATION 0.01
+
 // Ad-hoc schema to systematically encode the format as int
 #define PCM(sign, is_float, bits, is_be) \
     ((sign) | ((is_float) << 1) | ((is_be) << 2) | ((bits) << 3))
@@ -72,6 +81,8 @@ const struct m_sub_options demux_rawaudio_conf = {
                     {"s32",     PCM(1, 0, 32, NE)},
                     {"float",   PCM(0, 1, 32, NE)},
                     {"double",  PCM(0, 1, 64, NE)})),
+        OPT_DOUBLE("packet-duration", packet_duration, M_OPT_RANGE,
+                   .min = 0.001, .max = 10),
         {0}
     },
     .size = sizeof(struct demux_rawaudio_opts),
@@ -84,6 +95,7 @@ const struct m_sub_options demux_rawaudio_conf = {
         },
         .samplerate = 44100,
         .aformat = PCM(1, 0, 16, 0), // s16le
+        .packet_duration = 0.125,
     },
 };
 
@@ -94,6 +106,7 @@ struct priv {
     struct sh_stream *sh;
     int frame_size;
     int read_frames;
+    int min_read_frames, max_read_frames;
     double frame_rate;
 };
 
@@ -138,38 +151,76 @@ static int demux_rawaudio_open(demuxer_t *demuxer, enum demux_check check)
 
     demux_add_sh_stream(demuxer, sh);
 
+    int frame_size = samplesize * c->channels.num;
+    int max_frames = MPMAX(lrint(c->samplerate * opts->packet_duration), 1);
+    max_frames = MPMIN(max_frames, INT_MAX / 2 / frame_size);
+    int min_frames = lrint(c->samplerate * MIN_PACKET_DURATION);
+    min_frames = MPCLAMP(min_frames, 1, max_frames);
+
     struct priv *p = talloc_ptrtype(demuxer, p);
     demuxer->priv = p;
     *p = (struct priv) {
         .sh = sh,
-        .frame_size = samplesize * c->channels.num,
+        .frame_size = frame_size,
         .frame_rate = c->samplerate,
-        .read_frames = c->samplerate / 8,
+        .read_frames = min_frames,
+        .min_read_frames = min_frames,
+        .max_read_frames = max_frames,
     };
 
     return generic_open(demuxer);
 }
 
+// Create a packet referencing the stream's memory (memory:// streams), instead
+// of copying the data. Return NULL if unsupported.
+static struct demux_packet *read_packet_ref(stream_t *s, int len, bool *eof)
+{
+    int64_t pos = stream_tell(s);
+    struct stream_data_ref ref = {.pos = pos, .len = len};
+    if (stream_control(s, STREAM_CTRL_GET_DATA_REF, &ref) != STREAM_OK)
+        return NULL;
+    struct demux_packet *dp = NULL;
+    if (ref.len) {
+        dp = new_demux_packet_from_buf(ref.buf);
+        if (dp)
+            stream_seek(s, pos + ref.len);
+    } else {
+        *eof = true;
+    }
+    av_buffer_unref(&ref.buf);
+    return dp;
+}
+
 static int raw_fill_buffer(demuxer_t *demuxer)
 {
     struct priv *p = demuxer->priv;
+    stream_t *s = demuxer->stream;
 
-    if (demuxer->stream->eof)
+    if (s->eof)
         return 0;
 
-    struct demux_packet *dp = new_demux_packet(p->frame_size * p->read_frames);
+    int64_t pos = stream_tell(s);
+    int len = p->frame_size * p->read_frames;
+    bool eof = false;
+    struct demux_packet *dp = read_packet_ref(s, len, &eof);
+    if (eof)
+        return 0;
     if (!dp) {
-        MP_ERR(demuxer, "Can't read packet.\n");
-        return 1;
+        dp = new_demux_packet(len);
+        if (!dp) {
+            MP_ERR(demuxer, "Can't read packet.\n");
+            return 1;
+        }
+        len = stream_read(s, dp->buffer, dp->len);
+        demux_packet_shorten(dp, len);
     }
 
-    dp->pos = stream_tell(demuxer->stream);
+    dp->pos = pos;
     dp->pts = (dp->pos  / p->frame_size) / p->frame_rate;
-
-    int len = stream_read(demuxer->stream, dp->buffer, dp->len);
-    demux_packet_shorten(dp, len);
     demux_add_packet(p->sh, dp);
 
+    p->read_frames = MPMIN(p->read_frames * 2, p->max_read_frames);
+
     return 1;
 }
 
@@ -187,6 +238,7 @@ static void raw_seek(demuxer_t *demuxer, double seek_pts, int flags)
     if (end && pos > end)
         pos = end;
     stream_seek(s, (pos / p->frame_size) * p->frame_size);
+    p->read_frames = p->min_read_frames;
 }
 
 const demuxer_desc_t demuxer_desc_rawaudio = {
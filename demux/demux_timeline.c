@@ -17,15 +17,39 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "common/common.h"
 #include "common/msg.h"
+#include "options/m_config.h"
+#include "options/m_option.h"
+#include "osdep/threads.h"
 
 #include "demux.h"
 #include "timeline.h"
 #include "stheader.h"
 #include "stream/stream.h"
 
+struct demux_timeline_opts {
+    double lookahead;
+    int max_open;
+};
+
+#define OPT_BASE_STRUCT struct demux_timeline_opts
+const struct m_sub_options demux_timeline_conf = {
+    .opts = (const struct m_option[]) {
+        OPT_DOUBLE("demuxer-timeline-lookahead", lookahead, M_OPT_MIN, .min = 0),
+        OPT_INTRANGE("demuxer-timeline-max-open", max_open, 0, 1, INT_MAX),
+        {0}
+    },
+    .size = sizeof(struct demux_timeline_opts),
+    .defaults = &(const struct demux_timeline_opts){
+        .lookahead = 10.0,
+        .max_open = 3,
+    },
+};
+#undef OPT_BASE_STRUCT
+
 struct segment {
     int index;
     double start, end;
@@ -39,6 +63,12 @@ struct segment {
     // Uses -1 for streams that do not appear in the virtual timeline.
     int *stream_map;
     int num_stream_map;
+    // Set by the preload thread once it has opened d, and seeked it to the
+    // segment start. preload_tried is also set if opening failed, so that it
+    // is not retried. Both are reset when the segment is closed or becomes
+    // current.
+    bool preloaded;
+    bool preload_tried;
 };
 
 // Information for each stream on the virtual timeline. (Mirrors streams
@@ -66,6 +96,19 @@ struct priv {
     // Total number of packets received past end of segment. Used
     // to be clever about determining when to switch segments.
     int eos_packets;
+
+    struct demux_timeline_opts *opts;
+
+    // Opens lazy segments ahead of time. Only exists if there are any.
+    pthread_t preload_thread;
+    bool has_preload_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // -- protected by lock
+    // Segment being opened by the preload thread. The thread owns its d and
+    // stream_map fields until it resets this to NULL.
+    struct segment *preload_seg;
+    bool preload_terminate;
 };
 
 static bool target_stream_used(struct segment *seg, int target_index)
@@ -112,10 +155,26 @@ static void associate_streams(struct demuxer *demuxer, struct segment *seg)
     }
 }
 
+// Wait until the preload thread is done with its current segment.
+static void preload_wait(struct demuxer *demuxer)
+{
+    struct priv *p = demuxer->priv;
+
+    if (!p->has_preload_thread)
+        return;
+
+    pthread_mutex_lock(&p->lock);
+    while (p->preload_seg)
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
 static void reselect_streams(struct demuxer *demuxer)
 {
     struct priv *p = demuxer->priv;
 
+    preload_wait(demuxer);
+
     for (int n = 0; n < p->num_streams; n++) {
         struct virtual_stream *vs = p->streams[n];
         vs->selected = demux_stream_is_selected(vs->sh);
@@ -131,8 +190,10 @@ static void reselect_streams(struct demuxer *demuxer)
             bool selected = false;
             if (seg->stream_map[i] >= 0)
                 selected = p->streams[seg->stream_map[i]]->selected;
-            // This stops demuxer readahead for inactive segments.
-            if (!p->current || seg->d != p->current->d)
+            // This stops demuxer readahead for inactive segments. Preloaded
+            // segments keep their selection, so that switching to them
+            // doesn't need a refresh seek.
+            if (!p->current || (seg->d != p->current->d && !seg->preloaded))
                 selected = false;
             demuxer_select_track(seg->d, sh, MP_NOPTS_VALUE, selected);
         }
@@ -149,10 +210,31 @@ static void close_lazy_segments(struct demuxer *demuxer)
         if (seg != p->current && seg->d && seg->lazy) {
             demux_free(seg->d);
             seg->d = NULL;
+            seg->preloaded = false;
+            seg->preload_tried = false;
         }
     }
 }
 
+// Open a lazy segment. Called by both the demuxer and the preload thread.
+static struct demuxer *open_segment(struct demuxer *demuxer,
+                                    struct segment *seg)
+{
+    struct priv *p = demuxer->priv;
+
+    struct demuxer_params params = {
+        .init_fragment = p->tl->init_fragment,
+        .skip_lavf_probing = p->dash,
+    };
+    struct demuxer *d = demux_open_url(seg->url, &params, demuxer->cancel,
+                                       demuxer->global);
+    if (!d && !demux_cancel_test(demuxer))
+        MP_ERR(demuxer, "failed to load segment\n");
+    if (d)
+        demux_disable_cache(d);
+    return d;
+}
+
 static void reopen_lazy_segments(struct demuxer *demuxer)
 {
     struct priv *p = demuxer->priv;
@@ -162,19 +244,108 @@ static void reopen_lazy_segments(struct demuxer *demuxer)
 
     close_lazy_segments(demuxer);
 
-    struct demuxer_params params = {
-        .init_fragment = p->tl->init_fragment,
-        .skip_lavf_probing = true,
-    };
-    p->current->d = demux_open_url(p->current->url, &params,
-                                   demuxer->cancel, demuxer->global);
-    if (!p->current->d && !demux_cancel_test(demuxer))
-        MP_ERR(demuxer, "failed to load segment\n");
-    if (p->current->d)
-        demux_disable_cache(p->current->d);
+    p->current->d = open_segment(demuxer, p->current);
     associate_streams(demuxer, p->current);
 }
 
+static void *preload_thread(void *arg)
+{
+    struct demuxer *demuxer = arg;
+    struct priv *p = demuxer->priv;
+
+    mpthread_set_name("timeline-preload");
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->preload_terminate) {
+        struct segment *seg = p->preload_seg;
+        if (!seg) {
+            pthread_cond_wait(&p->wakeup, &p->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        MP_VERBOSE(demuxer, "preload segment %d\n", seg->index);
+
+        seg->d = open_segment(demuxer, seg);
+        if (seg->d) {
+            associate_streams(demuxer, seg);
+            // Select before seeking, as selecting later would seek again.
+            for (int i = 0; i < seg->num_stream_map; i++) {
+                int vs = seg->stream_map[i];
+                bool selected =
+                    vs >= 0 && demux_stream_is_selected(p->streams[vs]->sh);
+                demuxer_select_track(seg->d, demux_get_stream(seg->d, i),
+                                     MP_NOPTS_VALUE, selected);
+            }
+            // Same as switch_segment() does when reaching the segment.
+            if (!p->dash) {
+                demux_set_ts_offset(seg->d, seg->start - seg->d_start);
+                demux_seek(seg->d, seg->start, SEEK_HR);
+            }
+        }
+        // If opening failed, switch_segment() must not skip its seek.
+        seg->preloaded = !!seg->d;
+        seg->preload_tried = true;
+
+        pthread_mutex_lock(&p->lock);
+        p->preload_seg = NULL;
+        pthread_cond_broadcast(&p->wakeup);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Close lazy segments outside of the lookahead window, and start opening the
+// next one inside of it. pts is the current demuxing position.
+static void update_preload(struct demuxer *demuxer, double pts)
+{
+    struct priv *p = demuxer->priv;
+
+    if (!p->has_preload_thread || !p->current)
+        return;
+
+    pthread_mutex_lock(&p->lock);
+    bool busy = p->preload_seg;
+    pthread_mutex_unlock(&p->lock);
+    if (busy)
+        return;
+
+    if (pts == MP_NOPTS_VALUE)
+        pts = p->current->start;
+    double limit = pts + p->opts->lookahead;
+
+    struct segment *next = NULL;
+    int num_open = 0;
+    for (int n = 0; n < p->num_segments; n++) {
+        struct segment *seg = p->segments[n];
+        if (!seg->lazy)
+            continue;
+        bool wanted = seg == p->current ||
+                      (seg->index > p->current->index && seg->start < limit);
+        if (!wanted) {
+            if (seg->d) {
+                MP_VERBOSE(demuxer, "close segment %d\n", seg->index);
+                demux_free(seg->d);
+                seg->d = NULL;
+            }
+            seg->preloaded = false;
+            seg->preload_tried = false;
+        }
+        if (seg->d)
+            num_open += 1;
+        if (wanted && !next && seg != p->current && !seg->d &&
+            !seg->preload_tried)
+            next = seg;
+    }
+
+    if (next && num_open < p->opts->max_open) {
+        pthread_mutex_lock(&p->lock);
+        p->preload_seg = next;
+        pthread_cond_broadcast(&p->wakeup);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
 static void switch_segment(struct demuxer *demuxer, struct segment *new,
                            double start_pts, int flags, bool init)
 {
@@ -185,6 +356,13 @@ static void switch_segment(struct demuxer *demuxer, struct segment *new,
 
     MP_VERBOSE(demuxer, "switch to segment %d\n", new->index);
 
+    preload_wait(demuxer);
+
+    // The preload thread already seeked to the segment start.
+    bool preseeked = new->preloaded && init && start_pts == new->start;
+    new->preloaded = false;
+    new->preload_tried = false;
+
     p->current = new;
     reopen_lazy_segments(demuxer);
     if (!new->d)
@@ -192,7 +370,7 @@ static void switch_segment(struct demuxer *demuxer, struct segment *new,
     reselect_streams(demuxer);
     if (!p->dash)
         demux_set_ts_offset(new->d, new->start - new->d_start);
-    if (!p->dash || !init)
+    if ((!p->dash || !init) && !preseeked)
         demux_seek(new->d, start_pts, flags);
 
     for (int n = 0; n < p->num_streams; n++) {
@@ -201,6 +379,8 @@ static void switch_segment(struct demuxer *demuxer, struct segment *new,
     }
 
     p->eos_packets = 0;
+
+    update_preload(demuxer, start_pts);
 }
 
 static void d_seek(struct demuxer *demuxer, double seek_pts, int flags)
@@ -237,6 +417,9 @@ static int d_fill_buffer(struct demuxer *demuxer)
     if (!pkt || pkt->pts >= seg->end)
         p->eos_packets += 1;
 
+    if (pkt)
+        update_preload(demuxer, pkt->pts);
+
     // Test for EOF. Do this here to properly run into EOF even if other
     // streams are disabled etc. If it somehow doesn't manage to reach the end
     // after demuxing a high (bit arbitrary) number of packets, assume one of
@@ -421,6 +604,22 @@ static int d_open(struct demuxer *demuxer, enum demux_check check)
 
     reselect_streams(demuxer);
 
+    p->opts = mp_get_config_group(p, demuxer->global, &demux_timeline_conf);
+
+    bool any_lazy = false;
+    for (int n = 0; n < p->num_segments; n++)
+        any_lazy |= p->segments[n]->lazy;
+    if (any_lazy && p->opts->lookahead > 0 && p->opts->max_open > 1) {
+        pthread_mutex_init(&p->lock, NULL);
+        pthread_cond_init(&p->wakeup, NULL);
+        p->has_preload_thread =
+            !pthread_create(&p->preload_thread, NULL, preload_thread, demuxer);
+        if (!p->has_preload_thread) {
+            pthread_cond_destroy(&p->wakeup);
+            pthread_mutex_destroy(&p->lock);
+        }
+    }
+
     return 0;
 }
 
@@ -428,6 +627,15 @@ static void d_close(struct demuxer *demuxer)
 {
     struct priv *p = demuxer->priv;
     struct demuxer *master = p->tl->demuxer;
+    if (p->has_preload_thread) {
+        pthread_mutex_lock(&p->lock);
+        p->preload_terminate = true;
+        pthread_cond_broadcast(&p->wakeup);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->preload_thread, NULL);
+        pthread_cond_destroy(&p->wakeup);
+        pthread_mutex_destroy(&p->lock);
+    }
     p->current = NULL;
     close_lazy_segments(demuxer);
     timeline_destroy(p->tl);
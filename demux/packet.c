@@ -27,6 +27,7 @@
 
 #include "common/av_common.h"
 #include "common/common.h"
+#include "common/perf_counters.h"
 #include "demux.h"
 
 #include "packet.h"
@@ -36,6 +37,7 @@ static void packet_destroy(void *ptr)
     struct demux_packet *dp = ptr;
     av_packet_unref(dp->avpacket);
     mp_packet_tags_unref(dp->metadata);
+    mp_perf_inc(MP_PERF_PACKETS_FREED);
 }
 
 // This actually preserves only data and side data, not PTS/DTS/pos/etc.
@@ -47,6 +49,7 @@ struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt)
         return NULL;
     struct demux_packet *dp = talloc(NULL, struct demux_packet);
     talloc_set_destructor(dp, packet_destroy);
+    mp_perf_inc(MP_PERF_PACKETS_ALLOCATED);
     *dp = (struct demux_packet) {
         .pts = MP_NOPTS_VALUE,
         .dts = MP_NOPTS_VALUE,
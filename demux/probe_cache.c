@@ -0,0 +1,245 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <libavutil/md5.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "misc/bstr.h"
+#include "options/path.h"
+#include "osdep/atomic.h"
+#include "osdep/io.h"
+#include "stream/stream.h"
+
+#include "probe_cache.h"
+
+#define PROBE_CACHE_DIR "probe_cache"
+#define PROBE_CACHE_HEADER "mpa-probe-cache 1"
+#define MAX_ENTRY_SIZE (1024 * 1024)
+// Least recently used entries beyond this number are removed.
+#define MAX_ENTRIES 2000
+// Entries not used for this long (in seconds) are removed.
+#define MAX_ENTRY_AGE (90 * 24 * 60 * 60)
+// Check the limits on the first store, and then after every this many.
+#define TRIM_INTERVAL 64
+
+static atomic_int num_stores;
+
+char *probe_cache_get_key(void *ta_parent, struct stream *s)
+{
+    if (!s->is_local_file)
+        return NULL;
+    char *path = mp_file_get_path(NULL, bstr0(s->url));
+    struct stat st;
+    char *key = NULL;
+    // (The key is stored on a line of its own.)
+    if (path && !strchr(path, '\n') && stat(path, &st) == 0) {
+        key = talloc_asprintf(ta_parent, "%s %"PRId64" %"PRId64, path,
+                              (int64_t)st.st_size, (int64_t)st.st_mtime);
+    }
+    talloc_free(path);
+    return key;
+}
+
+// The path part of the key (without size and mtime).
+static bstr get_key_path(bstr key)
+{
+    for (int n = 0; n < 2; n++) {
+        int pos = bstrrchr(key, ' ');
+        if (pos >= 0)
+            key = bstr_splice(key, 0, pos);
+    }
+    return key;
+}
+
+// The entry file depends on the path only, so that an entry for an old
+// version of the file is replaced, instead of staying around forever.
+static char *get_entry_file(void *ta_parent, struct mpv_global *global,
+                            const char *key)
+{
+    bstr path = get_key_path(bstr0(key));
+    uint8_t md5[16];
+    av_md5_sum(md5, path.start, path.len);
+    char *name = talloc_strdup(NULL, "");
+    for (int n = 0; n < 16; n++)
+        name = talloc_asprintf_append(name, "%02X", md5[n]);
+
+    char *dir = mp_find_user_config_file(name, global, PROBE_CACHE_DIR);
+    char *res = dir ? mp_path_join(ta_parent, dir, name) : NULL;
+    talloc_free(name);
+    return res;
+}
+
+static bool read_field(bstr *data, const char *name, bstr *out)
+{
+    bstr line = bstr_strip_linebreaks(bstr_getline(*data, data));
+    if (!bstr_eatstart0(&line, name) || !bstr_eatstart0(&line, "="))
+        return false;
+    *out = line;
+    return true;
+}
+
+struct probe_cache_entry *probe_cache_lookup(void *ta_parent,
+                                             struct mpv_global *global,
+                                             struct mp_log *log,
+                                             const char *key)
+{
+    void *tmp = talloc_new(NULL);
+    struct probe_cache_entry *e = NULL;
+
+    char *file = get_entry_file(tmp, global, key);
+    if (!file || !mp_path_exists(file))
+        goto done;
+    bstr data = stream_read_file(file, tmp, global, MAX_ENTRY_SIZE);
+    bstr header = bstr_strip_linebreaks(bstr_getline(data, &data));
+    bstr f_key, f_demuxer, f_format;
+    if (!bstr_equals0(header, PROBE_CACHE_HEADER) ||
+        !read_field(&data, "key", &f_key) ||
+        !read_field(&data, "demuxer", &f_demuxer) ||
+        !read_field(&data, "format", &f_format) ||
+        !f_demuxer.len)
+    {
+        mp_warn(log, "Ignoring invalid probe cache entry %s.\n", file);
+        goto done;
+    }
+    if (!bstr_equals0(f_key, key)) {
+        // The file was changed since it was cached (or it's a different path
+        // with the same hash).
+        if (bstr_equals(get_key_path(f_key), get_key_path(bstr0(key)))) {
+            mp_verbose(log, "Removing outdated probe cache entry %s.\n", file);
+            unlink(file);
+        }
+        goto done;
+    }
+
+    // The mtime of the entry is its last use, see trim_cache().
+    utime(file, NULL);
+
+    e = talloc_zero(ta_parent, struct probe_cache_entry);
+    e->demuxer = bstrto0(e, f_demuxer);
+    e->format = f_format.len ? bstrto0(e, f_format) : NULL;
+    e->data = data.len ? bstrto0(e, data) : NULL;
+    mp_verbose(log, "Using probe cache entry %s.\n", file);
+
+done:
+    talloc_free(tmp);
+    return e;
+}
+
+struct cache_file {
+    char *path;
+    int64_t mtime;
+};
+
+static int cmp_mtime(const void *a, const void *b)
+{
+    const struct cache_file *f1 = a, *f2 = b;
+    return f1->mtime < f2->mtime ? -1 : f1->mtime > f2->mtime;
+}
+
+// Remove entries that were not used for a long time, and the least recently
+// used ones if there are too many.
+static void trim_cache(struct mpv_global *global, struct mp_log *log)
+{
+    void *tmp = talloc_new(NULL);
+    char *dir = mp_find_user_config_file(tmp, global, PROBE_CACHE_DIR);
+    DIR *d = dir ? opendir(dir) : NULL;
+    if (!d)
+        goto done;
+
+    struct cache_file *files = NULL;
+    int num_files = 0, removed = 0;
+    int64_t now = time(NULL);
+    struct dirent *ep;
+    while ((ep = readdir(d))) {
+        // Entry files are named with 32 hex digits; skips temporary files.
+        if (strlen(ep->d_name) != 32)
+            continue;
+        char *path = mp_path_join(tmp, dir, ep->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0)
+            continue;
+        if (now - (int64_t)st.st_mtime > MAX_ENTRY_AGE) {
+            removed += unlink(path) == 0;
+            continue;
+        }
+        struct cache_file f = {path, st.st_mtime};
+        MP_TARRAY_APPEND(tmp, files, num_files, f);
+    }
+    closedir(d);
+
+    if (num_files > MAX_ENTRIES) {
+        qsort(files, num_files, sizeof(files[0]), cmp_mtime);
+        for (int n = 0; n < num_files - MAX_ENTRIES; n++)
+            removed += unlink(files[n].path) == 0;
+    }
+
+    if (removed)
+        mp_verbose(log, "Removed %d old probe cache entries.\n", removed);
+
+done:
+    talloc_free(tmp);
+}
+
+void probe_cache_store(struct mpv_global *global, struct mp_log *log,
+                       const char *key, struct probe_cache_entry *e)
+{
+    void *tmp = talloc_new(NULL);
+
+    char *file = get_entry_file(tmp, global, key);
+    if (!file)
+        goto done;
+    if (!e) {
+        unlink(file);
+        goto done;
+    }
+
+    mp_mk_config_dir(global, PROBE_CACHE_DIR);
+    char *data = talloc_asprintf(tmp, PROBE_CACHE_HEADER "\nkey=%s\n"
+                                 "demuxer=%s\nformat=%s\n%s", key, e->demuxer,
+                                 e->format ? e->format : "",
+                                 e->data ? e->data : "");
+
+    // Replace the old entry atomically, so readers never see partial data.
+    char *tmp_file = talloc_asprintf(tmp, "%s.%p.tmp", file, (void *)tmp);
+    FILE *f = fopen(tmp_file, "wb");
+    bool ok = f && fwrite(data, strlen(data), 1, f) == 1;
+    if (f)
+        ok = fclose(f) == 0 && ok;
+    if (ok && rename(tmp_file, file) == 0) {
+        mp_verbose(log, "Wrote probe cache entry %s.\n", file);
+        if (atomic_fetch_add(&num_stores, 1) % TRIM_INTERVAL == 0)
+            trim_cache(global, log);
+    } else {
+        mp_warn(log, "Could not write probe cache entry %s.\n", file);
+        if (f)
+            unlink(tmp_file);
+    }
+
+done:
+    talloc_free(tmp);
+}
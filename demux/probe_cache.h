@@ -0,0 +1,48 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MP_PROBE_CACHE_H_
+#define MP_PROBE_CACHE_H_
+
+struct mpv_global;
+struct mp_log;
+struct stream;
+
+// Result of probing a file, stored in the config directory.
+struct probe_cache_entry {
+    char *demuxer;      // demuxer_desc.name
+    char *format;       // demuxer.filetype (can be NULL)
+    char *data;         // private data of the demuxer (can be NULL)
+};
+
+// Return the key identifying the contents of the stream (the path, size and
+// mtime of local files), or NULL if the stream can't be cached.
+char *probe_cache_get_key(void *ta_parent, struct stream *s);
+
+// Return the entry for the key, or NULL if there is none. If there's an entry
+// for an older version of the same file, it's removed.
+struct probe_cache_entry *probe_cache_lookup(void *ta_parent,
+                                             struct mpv_global *global,
+                                             struct mp_log *log,
+                                             const char *key);
+
+// Replace the entry for the key. e==NULL removes it. Storing an entry also
+// evicts the least recently used entries beyond a fixed limit.
+void probe_cache_store(struct mpv_global *global, struct mp_log *log,
+                       const char *key, struct probe_cache_entry *e);
+
+#endif
@@ -1,5 +1,6 @@
 #include <math.h>
 
+#include "audio/out/ao.h"
 #include "common/common.h"
 #include "common/msg.h"
 #include "options/m_config.h"
@@ -14,6 +15,8 @@
 struct aspeed_priv {
     struct mp_subfilter sub;
     double cur_speed;
+    struct m_config_cache *opt_cache;
+    bool low_latency;   // --audio-low-latency the current sub.filter uses
 };
 
 static void aspeed_process(struct mp_filter *f)
@@ -23,15 +26,27 @@ static void aspeed_process(struct mp_filter *f)
     if (!mp_subfilter_read(&p->sub))
         return;
 
-    if (fabs(p->cur_speed - 1.0) < 1e-8) {
+    struct ao_opts *opts = p->opt_cache->opts;
+    m_config_cache_update(p->opt_cache);
+
+    bool unity = fabs(p->cur_speed - 1.0) < 1e-8;
+
+    // Recreate scaletempo if --audio-low-latency was changed at runtime.
+    if (unity || (p->sub.filter && p->low_latency != opts->audio_low_latency)) {
         if (p->sub.filter)
             MP_VERBOSE(f, "removing scaletempo\n");
         if (!mp_subfilter_drain_destroy(&p->sub))
             return;
-    } else if (!p->sub.filter) {
+    }
+
+    if (!unity && !p->sub.filter) {
         MP_VERBOSE(f, "adding scaletempo\n");
+        p->low_latency = opts->audio_low_latency;
+        // Shorter strides keep less audio queued in the filter.
+        char *low_latency_args[] = {"stride", "20", "search", "5", NULL};
         p->sub.filter =
-            mp_create_user_filter(f, MP_OUTPUT_CHAIN_AUDIO, "scaletempo", NULL);
+            mp_create_user_filter(f, MP_OUTPUT_CHAIN_AUDIO, "scaletempo",
+                                  p->low_latency ? low_latency_args : NULL);
         if (!p->sub.filter) {
             MP_ERR(f, "could not create scaletempo filter\n");
             mp_subfilter_continue(&p->sub);
@@ -100,6 +115,7 @@ struct mp_filter *mp_autoaspeed_create(struct mp_filter *parent)
 
     struct aspeed_priv *p = f->priv;
     p->cur_speed = 1.0;
+    p->opt_cache = m_config_cache_alloc(p, f->global, &ao_conf);
 
     p->sub.in = mp_filter_add_pin(f, MP_PIN_IN, "in");
     p->sub.out = mp_filter_add_pin(f, MP_PIN_OUT, "out");
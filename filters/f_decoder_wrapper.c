@@ -35,6 +35,7 @@
 
 #include "common/codecs.h"
 #include "common/global.h"
+#include "common/tracing.h"
 
 #include "audio/aframe.h"
 #include "demux/stheader.h"
@@ -417,8 +418,13 @@ static void process(struct mp_filter *f)
 {
     struct priv *p = f->priv;
 
+    mp_tracing_begin("decoder feed_packet");
     feed_packet(p);
+    mp_tracing_end("decoder feed_packet");
+
+    mp_tracing_begin("decoder read_frame");
     read_frame(p);
+    mp_tracing_end("decoder read_frame");
 }
 
 static const struct mp_filter_info decode_wrapper_filter = {
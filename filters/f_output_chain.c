@@ -63,7 +63,7 @@ struct mp_user_filter {
 
     bool last_is_active;
 
-    int64_t last_in_pts, last_out_pts;
+    double last_in_pts, last_out_pts;
 
     bool failed;
     bool error_eof_sent;
@@ -437,6 +437,30 @@ double mp_output_get_measured_total_delay(struct mp_output_chain *c)
     return delay;
 }
 
+int mp_output_get_measured_delays(struct mp_output_chain *c, void *ta_parent,
+                                  struct mp_output_filter_delay **out)
+{
+    struct chain *p = c->f->priv;
+
+    struct mp_output_filter_delay *delays =
+        talloc_zero_array(ta_parent, struct mp_output_filter_delay,
+                          p->num_all_filters);
+
+    for (int n = 0; n < p->num_all_filters; n++) {
+        struct mp_user_filter *u = p->all_filters[n];
+
+        delays[n].name = u->name;
+        if (u->last_in_pts != MP_NOPTS_VALUE &&
+            u->last_out_pts != MP_NOPTS_VALUE)
+        {
+            delays[n].delay = u->last_in_pts - u->last_out_pts;
+        }
+    }
+
+    *out = delays;
+    return p->num_all_filters;
+}
+
 static bool compare_filter(struct m_obj_settings *a, struct m_obj_settings *b)
 {
     if (a == b || !a || !b)
@@ -72,3 +72,15 @@ void mp_output_chain_set_audio_speed(struct mp_output_chain *p,
 // due to the change.
 // Makes sense for audio only.
 double mp_output_get_measured_total_delay(struct mp_output_chain *p);
+
+struct mp_output_filter_delay {
+    const char *name;   // filter name (owned by the chain)
+    double delay;       // measured delay in seconds (0 if unknown)
+};
+
+// Per-filter version of mp_output_get_measured_total_delay(). Returns the
+// number of filters, and sets *out to an array with an entry for each of them
+// (allocated with ta_parent). Entries are in chain order, and include the
+// automatically inserted filters.
+int mp_output_get_measured_delays(struct mp_output_chain *p, void *ta_parent,
+                                  struct mp_output_filter_delay **out);
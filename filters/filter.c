@@ -3,6 +3,8 @@
 #include "common/common.h"
 #include "common/global.h"
 #include "common/msg.h"
+#include "common/perf_counters.h"
+#include "common/tracing.h"
 
 #include "filter.h"
 #include "filter_internal.h"
@@ -182,6 +184,8 @@ bool mp_filter_run(struct mp_filter *filter)
 
     r->filtering = true;
 
+    mp_tracing_begin("filter run");
+
     flush_async_notifications(r);
 
     while (r->num_pending) {
@@ -189,10 +193,17 @@ bool mp_filter_run(struct mp_filter *filter)
         r->num_pending -= 1;
         next->in->pending = false;
 
-        if (next->in->info->process)
+        if (next->in->info->process) {
+            // (filter names are static strings)
+            mp_tracing_begin(next->in->info->name);
+            mp_perf_inc(MP_PERF_FILTER_PROCESS);
             next->in->info->process(next);
+            mp_tracing_end(next->in->info->name);
+        }
     }
 
+    mp_tracing_end("filter run");
+
     r->filtering = false;
 
     bool externals = r->external_pending;
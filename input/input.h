@@ -169,13 +169,59 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
                                struct mpv_global *global);
 void mp_uninit_ipc(struct mp_ipc_ctx *ctx);
 
+// Wire protocol of an IPC connection. Connections start with JSON, and can
+// switch with the "ipc_protocol" command. The reply to that command is still
+// sent in the old protocol; everything after it, in both directions, uses the
+// new one.
+//
+// MP_IPC_PROTOCOL_MSGPACK uses the same messages as JSON, but each is encoded
+// with MessagePack, and prefixed with its length in bytes (32 bit big endian).
+enum mp_ipc_protocol {
+    MP_IPC_PROTOCOL_JSON,
+    MP_IPC_PROTOCOL_MSGPACK,
+};
+
+// Largest MessagePack frame payload accepted or sent.
+#define MP_IPC_MAX_FRAME (16 * 1024 * 1024)
+
+// Per-connection state, owned by the transport.
+struct mp_ipc_conn {
+    enum mp_ipc_protocol proto;
+    // The transport can pass file descriptors (unix domain sockets).
+    bool can_send_fds;
+    // If >= 0 after a command, the transport must send this fd along with
+    // the reply, and close it.
+    int send_fd;
+};
+
 // Serialize the given mpv_event structure to JSON. Returns an allocated string.
 struct mpv_event;
 char *mp_json_encode_event(struct mpv_event *event);
 
+// Serialize the given mpv_event structure to a MessagePack frame (including
+// the length prefix). Returns an allocation, or {0} on failure.
+bstr mp_msgpack_encode_event(struct mpv_event *event);
+
+// Encode the "events-dropped" message, which tells the client that count
+// events were not sent, because it didn't read its output fast enough.
+// Returns an allocation, or {0} on failure.
+bstr mp_ipc_encode_events_dropped(enum mp_ipc_protocol proto, int64_t count);
+
 // Given the raw IPC input buffer "buf", remove the first newline-separated
 // command, execute it and return the result (if any) as an allocated string.
 struct mpv_handle;
 char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *buf);
 
+// Execute a single command line (with or without the trailing newline), and
+// return the result (if any) as an allocated string. If conn is not NULL, the
+// command can change the connection's state.
+char *mp_ipc_execute_line(struct mpv_handle *client, void *ctx, bstr line,
+                          struct mp_ipc_conn *conn);
+
+// Execute the command in a MessagePack frame payload (without the length
+// prefix), and return the reply as frame allocated under ctx, or {0} if it
+// could not be encoded.
+bstr mp_ipc_execute_msgpack(struct mpv_handle *client, void *ctx, bstr payload,
+                            struct mp_ipc_conn *conn);
+
 #endif /* MPLAYER_INPUT_H */
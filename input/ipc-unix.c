@@ -17,6 +17,7 @@
 
 #include <pthread.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <unistd.h>
 
 #include <poll.h>
@@ -24,10 +25,15 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include "config.h"
 
+#if HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include "osdep/io.h"
 #include "osdep/threads.h"
 
@@ -41,20 +47,43 @@
 #include "options/path.h"
 #include "player/client.h"
 
-#ifndef MSG_NOSIGNAL
-#define MSG_NOSIGNAL 0
-#endif
-
-struct mp_ipc_ctx {
-    struct mp_log *log;
-    struct mp_client_api *client_api;
-    const char *path;
+// A client with this much unsent output is throttled: its commands are not
+// run until the output drops below OUTPUT_LOW_WATER.
+#define OUTPUT_HIGH_WATER (1024 * 1024)
+#define OUTPUT_LOW_WATER (256 * 1024)
+// Events are still buffered for throttled clients up to this much output.
+// Events beyond that are dropped (they still need to be read, or the client
+// would never see MPV_EVENT_SHUTDOWN), and replaced with an "events-dropped"
+// message once the output is below OUTPUT_LOW_WATER again.
+#define OUTPUT_EVENT_LIMIT (8 * 1024 * 1024)
+// Stop reading input if this much is not consumed by the command thread yet.
+#define INPUT_HIGH_WATER (1024 * 1024)
+
+#define READ_CHUNK 4096
+#define MAX_IOV 64
+#define MAX_EVENTS 64
+
+// A file descriptor watched by the event loop.
+struct ipc_watch {
+    int fd;
+    struct ipc_client *client;  // NULL for the listener and wakeup pipe
+    int events;                 // POLLIN/POLLOUT to wait for, 0 for none
+    int revents;                // result of the last wait_events()
+    bool ready;                 // in mp_ipc_ctx.ready
+    bool pollable;              // false for regular files (always readable)
+    bool registered;            // added to the epoll set
+};
 
-    pthread_t thread;
-    int death_pipe[2];
+struct ipc_output {
+    bstr data;
+    int fd;                     // sent with the first byte of data, or -1
 };
 
-struct client_arg {
+// The event loop thread does all I/O for the client, and handles its events.
+// Commands are parsed and run on a separate thread per client, so a command
+// that takes long (or waits for the core) only blocks the client that sent it.
+struct ipc_client {
+    struct mp_ipc_ctx *ctx;
     struct mp_log *log;
     struct mpv_handle *client;
 
@@ -62,187 +91,688 @@ struct client_arg {
     int client_fd;
     bool close_client_fd;
 
-    bool writable;
+    // --- event loop thread only
+    bool dead;
+    bool events_pending;        // wakeup pipe was signaled
+    struct ipc_watch sock_watch;
+    struct ipc_watch wakeup_watch;
+
+    // --- command thread only
+    struct mp_ipc_conn conn;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;      // signals the command thread
+    // --- protected by lock
+    bool has_thread;            // command thread running; it frees the client
+    bool exit;                  // client is destroyed; thread must exit
+    bool cmd_running;           // command thread is running a command
+    bool failed;                // command thread found a fatal error
+    enum mp_ipc_protocol proto; // current protocol, for encoding events
+    bool writable;              // (only changed by the event loop thread)
+    bool read_eof;
+    bool throttled;             // see OUTPUT_HIGH_WATER
+    int64_t dropped_events;     // see OUTPUT_EVENT_LIMIT
+
+    // Received data. Bytes before read_pos were consumed already, and there
+    // is no complete command between read_pos and scan_pos (a newline with
+    // JSON, a whole frame with MessagePack).
+    char *rbuf;
+    size_t rbuf_len, rbuf_size;
+    size_t read_pos, scan_pos;
+
+    // Output waiting to be written. out[0] is partially written up to out_pos.
+    struct ipc_output *out;
+    int num_out;
+    size_t out_pos;
+    size_t out_bytes;
 };
 
-static int ipc_write_str(struct client_arg *client, const char *buf)
+struct mp_ipc_ctx {
+    struct mp_log *log;
+    struct mp_client_api *client_api;
+    const char *path;
+
+    pthread_t thread;
+    int wakeup_pipe[2];         // wakes up the event loop
+    char *input_file;
+
+    int ipc_fd;
+    int client_num;
+    struct ipc_watch listen_watch;
+    struct ipc_watch wakeup_watch;
+
+    // Event loop thread only.
+    struct ipc_client **clients;
+    int num_clients;
+    struct ipc_watch **ready;
+    int num_ready;
+    int num_always_ready;       // watches with !pollable waiting for input
+#if HAVE_EPOLL
+    int epoll_fd;
+#else
+    struct pollfd *fds;
+    struct ipc_watch **fd_watches;
+#endif
+
+    pthread_mutex_t lock;
+    // --- protected by lock
+    bool terminate;             // mp_uninit_ipc() was called
+    bool detached;              // thread frees the context on exit
+    int num_live_clients;       // clients whose mpv_handle is not destroyed
+};
+
+static void set_ready(struct mp_ipc_ctx *ctx, struct ipc_watch *w, int revents)
+{
+    w->revents |= revents;
+    if (!w->ready) {
+        w->ready = true;
+        MP_TARRAY_APPEND(ctx, ctx->ready, ctx->num_ready, w);
+    }
+}
+
+// Set the events to wait for.
+static void update_watch(struct mp_ipc_ctx *ctx, struct ipc_watch *w,
+                         int events)
 {
-    size_t count = strlen(buf);
-    while (count > 0) {
-        ssize_t rc = send(client->client_fd, buf, count, MSG_NOSIGNAL);
-        if (rc <= 0) {
-            if (rc == 0)
-                return -1;
+    if (!w->pollable) {
+        if ((w->events & POLLIN) != (events & POLLIN))
+            ctx->num_always_ready += (events & POLLIN) ? 1 : -1;
+        w->events = events;
+        return;
+    }
 
-            if (errno == EBADF || errno == ENOTSOCK) {
-                client->writable = false;
-                return 0;
-            }
+#if HAVE_EPOLL
+    if (!events) {
+        // Also stops EPOLLHUP/EPOLLERR, which can't be masked otherwise.
+        if (w->registered)
+            epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, w->fd, NULL);
+        w->registered = false;
+        w->events = 0;
+        return;
+    }
 
-            if (errno == EINTR || errno == EAGAIN)
-                continue;
+    if (w->events == events && w->registered)
+        return;
 
-            return rc;
+    struct epoll_event ev = {
+        .events = ((events & POLLIN) ? EPOLLIN : 0) |
+                  ((events & POLLOUT) ? EPOLLOUT : 0),
+        .data.ptr = w,
+    };
+    int op = w->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(ctx->epoll_fd, op, w->fd, &ev) < 0) {
+        if (errno == EPERM) {
+            // Regular files and such can't be polled, but never block.
+            w->pollable = false;
+            w->events = 0;
+            update_watch(ctx, w, events);
+            return;
         }
+        MP_ERR(ctx, "epoll_ctl error (%s)\n", mp_strerror(errno));
+    } else {
+        w->registered = true;
+    }
+#endif
+    w->events = events;
+}
 
-        count -= rc;
-        buf   += rc;
+static void remove_watch(struct mp_ipc_ctx *ctx, struct ipc_watch *w)
+{
+    update_watch(ctx, w, 0);
+    for (int n = 0; n < ctx->num_ready; n++) {
+        if (ctx->ready[n] == w)
+            ctx->ready[n] = NULL;
+    }
+    w->ready = false;
+}
+
+// Wait until something happens, and fill ctx->ready with the watches that
+// have revents set.
+static void wait_events(struct mp_ipc_ctx *ctx)
+{
+    int timeout = ctx->num_always_ready ? 0 : -1;
+
+#if HAVE_EPOLL
+    struct epoll_event events[MAX_EVENTS];
+    int num = epoll_wait(ctx->epoll_fd, events, MAX_EVENTS, timeout);
+    if (num < 0 && errno != EINTR)
+        MP_ERR(ctx, "epoll_wait error (%s)\n", mp_strerror(errno));
+    for (int n = 0; n < num; n++) {
+        struct ipc_watch *w = events[n].data.ptr;
+        int ev = events[n].events;
+        set_ready(ctx, w, ((ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) ? POLLIN : 0) |
+                          ((ev & EPOLLOUT) ? POLLOUT : 0));
     }
+#else
+    // Rebuilt on every wait; the number of clients is expected to be small.
+    int num_fds = 0;
+    struct ipc_watch *watches[2] = {&ctx->wakeup_watch, &ctx->listen_watch};
+    for (int n = 0; n < 2 + ctx->num_clients * 2; n++) {
+        struct ipc_watch *w;
+        if (n < 2) {
+            w = watches[n];
+        } else {
+            struct ipc_client *cl = ctx->clients[(n - 2) / 2];
+            w = (n & 1) ? &cl->sock_watch : &cl->wakeup_watch;
+        }
+        if (!w->events || !w->pollable)
+            continue;
+        MP_TARRAY_GROW(ctx, ctx->fds, num_fds);
+        MP_TARRAY_GROW(ctx, ctx->fd_watches, num_fds);
+        ctx->fds[num_fds] = (struct pollfd){.fd = w->fd, .events = w->events};
+        ctx->fd_watches[num_fds] = w;
+        num_fds++;
+    }
+    if (poll(ctx->fds, num_fds, timeout) < 0 && errno != EINTR)
+        MP_ERR(ctx, "Poll error\n");
+    for (int n = 0; n < num_fds; n++) {
+        int ev = ctx->fds[n].revents;
+        if (ev) {
+            set_ready(ctx, ctx->fd_watches[n],
+                      ((ev & (POLLIN | POLLHUP | POLLERR)) ? POLLIN : 0) |
+                      (ev & POLLOUT));
+        }
+    }
+#endif
 
-    return 0;
+    if (ctx->num_always_ready) {
+        for (int n = 0; n < ctx->num_clients; n++) {
+            struct ipc_watch *w = &ctx->clients[n]->sock_watch;
+            if (!w->pollable && (w->events & POLLIN))
+                set_ready(ctx, w, POLLIN);
+        }
+    }
 }
 
-static void *client_thread(void *p)
+static void wakeup_loop(struct mp_ipc_ctx *ctx)
 {
-    pthread_detach(pthread_self());
+    (void)write(ctx->wakeup_pipe[1], &(char){0}, 1);
+}
 
-    // We don't use MSG_NOSIGNAL because the moldy fruit OS doesn't support it.
-    struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_RESTART };
-    sigfillset(&sa.sa_mask);
-    sigaction(SIGPIPE, &sa, NULL);
+static void free_output(struct ipc_output *out)
+{
+    talloc_free(out->data.start);
+    if (out->fd >= 0)
+        close(out->fd);
+}
 
-    int rc;
+// msg.start must be a talloc allocation, which is freed or taken over. The
+// same applies to fd, unless it's -1. Called locked.
+static void queue_output(struct ipc_client *cl, bstr msg, int fd)
+{
+    struct ipc_output out = {msg, fd};
+    if (!cl->writable || !msg.len) {
+        free_output(&out);
+        return;
+    }
+    talloc_steal(cl, msg.start);
+    MP_TARRAY_APPEND(cl, cl->out, cl->num_out, out);
+    cl->out_bytes += msg.len;
+    if (cl->out_bytes >= OUTPUT_HIGH_WATER)
+        cl->throttled = true;
+}
 
-    struct client_arg *arg = p;
-    bstr client_msg = { talloc_strdup(NULL, ""), 0 };
+// Write as much queued output as possible without blocking. Called locked.
+static void flush_output(struct ipc_client *cl)
+{
+    while (cl->num_out && cl->writable) {
+        struct iovec iov[MAX_IOV];
+        int num_iov = MPMIN(cl->num_out, MAX_IOV);
+        for (int n = 0; n < num_iov; n++) {
+            // A message with a fd goes out with its own sendmsg() call.
+            if (n > 0 && cl->out[n].fd >= 0) {
+                num_iov = n;
+                break;
+            }
+            size_t skip = n == 0 ? cl->out_pos : 0;
+            iov[n] = (struct iovec){
+                .iov_base = cl->out[n].data.start + skip,
+                .iov_len = cl->out[n].data.len - skip,
+            };
+        }
 
-    mpthread_set_name(arg->client_name);
+        ssize_t rc;
+        int send_fd = cl->out[0].fd;
+        if (send_fd >= 0) {
+            union {
+                char buf[CMSG_SPACE(sizeof(int))];
+                struct cmsghdr align;
+            } control;
+            struct msghdr msg = {
+                .msg_iov = iov,
+                .msg_iovlen = 1,
+                .msg_control = control.buf,
+                .msg_controllen = sizeof(control.buf),
+            };
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &send_fd, sizeof(int));
+            num_iov = 1;
+            // (No MSG_NOSIGNAL; SIGPIPE is ignored, see ipc_thread().)
+            rc = sendmsg(cl->client_fd, &msg, 0);
+            if (rc > 0) {
+                close(send_fd);
+                cl->out[0].fd = -1;
+            }
+        } else {
+            rc = writev(cl->client_fd, iov, num_iov);
+        }
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EBADF || errno == ENOTSOCK) {
+                cl->writable = false;
+                break;
+            }
+            MP_ERR(cl, "Write error (%s)\n", mp_strerror(errno));
+            cl->dead = true;
+            return;
+        }
 
-    int pipe_fd = mpv_get_wakeup_pipe(arg->client);
-    if (pipe_fd < 0) {
-        MP_ERR(arg, "Could not get wakeup pipe\n");
-        goto done;
+        cl->out_bytes -= rc;
+        size_t done = rc;
+        int n = 0;
+        while (n < num_iov && done >= iov[n].iov_len) {
+            done -= iov[n].iov_len;
+            free_output(&cl->out[n]);
+            n++;
+        }
+        cl->out_pos = n ? done : cl->out_pos + done;
+        memmove(cl->out, cl->out + n, (cl->num_out - n) * sizeof(cl->out[0]));
+        cl->num_out -= n;
     }
 
-    MP_VERBOSE(arg, "Client connected\n");
+    if (!cl->writable) {
+        for (int n = 0; n < cl->num_out; n++)
+            free_output(&cl->out[n]);
+        cl->num_out = 0;
+        cl->out_pos = 0;
+        cl->out_bytes = 0;
+    }
 
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = pipe_fd},
-        {.events = POLLIN, .fd = arg->client_fd},
-    };
+    if (cl->throttled && cl->out_bytes <= OUTPUT_LOW_WATER) {
+        cl->throttled = false;
+        pthread_cond_signal(&cl->wakeup);
+    }
 
-    fcntl(arg->client_fd, F_SETFL, fcntl(arg->client_fd, F_GETFL, 0) | O_NONBLOCK);
+    if (cl->dropped_events && cl->out_bytes <= OUTPUT_LOW_WATER) {
+        MP_WARN(cl, "%"PRId64" events dropped.\n", cl->dropped_events);
+        bstr msg = mp_ipc_encode_events_dropped(cl->proto, cl->dropped_events);
+        cl->dropped_events = 0;
+        queue_output(cl, msg, -1);
+    }
+}
 
-    while (1) {
-        rc = poll(fds, 2, 0);
-        if (rc == 0)
-            rc = poll(fds, 2, -1);
-        if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
-            continue;
-        }
+// Called locked.
+static void read_input(struct ipc_client *cl)
+{
+    size_t old_len = cl->rbuf_len;
 
-        if (fds[0].revents & POLLIN) {
-            mp_flush_wakeup_pipe(pipe_fd);
+    while (!cl->read_eof) {
+        if (cl->rbuf_size - cl->rbuf_len < READ_CHUNK) {
+            cl->rbuf_size = MPMAX(cl->rbuf_size * 2, cl->rbuf_len + READ_CHUNK);
+            cl->rbuf = talloc_realloc_size(cl, cl->rbuf, cl->rbuf_size);
+        }
 
-            while (1) {
-                mpv_event *event = mpv_wait_event(arg->client, 0);
+        size_t space = cl->rbuf_size - cl->rbuf_len;
+        ssize_t bytes = read(cl->client_fd, cl->rbuf + cl->rbuf_len, space);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            MP_ERR(cl, "Read error (%s)\n", mp_strerror(errno));
+            cl->dead = true;
+            return;
+        }
 
-                if (event->event_id == MPV_EVENT_NONE)
-                    break;
+        if (bytes == 0) {
+            MP_VERBOSE(cl, "Client disconnected\n");
+            cl->read_eof = true;
+            break;
+        }
 
-                if (event->event_id == MPV_EVENT_SHUTDOWN)
-                    goto done;
+        cl->rbuf_len += bytes;
 
-                if (!arg->writable)
-                    continue;
+        // Don't let one client monopolize the loop.
+        if (bytes < space || cl->rbuf_len - cl->read_pos >= INPUT_HIGH_WATER)
+            break;
+    }
 
-                char *event_msg = mp_json_encode_event(event);
-                if (!event_msg) {
-                    MP_ERR(arg, "Encoding error\n");
-                    goto done;
-                }
+    if (cl->rbuf_len != old_len)
+        pthread_cond_signal(&cl->wakeup);
+}
 
-                rc = ipc_write_str(arg, event_msg);
-                talloc_free(event_msg);
-                if (rc < 0) {
-                    MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
-            }
+// Remove the next complete command from the read buffer, and set cmd to a
+// copy of it. Returns false if there is none. Called locked, on the command
+// thread.
+static bool next_command(struct ipc_client *cl, bstr *cmd)
+{
+    char *start = cl->rbuf + cl->read_pos;
+    bstr found = {0};
+    bool ok = false;
+
+    if (cl->conn.proto == MP_IPC_PROTOCOL_MSGPACK) {
+        unsigned char *ustart = (unsigned char *)start;
+        size_t avail = cl->rbuf_len - cl->read_pos;
+        uint32_t len = 0;
+        if (avail >= 4) {
+            len = ((uint32_t)ustart[0] << 24) | (ustart[1] << 16) |
+                  (ustart[2] << 8) | ustart[3];
         }
+        if (len > MP_IPC_MAX_FRAME) {
+            MP_ERR(cl, "Frame too large (%"PRIu32" bytes)\n", len);
+            cl->failed = true;
+        } else if (avail >= 4 && avail - 4 >= len) {
+            // The payload, without the length prefix.
+            found = (bstr){start + 4, len};
+            cl->read_pos = cl->scan_pos = cl->read_pos + 4 + len;
+            ok = true;
+        } else {
+            cl->scan_pos = cl->rbuf_len;
+        }
+    } else {
+        char *nl = memchr(cl->rbuf + cl->scan_pos, '\n',
+                          cl->rbuf_len - cl->scan_pos);
+        if (nl) {
+            found = (bstr){start, nl + 1 - start};
+            cl->read_pos = cl->scan_pos = nl + 1 - cl->rbuf;
+            ok = true;
+        } else {
+            cl->scan_pos = cl->rbuf_len;
+        }
+    }
+
+    if (ok)
+        *cmd = (bstr){talloc_memdup(NULL, found.start, found.len), found.len};
+
+    // Move the unconsumed rest to the start of the buffer.
+    if (cl->read_pos) {
+        memmove(cl->rbuf, cl->rbuf + cl->read_pos, cl->rbuf_len - cl->read_pos);
+        cl->rbuf_len -= cl->read_pos;
+        cl->scan_pos -= cl->read_pos;
+        cl->read_pos = 0;
+    }
 
-        if (fds[1].revents & (POLLIN | POLLHUP)) {
-            while (1) {
-                char buf[128];
-                bstr append = { buf, 0 };
+    return ok;
+}
 
-                ssize_t bytes = read(arg->client_fd, buf, sizeof(buf));
-                if (bytes < 0) {
-                    if (errno == EAGAIN)
-                        break;
+static void free_client(struct ipc_client *cl)
+{
+    struct mp_ipc_ctx *ctx = cl->ctx;
+
+    for (int n = 0; n < cl->num_out; n++)
+        free_output(&cl->out[n]);
+    if (cl->conn.send_fd >= 0)
+        close(cl->conn.send_fd);
+
+    // Decrement first: once the handle is destroyed, the core may assume the
+    // client is gone, and call mp_uninit_ipc(). (The event loop thread exits
+    // when the count drops to 0 after that, so wake it up within the lock.)
+    pthread_mutex_lock(&ctx->lock);
+    ctx->num_live_clients--;
+    wakeup_loop(ctx);
+    pthread_mutex_unlock(&ctx->lock);
+
+    mpv_destroy(cl->client);
+    pthread_cond_destroy(&cl->wakeup);
+    pthread_mutex_destroy(&cl->lock);
+    talloc_free(cl);
+}
 
-                    MP_ERR(arg, "Read error (%s)\n", mp_strerror(errno));
-                    goto done;
-                }
+static void *client_thread(void *p)
+{
+    struct ipc_client *cl = p;
+
+    mpthread_set_name(cl->client_name);
+
+    pthread_mutex_lock(&cl->lock);
+    while (!cl->exit) {
+        bstr cmd;
+        if (cl->throttled || cl->failed || !next_command(cl, &cmd)) {
+            // Let the event loop check whether the client is done, or can
+            // read more input.
+            wakeup_loop(cl->ctx);
+            pthread_cond_wait(&cl->wakeup, &cl->lock);
+            continue;
+        }
+        cl->cmd_running = true;
+        pthread_mutex_unlock(&cl->lock);
+
+        // (The command can change the protocol for the next ones.)
+        enum mp_ipc_protocol proto = cl->conn.proto;
+        bstr reply;
+        if (proto == MP_IPC_PROTOCOL_MSGPACK) {
+            reply = mp_ipc_execute_msgpack(cl->client, NULL, cmd, &cl->conn);
+        } else {
+            reply = bstr0(mp_ipc_execute_line(cl->client, NULL, cmd,
+                                              &cl->conn));
+        }
+        talloc_free(cmd.start);
 
-                if (bytes == 0) {
-                    MP_VERBOSE(arg, "Client disconnected\n");
-                    goto done;
-                }
+        pthread_mutex_lock(&cl->lock);
+        cl->cmd_running = false;
+        if (!reply.start && proto == MP_IPC_PROTOCOL_MSGPACK) {
+            MP_ERR(cl, "Encoding error\n");
+            cl->failed = true;
+        }
+        queue_output(cl, reply, cl->conn.send_fd);
+        cl->conn.send_fd = -1;
+        cl->proto = cl->conn.proto;
+        wakeup_loop(cl->ctx);
+    }
+    pthread_mutex_unlock(&cl->lock);
 
-                append.len = bytes;
+    free_client(cl);
+    return NULL;
+}
 
-                bstr_xappend(NULL, &client_msg, append);
+static void process_events(struct ipc_client *cl)
+{
+    while (cl->events_pending && !cl->dead) {
+        mpv_event *event = mpv_wait_event(cl->client, 0);
 
-                while (bstrchr(client_msg, '\n') != -1) {
-                    char *reply_msg = mp_ipc_consume_next_command(arg->client,
-                        NULL, &client_msg);
+        if (event->event_id == MPV_EVENT_NONE) {
+            cl->events_pending = false;
+            break;
+        }
+
+        if (event->event_id == MPV_EVENT_SHUTDOWN) {
+            cl->dead = true;
+            break;
+        }
 
-                    if (reply_msg && arg->writable) {
-                        rc = ipc_write_str(arg, reply_msg);
-                        if (rc < 0) {
-                            MP_ERR(arg, "Write error (%s)\n", mp_strerror(errno));
-                            talloc_free(reply_msg);
-                            goto done;
-                        }
-                    }
+        if (!cl->writable)
+            continue;
 
-                    talloc_free(reply_msg);
-                }
+        // The command thread can switch the protocol at any time, so encode
+        // the event again if that happened meanwhile.
+        while (1) {
+            pthread_mutex_lock(&cl->lock);
+            enum mp_ipc_protocol proto = cl->proto;
+            bool drop = cl->dropped_events ||
+                        cl->out_bytes >= OUTPUT_EVENT_LIMIT;
+            if (drop) {
+                if (!cl->dropped_events)
+                    MP_WARN(cl, "Client is not reading; dropping events.\n");
+                cl->dropped_events++;
             }
+            pthread_mutex_unlock(&cl->lock);
+            if (drop)
+                break;
+
+            bstr event_msg;
+            if (proto == MP_IPC_PROTOCOL_MSGPACK) {
+                event_msg = mp_msgpack_encode_event(event);
+            } else {
+                event_msg = bstr0(mp_json_encode_event(event));
+            }
+            if (!event_msg.start) {
+                MP_ERR(cl, "Encoding error\n");
+                cl->dead = true;
+                break;
+            }
+
+            pthread_mutex_lock(&cl->lock);
+            bool ok = cl->proto == proto;
+            if (ok)
+                queue_output(cl, event_msg, -1);
+            pthread_mutex_unlock(&cl->lock);
+            if (ok)
+                break;
+            talloc_free(event_msg.start);
         }
     }
+}
 
-done:
-    if (client_msg.len > 0)
-        MP_WARN(arg, "Ignoring unterminated command on disconnect.\n");
-    talloc_free(client_msg.start);
-    if (arg->close_client_fd)
-        close(arg->client_fd);
-    mpv_destroy(arg->client);
-    talloc_free(arg);
-    return NULL;
+static void destroy_client(struct mp_ipc_ctx *ctx, struct ipc_client *cl)
+{
+    remove_watch(ctx, &cl->sock_watch);
+    remove_watch(ctx, &cl->wakeup_watch);
+
+    for (int n = 0; n < ctx->num_clients; n++) {
+        if (ctx->clients[n] == cl) {
+            MP_TARRAY_REMOVE_AT(ctx->clients, ctx->num_clients, n);
+            break;
+        }
+    }
+
+    if (cl->close_client_fd)
+        close(cl->client_fd);
+
+    // The command thread might be running a command with the client, so it
+    // frees the client when it's done.
+    pthread_mutex_lock(&cl->lock);
+    if (cl->rbuf_len > cl->read_pos && !cl->failed)
+        MP_WARN(cl, "Ignoring unterminated command on disconnect.\n");
+    cl->exit = true;
+    bool has_thread = cl->has_thread;
+    pthread_cond_signal(&cl->wakeup);
+    pthread_mutex_unlock(&cl->lock);
+
+    if (!has_thread)
+        free_client(cl);
 }
 
-static void ipc_start_client(struct mp_ipc_ctx *ctx, struct client_arg *client)
+// Run all pending work for the client, and update what to wait for.
+static void update_client(struct mp_ipc_ctx *ctx, struct ipc_client *cl)
 {
-    client->client = mp_new_client(ctx->client_api, client->client_name);
-    if (!client->client)
-        goto err;
+    pthread_mutex_lock(&cl->lock);
+    flush_output(cl);
+    pthread_mutex_unlock(&cl->lock);
+
+    process_events(cl);
+
+    pthread_mutex_lock(&cl->lock);
+    flush_output(cl);
+    bool idle = !cl->cmd_running && cl->scan_pos == cl->rbuf_len;
+    if (cl->failed || (cl->read_eof && idle && !cl->num_out))
+        cl->dead = true;
+    int sock_events = 0;
+    if (!cl->read_eof &&
+        (cl->rbuf_len - cl->read_pos < INPUT_HIGH_WATER || idle))
+        sock_events |= POLLIN;
+    if (cl->num_out)
+        sock_events |= POLLOUT;
+    pthread_mutex_unlock(&cl->lock);
+
+    if (cl->dead) {
+        destroy_client(ctx, cl);
+        return;
+    }
+
+    update_watch(ctx, &cl->sock_watch, sock_events);
+}
 
-    client->log = mp_client_get_log(client->client);
+static bool is_unix_socket(int fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    return getsockname(fd, (struct sockaddr *)&addr, &len) == 0 &&
+           addr.ss_family == AF_UNIX;
+}
 
-    pthread_t client_thr;
-    if (pthread_create(&client_thr, NULL, client_thread, client))
+static void ipc_start_client(struct mp_ipc_ctx *ctx, struct ipc_client *cl)
+{
+    pthread_mutex_lock(&ctx->lock);
+    bool terminate = ctx->terminate;
+    if (!terminate)
+        ctx->num_live_clients++;
+    pthread_mutex_unlock(&ctx->lock);
+    if (terminate)
         goto err;
 
+    cl->client = mp_new_client(ctx->client_api, cl->client_name);
+    if (!cl->client)
+        goto err_live;
+
+    cl->log = mp_client_get_log(cl->client);
+
+    int pipe_fd = mpv_get_wakeup_pipe(cl->client);
+    if (pipe_fd < 0) {
+        MP_ERR(cl, "Could not get wakeup pipe\n");
+        goto err_live;
+    }
+
+    MP_VERBOSE(cl, "Client connected\n");
+
+    fcntl(cl->client_fd, F_SETFL, fcntl(cl->client_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    cl->ctx = ctx;
+    cl->conn = (struct mp_ipc_conn){
+        .can_send_fds = cl->writable && is_unix_socket(cl->client_fd),
+        .send_fd = -1,
+    };
+    cl->sock_watch = (struct ipc_watch){
+        .fd = cl->client_fd,
+        .client = cl,
+        .pollable = true,
+    };
+    cl->wakeup_watch = (struct ipc_watch){
+        .fd = pipe_fd,
+        .client = cl,
+        .pollable = true,
+    };
+
+    pthread_mutex_init(&cl->lock, NULL);
+    pthread_cond_init(&cl->wakeup, NULL);
+    cl->has_thread = true;
+    if (pthread_create(&cl->thread, NULL, client_thread, cl)) {
+        MP_ERR(cl, "Could not create client thread\n");
+        pthread_cond_destroy(&cl->wakeup);
+        pthread_mutex_destroy(&cl->lock);
+        goto err_live;
+    }
+    pthread_detach(cl->thread);
+
+    MP_TARRAY_APPEND(ctx, ctx->clients, ctx->num_clients, cl);
+    update_watch(ctx, &cl->wakeup_watch, POLLIN);
+    update_watch(ctx, &cl->sock_watch, POLLIN);
     return;
 
+err_live:
+    pthread_mutex_lock(&ctx->lock);
+    ctx->num_live_clients--;
+    pthread_mutex_unlock(&ctx->lock);
 err:
-    if (client->client)
-        mpv_destroy(client->client);
+    if (cl->client)
+        mpv_destroy(cl->client);
 
-    if (client->close_client_fd)
-        close(client->client_fd);
+    if (cl->close_client_fd)
+        close(cl->client_fd);
 
-    talloc_free(client);
+    talloc_free(cl);
 }
 
 static void ipc_start_client_json(struct mp_ipc_ctx *ctx, int id, int fd)
 {
-    struct client_arg *client = talloc_ptrtype(NULL, client);
-    *client = (struct client_arg){
+    struct ipc_client *client = talloc_ptrtype(NULL, client);
+    *client = (struct ipc_client){
         .client_name = talloc_asprintf(client, "ipc-%d", id),
         .client_fd   = fd,
         .close_client_fd = true,
@@ -284,8 +814,8 @@ static void ipc_start_client_text(struct mp_ipc_ctx *ctx, const char *path)
         return;
     }
 
-    struct client_arg *client = talloc_ptrtype(NULL, client);
-    *client = (struct client_arg){
+    struct ipc_client *client = talloc_ptrtype(NULL, client);
+    *client = (struct ipc_client){
         .client_name = "input-file",
         .client_fd   = client_fd,
         .close_client_fd = close_client_fd,
@@ -295,33 +825,28 @@ static void ipc_start_client_text(struct mp_ipc_ctx *ctx, const char *path)
     ipc_start_client(ctx, client);
 }
 
-static void *ipc_thread(void *p)
+static bool ipc_listen(struct mp_ipc_ctx *arg)
 {
     int rc;
 
-    int ipc_fd;
     struct sockaddr_un ipc_un = {0};
 
-    struct mp_ipc_ctx *arg = p;
-
-    mpthread_set_name("ipc socket listener");
-
     MP_VERBOSE(arg, "Starting IPC master\n");
 
-    ipc_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (ipc_fd < 0) {
+    arg->ipc_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (arg->ipc_fd < 0) {
         MP_ERR(arg, "Could not create IPC socket\n");
-        goto done;
+        return false;
     }
 
 #if HAVE_FCHMOD
-    fchmod(ipc_fd, 0600);
+    fchmod(arg->ipc_fd, 0600);
 #endif
 
     size_t path_len = strlen(arg->path);
     if (path_len >= sizeof(ipc_un.sun_path) - 1) {
         MP_ERR(arg, "Could not create IPC socket\n");
-        goto done;
+        return false;
     }
 
     ipc_un.sun_family = AF_UNIX,
@@ -335,51 +860,142 @@ static void *ipc_thread(void *p)
     }
 
     size_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + path_len;
-    rc = bind(ipc_fd, (struct sockaddr *) &ipc_un, addr_len);
+    rc = bind(arg->ipc_fd, (struct sockaddr *) &ipc_un, addr_len);
     if (rc < 0) {
         MP_ERR(arg, "Could not bind IPC socket\n");
-        goto done;
+        return false;
     }
 
-    rc = listen(ipc_fd, 10);
+    rc = listen(arg->ipc_fd, 10);
     if (rc < 0) {
         MP_ERR(arg, "Could not listen on IPC socket\n");
-        goto done;
+        return false;
     }
 
-    MP_VERBOSE(arg, "Listening to IPC socket.\n");
+    fcntl(arg->ipc_fd, F_SETFL, fcntl(arg->ipc_fd, F_GETFL, 0) | O_NONBLOCK);
 
-    int client_num = 0;
+    MP_VERBOSE(arg, "Listening to IPC socket.\n");
 
-    struct pollfd fds[2] = {
-        {.events = POLLIN, .fd = arg->death_pipe[0]},
-        {.events = POLLIN, .fd = ipc_fd},
+    arg->listen_watch = (struct ipc_watch){
+        .fd = arg->ipc_fd,
+        .pollable = true,
     };
+    update_watch(arg, &arg->listen_watch, POLLIN);
+    return true;
+}
+
+static void close_listener(struct mp_ipc_ctx *arg)
+{
+    if (arg->ipc_fd >= 0) {
+        remove_watch(arg, &arg->listen_watch);
+        close(arg->ipc_fd);
+        arg->ipc_fd = -1;
+    }
+}
 
+static void accept_clients(struct mp_ipc_ctx *arg)
+{
     while (1) {
-        rc = poll(fds, 2, -1);
-        if (rc < 0) {
-            MP_ERR(arg, "Poll error\n");
-            continue;
+        int client_fd = accept(arg->ipc_fd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            MP_ERR(arg, "Could not accept IPC client\n");
+            close_listener(arg);
+            return;
         }
 
-        if (fds[0].revents & POLLIN)
-            goto done;
+        ipc_start_client_json(arg, arg->client_num++, client_fd);
+    }
+}
+
+static void destroy_ctx(struct mp_ipc_ctx *arg)
+{
+    close_listener(arg);
+#if HAVE_EPOLL
+    if (arg->epoll_fd >= 0)
+        close(arg->epoll_fd);
+#endif
+    if (arg->wakeup_pipe[0] >= 0) {
+        close(arg->wakeup_pipe[0]);
+        close(arg->wakeup_pipe[1]);
+    }
+    pthread_mutex_destroy(&arg->lock);
+    talloc_free(arg);
+}
 
-        if (fds[1].revents & POLLIN) {
-            int client_fd = accept(ipc_fd, NULL, NULL);
-            if (client_fd < 0) {
-                MP_ERR(arg, "Could not accept IPC client\n");
-                goto done;
+// Serves the listener and all clients. Clients are served until they
+// disconnect or the player shuts down, even after mp_uninit_ipc().
+static void *ipc_thread(void *p)
+{
+    struct mp_ipc_ctx *arg = p;
+
+    mpthread_set_name("ipc");
+
+    // We don't use MSG_NOSIGNAL because the moldy fruit OS doesn't support it.
+    struct sigaction sa = { .sa_handler = SIG_IGN, .sa_flags = SA_RESTART };
+    sigfillset(&sa.sa_mask);
+    sigaction(SIGPIPE, &sa, NULL);
+
+    if (arg->path && arg->path[0] && !ipc_listen(arg))
+        close_listener(arg);
+
+    if (arg->input_file && arg->input_file[0])
+        ipc_start_client_text(arg, arg->input_file);
+
+    while (1) {
+        pthread_mutex_lock(&arg->lock);
+        bool terminate = arg->terminate;
+        bool done = terminate && !arg->num_live_clients;
+        pthread_mutex_unlock(&arg->lock);
+
+        if (terminate)
+            close_listener(arg);
+        if (done)
+            break;
+
+        wait_events(arg);
+
+        for (int n = 0; n < arg->num_ready; n++) {
+            struct ipc_watch *w = arg->ready[n];
+            if (!w)
+                continue;
+            if (w == &arg->wakeup_watch) {
+                mp_flush_wakeup_pipe(arg->wakeup_pipe[0]);
+            } else if (w == &arg->listen_watch) {
+                accept_clients(arg);
+            } else if (w == &w->client->wakeup_watch) {
+                mp_flush_wakeup_pipe(w->fd);
+                w->client->events_pending = true;
+            } else if (w->revents & POLLIN) {
+                pthread_mutex_lock(&w->client->lock);
+                read_input(w->client);
+                pthread_mutex_unlock(&w->client->lock);
             }
+        }
 
-            ipc_start_client_json(arg, client_num++, client_fd);
+        for (int n = 0; n < arg->num_ready; n++) {
+            struct ipc_watch *w = arg->ready[n];
+            if (w) {
+                w->revents = 0;
+                w->ready = false;
+            }
         }
+        arg->num_ready = 0;
+
+        // Clients may remove themselves from the list.
+        for (int n = arg->num_clients - 1; n >= 0; n--)
+            update_client(arg, arg->clients[n]);
     }
 
-done:
-    if (ipc_fd >= 0)
-        close(ipc_fd);
+    pthread_mutex_lock(&arg->lock);
+    bool detached = arg->detached;
+    pthread_mutex_unlock(&arg->lock);
+
+    if (detached)
+        destroy_ctx(arg);
 
     return NULL;
 }
@@ -394,32 +1010,43 @@ struct mp_ipc_ctx *mp_init_ipc(struct mp_client_api *client_api,
         .log        = mp_log_new(arg, global->log, "ipc"),
         .client_api = client_api,
         .path       = mp_get_user_path(arg, global, opts->ipc_path),
-        .death_pipe = {-1, -1},
+        .wakeup_pipe = {-1, -1},
+        .ipc_fd     = -1,
+#if HAVE_EPOLL
+        .epoll_fd   = -1,
+#endif
     };
-    char *input_file = mp_get_user_path(arg, global, opts->input_file);
+    pthread_mutex_init(&arg->lock, NULL);
+    arg->input_file = mp_get_user_path(arg, global, opts->input_file);
 
     talloc_free(opts);
 
-    if (input_file && *input_file)
-        ipc_start_client_text(arg, input_file);
+    bool have_input = arg->input_file && arg->input_file[0];
+    if (!have_input && (!arg->path || !arg->path[0]))
+        goto out;
 
-    if (!arg->path || !arg->path[0])
+#if HAVE_EPOLL
+    arg->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (arg->epoll_fd < 0)
         goto out;
+#endif
 
-    if (mp_make_wakeup_pipe(arg->death_pipe) < 0)
+    if (mp_make_wakeup_pipe(arg->wakeup_pipe) < 0)
         goto out;
 
+    arg->wakeup_watch = (struct ipc_watch){
+        .fd = arg->wakeup_pipe[0],
+        .pollable = true,
+    };
+    update_watch(arg, &arg->wakeup_watch, POLLIN);
+
     if (pthread_create(&arg->thread, NULL, ipc_thread, arg))
         goto out;
 
     return arg;
 
 out:
-    if (arg->death_pipe[0] >= 0) {
-        close(arg->death_pipe[0]);
-        close(arg->death_pipe[1]);
-    }
-    talloc_free(arg);
+    destroy_ctx(arg);
     return NULL;
 }
 
@@ -428,10 +1055,23 @@ void mp_uninit_ipc(struct mp_ipc_ctx *arg)
     if (!arg)
         return;
 
-    (void)write(arg->death_pipe[1], &(char){0}, 1);
-    pthread_join(arg->thread, NULL);
+    pthread_mutex_lock(&arg->lock);
+    arg->terminate = true;
+    // Connected clients keep the thread running. Their command threads might
+    // be blocked on a command running on the core (i.e. our caller), so it
+    // can't be joined, and frees itself when the last client is gone. It
+    // checks detached under the lock before freeing anything, so wake it up
+    // and detach it while holding the lock.
+    arg->detached = arg->num_live_clients > 0;
+    bool detached = arg->detached;
+    wakeup_loop(arg);
+    if (detached)
+        pthread_detach(arg->thread);
+    pthread_mutex_unlock(&arg->lock);
+
+    if (detached)
+        return;
 
-    close(arg->death_pipe[0]);
-    close(arg->death_pipe[1]);
-    talloc_free(arg);
+    pthread_join(arg->thread, NULL);
+    destroy_ctx(arg);
 }
@@ -15,11 +15,15 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <unistd.h>
+
 #include "config.h"
 
 #include "common/msg.h"
 #include "input/input.h"
+#include "libmpa/playback_state.h"
 #include "misc/json.h"
+#include "misc/msgpack.h"
 #include "misc/node.h"
 #include "options/m_option.h"
 #include "options/options.h"
@@ -166,9 +170,41 @@ static void mpv_event_to_node(void *ta_parent, mpv_event *event, mpv_node *dst)
     }
 }
 
+// Encode node as a frame of the binary protocol: the length of the payload
+// as 32 bit big endian, followed by the MessagePack encoded node.
+static bstr msgpack_frame(void *ta_parent, mpv_node *node)
+{
+    bstr frame = {0};
+    bstr_xappend(ta_parent, &frame, (bstr){"\0\0\0\0", 4});
+    if (msgpack_write(ta_parent, &frame, node) < 0 ||
+        frame.len - 4 > MP_IPC_MAX_FRAME)
+    {
+        talloc_free(frame.start);
+        return (bstr){0};
+    }
+    uint32_t len = frame.len - 4;
+    for (int n = 0; n < 4; n++)
+        frame.start[n] = len >> (24 - n * 8);
+    return frame;
+}
+
+bstr mp_msgpack_encode_event(mpv_event *event)
+{
+    void *ta_parent = talloc_new_arena(NULL);
+    mpv_node event_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
+
+    mpv_event_to_node(ta_parent, event, &event_node);
+
+    bstr output = msgpack_frame(NULL, &event_node);
+
+    talloc_free(ta_parent);
+
+    return output;
+}
+
 char *mp_json_encode_event(mpv_event *event)
 {
-    void *ta_parent = talloc_new(NULL);
+    void *ta_parent = talloc_new_arena(NULL);
     mpv_node event_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
 
     mpv_event_to_node(ta_parent, event, &event_node);
@@ -182,37 +218,58 @@ char *mp_json_encode_event(mpv_event *event)
     return output;
 }
 
-// Function is allowed to modify src[n].
-static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
-                                  char *src)
+bstr mp_ipc_encode_events_dropped(enum mp_ipc_protocol proto, int64_t count)
+{
+    void *ta_parent = talloc_new_arena(NULL);
+    mpv_node node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
+
+    mpv_node_map_add_string(ta_parent, &node, "event", "events-dropped");
+    mpv_node_map_add_int64(ta_parent, &node, "count", count);
+
+    bstr output;
+    if (proto == MP_IPC_PROTOCOL_MSGPACK) {
+        output = msgpack_frame(NULL, &node);
+    } else {
+        char *json = talloc_strdup(NULL, "");
+        json_write(&json, &node);
+        output = bstr0(ta_talloc_strdup_append(json, "\n"));
+    }
+
+    talloc_free(ta_parent);
+
+    return output;
+}
+
+// Execute the command in msg_node, and add the results to reply_node.
+// rc < 0 means msg_node could not be parsed. conn is NULL if the transport
+// has no per-connection state.
+static void execute_command_node(struct mpv_handle *client, void *ta_parent,
+                                 int rc, mpv_node *msg_node,
+                                 struct mp_ipc_conn *conn,
+                                 mpv_node *reply_node)
 {
-    int rc;
     const char *cmd = NULL;
     struct mp_log *log = mp_client_get_log(client);
 
-    mpv_node msg_node;
-    mpv_node reply_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
     mpv_node *reqid_node = NULL;
 
-    rc = json_parse(ta_parent, &msg_node, &src, 50);
     if (rc < 0) {
-        mp_err(log, "malformed JSON received: '%s'\n", src);
         rc = MPV_ERROR_INVALID_PARAMETER;
         goto error;
     }
 
-    if (msg_node.format != MPV_FORMAT_NODE_MAP) {
+    if (msg_node->format != MPV_FORMAT_NODE_MAP) {
         rc = MPV_ERROR_INVALID_PARAMETER;
         goto error;
     }
 
-    reqid_node = node_map_get(&msg_node, "request_id");
+    reqid_node = node_map_get(msg_node, "request_id");
     if (reqid_node && reqid_node->format != MPV_FORMAT_INT64) {
         mp_warn(log, "'request_id' must be an integer. Using other types is "
                 "deprecated and will trigger an error in the future!\n");
     }
 
-    mpv_node *cmd_node = node_map_get(&msg_node, "command");
+    mpv_node *cmd_node = node_map_get(msg_node, "command");
     if (!cmd_node ||
         (cmd_node->format != MPV_FORMAT_NODE_ARRAY) ||
         !cmd_node->u.list->num)
@@ -231,16 +288,54 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
 
     if (!strcmp("client_name", cmd)) {
         const char *client_name = mpv_client_name(client);
-        mpv_node_map_add_string(ta_parent, &reply_node, "data", client_name);
+        mpv_node_map_add_string(ta_parent, reply_node, "data", client_name);
         rc = MPV_ERROR_SUCCESS;
     } else if (!strcmp("get_time_us", cmd)) {
         int64_t time_us = mpv_get_time_us(client);
-        mpv_node_map_add_int64(ta_parent, &reply_node, "data", time_us);
+        mpv_node_map_add_int64(ta_parent, reply_node, "data", time_us);
         rc = MPV_ERROR_SUCCESS;
     } else if (!strcmp("get_version", cmd)) {
         int64_t ver = mpv_client_api_version();
-        mpv_node_map_add_int64(ta_parent, &reply_node, "data", ver);
+        mpv_node_map_add_int64(ta_parent, reply_node, "data", ver);
         rc = MPV_ERROR_SUCCESS;
+    } else if (!strcmp("ipc_protocol", cmd)) {
+        if (cmd_node->u.list->num != 2) {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+
+        if (cmd_node->u.list->values[1].format != MPV_FORMAT_STRING) {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+
+        char *name = cmd_node->u.list->values[1].u.string;
+        if (!conn) {
+            rc = MPV_ERROR_NOT_IMPLEMENTED;
+        } else if (!strcmp(name, "json")) {
+            conn->proto = MP_IPC_PROTOCOL_JSON;
+            rc = MPV_ERROR_SUCCESS;
+        } else if (!strcmp(name, "msgpack")) {
+            conn->proto = MP_IPC_PROTOCOL_MSGPACK;
+            rc = MPV_ERROR_SUCCESS;
+        } else {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+        }
+    } else if (!strcmp("get_playback_state_fd", cmd)) {
+        if (!conn || !conn->can_send_fds) {
+            rc = MPV_ERROR_NOT_IMPLEMENTED;
+            goto error;
+        }
+
+        int fd = mpv_get_playback_state_fd(client);
+        if (fd >= 0) {
+            if (conn->send_fd >= 0)
+                close(conn->send_fd);
+            conn->send_fd = fd;
+            mpv_node_map_add_int64(ta_parent, reply_node, "data",
+                                   MPV_PLAYBACK_STATE_MAP_SIZE);
+        }
+        rc = fd < 0 ? fd : MPV_ERROR_SUCCESS;
     } else if (!strcmp("get_property", cmd)) {
         mpv_node result_node;
 
@@ -257,7 +352,26 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
         rc = mpv_get_property(client, cmd_node->u.list->values[1].u.string,
                               MPV_FORMAT_NODE, &result_node);
         if (rc >= 0) {
-            mpv_node_map_add(ta_parent, &reply_node, "data", &result_node);
+            mpv_node_map_add(ta_parent, reply_node, "data", &result_node);
+            mpv_free_node_contents(&result_node);
+        }
+    } else if (!strcmp("get_properties", cmd)) {
+        mpv_node result_node;
+        int num = cmd_node->u.list->num - 1;
+
+        const char **names = talloc_array(ta_parent, const char *, num + 1);
+        for (int n = 0; n < num; n++) {
+            if (cmd_node->u.list->values[n + 1].format != MPV_FORMAT_STRING) {
+                rc = MPV_ERROR_INVALID_PARAMETER;
+                goto error;
+            }
+            names[n] = cmd_node->u.list->values[n + 1].u.string;
+        }
+        names[num] = NULL;
+
+        rc = mpv_get_properties(client, names, &result_node);
+        if (rc >= 0) {
+            mpv_node_map_add(ta_parent, reply_node, "data", &result_node);
             mpv_free_node_contents(&result_node);
         }
     } else if (!strcmp("get_property_string", cmd)) {
@@ -274,10 +388,10 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
         char *result = mpv_get_property_string(client,
                                         cmd_node->u.list->values[1].u.string);
         if (result) {
-            mpv_node_map_add_string(ta_parent, &reply_node, "data", result);
+            mpv_node_map_add_string(ta_parent, reply_node, "data", result);
             mpv_free(result);
         } else {
-            mpv_node_map_add_null(ta_parent, &reply_node, "data");
+            mpv_node_map_add_null(ta_parent, reply_node, "data");
         }
     } else if (!strcmp("set_property", cmd) ||
         !strcmp("set_property_string", cmd))
@@ -294,6 +408,18 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
 
         rc = mpv_set_property(client, cmd_node->u.list->values[1].u.string,
                               MPV_FORMAT_NODE, &cmd_node->u.list->values[2]);
+    } else if (!strcmp("set_properties", cmd)) {
+        if (cmd_node->u.list->num != 2) {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+
+        if (cmd_node->u.list->values[1].format != MPV_FORMAT_NODE_MAP) {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+
+        rc = mpv_set_properties(client, &cmd_node->u.list->values[1]);
     } else if (!strcmp("observe_property", cmd)) {
         if (cmd_node->u.list->num != 3) {
             rc = MPV_ERROR_INVALID_PARAMETER;
@@ -334,6 +460,31 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
                                   cmd_node->u.list->values[1].u.int64,
                                   cmd_node->u.list->values[2].u.string,
                                   MPV_FORMAT_STRING);
+    } else if (!strcmp("observe_property_rate", cmd)) {
+        if (cmd_node->u.list->num != 3) {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+
+        if (cmd_node->u.list->values[1].format != MPV_FORMAT_INT64) {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+
+        double rate;
+        mpv_node *rate_node = &cmd_node->u.list->values[2];
+        if (rate_node->format == MPV_FORMAT_INT64) {
+            rate = rate_node->u.int64;
+        } else if (rate_node->format == MPV_FORMAT_DOUBLE) {
+            rate = rate_node->u.double_;
+        } else {
+            rc = MPV_ERROR_INVALID_PARAMETER;
+            goto error;
+        }
+
+        rc = mpv_observe_property_rate(client,
+                                       cmd_node->u.list->values[1].u.int64,
+                                       rate);
     } else if (!strcmp("unobserve_property", cmd)) {
         if (cmd_node->u.list->num != 2) {
             rc = MPV_ERROR_INVALID_PARAMETER;
@@ -398,7 +549,7 @@ static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
 
         rc = mpv_command_node(client, cmd_node, &result_node);
         if (rc >= 0)
-            mpv_node_map_add(ta_parent, &reply_node, "data", &result_node);
+            mpv_node_map_add(ta_parent, reply_node, "data", &result_node);
     }
 
 error:
@@ -407,14 +558,31 @@ error:
      * the original requests.
      */
     if (reqid_node) {
-        mpv_node_map_add(ta_parent, &reply_node, "request_id", reqid_node);
+        mpv_node_map_add(ta_parent, reply_node, "request_id", reqid_node);
     } else {
-        mpv_node_map_add_int64(ta_parent, &reply_node, "request_id", 0);
+        mpv_node_map_add_int64(ta_parent, reply_node, "request_id", 0);
     }
 
-    mpv_node_map_add_string(ta_parent, &reply_node, "error", mpv_error_string(rc));
+    mpv_node_map_add_string(ta_parent, reply_node, "error", mpv_error_string(rc));
+}
 
-    char *output = talloc_strdup(ta_parent, "");
+// Function is allowed to modify src[n].
+static char *json_execute_command(struct mpv_handle *client, void *ta_parent,
+                                  char *src, struct mp_ipc_conn *conn)
+{
+    mpv_node msg_node;
+    mpv_node reply_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
+
+    int rc = json_parse(ta_parent, &msg_node, &src, 50);
+    if (rc < 0) {
+        mp_err(mp_client_get_log(client), "malformed JSON received: '%s'\n",
+               src);
+    }
+
+    execute_command_node(client, ta_parent, rc, &msg_node, conn, &reply_node);
+
+    // Not allocated from ta_parent, which may be an arena.
+    char *output = talloc_strdup(NULL, "");
     json_write(&output, &reply_node);
     output = ta_talloc_strdup_append(output, "\n");
 
@@ -430,13 +598,23 @@ static char *text_execute_command(struct mpv_handle *client, void *tmp, char *sr
 
 char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *buf)
 {
-    void *tmp = talloc_new(NULL);
-
     bstr rest;
     bstr line = bstr_getline(*buf, &rest);
-    char *line0 = bstrto0(tmp, line);
-    talloc_steal(tmp, buf->start);
+    char *reply_msg = mp_ipc_execute_line(client, ctx, line, NULL);
+
+    bstr old = *buf;
     *buf = bstrdup(NULL, rest);
+    talloc_free(old.start);
+
+    return reply_msg;
+}
+
+char *mp_ipc_execute_line(struct mpv_handle *client, void *ctx, bstr line,
+                          struct mp_ipc_conn *conn)
+{
+    void *tmp = talloc_new_arena(NULL);
+
+    char *line0 = bstrto0(tmp, line);
 
     json_skip_whitespace(&line0);
 
@@ -444,7 +622,7 @@ char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *bu
     if (line0[0] == '\0' || line0[0] == '#') {
         // skip
     } else if (line0[0] == '{') {
-        reply_msg = json_execute_command(client, tmp, line0);
+        reply_msg = json_execute_command(client, tmp, line0, conn);
     } else {
         reply_msg = text_execute_command(client, tmp, line0);
     }
@@ -453,3 +631,25 @@ char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *bu
     talloc_free(tmp);
     return reply_msg;
 }
+
+bstr mp_ipc_execute_msgpack(struct mpv_handle *client, void *ctx, bstr payload,
+                            struct mp_ipc_conn *conn)
+{
+    void *tmp = talloc_new_arena(NULL);
+
+    mpv_node msg_node;
+    mpv_node reply_node = {.format = MPV_FORMAT_NODE_MAP, .u.list = NULL};
+
+    int rc = msgpack_parse(tmp, &msg_node, &payload, 50);
+    if (rc >= 0 && payload.len)
+        rc = -1; // trailing data
+    if (rc < 0)
+        mp_err(mp_client_get_log(client), "malformed MessagePack received\n");
+
+    execute_command_node(client, tmp, rc, &msg_node, conn, &reply_node);
+
+    bstr reply = msgpack_frame(ctx, &reply_node);
+
+    talloc_free(tmp);
+    return reply;
+}
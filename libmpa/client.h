@@ -223,7 +223,7 @@ extern "C" {
  * relational operators (<, >, <=, >=).
  */
 #define MPV_MAKE_VERSION(major, minor) (((major) << 16) | (minor) | 0UL)
-#define MPV_CLIENT_API_VERSION MPV_MAKE_VERSION(1, 103)
+#define MPV_CLIENT_API_VERSION MPV_MAKE_VERSION(1, 108)
 
 /**
  * The API user is allowed to "#define MPV_ENABLE_DEPRECATED 0" before
@@ -1164,6 +1164,39 @@ char *mpv_get_property_osd_string(mpv_handle *ctx, const char *name);
 int mpv_get_property_async(mpv_handle *ctx, uint64_t reply_userdata,
                            const char *name, mpv_format format);
 
+/**
+ * Read several properties at once. All properties are read in a single
+ * operation on the player core, so the values are consistent with each other
+ * (e.g. "time-pos" and "duration" always refer to the same file). This is
+ * also much cheaper than calling mpv_get_property() for each property.
+ *
+ * Properties that can't be read (for example because they're unavailable) are
+ * left out of the result. Use mpv_get_property() to get the error for an
+ * individual property.
+ *
+ * @param names NULL-terminated array of property names
+ * @param[out] result Set to a MPV_FORMAT_NODE_MAP, which maps the property
+ *                    names to their values (with the same types as
+ *                    mpv_get_property() with MPV_FORMAT_NODE). Free it with
+ *                    mpv_free_node_contents().
+ * @return error code (only for invalid parameters, or if mpv is not
+ *         initialized)
+ */
+int mpv_get_properties(mpv_handle *ctx, const char **names, mpv_node *result);
+
+/**
+ * Set several properties at once. All properties are set in a single
+ * operation on the player core, in the order of the map entries. Each entry is
+ * handled like mpv_set_property() with MPV_FORMAT_NODE.
+ *
+ * If setting a property fails, the following properties are not set anymore,
+ * but the properties before it remain set.
+ *
+ * @param values MPV_FORMAT_NODE_MAP, which maps property names to new values
+ * @return error code of the first property that failed, or 0 on success
+ */
+int mpv_set_properties(mpv_handle *ctx, mpv_node *values);
+
 /**
  * Get a notification whenever the given property changes. You will receive
  * updates as MPV_EVENT_PROPERTY_CHANGE. Note that this is not very precise:
@@ -1231,6 +1264,24 @@ int mpv_observe_property(mpv_handle *mpv, uint64_t reply_userdata,
  */
 int mpv_unobserve_property(mpv_handle *mpv, uint64_t registered_reply_userdata);
 
+/**
+ * Limit how often MPV_EVENT_PROPERTY_CHANGE is sent for the properties which
+ * were observed with the given reply_userdata. Changes in between are merged,
+ * so the event always has the most recent value. This is useful for properties
+ * which change very often, like "time-pos".
+ *
+ * The limit applies to properties observed before this call only.
+ *
+ * @param registered_reply_userdata ID that was passed to mpv_observe_property
+ * @param max_rate maximum number of change events per second and property,
+ *                 or 0 to remove the limit
+ * @return negative value is an error code, >=0 is number of affected
+ *         properties on success
+ */
+int mpv_observe_property_rate(mpv_handle *mpv,
+                              uint64_t registered_reply_userdata,
+                              double max_rate);
+
 typedef enum mpv_event_id {
     /**
      * Nothing happened. Happens on timeouts or sporadic wakeups.
@@ -0,0 +1,126 @@
+/* Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MPV_CLIENT_API_PLAYBACK_STATE_H_
+#define MPV_CLIENT_API_PLAYBACK_STATE_H_
+
+#include "client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Warning: this API is not stable yet.
+ *
+ * Overview
+ * --------
+ *
+ * This API gives fast read access to frequently polled playback state, such
+ * as the playback position. The player core copies the state into a shared
+ * memory segment once per playloop iteration. Clients map the segment and
+ * read it without any syscalls, and without waiting for the core.
+ *
+ * Usage
+ * -----
+ *
+ * Call mpv_get_playback_state_fd() to get a file descriptor for the segment,
+ * and mmap() it read-only with MPV_PLAYBACK_STATE_MAP_SIZE bytes. The file
+ * descriptor can be closed after mapping, or passed to another process. The
+ * JSON IPC sends it with the "get_playback_state_fd" command (unix sockets
+ * only, as SCM_RIGHTS ancillary data on the reply).
+ *
+ * Then call mpv_read_playback_state() on the mapping whenever the state is
+ * needed. This function only reads memory, and never blocks on the core.
+ *
+ * The mapping stays valid after mpv is destroyed, but isn't updated anymore.
+ *
+ * The state is as current as the last playloop iteration. It may lag behind
+ * the corresponding properties by up to one iteration, and it is not updated
+ * while the core sleeps (e.g. when paused and nothing else happens). Use
+ * time_us to see how old the data is.
+ *
+ * Example:
+ *
+ *      int fd = mpv_get_playback_state_fd(mpv);
+ *      void *map = mmap(NULL, MPV_PLAYBACK_STATE_MAP_SIZE, PROT_READ,
+ *                       MAP_SHARED, fd, 0);
+ *      close(fd);
+ *      mpv_playback_state st;
+ *      if (mpv_read_playback_state(map, &st) >= 0)
+ *          printf("%f\n", st.time_pos);
+ */
+
+/**
+ * Size of the shared memory segment.
+ */
+#define MPV_PLAYBACK_STATE_MAP_SIZE 4096
+
+/**
+ * Snapshot of the playback state. The names in quotes refer to the properties
+ * the fields correspond to. Fields for unavailable properties are set to NAN
+ * (double). Flags are 0 or 1.
+ *
+ * New fields may be added to the end. mpv_read_playback_state() sets fields
+ * unknown to the mpv version that writes the segment to 0.
+ */
+typedef struct mpv_playback_state {
+    /**
+     * Incremented on every update. 0 if the core never wrote the state.
+     */
+    uint64_t generation;
+    /**
+     * mpv_get_time_us() at the time of the update.
+     */
+    int64_t time_us;
+    double time_pos;            // "time-pos"
+    double duration;            // "duration"
+    double speed;               // "speed"
+    double volume;              // "volume"
+    double cache_duration;      // "demuxer-cache-duration"
+    int32_t pause;              // "pause"
+    int32_t paused_for_cache;   // "paused-for-cache"
+    int32_t core_idle;          // "core-idle"
+    int32_t idle_active;        // "idle-active"
+    int32_t eof_reached;        // "eof-reached"
+    int32_t seeking;            // "seeking"
+    int32_t mute;               // "mute"
+    int32_t reserved;
+} mpv_playback_state;
+
+/**
+ * Return a new file descriptor for the shared memory segment, which the
+ * caller must close. The segment is created on the first call.
+ *
+ * @return the file descriptor, or an error code (MPV_ERROR_UNSUPPORTED if the
+ *         platform has no shared memory support)
+ */
+int mpv_get_playback_state_fd(mpv_handle *ctx);
+
+/**
+ * Copy the current state from the mapped segment to *state. Safe to call
+ * from any thread and process, at any time.
+ *
+ * @param map the segment, mapped with at least MPV_PLAYBACK_STATE_MAP_SIZE
+ *            bytes
+ * @return error code (MPV_ERROR_UNSUPPORTED if map is not a playback state
+ *         segment, MPV_ERROR_GENERIC if no consistent copy could be read,
+ *         which happens only if the writer died in the middle of an update)
+ */
+int mpv_read_playback_state(const void *map, mpv_playback_state *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -105,6 +105,58 @@ extern "C" {
  */
 typedef int64_t (*mpv_stream_cb_read_fn)(void *cookie, char *buf, uint64_t nbytes);
 
+/**
+ * Opaque handle for a pending asynchronous read, see
+ * mpv_stream_cb_read_async_fn.
+ */
+typedef struct mpv_stream_cb_read_request mpv_stream_cb_read_request;
+
+/**
+ * Asynchronous read callback, an alternative to mpv_stream_cb_read_fn for
+ * streams that get their data asynchronously (for example from the user's own
+ * network code). The callback must not block. It starts reading nbytes at
+ * offset into buf, and returns. When the data is there, the user calls
+ * mpv_stream_cb_read_complete() with req. This can happen on any thread, and
+ * also from within this callback. buf remains valid until then.
+ *
+ * libmpv keeps several requests pending at the same time, for consecutive
+ * offsets (readahead), and uses the data as soon as the first request has
+ * completed. Requests can be completed in any order. Short reads are allowed,
+ * but cause libmpv to drop the following requests and to read again from the
+ * end of the short read.
+ *
+ * Every request must be completed exactly once, even if it was cancelled. The
+ * close callback is only called after all requests have been completed.
+ *
+ * @param cookie opaque cookie identifying the stream,
+ *               returned from mpv_stream_cb_open_fn
+ * @param req handle to pass to mpv_stream_cb_read_complete()
+ * @param offset absolute stream position to read from
+ * @param buf buffer to read data into
+ * @param nbytes size of the buffer
+ */
+typedef void (*mpv_stream_cb_read_async_fn)(void *cookie,
+                                            mpv_stream_cb_read_request *req,
+                                            int64_t offset, char *buf,
+                                            uint64_t nbytes);
+
+/**
+ * Cancel callback for asynchronous reads. libmpv calls it for requests it
+ * doesn't need anymore (after a seek, or when closing the stream). The user
+ * should complete the request as soon as possible. The result passed to
+ * mpv_stream_cb_read_complete() is ignored. This can be called while the user
+ * is completing the request, in which case it must be ignored. Must not
+ * block.
+ *
+ * This callback can be NULL, in which case requests are simply waited for.
+ *
+ * @param cookie opaque cookie identifying the stream,
+ *               returned from mpv_stream_cb_open_fn
+ * @param req the request passed to mpv_stream_cb_read_async_fn
+ */
+typedef void (*mpv_stream_cb_cancel_read_fn)(void *cookie,
+                                             mpv_stream_cb_read_request *req);
+
 /**
  * Seek callback used to implement a custom stream.
  *
@@ -164,12 +216,22 @@ typedef struct mpv_stream_cb_info {
      * Callbacks set by the user in the mpv_stream_cb_open_ro_fn callback. Some
      * of them are optional, and can be left unset.
      *
-     * The following callbacks are mandatory: read_fn, close_fn
+     * The following callbacks are mandatory: read_fn or read_async_fn,
+     * close_fn
      */
     mpv_stream_cb_read_fn read_fn;
     mpv_stream_cb_seek_fn seek_fn;
     mpv_stream_cb_size_fn size_fn;
     mpv_stream_cb_close_fn close_fn;
+
+    /**
+     * If read_async_fn is set, it is used instead of read_fn. With async
+     * reads, seek_fn only determines whether the stream is seekable (the
+     * requests carry their offsets), and is called on every seek, so the user
+     * can validate the position.
+     */
+    mpv_stream_cb_read_async_fn read_async_fn;
+    mpv_stream_cb_cancel_read_fn cancel_read_fn;
 } mpv_stream_cb_info;
 
 /**
@@ -216,6 +278,16 @@ typedef int (*mpv_stream_cb_open_ro_fn)(void *user_data, char *uri,
 int mpv_stream_cb_add_ro(mpv_handle *ctx, const char *protocol, void *user_data,
                          mpv_stream_cb_open_ro_fn open_fn);
 
+/**
+ * Complete a request started with mpv_stream_cb_read_async_fn. Safe to call
+ * from any thread. req is invalid after this call.
+ *
+ * @param req the request
+ * @param result number of bytes read into the buffer, 0 on EOF, or -1 on error
+ */
+void mpv_stream_cb_read_complete(mpv_stream_cb_read_request *req,
+                                 int64_t result);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,126 @@
+/* Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MPV_CLIENT_API_STREAM_PUSH_H_
+#define MPV_CLIENT_API_STREAM_PUSH_H_
+
+#include <stddef.h>
+
+#include "client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Warning: this API is not stable yet.
+ *
+ * Overview
+ * --------
+ *
+ * This API lets the client push data into the player while it is being
+ * produced, for example audio from a speech synthesizer. The client appends
+ * chunks to a ring buffer owned by the player, and the demuxer reads from
+ * it. A read waits for data, and wakes up as soon as the client appends some,
+ * so the data is played with the latency of a single demuxer packet.
+ *
+ * Compared to stream_cb.h, the client doesn't need to implement a blocking
+ * read callback that runs on the demuxer thread.
+ *
+ * Usage
+ * -----
+ *
+ * Create a stream with mpv_push_stream_create(), and play it with
+ * `loadfile push://<name>`. Append data with mpv_push_stream_write(), and call
+ * mpv_push_stream_end() when done. The player sees the end of the file once
+ * it has read all data.
+ *
+ * The data can be any format the player can read without seeking. Raw PCM
+ * needs the format to be set with `--demuxer=rawaudio` and the
+ * `--demuxer-rawaudio-...` options. Alternatively, write a WAV header with
+ * the data size set to 0xFFFFFFFF (unknown) first.
+ *
+ * The stream is not seekable. Data read by the player is removed from the
+ * buffer, so if the file is played again (or opened by something else), only
+ * new data is read. Only one player stream can read it at a time.
+ *
+ * Example:
+ *
+ *      mpv_push_stream *s;
+ *      mpv_push_stream_create(mpv, "tts", 64 * 1024, &s);
+ *      const char *cmd[] = {"loadfile", "push://tts", NULL};
+ *      mpv_command(mpv, cmd);
+ *      while (have_more_audio())
+ *          mpv_push_stream_write(s, buf, size);
+ *      mpv_push_stream_end(s);
+ *      // wait for MPV_EVENT_END_FILE
+ *      mpv_push_stream_destroy(s);
+ */
+
+typedef struct mpv_push_stream mpv_push_stream;
+
+/**
+ * Create a push stream, which can be opened as `push://<name>`.
+ *
+ * @param name the name used in the URL. Must be unique within the mpv
+ *             instance, and must not be empty.
+ * @param buffer_size size of the ring buffer in bytes. Writes block while the
+ *                    buffer is full.
+ * @param[out] res set to the new stream on success
+ * @return error code (MPV_ERROR_INVALID_PARAMETER if the name is invalid or
+ *         already in use, or buffer_size is 0)
+ */
+int mpv_push_stream_create(mpv_handle *ctx, const char *name,
+                           size_t buffer_size, mpv_push_stream **res);
+
+/**
+ * Append data to the stream. This blocks until all data has been copied into
+ * the ring buffer, which means it waits for the player to read data if the
+ * buffer is full.
+ *
+ * Safe to call from any thread, but only one thread should write at a time.
+ *
+ * If the player closed the stream (for example because playback was stopped),
+ * and hasn't opened it again, this doesn't wait for a full buffer, but fails
+ * with MPV_ERROR_GENERIC. Writes before the player opened the stream for the
+ * first time wait as usual.
+ *
+ * @return error code (MPV_ERROR_INVALID_PARAMETER if mpv_push_stream_end() was
+ *         called, including while this function was waiting;
+ *         MPV_ERROR_GENERIC if the buffer is full and the player closed the
+ *         stream; the data may have been written partially in both cases)
+ */
+int mpv_push_stream_write(mpv_push_stream *s, const void *data, size_t size);
+
+/**
+ * Mark the end of the stream. The player reads the remaining data, and then
+ * sees EOF. A mpv_push_stream_write() call blocked in another thread returns
+ * with an error. Safe to call from any thread, and more than once.
+ */
+void mpv_push_stream_end(mpv_push_stream *s);
+
+/**
+ * Unregister the name, end the stream (as with mpv_push_stream_end()), and
+ * release the handle. The memory is freed once the player has closed the
+ * stream. No other function must be running on s when calling this, and s
+ * is invalid after it returns.
+ *
+ * This must be called before the mpv instance is destroyed.
+ */
+void mpv_push_stream_destroy(mpv_push_stream *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
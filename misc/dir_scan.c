@@ -0,0 +1,455 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "misc/bstr.h"
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
+#include "options/path.h"
+#include "osdep/io.h"
+
+#include "dir_scan.h"
+
+#define MAX_DEPTH 20
+
+#define SNAPSHOT_HEADER "mpa-dir-snapshot 1"
+#define MAX_SNAPSHOT_SIZE (256 * 1024 * 1024)
+
+struct dir_entry {
+    const char *name;
+    int len;
+    bool is_dir;
+    struct dir_node *dir;       // set if is_dir
+};
+
+struct dir_node {
+    struct dir_scan *scan;
+    struct dir_node *parent;
+    char *path;
+    int depth;
+    // All following fields are written by the scan task only, and are
+    // accessed by others only after done was set.
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime;
+    bool listed;                // entries are the complete listing
+    struct dir_entry *entries;
+    int num_entries;
+    bool done;                  // protected by dir_scan.lock
+};
+
+// A directory listing in the loaded snapshot.
+struct snapshot_dir {
+    const char *path;
+    int64_t mtime;
+    const char *entries;        // num_entries type+name strings
+    int num_entries;
+};
+
+struct iter_pos {
+    struct dir_node *node;
+    int index;
+};
+
+struct dir_scan {
+    struct mp_log *log;
+    struct mp_cancel *cancel;
+    struct mp_task_group *group;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    struct dir_node *root;
+    int64_t start_time;
+
+    // The loaded snapshot; read-only while scanning.
+    char *snapshot_file;
+    char *snapshot_data;
+    int64_t snapshot_time;
+    struct snapshot_dir *snapshot_dirs;
+    int num_snapshot_dirs;
+
+    // Accessed by the dir_scan_next() caller only.
+    struct iter_pos *stack;
+    int num_stack;
+    char *cur;
+    bool finished;
+};
+
+static void add_entry(struct dir_node *node, const char *name, bool is_dir)
+{
+    struct dir_entry e = {.name = name, .len = strlen(name), .is_dir = is_dir};
+    MP_TARRAY_APPEND(node, node->entries, node->num_entries, e);
+}
+
+static int entry_char(const struct dir_entry *e, int n)
+{
+    if (n < e->len)
+        return (unsigned char)e->name[n];
+    return n == e->len && e->is_dir ? '/' : 0;
+}
+
+// Compare as if directory names had a trailing "/". Sorting each directory
+// with this yields the strcmp() order of the full paths of all files.
+static int cmp_entry(const void *a, const void *b)
+{
+    const struct dir_entry *e1 = a, *e2 = b;
+    for (int n = 0; ; n++) {
+        int c1 = entry_char(e1, n), c2 = entry_char(e2, n);
+        if (c1 != c2 || !c1)
+            return c1 - c2;
+    }
+}
+
+static int cmp_snapshot_dir(const void *a, const void *b)
+{
+    return strcmp(((struct snapshot_dir *)a)->path,
+                  ((struct snapshot_dir *)b)->path);
+}
+
+static void load_snapshot(struct dir_scan *s)
+{
+    FILE *f = fopen(s->snapshot_file, "rb");
+    if (!f)
+        return;
+    char *data = NULL;
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) == 0)
+        size = ftell(f);
+    if (size > 0 && size < MAX_SNAPSHOT_SIZE && fseek(f, 0, SEEK_SET) == 0) {
+        data = talloc_size(s, size + 1);
+        if (fread(data, size, 1, f) != 1)
+            TA_FREEP(&data);
+    }
+    fclose(f);
+    if (!data)
+        return;
+    data[size] = '\0';
+    s->snapshot_data = data;
+
+    char *end = data + size;
+    char *pos = strchr(data, '\n');
+    long long time;
+    if (!pos || sscanf(data, SNAPSHOT_HEADER " %lld", &time) != 1)
+        goto error;
+    s->snapshot_time = time;
+    pos++;
+
+    // Records: "<mtime> <path>\0", followed by "<d|f><name>\0" per entry,
+    // terminated by an empty string.
+    while (pos < end) {
+        struct snapshot_dir d = {0};
+        char *path = strchr(pos, ' ');
+        if (!path)
+            goto error;
+        d.mtime = strtoll(pos, NULL, 10);
+        d.path = path + 1;
+        pos += strlen(pos) + 1;
+        d.entries = pos;
+        while (pos < end && pos[0]) {
+            if (pos[0] != 'd' && pos[0] != 'f')
+                goto error;
+            pos += strlen(pos) + 1;
+            d.num_entries++;
+        }
+        if (pos >= end)
+            goto error;
+        pos++;
+        MP_TARRAY_APPEND(s, s->snapshot_dirs, s->num_snapshot_dirs, d);
+    }
+
+    if (s->num_snapshot_dirs) {
+        qsort(s->snapshot_dirs, s->num_snapshot_dirs,
+              sizeof(s->snapshot_dirs[0]), cmp_snapshot_dir);
+    }
+    MP_VERBOSE(s, "Loaded directory snapshot with %d directories.\n",
+               s->num_snapshot_dirs);
+    return;
+
+error:
+    MP_WARN(s, "Ignoring invalid directory snapshot %s.\n", s->snapshot_file);
+    s->num_snapshot_dirs = 0;
+}
+
+// Take the listing from the snapshot, if the directory didn't change since.
+static bool reuse_snapshot(struct dir_scan *s, struct dir_node *node)
+{
+    struct snapshot_dir key = {.path = node->path};
+    struct snapshot_dir *d = NULL;
+    if (s->num_snapshot_dirs) {
+        d = bsearch(&key, s->snapshot_dirs, s->num_snapshot_dirs,
+                    sizeof(s->snapshot_dirs[0]), cmp_snapshot_dir);
+    }
+    // Changes within the same second as the last scan may not be visible in
+    // the mtime. (Allow for filesystems with a granularity of 2 seconds.)
+    if (!d || d->mtime != node->mtime || d->mtime + 2 >= s->snapshot_time)
+        return false;
+
+    const char *pos = d->entries;
+    for (int n = 0; n < d->num_entries; n++) {
+        add_entry(node, pos + 1, pos[0] == 'd');
+        pos += strlen(pos) + 1;
+    }
+    return true;
+}
+
+static bool is_dir_entry(struct dir_node *node, struct dirent *ep)
+{
+#ifdef DT_DIR
+    // Avoid the stat() call if the filesystem reports the type.
+    if (ep->d_type == DT_DIR)
+        return true;
+    if (ep->d_type == DT_REG)
+        return false;
+#endif
+    char *file = mp_path_join(NULL, node->path, ep->d_name);
+    struct stat st;
+    bool res = stat(file, &st) == 0 && S_ISDIR(st.st_mode);
+    talloc_free(file);
+    return res;
+}
+
+static bool read_dir(struct dir_scan *s, struct dir_node *node)
+{
+    DIR *dp = opendir(node->path);
+    if (!dp) {
+        MP_ERR(s, "Could not read directory %s.\n", node->path);
+        return false;
+    }
+
+    void *names = talloc_new_arena(node);
+    struct dirent *ep;
+    while ((ep = readdir(dp))) {
+        if (ep->d_name[0] == '.')
+            continue;
+        if (mp_cancel_test(s->cancel))
+            break;
+        add_entry(node, talloc_strdup(names, ep->d_name),
+                  is_dir_entry(node, ep));
+    }
+
+    closedir(dp);
+    return true;
+}
+
+static void scan_node(void *ctx);
+
+static void list_dir(struct dir_scan *s, struct dir_node *node)
+{
+    if (strlen(node->path) >= 8192 || node->depth >= MAX_DEPTH)
+        return; // things like mount bind loops
+
+    struct stat st;
+    if (stat(node->path, &st) != 0) {
+        MP_ERR(s, "Could not read directory %s.\n", node->path);
+        return;
+    }
+    for (struct dir_node *cur = node->parent; cur; cur = cur->parent) {
+        if (cur->dev == st.st_dev && cur->ino == st.st_ino) {
+            MP_VERBOSE(s, "Skip recursive entry: %s\n", node->path);
+            return;
+        }
+    }
+    node->dev = st.st_dev;
+    node->ino = st.st_ino;
+    node->mtime = st.st_mtime;
+
+    if (!reuse_snapshot(s, node) && !read_dir(s, node))
+        return;
+    node->listed = !mp_cancel_test(s->cancel);
+
+    if (node->num_entries) {
+        qsort(node->entries, node->num_entries, sizeof(node->entries[0]),
+              cmp_entry);
+    }
+
+    // Queued in reverse, because a worker runs the items it queued itself in
+    // LIFO order, and the reader needs the first directory first. Idle workers
+    // steal from the other end.
+    for (int n = node->num_entries - 1; n >= 0; n--) {
+        struct dir_entry *e = &node->entries[n];
+        if (!e->is_dir)
+            continue;
+        struct dir_node *child = talloc_zero(node, struct dir_node);
+        *child = (struct dir_node){
+            .scan = s,
+            .parent = node,
+            .path = mp_path_join(child, node->path, e->name),
+            .depth = node->depth + 1,
+        };
+        e->dir = child;
+        mp_task_group_add(s->group, scan_node, child);
+    }
+}
+
+static void scan_node(void *ctx)
+{
+    struct dir_node *node = ctx;
+    struct dir_scan *s = node->scan;
+
+    if (!mp_cancel_test(s->cancel))
+        list_dir(s, node);
+
+    pthread_mutex_lock(&s->lock);
+    node->done = true;
+    pthread_cond_broadcast(&s->wakeup);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void write_node(bstr *buf, struct dir_node *node)
+{
+    if (!node->listed)
+        return;
+    bstr_xappend_asprintf(NULL, buf, "%"PRId64" %s", node->mtime, node->path);
+    bstr_xappend(NULL, buf, (bstr){"", 1});
+    for (int n = 0; n < node->num_entries; n++) {
+        struct dir_entry *e = &node->entries[n];
+        bstr_xappend(NULL, buf, bstr0(e->is_dir ? "d" : "f"));
+        bstr_xappend(NULL, buf, (bstr){(char *)e->name, e->len + 1});
+    }
+    bstr_xappend(NULL, buf, (bstr){"", 1});
+    for (int n = 0; n < node->num_entries; n++) {
+        if (node->entries[n].dir)
+            write_node(buf, node->entries[n].dir);
+    }
+}
+
+static void write_snapshot(struct dir_scan *s)
+{
+    bstr buf = {0};
+    bstr_xappend_asprintf(NULL, &buf, SNAPSHOT_HEADER " %"PRId64"\n",
+                          s->start_time);
+    write_node(&buf, s->root);
+
+    // Replace the old file atomically, in case of concurrent scans.
+    char *tmp = talloc_asprintf(NULL, "%s.%p.tmp", s->snapshot_file, (void *)s);
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f && fwrite(buf.start, buf.len, 1, f) == 1;
+    if (f)
+        ok = fclose(f) == 0 && ok;
+    if (ok && rename(tmp, s->snapshot_file) == 0) {
+        MP_VERBOSE(s, "Wrote directory snapshot %s.\n", s->snapshot_file);
+    } else {
+        MP_WARN(s, "Could not write directory snapshot %s.\n",
+                s->snapshot_file);
+        if (f)
+            unlink(tmp);
+    }
+    talloc_free(tmp);
+    talloc_free(buf.start);
+}
+
+static void cancel_cb(void *ctx)
+{
+    struct dir_scan *s = ctx;
+    pthread_mutex_lock(&s->lock);
+    pthread_cond_broadcast(&s->wakeup);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void destroy_scan(void *ptr)
+{
+    struct dir_scan *s = ptr;
+    mp_cancel_trigger(s->cancel);
+    TA_FREEP(&s->group);
+    TA_FREEP(&s->cancel);
+    pthread_cond_destroy(&s->wakeup);
+    pthread_mutex_destroy(&s->lock);
+}
+
+struct dir_scan *dir_scan_create(void *ta_parent, struct mp_log *log,
+                                 struct mp_thread_pool *pool,
+                                 const char *path, const char *snapshot)
+{
+    struct dir_scan *s = talloc_zero(ta_parent, struct dir_scan);
+    // The scan can outlive the caller's log (e.g. the demuxer's).
+    s->log = mp_log_new(s, log, NULL);
+    s->start_time = time(NULL);
+    s->cancel = mp_cancel_new(s);
+    s->group = mp_task_group_create(s, pool);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->wakeup, NULL);
+    talloc_set_destructor(s, destroy_scan);
+    mp_cancel_set_cb(s->cancel, cancel_cb, s);
+
+    if (snapshot) {
+        s->snapshot_file = talloc_strdup(s, snapshot);
+        load_snapshot(s);
+    }
+
+    s->root = talloc_zero(s, struct dir_node);
+    s->root->scan = s;
+    s->root->path = talloc_strdup(s->root, path);
+    MP_TARRAY_APPEND(s, s->stack, s->num_stack, (struct iter_pos){s->root});
+    mp_task_group_add(s->group, scan_node, s->root);
+    return s;
+}
+
+void dir_scan_set_cancel(struct dir_scan *s, struct mp_cancel *cancel)
+{
+    mp_cancel_set_parent(s->cancel, cancel);
+}
+
+const char *dir_scan_next(struct dir_scan *s)
+{
+    TA_FREEP(&s->cur);
+
+    while (s->num_stack) {
+        struct iter_pos *pos = &s->stack[s->num_stack - 1];
+        struct dir_node *node = pos->node;
+
+        pthread_mutex_lock(&s->lock);
+        while (!node->done && !mp_cancel_test(s->cancel))
+            pthread_cond_wait(&s->wakeup, &s->lock);
+        bool done = node->done;
+        pthread_mutex_unlock(&s->lock);
+        if (!done) {
+            s->num_stack = 0;
+            return NULL;
+        }
+
+        if (pos->index >= node->num_entries) {
+            s->num_stack--;
+            continue;
+        }
+        struct dir_entry *e = &node->entries[pos->index++];
+        if (e->dir) {
+            MP_TARRAY_APPEND(s, s->stack, s->num_stack, (struct iter_pos){e->dir});
+            continue;
+        }
+        s->cur = mp_path_join(s, node->path, e->name);
+        return s->cur;
+    }
+
+    if (!s->finished) {
+        s->finished = true;
+        if (s->snapshot_file && !mp_cancel_test(s->cancel))
+            write_snapshot(s);
+    }
+    return NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef MP_DIR_SCAN_H_
+#define MP_DIR_SCAN_H_
+
+struct mp_log;
+struct mp_cancel;
+struct mp_thread_pool;
+struct dir_scan;
+
+// Start scanning the directory at path recursively. Subdirectories are scanned
+// in parallel as a task group on pool (which must outlive the scan), while the
+// caller reads the results with dir_scan_next(). Hidden entries (starting with ".") are skipped.
+// snapshot is the name of a file, which is used to remember the directory
+// listings (validated by directory mtimes), so that directories that didn't
+// change don't need to be read again. It can be NULL.
+// Freeing the returned object (with talloc_free()) stops the scan.
+struct dir_scan *dir_scan_create(void *ta_parent, struct mp_log *log,
+                                 struct mp_thread_pool *pool,
+                                 const char *path, const char *snapshot);
+
+// Abort the scan when cancel is triggered. cancel must stay valid until this
+// is called again with NULL, or the scan is freed.
+void dir_scan_set_cancel(struct dir_scan *s, struct mp_cancel *cancel);
+
+// Return the path of the next file, or NULL if there are no more files. Files
+// are returned in the order of their full paths (as in strcmp()). This waits
+// until the directory containing the next file has been scanned. The returned
+// string is valid until the next call.
+// If the scan was complete, the snapshot file is updated on the last call.
+const char *dir_scan_next(struct dir_scan *s);
+
+#endif
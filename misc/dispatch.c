@@ -19,12 +19,25 @@
 #include <assert.h>
 
 #include "common/common.h"
+#include "common/perf_counters.h"
+#include "common/tracing.h"
+#include "osdep/atomic.h"
 #include "osdep/threads.h"
 #include "osdep/timer.h"
 
 #include "dispatch.h"
 
 struct mp_dispatch_queue {
+    // Items are pushed to the inbox without taking the lock. It's a LIFO
+    // list, which is moved to the head/tail list (in FIFO order) with the
+    // lock held (see drain_inbox()).
+    mp_atomic_ptr inbox;
+    // mp_dispatch_interrupt() was called (moved to interrupted with the lock
+    // held).
+    atomic_bool interrupt_pending;
+    // The target thread is (about to be) waiting for the condition. Senders
+    // only need to take the lock to signal it if this is set.
+    atomic_bool sleeping;
     struct mp_dispatch_item *head, *tail;
     pthread_mutex_t lock;
     pthread_cond_t cond;
@@ -62,6 +75,7 @@ static void queue_dtor(void *p)
 {
     struct mp_dispatch_queue *queue = p;
     assert(!queue->head);
+    assert(!atomic_load(&queue->inbox));
     assert(!queue->in_process);
     assert(!queue->lock_requests);
     assert(!queue->locked);
@@ -104,11 +118,62 @@ void mp_dispatch_set_wakeup_fn(struct mp_dispatch_queue *queue,
     queue->wakeup_ctx = wakeup_ctx;
 }
 
+static void append_locked(struct mp_dispatch_queue *queue,
+                          struct mp_dispatch_item *item)
+{
+    if (queue->tail) {
+        queue->tail->next = item;
+    } else {
+        queue->head = item;
+    }
+    queue->tail = item;
+    // No wakeup callback -> assume mp_dispatch_queue_process() needs to be
+    // interrupted instead.
+    if (!queue->wakeup_fn)
+        queue->interrupted = true;
+}
+
+// Move the items pushed by mp_dispatch_append() to the locked list, and apply
+// pending mp_dispatch_interrupt() calls. Must be called with the lock held.
+static void drain_inbox(struct mp_dispatch_queue *queue)
+{
+    if (atomic_load(&queue->interrupt_pending) &&
+        atomic_exchange(&queue->interrupt_pending, false))
+        queue->interrupted = true;
+
+    if (!atomic_load(&queue->inbox))
+        return;
+    struct mp_dispatch_item *newest = atomic_exchange(&queue->inbox, NULL);
+    // Reverse the LIFO list, and append it.
+    struct mp_dispatch_item *list = NULL, *cur = newest;
+    while (cur) {
+        struct mp_dispatch_item *next = cur->next;
+        cur->next = list;
+        list = cur;
+        cur = next;
+    }
+    append_locked(queue, list);
+    queue->tail = newest;
+}
+
+// Wake up the target thread if it's waiting in mp_dispatch_queue_process().
+// Must be called after making the reason visible (inbox or interrupt_pending).
+static void wakeup_sleeping(struct mp_dispatch_queue *queue)
+{
+    if (atomic_load(&queue->sleeping)) {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_broadcast(&queue->cond);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
 static void mp_dispatch_append(struct mp_dispatch_queue *queue,
                                struct mp_dispatch_item *item)
 {
-    pthread_mutex_lock(&queue->lock);
     if (item->mergeable) {
+        // Needs to look at the queued items, so take the slow path.
+        pthread_mutex_lock(&queue->lock);
+        drain_inbox(queue);
         for (struct mp_dispatch_item *cur = queue->head; cur; cur = cur->next) {
             if (cur->mergeable && cur->fn == item->fn &&
                 cur->fn_data == item->fn_data)
@@ -118,23 +183,21 @@ static void mp_dispatch_append(struct mp_dispatch_queue *queue,
                 return;
             }
         }
-    }
-
-    if (queue->tail) {
-        queue->tail->next = item;
+        append_locked(queue, item);
+        // Wake up the main thread; note that other threads might wait on this
+        // condition for reasons, so broadcast the condition.
+        pthread_cond_broadcast(&queue->cond);
+        pthread_mutex_unlock(&queue->lock);
     } else {
-        queue->head = item;
+        void *head = atomic_load(&queue->inbox);
+        do {
+            item->next = head;
+        } while (!atomic_compare_exchange_strong(&queue->inbox, &head, item));
+        // If the inbox wasn't empty, the thread that made it non-empty
+        // already took care of the wakeup.
+        if (!head)
+            wakeup_sleeping(queue);
     }
-    queue->tail = item;
-
-    // Wake up the main thread; note that other threads might wait on this
-    // condition for reasons, so broadcast the condition.
-    pthread_cond_broadcast(&queue->cond);
-    // No wakeup callback -> assume mp_dispatch_queue_process() needs to be
-    // interrupted instead.
-    if (!queue->wakeup_fn)
-        queue->interrupted = true;
-    pthread_mutex_unlock(&queue->lock);
 
     if (queue->wakeup_fn)
         queue->wakeup_fn(queue->wakeup_ctx);
@@ -200,6 +263,7 @@ void mp_dispatch_cancel_fn(struct mp_dispatch_queue *queue,
                            mp_dispatch_fn fn, void *fn_data)
 {
     pthread_mutex_lock(&queue->lock);
+    drain_inbox(queue);
     struct mp_dispatch_item **pcur = &queue->head;
     queue->tail = NULL;
     while (*pcur) {
@@ -261,6 +325,7 @@ void mp_dispatch_queue_process(struct mp_dispatch_queue *queue, double timeout)
     if (queue->lock_requests)
         pthread_cond_broadcast(&queue->cond);
     while (1) {
+        drain_inbox(queue);
         if (queue->lock_requests) {
             // Block due to something having called mp_dispatch_lock().
             pthread_cond_wait(&queue->cond, &queue->lock);
@@ -291,9 +356,17 @@ void mp_dispatch_queue_process(struct mp_dispatch_queue *queue, double timeout)
                 item->completed = true;
             }
         } else if (queue->wait > 0 && !queue->interrupted) {
-            struct timespec ts = mp_time_us_to_timespec(queue->wait);
-            if (pthread_cond_timedwait(&queue->cond, &queue->lock, &ts))
-                queue->wait = 0;
+            // Senders check sleeping after pushing, so either they see it
+            // and signal the condition, or we see their item here.
+            atomic_store(&queue->sleeping, true);
+            if (!atomic_load(&queue->inbox) &&
+                !atomic_load(&queue->interrupt_pending))
+            {
+                struct timespec ts = mp_time_us_to_timespec(queue->wait);
+                if (pthread_cond_timedwait(&queue->cond, &queue->lock, &ts))
+                    queue->wait = 0;
+            }
+            atomic_store(&queue->sleeping, false);
         } else {
             break;
         }
@@ -312,10 +385,8 @@ void mp_dispatch_queue_process(struct mp_dispatch_queue *queue, double timeout)
 // wakeup the main thread from another thread in a race free way).
 void mp_dispatch_interrupt(struct mp_dispatch_queue *queue)
 {
-    pthread_mutex_lock(&queue->lock);
-    queue->interrupted = true;
-    pthread_cond_broadcast(&queue->cond);
-    pthread_mutex_unlock(&queue->lock);
+    if (!atomic_exchange(&queue->interrupt_pending, true))
+        wakeup_sleeping(queue);
 }
 
 // If a mp_dispatch_queue_process() call is in progress, then adjust the maximum
@@ -345,6 +416,8 @@ void mp_dispatch_adjust_timeout(struct mp_dispatch_queue *queue, int64_t until)
 // already holding the dispatch lock.
 void mp_dispatch_lock(struct mp_dispatch_queue *queue)
 {
+    mp_tracing_begin("dispatch lock wait");
+    int64_t wait_start = mp_time_us();
     pthread_mutex_lock(&queue->lock);
     // Must not be called recursively from dispatched callbacks.
     if (queue->in_process)
@@ -376,6 +449,8 @@ void mp_dispatch_lock(struct mp_dispatch_queue *queue)
     queue->locked_explicit = true;
     queue->locked_explicit_thread = pthread_self();
     pthread_mutex_unlock(&queue->lock);
+    mp_perf_add(MP_PERF_LOCK_WAIT_US, mp_time_us() - wait_start);
+    mp_tracing_end("dispatch lock wait");
 }
 
 // Undo mp_dispatch_lock().
@@ -35,6 +35,10 @@
  *
  * Doesn't insert whitespace. It's literally a waste of space.
  *
+ * Doubles are written with (nearly always) the fewest digits that parse back
+ * to the same value, and always with a "." or exponent, so they are read back
+ * as doubles.
+ *
  * Can output invalid UTF-8, if input is invalid UTF-8. Consumers are supposed
  * to deal with somehow: either by using byte-strings for JSON, or by running
  * a "fixup" pass on the input data. The latter could for example change
@@ -54,6 +58,140 @@
 
 #include "json.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_JSON_SIMD 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_JSON_SIMD 1
+#else
+#define HAVE_JSON_SIMD 0
+#endif
+
+// What scan() looks for. All of them stop at '\0'.
+enum scan_mode {
+    SCAN_STR,       // '"' or '\\'
+    SCAN_NON_WS,    // anything that is not JSON whitespace
+    SCAN_ESCAPE,    // anything the writer has to escape
+};
+
+static inline bool is_ws(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+#if HAVE_JSON_SIMD
+
+// The vector loads below are 16 byte aligned, so they never cross a page
+// boundary, but they may read past the end of the string's allocation.
+#define NO_ASAN __attribute__((no_sanitize_address))
+
+#if defined(__SSE2__)
+
+#define MASK_BITS 1 // bits per byte in block_mask()'s result
+
+// Return a bit mask of the matching bytes in the 16 byte block at p.
+static inline NO_ASAN uint64_t block_mask(const unsigned char *p,
+                                          enum scan_mode mode)
+{
+    __m128i v = _mm_load_si128((const __m128i *)p);
+    __m128i m;
+    switch (mode) {
+    case SCAN_STR:
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+        return _mm_movemask_epi8(m);
+    case SCAN_NON_WS:
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+        return ~_mm_movemask_epi8(m) & 0xFFFF;
+    case SCAN_ESCAPE:
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        // unsigned v < 32
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(31)), v));
+        return _mm_movemask_epi8(m);
+    }
+    abort();
+}
+
+#else
+
+#define MASK_BITS 4
+
+static inline NO_ASAN uint64_t block_mask(const unsigned char *p,
+                                          enum scan_mode mode)
+{
+    uint8x16_t v = vld1q_u8(p);
+    uint8x16_t m;
+    switch (mode) {
+    case SCAN_STR:
+        m = vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\')));
+        m = vorrq_u8(m, vceqzq_u8(v));
+        break;
+    case SCAN_NON_WS:
+        m = vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\t')));
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\n')));
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\r')));
+        m = vmvnq_u8(m);
+        break;
+    case SCAN_ESCAPE:
+        m = vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\')));
+        m = vorrq_u8(m, vcltq_u8(v, vdupq_n_u8(32)));
+        break;
+    default:
+        abort();
+    }
+    // Narrow each byte to 4 bits.
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(n), 0);
+}
+
+#endif
+
+// Return a pointer to the first byte at or after s that matches mode.
+static NO_ASAN const unsigned char *scan(const unsigned char *s,
+                                         enum scan_mode mode)
+{
+    size_t offset = (uintptr_t)s & 15;
+    const unsigned char *p = s - offset;
+    uint64_t m = block_mask(p, mode) >> (offset * MASK_BITS);
+    if (m)
+        return s + __builtin_ctzll(m) / MASK_BITS;
+    while (1) {
+        p += 16;
+        m = block_mask(p, mode);
+        if (m)
+            return p + __builtin_ctzll(m) / MASK_BITS;
+    }
+}
+
+#else
+
+static const unsigned char *scan(const unsigned char *s, enum scan_mode mode)
+{
+    switch (mode) {
+    case SCAN_STR:
+        while (*s && *s != '"' && *s != '\\')
+            s++;
+        break;
+    case SCAN_NON_WS:
+        while (is_ws(*s))
+            s++;
+        break;
+    case SCAN_ESCAPE:
+        while (*s >= 32 && *s != '"' && *s != '\\')
+            s++;
+        break;
+    }
+    return s;
+}
+
+#endif
+
 static bool eat_c(char **s, char c)
 {
     if (**s == c) {
@@ -65,12 +203,12 @@ static bool eat_c(char **s, char c)
 
 static void eat_ws(char **src)
 {
-    while (1) {
-        char c = **src;
-        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
-            return;
-        *src += 1;
-    }
+    // Most of the time, there's at most 1 whitespace character.
+    if (!is_ws(**src))
+        return;
+    *src += 1;
+    if (is_ws(**src))
+        *src = (char *)scan((unsigned char *)*src, SCAN_NON_WS);
 }
 
 void json_skip_whitespace(char **src)
@@ -103,13 +241,14 @@ static int read_str(void *ta_parent, struct mpv_node *dst, char **src)
     char *str = *src;
     char *cur = str;
     bool has_escapes = false;
-    while (cur[0] && cur[0] != '"') {
-        if (cur[0] == '\\') {
-            has_escapes = true;
-            // skip >\"< and >\\< (latter to handle >\\"< correctly)
-            if (cur[1] == '"' || cur[1] == '\\')
-                cur++;
-        }
+    while (1) {
+        cur = (char *)scan((unsigned char *)cur, SCAN_STR);
+        if (cur[0] != '\\')
+            break;
+        has_escapes = true;
+        // skip >\"< and >\\< (latter to handle >\\"< correctly)
+        if (cur[1] == '"' || cur[1] == '\\')
+            cur++;
         cur++;
     }
     if (cur[0] != '"')
@@ -221,6 +360,13 @@ int json_parse(void *ta_parent, struct mpv_node *dst, char **src, int max_depth)
         long long int numi = strtoll(*src, &nsrci, 0);
         if (errno)
             nsrci = *src;
+        // Skip strtod() if the number obviously ends here.
+        if (nsrci > *src && !mp_isalnum(*nsrci) && *nsrci != '.') {
+            *src = nsrci;
+            dst->format = MPV_FORMAT_INT64;
+            dst->u.int64 = numi;
+            return 0;
+        }
         errno = 0;
         double numf = strtod(*src, &nsrcf);
         if (errno)
@@ -244,6 +390,7 @@ int json_parse(void *ta_parent, struct mpv_node *dst, char **src, int max_depth)
 
 
 #define APPEND(b, s) bstr_xappend(NULL, (b), bstr0(s))
+#define APPEND_C(b, s) bstr_xappend(NULL, (b), (bstr){(s), sizeof(s) - 1})
 
 static const char special_escape[] = {
     ['\b'] = 'b',
@@ -255,27 +402,277 @@ static const char special_escape[] = {
 
 static void write_json_str(bstr *b, unsigned char *str)
 {
-    APPEND(b, "\"");
+    APPEND_C(b, "\"");
     while (1) {
-        unsigned char *cur = str;
-        while (cur[0] >= 32 && cur[0] != '"' && cur[0] != '\\')
-            cur++;
+        unsigned char *cur = (unsigned char *)scan(str, SCAN_ESCAPE);
+        bstr_xappend(NULL, b, (bstr){str, cur - str});
         if (!cur[0])
             break;
-        bstr_xappend(NULL, b, (bstr){str, cur - str});
-        if (cur[0] == '\"') {
-            bstr_xappend(NULL, b, (bstr){"\\\"", 2});
-        } else if (cur[0] == '\\') {
-            bstr_xappend(NULL, b, (bstr){"\\\\", 2});
-        } else if (cur[0] < sizeof(special_escape) && special_escape[cur[0]]) {
-            bstr_xappend_asprintf(NULL, b, "\\%c", special_escape[cur[0]]);
-        } else {
-            bstr_xappend_asprintf(NULL, b, "\\u%04x", (unsigned char)cur[0]);
+        char buf[6] = {'\\', cur[0]};
+        int len = 2;
+        if (cur[0] < sizeof(special_escape) && special_escape[cur[0]]) {
+            buf[1] = special_escape[cur[0]];
+        } else if (cur[0] < 32) {
+            static const char hex[] = "0123456789abcdef";
+            memcpy(buf + 1, "u00", 3);
+            buf[4] = hex[cur[0] >> 4];
+            buf[5] = hex[cur[0] & 15];
+            len = 6;
         }
+        bstr_xappend(NULL, b, (bstr){buf, len});
         str = cur + 1;
     }
-    APPEND(b, str);
-    APPEND(b, "\"");
+    APPEND_C(b, "\"");
+}
+
+// Write v to buf (which must have at least 24 bytes), and return the length.
+static int format_int64(char *buf, int64_t v)
+{
+    char tmp[24];
+    int len = 0;
+    uint64_t u = v < 0 ? -(uint64_t)v : v;
+    do {
+        tmp[len++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    int n = 0;
+    if (v < 0)
+        buf[n++] = '-';
+    while (len)
+        buf[n++] = tmp[--len];
+    return n;
+}
+
+// Double to string conversion with the Grisu2 algorithm, see:
+//   Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+//   with Integers", PLDI 2010
+// The output always parses back to the same value, and is the shortest such
+// representation in almost all cases.
+
+struct diy_fp {
+    uint64_t f;
+    int e;
+};
+
+// 10^k as diy_fp, for k = -348, -340, ..., 340.
+static const struct diy_fp cached_powers[] = {
+    {0xfa8fd5a0081c0288, -1220}, {0xbaaee17fa23ebf76, -1193},
+    {0x8b16fb203055ac76, -1166}, {0xcf42894a5dce35ea, -1140},
+    {0x9a6bb0aa55653b2d, -1113}, {0xe61acf033d1a45df, -1087},
+    {0xab70fe17c79ac6ca, -1060}, {0xff77b1fcbebcdc4f, -1034},
+    {0xbe5691ef416bd60c, -1007}, {0x8dd01fad907ffc3c, -980},
+    {0xd3515c2831559a83, -954}, {0x9d71ac8fada6c9b5, -927},
+    {0xea9c227723ee8bcb, -901}, {0xaecc49914078536d, -874},
+    {0x823c12795db6ce57, -847}, {0xc21094364dfb5637, -821},
+    {0x9096ea6f3848984f, -794}, {0xd77485cb25823ac7, -768},
+    {0xa086cfcd97bf97f4, -741}, {0xef340a98172aace5, -715},
+    {0xb23867fb2a35b28e, -688}, {0x84c8d4dfd2c63f3b, -661},
+    {0xc5dd44271ad3cdba, -635}, {0x936b9fcebb25c996, -608},
+    {0xdbac6c247d62a584, -582}, {0xa3ab66580d5fdaf6, -555},
+    {0xf3e2f893dec3f126, -529}, {0xb5b5ada8aaff80b8, -502},
+    {0x87625f056c7c4a8b, -475}, {0xc9bcff6034c13053, -449},
+    {0x964e858c91ba2655, -422}, {0xdff9772470297ebd, -396},
+    {0xa6dfbd9fb8e5b88f, -369}, {0xf8a95fcf88747d94, -343},
+    {0xb94470938fa89bcf, -316}, {0x8a08f0f8bf0f156b, -289},
+    {0xcdb02555653131b6, -263}, {0x993fe2c6d07b7fac, -236},
+    {0xe45c10c42a2b3b06, -210}, {0xaa242499697392d3, -183},
+    {0xfd87b5f28300ca0e, -157}, {0xbce5086492111aeb, -130},
+    {0x8cbccc096f5088cc, -103}, {0xd1b71758e219652c, -77},
+    {0x9c40000000000000, -50}, {0xe8d4a51000000000, -24},
+    {0xad78ebc5ac620000, 3}, {0x813f3978f8940984, 30},
+    {0xc097ce7bc90715b3, 56}, {0x8f7e32ce7bea5c70, 83},
+    {0xd5d238a4abe98068, 109}, {0x9f4f2726179a2245, 136},
+    {0xed63a231d4c4fb27, 162}, {0xb0de65388cc8ada8, 189},
+    {0x83c7088e1aab65db, 216}, {0xc45d1df942711d9a, 242},
+    {0x924d692ca61be758, 269}, {0xda01ee641a708dea, 295},
+    {0xa26da3999aef774a, 322}, {0xf209787bb47d6b85, 348},
+    {0xb454e4a179dd1877, 375}, {0x865b86925b9bc5c2, 402},
+    {0xc83553c5c8965d3d, 428}, {0x952ab45cfa97a0b3, 455},
+    {0xde469fbd99a05fe3, 481}, {0xa59bc234db398c25, 508},
+    {0xf6c69a72a3989f5c, 534}, {0xb7dcbf5354e9bece, 561},
+    {0x88fcf317f22241e2, 588}, {0xcc20ce9bd35c78a5, 614},
+    {0x98165af37b2153df, 641}, {0xe2a0b5dc971f303a, 667},
+    {0xa8d9d1535ce3b396, 694}, {0xfb9b7cd9a4a7443c, 720},
+    {0xbb764c4ca7a44410, 747}, {0x8bab8eefb6409c1a, 774},
+    {0xd01fef10a657842c, 800}, {0x9b10a4e5e9913129, 827},
+    {0xe7109bfba19c0c9d, 853}, {0xac2820d9623bf429, 880},
+    {0x80444b5e7aa7cf85, 907}, {0xbf21e44003acdd2d, 933},
+    {0x8e679c2f5e44ff8f, 960}, {0xd433179d9c8cb841, 986},
+    {0x9e19db92b4e31ba9, 1013}, {0xeb96bf6ebadf77d9, 1039},
+    {0xaf87023b9bf0ee6b, 1066},
+};
+
+static const uint64_t pow10_u64[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+static struct diy_fp fp_mul(struct diy_fp a, struct diy_fp b)
+{
+    uint64_t m32 = 0xFFFFFFFFu;
+    uint64_t ah = a.f >> 32, al = a.f & m32, bh = b.f >> 32, bl = b.f & m32;
+    uint64_t hh = ah * bh, lh = al * bh, hl = ah * bl, ll = al * bl;
+    uint64_t tmp = (ll >> 32) + (hl & m32) + (lh & m32) + (1U << 31);
+    return (struct diy_fp){hh + (hl >> 32) + (lh >> 32) + (tmp >> 32),
+                           a.e + b.e + 64};
+}
+
+static struct diy_fp fp_normalize(struct diy_fp v)
+{
+    int shift = __builtin_clzll(v.f);
+    return (struct diy_fp){v.f << shift, v.e - shift};
+}
+
+// Round the last digit towards w, as long as it stays within the boundaries.
+static void grisu_round(char *buf, int len, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+// Write the decimal digits of v to buf, and return the number of digits. The
+// value is digits * 10^*k. v must be finite and > 0.
+static int grisu2(double v, char *buf, int *k)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    uint64_t hidden = 1ULL << 52;
+    int biased_e = (bits >> 52) & 0x7FF;
+    struct diy_fp w = {bits & (hidden - 1), -1074};
+    if (biased_e) {
+        w.f += hidden;
+        w.e = biased_e - 1075;
+    }
+
+    // Boundaries halfway to the neighbouring doubles.
+    struct diy_fp plus = fp_normalize((struct diy_fp){(w.f << 1) + 1, w.e - 1});
+    struct diy_fp minus = w.f == hidden && biased_e > 1
+        ? (struct diy_fp){(w.f << 2) - 1, w.e - 2}
+        : (struct diy_fp){(w.f << 1) - 1, w.e - 1};
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    // Scale by a cached power of 10, so that the exponent is in [-60, -32].
+    double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    int ki = (int)dk;
+    if (dk - ki > 0.0)
+        ki++;
+    int index = (ki >> 3) + 1;
+    *k = -(-348 + index * 8);
+    struct diy_fp c = cached_powers[index];
+
+    struct diy_fp W = fp_mul(fp_normalize(w), c);
+    struct diy_fp Wp = fp_mul(plus, c);
+    struct diy_fp Wm = fp_mul(minus, c);
+    Wm.f++;
+    Wp.f--;
+
+    // Generate digits of Wp until they're within delta of it.
+    uint64_t delta = Wp.f - Wm.f;
+    uint64_t wp_w = Wp.f - W.f;
+    int one_e = -Wp.e;
+    uint64_t one_f = 1ULL << one_e;
+    uint32_t p1 = Wp.f >> one_e;
+    uint64_t p2 = Wp.f & (one_f - 1);
+    int kappa = 1;
+    while (kappa < 10 && p1 >= pow10_u64[kappa])
+        kappa++;
+    int len = 0;
+    while (kappa > 0) {
+        uint32_t d = p1 / pow10_u64[kappa - 1];
+        p1 %= pow10_u64[kappa - 1];
+        if (d || len)
+            buf[len++] = '0' + d;
+        kappa--;
+        uint64_t rest = ((uint64_t)p1 << one_e) + p2;
+        if (rest <= delta) {
+            *k += kappa;
+            grisu_round(buf, len, delta, rest, pow10_u64[kappa] << one_e, wp_w);
+            return len;
+        }
+    }
+    while (1) {
+        p2 *= 10;
+        delta *= 10;
+        int d = p2 >> one_e;
+        if (d || len)
+            buf[len++] = '0' + d;
+        p2 &= one_f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            grisu_round(buf, len, delta, p2, one_f,
+                        wp_w * (-kappa < 20 ? pow10_u64[-kappa] : 0));
+            return len;
+        }
+    }
+}
+
+// Write v to buf (which must have at least 32 bytes), and return the length.
+// The result always contains a "." or an exponent, so that it's parsed back
+// as double. Infinities and NaN are written as by printf.
+static int format_double(char *buf, double v)
+{
+    if (!isfinite(v))
+        return snprintf(buf, 32, "%f", v);
+    int len = 0;
+    if (signbit(v)) {
+        buf[len++] = '-';
+        v = -v;
+    }
+    if (v == 0) {
+        memcpy(buf + len, "0.0", 4);
+        return len + 3;
+    }
+
+    char digits[24];
+    int k;
+    int num = grisu2(v, digits, &k);
+    int point = num + k; // position of the decimal point relative to digits
+
+    if (k >= 0 && point <= 21) {
+        // 1234e7 -> 12340000000.0
+        memcpy(buf + len, digits, num);
+        len += num;
+        memset(buf + len, '0', k);
+        len += k;
+        memcpy(buf + len, ".0", 2);
+        len += 2;
+    } else if (point > 0 && point <= 21) {
+        // 1234e-2 -> 12.34
+        memcpy(buf + len, digits, point);
+        len += point;
+        buf[len++] = '.';
+        memcpy(buf + len, digits + point, num - point);
+        len += num - point;
+    } else if (point > -6 && point <= 0) {
+        // 1234e-6 -> 0.001234
+        memcpy(buf + len, "0.", 2);
+        len += 2;
+        memset(buf + len, '0', -point);
+        len += -point;
+        memcpy(buf + len, digits, num);
+        len += num;
+    } else {
+        // 1234e30 -> 1.234e+33
+        buf[len++] = digits[0];
+        if (num > 1) {
+            buf[len++] = '.';
+            memcpy(buf + len, digits + 1, num - 1);
+            len += num - 1;
+        }
+        len += snprintf(buf + len, 32 - len, "e%+d", point - 1);
+    }
+    buf[len] = '\0';
+    return len;
 }
 
 static void add_indent(bstr *b, int indent)
@@ -289,18 +686,19 @@ static void add_indent(bstr *b, int indent)
 
 static int json_append(bstr *b, const struct mpv_node *src, int indent)
 {
+    char buf[32];
     switch (src->format) {
     case MPV_FORMAT_NONE:
-        APPEND(b, "null");
+        APPEND_C(b, "null");
         return 0;
     case MPV_FORMAT_FLAG:
         APPEND(b, src->u.flag ? "true" : "false");
         return 0;
     case MPV_FORMAT_INT64:
-        bstr_xappend_asprintf(NULL, b, "%"PRId64, src->u.int64);
+        bstr_xappend(NULL, b, (bstr){buf, format_int64(buf, src->u.int64)});
         return 0;
     case MPV_FORMAT_DOUBLE:
-        bstr_xappend_asprintf(NULL, b, "%f", src->u.double_);
+        bstr_xappend(NULL, b, (bstr){buf, format_double(buf, src->u.double_)});
         return 0;
     case MPV_FORMAT_STRING:
         write_json_str(b, src->u.string);
@@ -313,11 +711,11 @@ static int json_append(bstr *b, const struct mpv_node *src, int indent)
         int next_indent = indent >= 0 ? indent + 1 : -1;
         for (int n = 0; n < list->num; n++) {
             if (n)
-                APPEND(b, ",");
+                APPEND_C(b, ",");
             add_indent(b, next_indent);
             if (is_obj) {
                 write_json_str(b, list->keys[n]);
-                APPEND(b, ":");
+                APPEND_C(b, ":");
             }
             json_append(b, &list->values[n], next_indent);
         }
@@ -352,3 +750,13 @@ int json_write_pretty(char **dst, struct mpv_node *src)
 {
     return json_append_str(dst, src, 0);
 }
+
+/* Same as json_write(), but append to a bstr (whose start is a talloc
+ * allocation or NULL, see bstr_xappend()). Unlike json_write(), this doesn't
+ * need a strlen() per call, and the buffer can be reused for multiple writes
+ * by setting dst->len to 0.
+ */
+int json_write_bstr(bstr *dst, struct mpv_node *src)
+{
+    return json_append(dst, src, -1);
+}
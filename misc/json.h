@@ -20,10 +20,12 @@
 
 // We reuse mpv_node.
 #include "libmpa/client.h"
+#include "misc/bstr.h"
 
 int json_parse(void *ta_parent, struct mpv_node *dst, char **src, int max_depth);
 void json_skip_whitespace(char **src);
 int json_write(char **s, struct mpv_node *src);
 int json_write_pretty(char **s, struct mpv_node *src);
+int json_write_bstr(bstr *dst, struct mpv_node *src);
 
 #endif
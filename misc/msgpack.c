@@ -0,0 +1,290 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* MessagePack parser and writer for mpv_node.
+ *
+ * Parser:
+ *
+ * Accepts everything mpv_node can represent. Both str and bin are read as
+ * MPV_FORMAT_STRING (and must not contain '\0'), float 32 and 64 as
+ * MPV_FORMAT_DOUBLE. Unsigned integers larger than INT64_MAX, non-string map
+ * keys and extension types are rejected.
+ *
+ * Writer:
+ *
+ * Always uses the shortest encoding for integers and string lengths, and
+ * float 64 for doubles.
+ *
+ * Also see: https://github.com/msgpack/msgpack/blob/master/spec.md
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "common/common.h"
+
+#include "msgpack.h"
+
+static bool read_bytes(bstr *src, size_t len, unsigned char **out)
+{
+    if (src->len < len)
+        return false;
+    *out = src->start;
+    *src = bstr_cut(*src, len);
+    return true;
+}
+
+static bool read_uint(bstr *src, int bytes, uint64_t *out)
+{
+    unsigned char *p;
+    if (!read_bytes(src, bytes, &p))
+        return false;
+    uint64_t v = 0;
+    for (int n = 0; n < bytes; n++)
+        v = (v << 8) | p[n];
+    *out = v;
+    return true;
+}
+
+static int read_str(void *ta_parent, struct mpv_node *dst, bstr *src,
+                    size_t len)
+{
+    unsigned char *p;
+    if (!read_bytes(src, len, &p) || memchr(p, '\0', len))
+        return -1;
+    dst->format = MPV_FORMAT_STRING;
+    dst->u.string = talloc_strndup(ta_parent, (char *)p, len);
+    return 0;
+}
+
+static int read_sub(void *ta_parent, struct mpv_node *dst, bstr *src,
+                    size_t num, bool is_obj, int max_depth)
+{
+    // Every item takes at least 1 byte; don't trust the count beyond that.
+    if (num > src->len)
+        return -1;
+
+    struct mpv_node_list *list = talloc_zero(ta_parent, struct mpv_node_list);
+    dst->format = is_obj ? MPV_FORMAT_NODE_MAP : MPV_FORMAT_NODE_ARRAY;
+    dst->u.list = list;
+    if (!num)
+        return 0;
+
+    list->values = talloc_array(list, struct mpv_node, num);
+    if (is_obj)
+        list->keys = talloc_array(list, char *, num);
+
+    for (size_t n = 0; n < num; n++) {
+        if (is_obj) {
+            struct mpv_node key;
+            if (msgpack_parse(list, &key, src, max_depth) < 0)
+                return -1;
+            if (key.format != MPV_FORMAT_STRING)
+                return -1;
+            list->keys[n] = key.u.string;
+        }
+        if (msgpack_parse(list, &list->values[n], src, max_depth) < 0)
+            return -1;
+        list->num++;
+    }
+    return 0;
+}
+
+/* Parse the first MessagePack object in *src, and advance *src past it.
+ * max_depth limits the nesting of arrays and maps.
+ * Returns: 0 on success, <0 on failure (*src and *dst are in an undefined
+ * state then).
+ */
+int msgpack_parse(void *ta_parent, struct mpv_node *dst, bstr *src,
+                  int max_depth)
+{
+    unsigned char *p;
+    if (!read_bytes(src, 1, &p))
+        return -1;
+    unsigned char c = p[0];
+    uint64_t v;
+
+    if (c <= 0x7f) {
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = c;
+        return 0;
+    }
+    if (c >= 0xe0) {
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = (int8_t)c;
+        return 0;
+    }
+    if (c >= 0xa0 && c <= 0xbf)
+        return read_str(ta_parent, dst, src, c & 0x1f);
+    if ((c & 0xf0) == 0x80 || (c & 0xf0) == 0x90) {
+        if (max_depth <= 0)
+            return -1;
+        return read_sub(ta_parent, dst, src, c & 0x0f, c < 0x90, max_depth - 1);
+    }
+
+    switch (c) {
+    case 0xc0:
+        dst->format = MPV_FORMAT_NONE;
+        return 0;
+    case 0xc2:
+    case 0xc3:
+        dst->format = MPV_FORMAT_FLAG;
+        dst->u.flag = c == 0xc3;
+        return 0;
+    case 0xc4: case 0xc5: case 0xc6:     // bin 8/16/32
+    case 0xd9: case 0xda: case 0xdb:     // str 8/16/32
+        if (!read_uint(src, 1 << ((c - (c >= 0xd9 ? 0xd9 : 0xc4))), &v))
+            return -1;
+        return read_str(ta_parent, dst, src, v);
+    case 0xca: {
+        if (!read_uint(src, 4, &v))
+            return -1;
+        union { uint32_t i; float f; } u = { .i = v };
+        dst->format = MPV_FORMAT_DOUBLE;
+        dst->u.double_ = u.f;
+        return 0;
+    }
+    case 0xcb: {
+        if (!read_uint(src, 8, &v))
+            return -1;
+        union { uint64_t i; double d; } u = { .i = v };
+        dst->format = MPV_FORMAT_DOUBLE;
+        dst->u.double_ = u.d;
+        return 0;
+    }
+    case 0xcc: case 0xcd: case 0xce: case 0xcf:     // uint 8/16/32/64
+        if (!read_uint(src, 1 << (c - 0xcc), &v) || v > INT64_MAX)
+            return -1;
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = v;
+        return 0;
+    case 0xd0: case 0xd1: case 0xd2: case 0xd3: {   // int 8/16/32/64
+        int bytes = 1 << (c - 0xd0);
+        if (!read_uint(src, bytes, &v))
+            return -1;
+        // Sign-extend.
+        int shift = 64 - bytes * 8;
+        dst->format = MPV_FORMAT_INT64;
+        dst->u.int64 = shift ? (int64_t)(v << shift) >> shift : (int64_t)v;
+        return 0;
+    }
+    case 0xdc: case 0xdd:       // array 16/32
+    case 0xde: case 0xdf:       // map 16/32
+        if (max_depth <= 0)
+            return -1;
+        if (!read_uint(src, (c & 1) ? 4 : 2, &v))
+            return -1;
+        return read_sub(ta_parent, dst, src, v, c >= 0xde, max_depth - 1);
+    }
+
+    return -1; // reserved or extension type
+}
+
+static void write_uint(void *talloc_ctx, bstr *b, unsigned char tag,
+                       uint64_t v, int bytes)
+{
+    unsigned char buf[9] = {tag};
+    for (int n = 0; n < bytes; n++)
+        buf[bytes - n] = v >> (n * 8);
+    bstr_xappend(talloc_ctx, b, (bstr){buf, bytes + 1});
+}
+
+// Write a length with the "fix" type if it fits into max_fix, or else the
+// 8 bit (if tag8 is not 0), 16 bit or 32 bit variant (which is tag16 + 1).
+static void write_len(void *talloc_ctx, bstr *b, unsigned char fix_tag,
+                      size_t max_fix, unsigned char tag8, unsigned char tag16,
+                      size_t len)
+{
+    if (len <= max_fix) {
+        write_uint(talloc_ctx, b, fix_tag | len, 0, 0);
+    } else if (tag8 && len <= UINT8_MAX) {
+        write_uint(talloc_ctx, b, tag8, len, 1);
+    } else if (len <= UINT16_MAX) {
+        write_uint(talloc_ctx, b, tag16, len, 2);
+    } else {
+        write_uint(talloc_ctx, b, tag16 + 1, len, 4);
+    }
+}
+
+static void write_str(void *talloc_ctx, bstr *b, const char *str)
+{
+    size_t len = strlen(str);
+    write_len(talloc_ctx, b, 0xa0, 31, 0xd9, 0xda, len);
+    bstr_xappend(talloc_ctx, b, (bstr){(unsigned char *)str, len});
+}
+
+static int msgpack_append(void *talloc_ctx, bstr *b,
+                          const struct mpv_node *src)
+{
+    switch (src->format) {
+    case MPV_FORMAT_NONE:
+        write_uint(talloc_ctx, b, 0xc0, 0, 0);
+        return 0;
+    case MPV_FORMAT_FLAG:
+        write_uint(talloc_ctx, b, src->u.flag ? 0xc3 : 0xc2, 0, 0);
+        return 0;
+    case MPV_FORMAT_INT64: {
+        int64_t v = src->u.int64;
+        if (v >= 0 && v <= 0x7f) {
+            write_uint(talloc_ctx, b, v, 0, 0);
+        } else if (v < 0 && v >= -32) {
+            write_uint(talloc_ctx, b, (uint8_t)v, 0, 0);
+        } else if (v > 0) {
+            int size = v <= UINT8_MAX ? 0 : v <= UINT16_MAX ? 1 :
+                       v <= UINT32_MAX ? 2 : 3;
+            write_uint(talloc_ctx, b, 0xcc + size, v, 1 << size);
+        } else {
+            int size = v >= INT8_MIN ? 0 : v >= INT16_MIN ? 1 :
+                       v >= INT32_MIN ? 2 : 3;
+            write_uint(talloc_ctx, b, 0xd0 + size, v, 1 << size);
+        }
+        return 0;
+    }
+    case MPV_FORMAT_DOUBLE: {
+        union { double d; uint64_t i; } u = { .d = src->u.double_ };
+        write_uint(talloc_ctx, b, 0xcb, u.i, 8);
+        return 0;
+    }
+    case MPV_FORMAT_STRING:
+        write_str(talloc_ctx, b, src->u.string);
+        return 0;
+    case MPV_FORMAT_NODE_ARRAY:
+    case MPV_FORMAT_NODE_MAP: {
+        struct mpv_node_list *list = src->u.list;
+        bool is_obj = src->format == MPV_FORMAT_NODE_MAP;
+        write_len(talloc_ctx, b, is_obj ? 0x80 : 0x90, 15, 0,
+                  is_obj ? 0xde : 0xdc, list->num);
+        for (int n = 0; n < list->num; n++) {
+            if (is_obj)
+                write_str(talloc_ctx, b, list->keys[n]);
+            if (msgpack_append(talloc_ctx, b, &list->values[n]) < 0)
+                return -1;
+        }
+        return 0;
+    }
+    }
+    return -1; // unknown format
+}
+
+/* Write the contents of *src as MessagePack, and append it to *dst.
+ * dst->start is expected to be a talloc allocation or NULL (see bstr_xappend).
+ * Returns: 0 on success, <0 on failure.
+ */
+int msgpack_write(void *talloc_ctx, bstr *dst, struct mpv_node *src)
+{
+    return msgpack_append(talloc_ctx, dst, src);
+}
@@ -16,6 +16,7 @@
 #include <pthread.h>
 
 #include "common/common.h"
+#include "osdep/atomic.h"
 #include "osdep/threads.h"
 #include "osdep/timer.h"
 
@@ -25,9 +26,29 @@
 // and the thread count is above the configured minimum.
 #define DESTROY_TIMEOUT 10
 
+// How long a worker waiting for a task group sleeps when it found no other
+// work to do. Tasks of the group may still be queued on other workers.
+#define GROUP_POLL_TIMEOUT 0.01
+
 struct work {
     void (*fn)(void *ctx);
     void *fn_ctx;
+    struct mp_task_group *group;
+};
+
+// Work queued by a worker thread. The owner pushes and pops at the back (so
+// it processes what it created last, while the data is still in the cache),
+// other workers steal from the front.
+struct work_deque {
+    pthread_mutex_t lock;
+    struct work *items;         // ring buffer with alloc entries
+    int alloc, start, num;
+};
+
+struct worker {
+    struct mp_thread_pool *pool;
+    pthread_t thread;
+    struct work_deque deque;
 };
 
 struct mp_thread_pool {
@@ -36,41 +57,162 @@ struct mp_thread_pool {
     pthread_mutex_t lock;
     pthread_cond_t wakeup;
 
+    // Number of threads which have taken up work and are still processing it.
+    atomic_int busy_threads;
+    // Number of threads which are looking for work, or waiting on wakeup.
+    // Read without lock by workers queuing to their own deque.
+    atomic_int idle_threads;
+    // Whether num_threads < max_threads.
+    atomic_bool can_grow;
+
     // --- the following fields are protected by lock
 
-    pthread_t *threads;
+    struct worker **workers;
     int num_threads;
 
-    // Number of threads which have taken up work and are still processing it.
-    int busy_threads;
-
     bool terminate;
 
+    // Work queued from other threads (FIFO: taken from the end).
     struct work *work;
     int num_work;
+
+    // Index of the worker the next steal attempt starts with.
+    int steal_start;
+};
+
+struct mp_task_group {
+    struct mp_thread_pool *pool;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+
+    int pending;                // queued or running tasks
 };
 
+static pthread_once_t worker_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t worker_key;
+
+static void create_worker_key(void)
+{
+    pthread_key_create(&worker_key, NULL);
+}
+
+// Return the worker struct if the calling thread is a worker of this pool.
+static struct worker *get_worker(struct mp_thread_pool *pool)
+{
+    pthread_once(&worker_key_once, create_worker_key);
+    struct worker *w = pthread_getspecific(worker_key);
+    return w && w->pool == pool ? w : NULL;
+}
+
+static void deque_push(struct worker *w, struct work work)
+{
+    struct work_deque *q = &w->deque;
+    pthread_mutex_lock(&q->lock);
+    if (q->num == q->alloc) {
+        int alloc = MPMAX(16, q->alloc * 2);
+        struct work *items = talloc_array(w, struct work, alloc);
+        for (int n = 0; n < q->num; n++)
+            items[n] = q->items[(q->start + n) % q->alloc];
+        talloc_free(q->items);
+        q->items = items;
+        q->alloc = alloc;
+        q->start = 0;
+    }
+    q->items[(q->start + q->num) % q->alloc] = work;
+    q->num += 1;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static bool deque_pop(struct work_deque *q, struct work *out)
+{
+    pthread_mutex_lock(&q->lock);
+    bool ok = q->num > 0;
+    if (ok) {
+        q->num -= 1;
+        *out = q->items[(q->start + q->num) % q->alloc];
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+static bool deque_steal(struct work_deque *q, struct work *out)
+{
+    pthread_mutex_lock(&q->lock);
+    bool ok = q->num > 0;
+    if (ok) {
+        *out = q->items[q->start];
+        q->start = (q->start + 1) % q->alloc;
+        q->num -= 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+// Take work from the global queue, or steal it from another worker.
+// self can be NULL.
+static bool take_work_locked(struct mp_thread_pool *pool, struct worker *self,
+                             struct work *out)
+{
+    if (pool->num_work > 0) {
+        *out = pool->work[pool->num_work - 1];
+        pool->num_work -= 1;
+        return true;
+    }
+
+    for (int n = 0; n < pool->num_threads; n++) {
+        int i = (pool->steal_start + n) % pool->num_threads;
+        struct worker *victim = pool->workers[i];
+        if (victim != self && deque_steal(&victim->deque, out)) {
+            pool->steal_start = i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_work(struct mp_thread_pool *pool, struct work *work)
+{
+    atomic_fetch_add(&pool->busy_threads, 1);
+    work->fn(work->fn_ctx);
+    atomic_fetch_add(&pool->busy_threads, -1);
+
+    struct mp_task_group *group = work->group;
+    if (group) {
+        pthread_mutex_lock(&group->lock);
+        group->pending -= 1;
+        if (!group->pending)
+            pthread_cond_broadcast(&group->done);
+        pthread_mutex_unlock(&group->lock);
+    }
+}
+
 static void *worker_thread(void *arg)
 {
-    struct mp_thread_pool *pool = arg;
+    struct worker *w = arg;
+    struct mp_thread_pool *pool = w->pool;
 
     mpthread_set_name("worker");
-
-    pthread_mutex_lock(&pool->lock);
+    pthread_once(&worker_key_once, create_worker_key);
+    pthread_setspecific(worker_key, w);
 
     struct timespec ts = {0};
     bool got_timeout = false;
     while (1) {
-        struct work work = {0};
-        if (pool->num_work > 0) {
-            work = pool->work[pool->num_work - 1];
-            pool->num_work -= 1;
+        struct work work;
+        if (deque_pop(&w->deque, &work)) {
+            run_work(pool, &work);
+            continue;
         }
 
-        if (!work.fn) {
-            if (got_timeout || pool->terminate)
-                break;
+        pthread_mutex_lock(&pool->lock);
+
+        // Announce that we're idle before looking at the deques, so a worker
+        // pushing to its own deque either sees this, or we see its work.
+        atomic_fetch_add(&pool->idle_threads, 1);
 
+        bool found = take_work_locked(pool, w, &work);
+        if (!found && !got_timeout && !pool->terminate) {
             if (pool->num_threads > pool->min_threads) {
                 if (!ts.tv_sec && !ts.tv_nsec)
                     ts = mp_rel_time_to_timespec(DESTROY_TIMEOUT);
@@ -79,16 +221,19 @@ static void *worker_thread(void *arg)
             } else {
                 pthread_cond_wait(&pool->wakeup, &pool->lock);
             }
+            atomic_fetch_add(&pool->idle_threads, -1);
+            pthread_mutex_unlock(&pool->lock);
             continue;
         }
 
-        pool->busy_threads += 1;
-        pthread_mutex_unlock(&pool->lock);
+        atomic_fetch_add(&pool->idle_threads, -1);
 
-        work.fn(work.fn_ctx);
+        if (!found)
+            break;
 
-        pthread_mutex_lock(&pool->lock);
-        pool->busy_threads -= 1;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_work(pool, &work);
 
         ts = (struct timespec){0};
         got_timeout = false;
@@ -96,11 +241,15 @@ static void *worker_thread(void *arg)
 
     // If no termination signal was given, it must mean we died because of a
     // timeout, and nobody is waiting for us. We have to remove ourselves.
+    // Our deque is empty, and nobody else can add to it.
     if (!pool->terminate) {
         for (int n = 0; n < pool->num_threads; n++) {
-            if (pthread_equal(pool->threads[n], pthread_self())) {
+            if (pool->workers[n] == w) {
                 pthread_detach(pthread_self());
-                MP_TARRAY_REMOVE_AT(pool->threads, pool->num_threads, n);
+                MP_TARRAY_REMOVE_AT(pool->workers, pool->num_threads, n);
+                atomic_store(&pool->can_grow, true);
+                pthread_mutex_destroy(&w->deque.lock);
+                talloc_free(w);
                 pthread_mutex_unlock(&pool->lock);
                 return NULL;
             }
@@ -122,31 +271,44 @@ static void thread_pool_dtor(void *ctx)
     pool->terminate = true;
     pthread_cond_broadcast(&pool->wakeup);
 
-    pthread_t *threads = pool->threads;
+    struct worker **workers = pool->workers;
     int num_threads = pool->num_threads;
 
-    pool->threads = NULL;
-    pool->num_threads = 0;
-
     pthread_mutex_unlock(&pool->lock);
 
+    // Workers can steal from each other until the last one exits, so keep
+    // them all in the list until then.
     for (int n = 0; n < num_threads; n++)
-        pthread_join(threads[n], NULL);
+        pthread_join(workers[n]->thread, NULL);
+
+    for (int n = 0; n < num_threads; n++) {
+        assert(workers[n]->deque.num == 0);
+        pthread_mutex_destroy(&workers[n]->deque.lock);
+    }
 
     assert(pool->num_work == 0);
-    assert(pool->num_threads == 0);
     pthread_cond_destroy(&pool->wakeup);
     pthread_mutex_destroy(&pool->lock);
 }
 
 static bool add_thread(struct mp_thread_pool *pool)
 {
-    pthread_t thread;
+    // (Work running during destruction can still queue more work.)
+    if (pool->terminate)
+        return false;
 
-    if (pthread_create(&thread, NULL, worker_thread, pool) != 0)
+    struct worker *w = talloc_zero(pool, struct worker);
+    w->pool = pool;
+    pthread_mutex_init(&w->deque.lock, NULL);
+
+    if (pthread_create(&w->thread, NULL, worker_thread, w) != 0) {
+        pthread_mutex_destroy(&w->deque.lock);
+        talloc_free(w);
         return false;
+    }
 
-    MP_TARRAY_APPEND(pool, pool->threads, pool->num_threads, thread);
+    MP_TARRAY_APPEND(pool, pool->workers, pool->num_threads, w);
+    atomic_store(&pool->can_grow, pool->num_threads < pool->max_threads);
     return true;
 }
 
@@ -165,6 +327,7 @@ struct mp_thread_pool *mp_thread_pool_create(void *ta_parent, int init_threads,
 
     pool->min_threads = min_threads;
     pool->max_threads = max_threads;
+    atomic_store(&pool->can_grow, true);
 
     pthread_mutex_lock(&pool->lock);
     for (int n = 0; n < init_threads; n++)
@@ -178,21 +341,49 @@ struct mp_thread_pool *mp_thread_pool_create(void *ta_parent, int init_threads,
     return pool;
 }
 
-static bool thread_pool_add(struct mp_thread_pool *pool, void (*fn)(void *ctx),
-                            void *fn_ctx, bool allow_queue)
+// Queue work on the calling worker's own deque. This doesn't touch the pool
+// lock, unless another thread needs to be woken up or created.
+static void queue_local(struct worker *w, struct work work)
+{
+    struct mp_thread_pool *pool = w->pool;
+
+    deque_push(w, work);
+
+    // (A read-modify-write, so that it's ordered against the increment done
+    // by a worker going idle.)
+    if (atomic_fetch_add(&pool->idle_threads, 0) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wakeup);
+        pthread_mutex_unlock(&pool->lock);
+    } else if (atomic_load(&pool->can_grow)) {
+        // Nobody is available to steal it; we'd have to run it ourselves.
+        pthread_mutex_lock(&pool->lock);
+        if (pool->num_threads < pool->max_threads)
+            add_thread(pool);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static bool thread_pool_add(struct mp_thread_pool *pool, struct work work,
+                            bool allow_queue)
 {
     bool ok = true;
 
-    assert(fn);
+    assert(work.fn);
+
+    struct worker *w = allow_queue ? get_worker(pool) : NULL;
+    if (w) {
+        queue_local(w, work);
+        return true;
+    }
 
     pthread_mutex_lock(&pool->lock);
-    struct work work = {fn, fn_ctx};
 
     // If there are not enough threads to process all at once, but we can
     // create a new thread, then do so. If work is queued quickly, it can
     // happen that not all available threads have picked up work yet (up to
     // num_threads - busy_threads threads), which has to be accounted for.
-    if (pool->busy_threads + pool->num_work + 1 > pool->num_threads &&
+    if (atomic_load(&pool->busy_threads) + pool->num_work + 1 > pool->num_threads &&
         pool->num_threads < pool->max_threads)
     {
         if (!add_thread(pool)) {
@@ -213,11 +404,81 @@ static bool thread_pool_add(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                           void *fn_ctx)
 {
-    return thread_pool_add(pool, fn, fn_ctx, true);
+    return thread_pool_add(pool, (struct work){fn, fn_ctx}, true);
 }
 
 bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                         void *fn_ctx)
 {
-    return thread_pool_add(pool, fn, fn_ctx, false);
+    return thread_pool_add(pool, (struct work){fn, fn_ctx}, false);
+}
+
+static void task_group_dtor(void *ctx)
+{
+    struct mp_task_group *group = ctx;
+
+    mp_task_group_wait(group);
+    pthread_cond_destroy(&group->done);
+    pthread_mutex_destroy(&group->lock);
+}
+
+struct mp_task_group *mp_task_group_create(void *ta_parent,
+                                           struct mp_thread_pool *pool)
+{
+    struct mp_task_group *group = talloc_zero(ta_parent, struct mp_task_group);
+    talloc_set_destructor(group, task_group_dtor);
+
+    group->pool = pool;
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->done, NULL);
+
+    return group;
+}
+
+void mp_task_group_add(struct mp_task_group *group, void (*fn)(void *ctx),
+                       void *fn_ctx)
+{
+    pthread_mutex_lock(&group->lock);
+    group->pending += 1;
+    pthread_mutex_unlock(&group->lock);
+
+    struct work work = {fn, fn_ctx, group};
+    if (!thread_pool_add(group->pool, work, true))
+        run_work(group->pool, &work);
+}
+
+void mp_task_group_wait(struct mp_task_group *group)
+{
+    struct mp_thread_pool *pool = group->pool;
+    struct worker *w = get_worker(pool);
+
+    pthread_mutex_lock(&group->lock);
+    while (group->pending) {
+        if (!w) {
+            pthread_cond_wait(&group->done, &group->lock);
+            continue;
+        }
+
+        // A worker must not just block: if all workers did, the group's
+        // tasks would never run. Run other work meanwhile (most likely the
+        // group's own tasks, which are at the back of our deque).
+        pthread_mutex_unlock(&group->lock);
+
+        struct work work;
+        bool found = deque_pop(&w->deque, &work);
+        if (!found) {
+            pthread_mutex_lock(&pool->lock);
+            found = take_work_locked(pool, w, &work);
+            pthread_mutex_unlock(&pool->lock);
+        }
+        if (found)
+            run_work(pool, &work);
+
+        pthread_mutex_lock(&group->lock);
+        if (!found && group->pending) {
+            struct timespec ts = mp_rel_time_to_timespec(GROUP_POLL_TIMEOUT);
+            pthread_cond_timedwait(&group->done, &group->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&group->lock);
 }
@@ -2,6 +2,7 @@
 #define MPV_MP_THREAD_POOL_H
 
 struct mp_thread_pool;
+struct mp_task_group;
 
 // Create a thread pool with the given number of worker threads. This can return
 // NULL if the worker threads could not be created. The thread pool can be
@@ -21,6 +22,8 @@ struct mp_thread_pool *mp_thread_pool_create(void *ta_parent, int init_threads,
 // with unbounded size. This function always returns immediately.
 // Concurrent queue calls are allowed, as long as it does not overlap with
 // pool destruction.
+// If called from one of the pool's worker threads, the item goes to a queue
+// owned by the worker, from which idle workers steal work.
 // This function is explicitly thread-safe.
 // Cannot fail if thread pool was created with at least 1 thread.
 bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
@@ -31,4 +34,19 @@ bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                         void *fn_ctx);
 
+// A set of work items that can be waited on together. The pool must outlive
+// the group. Freeing the group waits until all its items are done.
+struct mp_task_group *mp_task_group_create(void *ta_parent,
+                                           struct mp_thread_pool *pool);
+
+// Queue fn(fn_ctx) on the group's pool. If it can't be queued, it is run
+// immediately on the calling thread. Items can add more items to the group.
+void mp_task_group_add(struct mp_task_group *group, void (*fn)(void *ctx),
+                       void *fn_ctx);
+
+// Wait until all items added to the group so far are done. If called from a
+// worker thread of the pool, this runs other work while waiting (so nested
+// groups can't exhaust the pool).
+void mp_task_group_wait(struct mp_task_group *group);
+
 #endif
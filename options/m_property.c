@@ -36,30 +36,61 @@
 #include "common/msg.h"
 #include "common/common.h"
 
-static int m_property_multiply(struct mp_log *log,
-                               const struct m_property *prop_list,
-                               const char *property, double f, void *ctx)
+struct m_property_index {
+    const struct m_property *list;
+    int *slots;         // list index + 1, or 0 for unused slots
+    unsigned mask;      // number of slots - 1
+};
+
+// FNV-1a
+static unsigned hash_name(bstr name)
 {
-    union m_option_value val = {0};
-    struct m_option opt = {0};
-    int r;
+    unsigned h = 2166136261u;
+    for (int n = 0; n < name.len; n++)
+        h = (h ^ name.start[n]) * 16777619u;
+    return h;
+}
 
-    r = m_property_do(log, prop_list, property, M_PROPERTY_GET_CONSTRICTED_TYPE,
-                      &opt, ctx);
-    if (r != M_PROPERTY_OK)
-        return r;
-    assert(opt.type);
+// Build a hash table for name lookups in the list. The list must not be
+// changed while the index is in use. If names are duplicated, the first
+// entry wins (like m_property_list_find()).
+struct m_property_index *m_property_index_new(void *ta_parent,
+                                              const struct m_property *list)
+{
+    struct m_property_index *index = talloc_zero(ta_parent, struct m_property_index);
+    index->list = list;
 
-    if (!opt.type->multiply)
-        return M_PROPERTY_NOT_IMPLEMENTED;
+    int count = 0;
+    while (list[count].name)
+        count++;
+    unsigned size = 16;
+    while (size < count * 2)
+        size *= 2;
+    index->mask = size - 1;
+    index->slots = talloc_zero_array(index, int, size);
+
+    for (int n = 0; n < count; n++) {
+        if (m_property_index_find(index, bstr0(list[n].name)))
+            continue;
+        unsigned slot = hash_name(bstr0(list[n].name)) & index->mask;
+        while (index->slots[slot])
+            slot = (slot + 1) & index->mask;
+        index->slots[slot] = n + 1;
+    }
+    return index;
+}
 
-    r = m_property_do(log, prop_list, property, M_PROPERTY_GET, &val, ctx);
-    if (r != M_PROPERTY_OK)
-        return r;
-    opt.type->multiply(&opt, &val, f);
-    r = m_property_do(log, prop_list, property, M_PROPERTY_SET, &val, ctx);
-    m_option_free(&opt, &val);
-    return r;
+struct m_property *m_property_index_find(struct m_property_index *index,
+                                         bstr name)
+{
+    unsigned slot = hash_name(name) & index->mask;
+    while (index->slots[slot]) {
+        const struct m_property *prop = &index->list[index->slots[slot] - 1];
+        if (bstr_equals0(name, prop->name))
+            return (struct m_property *)prop;
+        slot = (slot + 1) & index->mask;
+    }
+    return NULL;
 }
 
 struct m_property *m_property_list_find(const struct m_property *list,
@@ -72,49 +103,101 @@ struct m_property *m_property_list_find(const struct m_property *list,
     return NULL;
 }
 
-static int do_action(const struct m_property *prop_list, const char *name,
-                     int action, void *arg, void *ctx)
+static struct m_property *list_find_bstr(const struct m_property *list,
+                                         bstr name)
 {
-    struct m_property *prop;
-    struct m_property_action_arg ka;
+    for (int n = 0; list && list[n].name; n++) {
+        if (bstr_equals0(name, list[n].name))
+            return (struct m_property *)&list[n];
+    }
+    return NULL;
+}
+
+void m_property_resolve(const struct m_property *prop_list,
+                        struct m_property_index *index, const char *name,
+                        struct m_property_ref *ref)
+{
+    *ref = (struct m_property_ref){ .name = name };
+    bstr base = bstr0(name);
     const char *sep = strchr(name, '/');
     if (sep && sep[1]) {
-        char base[128];
-        snprintf(base, sizeof(base), "%.*s", (int)(sep - name), name);
-        prop = m_property_list_find(prop_list, base);
+        base = bstr_splice(base, 0, sep - name);
+        ref->key = sep + 1;
+    }
+    ref->prop = index ? m_property_index_find(index, base)
+                      : list_find_bstr(prop_list, base);
+}
+
+static int do_action(const struct m_property_ref *ref, int action, void *arg,
+                     void *ctx)
+{
+    struct m_property_action_arg ka;
+    if (!ref->prop)
+        return M_PROPERTY_UNKNOWN;
+    if (ref->key) {
         ka = (struct m_property_action_arg) {
-            .key = sep + 1,
+            .key = ref->key,
             .action = action,
             .arg = arg,
         };
         action = M_PROPERTY_KEY_ACTION;
         arg = &ka;
-    } else
-        prop = m_property_list_find(prop_list, name);
-    if (!prop)
-        return M_PROPERTY_UNKNOWN;
-    return prop->call(ctx, prop, action, arg);
+    }
+    return ref->prop->call(ctx, ref->prop, action, arg);
+}
+
+static int m_property_multiply(struct mp_log *log,
+                               const struct m_property_ref *ref, double f,
+                               void *ctx)
+{
+    union m_option_value val = {0};
+    struct m_option opt = {0};
+    int r;
+
+    r = m_property_do_ref(log, ref, M_PROPERTY_GET_CONSTRICTED_TYPE, &opt, ctx);
+    if (r != M_PROPERTY_OK)
+        return r;
+    assert(opt.type);
+
+    if (!opt.type->multiply)
+        return M_PROPERTY_NOT_IMPLEMENTED;
+
+    r = m_property_do_ref(log, ref, M_PROPERTY_GET, &val, ctx);
+    if (r != M_PROPERTY_OK)
+        return r;
+    opt.type->multiply(&opt, &val, f);
+    r = m_property_do_ref(log, ref, M_PROPERTY_SET, &val, ctx);
+    m_option_free(&opt, &val);
+    return r;
 }
 
 // (as a hack, log can be NULL on read-only paths)
 int m_property_do(struct mp_log *log, const struct m_property *prop_list,
                   const char *name, int action, void *arg, void *ctx)
+{
+    struct m_property_ref ref;
+    m_property_resolve(prop_list, NULL, name, &ref);
+    return m_property_do_ref(log, &ref, action, arg, ctx);
+}
+
+int m_property_do_ref(struct mp_log *log, const struct m_property_ref *ref,
+                      int action, void *arg, void *ctx)
 {
     union m_option_value val = {0};
     int r;
 
     struct m_option opt = {0};
-    r = do_action(prop_list, name, M_PROPERTY_GET_TYPE, &opt, ctx);
+    r = do_action(ref, M_PROPERTY_GET_TYPE, &opt, ctx);
     if (r <= 0)
         return r;
     assert(opt.type);
 
     switch (action) {
     case M_PROPERTY_PRINT: {
-        if ((r = do_action(prop_list, name, M_PROPERTY_PRINT, arg, ctx)) >= 0)
+        if ((r = do_action(ref, M_PROPERTY_PRINT, arg, ctx)) >= 0)
             return r;
         // Fallback to m_option
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET, &val, ctx)) <= 0)
+        if ((r = do_action(ref, M_PROPERTY_GET, &val, ctx)) <= 0)
             return r;
         char *str = m_option_pretty_print(&opt, &val);
         m_option_free(&opt, &val);
@@ -122,7 +205,7 @@ int m_property_do(struct mp_log *log, const struct m_property *prop_list,
         return str != NULL;
     }
     case M_PROPERTY_GET_STRING: {
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET, &val, ctx)) <= 0)
+        if ((r = do_action(ref, M_PROPERTY_GET, &val, ctx)) <= 0)
             return r;
         char *str = m_option_print(&opt, &val);
         m_option_free(&opt, &val);
@@ -131,48 +214,48 @@ int m_property_do(struct mp_log *log, const struct m_property *prop_list,
     }
     case M_PROPERTY_SET_STRING: {
         struct mpv_node node = { .format = MPV_FORMAT_STRING, .u.string = arg };
-        return m_property_do(log, prop_list, name, M_PROPERTY_SET_NODE, &node, ctx);
+        return m_property_do_ref(log, ref, M_PROPERTY_SET_NODE, &node, ctx);
     }
     case M_PROPERTY_MULTIPLY: {
-        return m_property_multiply(log, prop_list, name, *(double *)arg, ctx);
+        return m_property_multiply(log, ref, *(double *)arg, ctx);
     }
     case M_PROPERTY_SWITCH: {
         if (!log)
             return M_PROPERTY_ERROR;
         struct m_property_switch_arg *sarg = arg;
-        if ((r = do_action(prop_list, name, M_PROPERTY_SWITCH, arg, ctx)) !=
+        if ((r = do_action(ref, M_PROPERTY_SWITCH, arg, ctx)) !=
             M_PROPERTY_NOT_IMPLEMENTED)
             return r;
         // Fallback to m_option
-        r = m_property_do(log, prop_list, name, M_PROPERTY_GET_CONSTRICTED_TYPE,
-                          &opt, ctx);
+        r = m_property_do_ref(log, ref, M_PROPERTY_GET_CONSTRICTED_TYPE,
+                              &opt, ctx);
         if (r <= 0)
             return r;
         assert(opt.type);
         if (!opt.type->add)
             return M_PROPERTY_NOT_IMPLEMENTED;
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET, &val, ctx)) <= 0)
+        if ((r = do_action(ref, M_PROPERTY_GET, &val, ctx)) <= 0)
             return r;
         opt.type->add(&opt, &val, sarg->inc, sarg->wrap);
-        r = do_action(prop_list, name, M_PROPERTY_SET, &val, ctx);
+        r = do_action(ref, M_PROPERTY_SET, &val, ctx);
         m_option_free(&opt, &val);
         return r;
     }
     case M_PROPERTY_GET_CONSTRICTED_TYPE: {
-        if ((r = do_action(prop_list, name, action, arg, ctx)) >= 0)
+        if ((r = do_action(ref, action, arg, ctx)) >= 0)
             return r;
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET_TYPE, arg, ctx)) >= 0)
+        if ((r = do_action(ref, M_PROPERTY_GET_TYPE, arg, ctx)) >= 0)
             return r;
         return M_PROPERTY_NOT_IMPLEMENTED;
     }
     case M_PROPERTY_SET: {
-        return do_action(prop_list, name, M_PROPERTY_SET, arg, ctx);
+        return do_action(ref, M_PROPERTY_SET, arg, ctx);
     }
     case M_PROPERTY_GET_NODE: {
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET_NODE, arg, ctx)) !=
+        if ((r = do_action(ref, M_PROPERTY_GET_NODE, arg, ctx)) !=
             M_PROPERTY_NOT_IMPLEMENTED)
             return r;
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET, &val, ctx)) <= 0)
+        if ((r = do_action(ref, M_PROPERTY_GET, &val, ctx)) <= 0)
             return r;
         struct mpv_node *node = arg;
         int err = m_option_get_node(&opt, NULL, node, &val);
@@ -189,22 +272,22 @@ int m_property_do(struct mp_log *log, const struct m_property *prop_list,
     case M_PROPERTY_SET_NODE: {
         if (!log)
             return M_PROPERTY_ERROR;
-        if ((r = do_action(prop_list, name, M_PROPERTY_SET_NODE, arg, ctx)) !=
+        if ((r = do_action(ref, M_PROPERTY_SET_NODE, arg, ctx)) !=
             M_PROPERTY_NOT_IMPLEMENTED)
             return r;
-        int err = m_option_set_node_or_string(log, &opt, name, &val, arg);
+        int err = m_option_set_node_or_string(log, &opt, ref->name, &val, arg);
         if (err == M_OPT_UNKNOWN) {
             r = M_PROPERTY_NOT_IMPLEMENTED;
         } else if (err < 0) {
             r = M_PROPERTY_INVALID_FORMAT;
         } else {
-            r = do_action(prop_list, name, M_PROPERTY_SET, &val, ctx);
+            r = do_action(ref, M_PROPERTY_SET, &val, ctx);
         }
         m_option_free(&opt, &val);
         return r;
     }
     default:
-        return do_action(prop_list, name, action, arg, ctx);
+        return do_action(ref, action, arg, ctx);
     }
 }
 
@@ -235,14 +318,17 @@ static void m_property_unkey(int *action, void **arg)
     }
 }
 
-static int m_property_do_bstr(const struct m_property *prop_list, bstr name,
+static int m_property_do_bstr(const struct m_property *prop_list,
+                              struct m_property_index *index, bstr name,
                               int action, void *arg, void *ctx)
 {
     char name0[64];
     if (name.len >= sizeof(name0))
         return M_PROPERTY_UNKNOWN;
     snprintf(name0, sizeof(name0), "%.*s", BSTR_P(name));
-    return m_property_do(NULL, prop_list, name0, action, arg, ctx);
+    struct m_property_ref ref;
+    m_property_resolve(prop_list, index, name0, &ref);
+    return m_property_do_ref(NULL, &ref, action, arg, ctx);
 }
 
 static void append_str(char **s, int *len, bstr append)
@@ -253,7 +339,8 @@ static void append_str(char **s, int *len, bstr append)
     *len = *len + append.len;
 }
 
-static int expand_property(const struct m_property *prop_list, char **ret,
+static int expand_property(const struct m_property *prop_list,
+                           struct m_property_index *index, char **ret,
                            int *ret_len, bstr prop, bool silent_error, void *ctx)
 {
     bool cond_yes = bstr_eatstart0(&prop, "?");
@@ -267,7 +354,7 @@ static int expand_property(const struct m_property *prop_list, char **ret,
     int method = raw ? M_PROPERTY_GET_STRING : M_PROPERTY_PRINT;
 
     char *s = NULL;
-    int r = m_property_do_bstr(prop_list, prop, method, &s, ctx);
+    int r = m_property_do_bstr(prop_list, index, prop, method, &s, ctx);
     bool skip;
     if (comp) {
         skip = ((s && bstr_equals0(comp_with, s)) != cond_yes);
@@ -285,6 +372,7 @@ static int expand_property(const struct m_property *prop_list, char **ret,
 }
 
 char *m_properties_expand_string(const struct m_property *prop_list,
+                                 struct m_property_index *index,
                                  const char *str0, void *ctx)
 {
     char *ret = NULL;
@@ -310,7 +398,8 @@ char *m_properties_expand_string(const struct m_property *prop_list,
             bool have_fallback = bstr_eatstart0(&str, ":");
 
             if (!skip) {
-                skip = expand_property(prop_list, &ret, &ret_len, name, have_fallback, ctx);
+                skip = expand_property(prop_list, index, &ret, &ret_len, name,
+                                       have_fallback, ctx);
                 if (skip)
                     skip_level = level;
             }
@@ -138,6 +138,27 @@ struct m_property {
 struct m_property *m_property_list_find(const struct m_property *list,
                                         const char *name);
 
+// Hash table for looking up properties by name in constant time.
+struct m_property_index;
+struct m_property_index *m_property_index_new(void *ta_parent,
+                                              const struct m_property *list);
+struct m_property *m_property_index_find(struct m_property_index *index,
+                                         bstr name);
+
+// A property name resolved to the property implementation. This can be kept
+// to access the same property repeatedly without name lookups.
+struct m_property_ref {
+    struct m_property *prop;    // NULL if the property doesn't exist
+    const char *key;            // sub-property path ("a/b" => "b"), or NULL
+    const char *name;           // full name (for messages)
+};
+
+// Resolve the name using the index, or prop_list if index is NULL. The
+// strings in ref point into name, which must stay valid while ref is used.
+void m_property_resolve(const struct m_property *prop_list,
+                        struct m_property_index *index, const char *name,
+                        struct m_property_ref *ref);
+
 // Access a property.
 // action: one of m_property_action
 // ctx: opaque value passed through to property implementation
@@ -145,6 +166,10 @@ struct m_property *m_property_list_find(const struct m_property *list,
 int m_property_do(struct mp_log *log, const struct m_property* prop_list,
                   const char* property_name, int action, void* arg, void *ctx);
 
+// Like m_property_do(), but with a resolved name.
+int m_property_do_ref(struct mp_log *log, const struct m_property_ref *ref,
+                      int action, void *arg, void *ctx);
+
 // Given a path of the form "a/b/c", this function will set *prefix to "a",
 // and rem to "b/c", and return true.
 // If there is no '/' in the path, set prefix to path, and rem to "", and
@@ -167,7 +192,9 @@ void m_properties_print_help_list(struct mp_log *log,
 // STR is recursively expanded using the same rules.
 // "$$" can be used to escape "$", and "$}" to escape "}".
 // "$>" disables parsing of "$" for the rest of the string.
+// index is optional, and speeds up name lookups.
 char* m_properties_expand_string(const struct m_property *prop_list,
+                                 struct m_property_index *index,
                                  const char *str, void *ctx);
 
 // Trivial helpers for implementing properties.
@@ -50,6 +50,8 @@ static void print_version(struct mp_log *log)
 extern const struct m_sub_options stream_lavf_conf;
 extern const struct m_sub_options demux_rawaudio_conf;
 extern const struct m_sub_options demux_lavf_conf;
+extern const struct m_sub_options demux_playlist_conf;
+extern const struct m_sub_options demux_timeline_conf;
 extern const struct m_sub_options ad_lavc_conf;
 extern const struct m_sub_options input_config;
 extern const struct m_sub_options ao_alsa_conf;
@@ -106,6 +108,7 @@ const m_option_t mp_opts[] = {
     OPT_STRING("dump-stats", dump_stats, UPDATE_TERM | CONF_PRE_PARSE),
     OPT_FLAG("msg-color", msg_color, CONF_PRE_PARSE | UPDATE_TERM),
     OPT_STRING("log-file", log_file, CONF_PRE_PARSE | M_OPT_FILE | UPDATE_TERM),
+    OPT_STRING("trace-file", trace_file, CONF_PRE_PARSE | M_OPT_FILE | UPDATE_TERM),
     OPT_FLAG("msg-module", msg_module, UPDATE_TERM),
     OPT_FLAG("msg-time", msg_time, UPDATE_TERM),
 
@@ -219,6 +222,8 @@ const m_option_t mp_opts[] = {
 
     OPT_SUBSTRUCT("", demux_lavf, demux_lavf_conf, 0),
     OPT_SUBSTRUCT("demuxer-rawaudio", demux_rawaudio, demux_rawaudio_conf, 0),
+    OPT_SUBSTRUCT("", demux_playlist, demux_playlist_conf, 0),
+    OPT_SUBSTRUCT("", demux_timeline, demux_timeline_conf, 0),
 
 //---------------------- libao/libvo options ------------------------
     OPT_SUBSTRUCT("", ao_opts, ao_conf, 0),
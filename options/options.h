@@ -18,6 +18,7 @@ typedef struct MPOpts {
     int msg_module;
     int msg_time;
     char *log_file;
+    char *trace_file;
 
     int operation_mode;
 
@@ -152,6 +153,8 @@ typedef struct MPOpts {
 
     struct demux_rawaudio_opts *demux_rawaudio;
     struct demux_lavf_opts *demux_lavf;
+    struct demux_playlist_opts *demux_playlist;
+    struct demux_timeline_opts *demux_timeline;
 
     struct demux_opts *demux_opts;
 
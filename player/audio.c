@@ -28,6 +28,7 @@
 #include "common/msg.h"
 #include "options/options.h"
 #include "common/common.h"
+#include "common/perf_counters.h"
 #include "osdep/timer.h"
 
 #include "audio/audio_buffer.h"
@@ -35,6 +36,7 @@
 #include "audio/out/ao.h"
 #include "demux/demux.h"
 #include "filters/f_decoder_wrapper.h"
+#include "filters/f_output_chain.h"
 
 #include "core.h"
 #include "command.h"
@@ -192,6 +194,7 @@ void reset_audio_state(struct MPContext *mpctx)
     mpctx->delay = 0;
     mpctx->audio_drop_throttle = 0;
     mpctx->audio_stat_start = 0;
+    mpctx->latency_start_pts = MP_NOPTS_VALUE;
 }
 
 void uninit_audio_out(struct MPContext *mpctx)
@@ -202,6 +205,9 @@ void uninit_audio_out(struct MPContext *mpctx)
             ao_drain(mpctx->ao);
         ao_uninit(mpctx->ao);
 
+        // Queued audio is discarded, so these targets are never played.
+        audio_expire_latency_cmds(mpctx, false);
+
         mp_notify(mpctx, MPV_EVENT_AUDIO_RECONFIG, NULL);
     }
     mpctx->ao = NULL;
@@ -237,6 +243,8 @@ void uninit_audio_chain(struct MPContext *mpctx)
 
         mpctx->audio_status = STATUS_EOF;
 
+        audio_expire_latency_cmds(mpctx, false);
+
         mp_notify(mpctx, MPV_EVENT_AUDIO_RECONFIG, NULL);
     }
 }
@@ -546,6 +554,161 @@ double playing_audio_pts(struct MPContext *mpctx)
     return pts - mpctx->audio_speed * ao_get_delay(mpctx->ao);
 }
 
+void audio_get_latency(struct MPContext *mpctx, struct audio_latency *l)
+{
+    struct ao_chain *ao_c = mpctx->ao_chain;
+
+    *l = (struct audio_latency){0};
+
+    if (ao_c) {
+        l->filters = mp_output_get_measured_total_delay(ao_c->filter);
+        if (ao_c->output_frame)
+            l->output_queue = mp_aframe_duration(ao_c->output_frame);
+        l->ao_chain = mp_audio_buffer_seconds(ao_c->ao_buffer);
+    }
+
+    if (mpctx->ao)
+        ao_get_delay_split(mpctx->ao, &l->ao_buffer, &l->device);
+
+    l->total = l->filters + l->output_queue + l->ao_chain + l->ao_buffer +
+               l->device;
+}
+
+// Warn if the output delay exceeds --audio-latency-target during playback.
+static void check_latency_target(struct MPContext *mpctx)
+{
+    double target = mpctx->opts->ao_opts->audio_latency_target / 1000.0;
+    if (target <= 0 || !mpctx->restart_complete)
+        return;
+
+    struct audio_latency l;
+    audio_get_latency(mpctx, &l);
+
+    if (l.total > target && !mpctx->latency_target_exceeded) {
+        MP_WARN(mpctx, "Audio output delay of %.1f ms exceeds the latency "
+                "target of %.1f ms (filters %.1f, output queue %.1f, "
+                "ao-chain %.1f, ao-buffer %.1f, device %.1f).\n",
+                l.total * 1e3, target * 1e3, l.filters * 1e3,
+                l.output_queue * 1e3, l.ao_chain * 1e3, l.ao_buffer * 1e3,
+                l.device * 1e3);
+        mpctx->latency_target_exceeded = true;
+    } else if (l.total < target * 0.8 && mpctx->latency_target_exceeded) {
+        // (Hysteresis, so that a delay around the target doesn't spam.)
+        MP_VERBOSE(mpctx, "Audio output delay is within the target again.\n");
+        mpctx->latency_target_exceeded = false;
+    }
+}
+
+// Record that a command of the given type was issued now. Its time-to-audible
+// is the time until the first audio affected by it reaches the device output,
+// and is determined by audio_update_latency().
+void audio_mark_latency_cmd(struct MPContext *mpctx, enum latency_cmd type)
+{
+    struct latency_cmd_state *c = &mpctx->latency_cmds[type];
+    *c = (struct latency_cmd_state){
+        .issued = mp_time_sec(),
+        .wait_restart = true,
+        .target_pts = MP_NOPTS_VALUE,
+        .time_to_audible = -1,
+    };
+
+    // Without audio, the command has no audible effect to wait for.
+    if (mpctx->restart_complete &&
+        (!mpctx->ao_chain || mpctx->audio_status == STATUS_EOF))
+    {
+        c->unavailable = true;
+        return;
+    }
+
+    // Otherwise the target is set when playback (re)starts.
+    if (!mpctx->ao || !mpctx->restart_complete ||
+        mpctx->audio_status != STATUS_PLAYING)
+        return;
+
+    double pts = playing_audio_pts(mpctx);
+    if (pts == MP_NOPTS_VALUE)
+        return;
+
+    switch (type) {
+    case LATENCY_CMD_PLAY:
+        // Unpausing continues with the audio that is already queued.
+        c->wait_restart = false;
+        c->target_pts = pts;
+        break;
+    case LATENCY_CMD_VOLUME: {
+        // The gain is applied when audio leaves the AO soft buffer, so only
+        // audio already passed to the device is unaffected.
+        double soft, device;
+        ao_get_delay_split(mpctx->ao, &soft, &device);
+        c->wait_restart = false;
+        c->target_pts = pts + device * mpctx->audio_speed;
+        break;
+    }
+    default: ;
+    }
+}
+
+// Called when playback starts after loading a file or seeking. The commands
+// are audible once the first audio written after the restart is played
+// (including the device delay). If playback restarted without audio (no
+// track, audio disabled, or the AO failed), they are never audible.
+void audio_latency_restart(struct MPContext *mpctx)
+{
+    double pts = mpctx->latency_start_pts;
+    if (pts == MP_NOPTS_VALUE) {
+        audio_expire_latency_cmds(mpctx, true);
+        return;
+    }
+    for (int n = 0; n < LATENCY_CMD_COUNT; n++) {
+        struct latency_cmd_state *c = &mpctx->latency_cmds[n];
+        if (c->issued && c->wait_restart && !c->unavailable) {
+            c->wait_restart = false;
+            c->target_pts = pts;
+        }
+    }
+}
+
+// Give up on pending time-to-audible measurements whose target audio will not
+// be played anymore. If all is false, commands waiting for the next playback
+// restart are kept, since a new audio chain or AO may resolve them.
+void audio_expire_latency_cmds(struct MPContext *mpctx, bool all)
+{
+    for (int n = 0; n < LATENCY_CMD_COUNT; n++) {
+        struct latency_cmd_state *c = &mpctx->latency_cmds[n];
+        if (!c->issued || c->time_to_audible >= 0 || c->unavailable)
+            continue;
+        if (c->wait_restart && !all)
+            continue;
+        c->unavailable = true;
+    }
+}
+
+// Resolve pending time-to-audible measurements, and check the latency
+// target. Called on every playloop iteration.
+void audio_update_latency(struct MPContext *mpctx)
+{
+    if (mpctx->paused || mpctx->audio_status != STATUS_PLAYING)
+        return;
+
+    check_latency_target(mpctx);
+
+    double pts = MP_NOPTS_VALUE;
+    double now = mp_time_sec();
+    for (int n = 0; n < LATENCY_CMD_COUNT; n++) {
+        struct latency_cmd_state *c = &mpctx->latency_cmds[n];
+        if (c->time_to_audible >= 0 || c->unavailable || c->wait_restart ||
+            c->target_pts == MP_NOPTS_VALUE)
+            continue;
+        if (pts == MP_NOPTS_VALUE)
+            pts = playing_audio_pts(mpctx);
+        if (pts == MP_NOPTS_VALUE || pts < c->target_pts)
+            continue;
+        // Interpolate the time at which target_pts was actually played.
+        double late = (pts - c->target_pts) / mpctx->audio_speed;
+        c->time_to_audible = MPMAX(now - late - c->issued, 0);
+    }
+}
+
 static int write_to_ao(struct MPContext *mpctx, uint8_t **planes, int samples,
                        int flags)
 {
@@ -669,6 +832,7 @@ static bool copy_output(struct MPContext *mpctx, struct ao_chain *ao_c,
     int ao_format;
     struct mp_chmap ao_channels;
     ao_get_format(ao_c->ao, &ao_rate, &ao_format, &ao_channels);
+    int frame_bytes = af_fmt_to_bytes(ao_format) * ao_channels.num;
 
     while (mp_audio_buffer_samples(outbuf) < minsamples) {
         int cursamples = mp_audio_buffer_samples(outbuf);
@@ -713,6 +877,8 @@ static bool copy_output(struct MPContext *mpctx, struct ao_chain *ao_c,
                 uint8_t **data = mp_aframe_get_data_ro(ao_c->output_frame);
                 mp_audio_buffer_append(outbuf, (void **)data,
                                        maxsamples - cursamples);
+                mp_perf_add(MP_PERF_PCM_BYTES_AO_CHAIN,
+                            (maxsamples - cursamples) * frame_bytes);
                 mp_aframe_skip_samples(ao_c->output_frame,
                                        maxsamples - cursamples);
             }
@@ -723,6 +889,8 @@ static bool copy_output(struct MPContext *mpctx, struct ao_chain *ao_c,
         uint8_t **data = mp_aframe_get_data_ro(ao_c->output_frame);
         mp_audio_buffer_append(outbuf, (void **)data,
                                mp_aframe_get_size(ao_c->output_frame));
+        mp_perf_add(MP_PERF_PCM_BYTES_AO_CHAIN,
+                    mp_aframe_get_size(ao_c->output_frame) * frame_bytes);
         TA_FREEP(&ao_c->output_frame);
     }
     return true;
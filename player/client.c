@@ -29,6 +29,7 @@
 #include "common/global.h"
 #include "input/input.h"
 #include "input/cmd.h"
+#include "libmpa/playback_state.h"
 #include "misc/ctype.h"
 #include "misc/dispatch.h"
 #include "misc/node.h"
@@ -83,14 +84,17 @@ struct mp_client_api {
 
 struct observe_property {
     char *name;
+    struct m_property_ref ref; // ==mp_property_resolve(name)
     int id;                 // ==mp_get_property_id(name)
     uint64_t event_mask;    // ==mp_get_property_event_mask(name)
     int64_t reply_id;
     mpv_format format;
     bool changed;           // property change should be signaled to user
-    bool need_new_value;    // a new value should be retrieved
+    bool need_new_value;    // the core should retrieve a new value
     bool updating;          // a new value is being retrieved
     bool dead;              // property unobserved while retrieving value
+    int64_t min_interval;   // minimum time between updates (us), or 0
+    int64_t last_update;    // mp_time_us() of the last retrieval
     bool new_value_valid, user_value_valid;
     union m_option_value new_value, user_value;
     struct mpv_handle *client;
@@ -135,8 +139,10 @@ struct mpv_handle {
     int num_properties;
     int lowest_changed;     // attempt at making change processing incremental
     int properties_updating;
+    bool properties_pending; // some properties have need_new_value set
     uint64_t property_event_masks; // or-ed together event masks of all properties
 
+    bool destroying;        // protected by mp_client_api.lock
     bool fuzzy_initialized; // see scripting.c wait_loaded()
     bool is_weak;           // can not keep core alive on its own
     struct mp_log_buffer *messages;
@@ -416,6 +422,11 @@ static void mp_destroy_client(mpv_handle *ctx, bool terminate)
 
     abort_async(mpctx, ctx, 0, 0);
 
+    // Stop mp_client_update_properties() from starting new updates.
+    pthread_mutex_lock(&clients->lock);
+    ctx->destroying = true;
+    pthread_mutex_unlock(&clients->lock);
+
     // reserved_events equals the number of asynchronous requests that weren't
     // yet replied. In order to avoid that trying to reply to a removed client
     // causes a crash, block until all asynchronous requests were served.
@@ -425,7 +436,18 @@ static void mp_destroy_client(mpv_handle *ctx, bool terminate)
 
     mp_input_remove_sections_by_owner(mpctx->input, ctx->name);
 
-    pthread_mutex_lock(&clients->lock);
+    // Property updates are started with clients->lock held, so none can be
+    // started anymore once this is 0 while holding it.
+    while (1) {
+        pthread_mutex_lock(&clients->lock);
+        pthread_mutex_lock(&ctx->lock);
+        bool updating = ctx->properties_updating;
+        pthread_mutex_unlock(&ctx->lock);
+        if (!updating)
+            break;
+        pthread_mutex_unlock(&clients->lock);
+        mpv_wait_async_requests(ctx);
+    }
 
     for (int n = 0; n < clients->num_clients; n++) {
         if (clients->clients[n] == ctx) {
@@ -1295,6 +1317,7 @@ int mpv_set_property_async(mpv_handle *ctx, uint64_t ud, const char *name,
 struct getproperty_request {
     struct MPContext *mpctx;
     const char *name;
+    const struct m_property_ref *ref; // if set, pre-resolved name
     mpv_format format;
     void *data;
     int status;
@@ -1317,14 +1340,21 @@ static void getproperty_fn(void *arg)
     union m_option_value xdata = {0};
     void *data = req->data ? req->data : &xdata;
 
+    struct m_property_ref ref;
+    if (req->ref) {
+        ref = *req->ref;
+    } else {
+        mp_property_resolve(req->mpctx, req->name, &ref);
+    }
+
     int err = -1;
     switch (req->format) {
     case MPV_FORMAT_OSD_STRING:
-        err = mp_property_do(req->name, M_PROPERTY_PRINT, data, req->mpctx);
+        err = mp_property_do_ref(&ref, M_PROPERTY_PRINT, data, req->mpctx);
         break;
     case MPV_FORMAT_STRING: {
         char *s = NULL;
-        err = mp_property_do(req->name, M_PROPERTY_GET_STRING, &s, req->mpctx);
+        err = mp_property_do_ref(&ref, M_PROPERTY_GET_STRING, &s, req->mpctx);
         if (err == M_PROPERTY_OK)
             *(char **)data = s;
         break;
@@ -1334,13 +1364,13 @@ static void getproperty_fn(void *arg)
     case MPV_FORMAT_INT64:
     case MPV_FORMAT_DOUBLE: {
         struct mpv_node node = {{0}};
-        err = mp_property_do(req->name, M_PROPERTY_GET_NODE, &node, req->mpctx);
+        err = mp_property_do_ref(&ref, M_PROPERTY_GET_NODE, &node, req->mpctx);
         if (err == M_PROPERTY_NOT_IMPLEMENTED) {
             // Go through explicit string conversion. Same reasoning as on the
             // GET code path.
             char *s = NULL;
-            err = mp_property_do(req->name, M_PROPERTY_GET_STRING, &s,
-                                 req->mpctx);
+            err = mp_property_do_ref(&ref, M_PROPERTY_GET_STRING, &s,
+                                     req->mpctx);
             if (err != M_PROPERTY_OK)
                 break;
             node.format = MPV_FORMAT_STRING;
@@ -1403,6 +1433,101 @@ int mpv_get_property(mpv_handle *ctx, const char *name, mpv_format format,
     return req.status;
 }
 
+struct getproperties_request {
+    struct MPContext *mpctx;
+    const char **names;
+    mpv_node *result;
+};
+
+static void getproperties_fn(void *arg)
+{
+    struct getproperties_request *req = arg;
+
+    node_init(req->result, MPV_FORMAT_NODE_MAP, NULL);
+    struct mpv_node_list *list = req->result->u.list;
+    for (int n = 0; req->names[n]; n++) {
+        struct mpv_node node;
+        struct getproperty_request preq = {
+            .mpctx = req->mpctx,
+            .name = req->names[n],
+            .format = MPV_FORMAT_NODE,
+            .data = &node,
+        };
+        getproperty_fn(&preq);
+        if (preq.status < 0)
+            continue;
+        *node_map_add(req->result, req->names[n], MPV_FORMAT_NONE) = node;
+        talloc_steal(list, node_get_alloc(&node));
+    }
+}
+
+int mpv_get_properties(mpv_handle *ctx, const char **names, mpv_node *result)
+{
+    if (!ctx->mpctx->initialized)
+        return MPV_ERROR_UNINITIALIZED;
+    if (!names || !result)
+        return MPV_ERROR_INVALID_PARAMETER;
+
+    struct getproperties_request req = {
+        .mpctx = ctx->mpctx,
+        .names = names,
+        .result = result,
+    };
+    run_locked(ctx, getproperties_fn, &req);
+    return 0;
+}
+
+struct setproperties_request {
+    struct MPContext *mpctx;
+    mpv_node *values;
+    int status;
+};
+
+static void setproperties_fn(void *arg)
+{
+    struct setproperties_request *req = arg;
+    struct mpv_node_list *list = req->values->u.list;
+
+    req->status = 0;
+    for (int n = 0; n < list->num; n++) {
+        struct setproperty_request preq = {
+            .mpctx = req->mpctx,
+            .name = list->keys[n],
+            .format = MPV_FORMAT_NODE,
+            .data = &list->values[n],
+        };
+        setproperty_fn(&preq);
+        if (preq.status < 0) {
+            req->status = preq.status;
+            break;
+        }
+    }
+}
+
+int mpv_set_properties(mpv_handle *ctx, mpv_node *values)
+{
+    if (!values || values->format != MPV_FORMAT_NODE_MAP)
+        return MPV_ERROR_INVALID_PARAMETER;
+
+    if (!ctx->mpctx->initialized) {
+        struct mpv_node_list *list = values->u.list;
+        for (int n = 0; n < list->num; n++) {
+            int r = mpv_set_property(ctx, list->keys[n], MPV_FORMAT_NODE,
+                                     &list->values[n]);
+            if (r < 0)
+                return r;
+        }
+        return 0;
+    }
+
+    struct setproperties_request req = {
+        .mpctx = ctx->mpctx,
+        .values = values,
+    };
+    run_locked(ctx, setproperties_fn, &req);
+    return req.status;
+}
+
 char *mpv_get_property_string(mpv_handle *ctx, const char *name)
 {
     char *str = NULL;
@@ -1468,10 +1593,13 @@ int mpv_observe_property(mpv_handle *ctx, uint64_t userdata,
         .changed = true,
         .need_new_value = true,
     };
+    mp_property_resolve(ctx->mpctx, prop->name, &prop->ref);
     MP_TARRAY_APPEND(ctx, ctx->properties, ctx->num_properties, prop);
     ctx->property_event_masks |= prop->event_mask;
     ctx->lowest_changed = 0;
+    ctx->properties_pending = true;
     pthread_mutex_unlock(&ctx->lock);
+    mp_wakeup_core(ctx->mpctx);
     invalidate_global_event_mask(ctx);
     return 0;
 }
@@ -1505,12 +1633,19 @@ int mpv_unobserve_property(mpv_handle *ctx, uint64_t userdata)
     return count;
 }
 
+// Called with the core locked. The new value is retrieved and pushed by
+// mp_client_update_properties() before the core goes to sleep.
 static void mark_property_changed(struct mpv_handle *client, int index)
 {
     struct observe_property *prop = client->properties[index];
-    prop->changed = true;
-    prop->need_new_value = prop->format != 0;
     client->lowest_changed = MPMIN(client->lowest_changed, index);
+    client->properties_pending = true;
+    if (!prop->need_new_value) {
+        prop->need_new_value = true;
+        // Only has an effect if the core is already sleeping (i.e. a client
+        // has locked it), and doesn't cause an extra playloop iteration.
+        mp_dispatch_adjust_timeout(client->mpctx->dispatch, 0);
+    }
 }
 
 // Broadcast that a property has changed.
@@ -1528,8 +1663,6 @@ void mp_client_property_change(struct MPContext *mpctx, const char *name)
             if (client->properties[i]->id == id)
                 mark_property_changed(client, i);
         }
-        if (client->lowest_changed < client->num_properties)
-            wakeup_client(client);
         pthread_mutex_unlock(&client->lock);
     }
 
@@ -1544,44 +1677,133 @@ static void notify_property_events(struct mpv_handle *ctx, uint64_t event_mask)
         if (ctx->properties[i]->event_mask & event_mask)
             mark_property_changed(ctx, i);
     }
-    if (ctx->lowest_changed < ctx->num_properties)
-        wakeup_client(ctx);
 }
 
-static void update_prop(void *p)
+struct prop_update {
+    struct observe_property *prop;
+    int format;             // prop->format (prop may be gone at the end)
+    union m_option_value val;
+    int status;
+    int same_as;            // index of the update with the same value, or -1
+};
+
+// Retrieve the new values of all changed observed properties, and push them
+// to the clients. A property observed by multiple clients (with the same
+// format) is read only once. Changes between calls are coalesced, and
+// properties with a rate limit are deferred until their interval has passed.
+// Called by the core thread before it goes to sleep.
+void mp_client_update_properties(struct MPContext *mpctx)
 {
-    struct observe_property *prop = p;
-    struct mpv_handle *ctx = prop->client;
+    struct mp_client_api *clients = mpctx->clients;
+    if (!mpctx->initialized)
+        return;
 
-    const struct m_option *type = get_mp_type_get(prop->format);
-    union m_option_value val = {0};
+    int64_t now = mp_time_us();
+    int64_t next_update = INT64_MAX;
+    struct prop_update *updates = NULL;
+    int num_updates = 0;
 
-    struct getproperty_request req = {
-        .mpctx = ctx->mpctx,
-        .name = prop->name,
-        .format = prop->format,
-        .data = &val,
-    };
+    pthread_mutex_lock(&clients->lock);
+    for (int n = 0; n < clients->num_clients; n++) {
+        struct mpv_handle *client = clients->clients[n];
+        if (client->destroying)
+            continue;
+        pthread_mutex_lock(&client->lock);
+        if (client->properties_pending) {
+            client->properties_pending = false;
+            for (int i = 0; i < client->num_properties; i++) {
+                struct observe_property *prop = client->properties[i];
+                if (!prop->need_new_value || prop->updating)
+                    continue;
+                int64_t due = prop->last_update + prop->min_interval;
+                if (prop->min_interval && due > now) {
+                    client->properties_pending = true;
+                    next_update = MPMIN(next_update, due);
+                    continue;
+                }
+                prop->need_new_value = false;
+                prop->last_update = now;
+                if (!prop->format) {
+                    prop->changed = true;
+                    wakeup_client(client);
+                    continue;
+                }
+                prop->updating = true;
+                client->properties_updating++;
+                MP_TARRAY_APPEND(NULL, updates, num_updates,
+                                 (struct prop_update){
+                                     .prop = prop,
+                                     .format = prop->format,
+                                 });
+            }
+        }
+        pthread_mutex_unlock(&client->lock);
+    }
+    pthread_mutex_unlock(&clients->lock);
+
+    if (next_update != INT64_MAX)
+        mp_set_timeout(mpctx, (next_update - now) / 1e6);
+
+    // Run the getters without holding any client locks. The clients can't go
+    // away while properties_updating is non-0.
+    for (int n = 0; n < num_updates; n++) {
+        struct prop_update *u = &updates[n];
+        struct observe_property *prop = u->prop;
+        u->same_as = -1;
+        for (int i = 0; i < n; i++) {
+            struct observe_property *other = updates[i].prop;
+            if (updates[i].same_as < 0 && other->format == prop->format &&
+                strcmp(other->name, prop->name) == 0)
+            {
+                u->same_as = i;
+                break;
+            }
+        }
+        if (u->same_as >= 0)
+            continue;
+        struct getproperty_request req = {
+            .mpctx = mpctx,
+            .name = prop->name,
+            .ref = &prop->ref,
+            .format = prop->format,
+            .data = &u->val,
+        };
+        getproperty_fn(&req);
+        u->status = req.status;
+    }
 
-    getproperty_fn(&req);
+    for (int n = 0; n < num_updates; n++) {
+        struct prop_update *u = &updates[n];
+        struct observe_property *prop = u->prop;
+        struct mpv_handle *ctx = prop->client;
+        const struct m_option *type = get_mp_type_get(prop->format);
+        struct prop_update *src = u->same_as >= 0 ? &updates[u->same_as] : u;
 
-    pthread_mutex_lock(&ctx->lock);
-    ctx->properties_updating--;
-    prop->updating = false;
-    m_option_free(type, &prop->new_value);
-    prop->new_value_valid = req.status >= 0;
-    if (prop->new_value_valid)
-        memcpy(&prop->new_value, &val, type->type->size);
-    if (prop->user_value_valid != prop->new_value_valid) {
-        prop->changed = true;
-    } else if (prop->user_value_valid && prop->new_value_valid) {
-        if (!equal_mpv_value(&prop->user_value, &prop->new_value, prop->format))
+        pthread_mutex_lock(&ctx->lock);
+        ctx->properties_updating--;
+        prop->updating = false;
+        m_option_free(type, &prop->new_value);
+        prop->new_value_valid = src->status >= 0;
+        if (prop->new_value_valid)
+            m_option_copy(type, &prop->new_value, &src->val);
+        if (prop->user_value_valid != prop->new_value_valid) {
             prop->changed = true;
+        } else if (prop->user_value_valid && prop->new_value_valid) {
+            if (!equal_mpv_value(&prop->user_value, &prop->new_value, prop->format))
+                prop->changed = true;
+        }
+        if (prop->dead)
+            talloc_steal(ctx->cur_event, prop);
+        wakeup_client(ctx);
+        pthread_mutex_unlock(&ctx->lock);
     }
-    if (prop->dead)
-        talloc_steal(ctx->cur_event, prop);
-    wakeup_client(ctx);
-    pthread_mutex_unlock(&ctx->lock);
+
+    for (int n = 0; n < num_updates; n++) {
+        struct prop_update *u = &updates[n];
+        if (u->same_as < 0 && u->status >= 0)
+            m_option_free(get_mp_type_get(u->format), &u->val);
+    }
+    talloc_free(updates);
 }
 
 // Set ctx->cur_event to a generated property change event, if there is any
@@ -1594,39 +1816,53 @@ static bool gen_property_change_event(struct mpv_handle *ctx)
     ctx->lowest_changed = ctx->num_properties;
     for (int n = start; n < ctx->num_properties; n++) {
         struct observe_property *prop = ctx->properties[n];
-        if ((prop->changed || prop->updating) && n < ctx->lowest_changed)
+        if ((prop->changed || prop->need_new_value || prop->updating) &&
+            n < ctx->lowest_changed)
             ctx->lowest_changed = n;
-        if (prop->changed) {
-            bool get_value = prop->need_new_value;
-            prop->need_new_value = false;
+        // Wait until the core has pushed the new value.
+        if (prop->changed && !prop->need_new_value && !prop->updating) {
             prop->changed = false;
-            if (prop->format && get_value) {
-                ctx->properties_updating++;
-                prop->updating = true;
-                mp_dispatch_enqueue(ctx->mpctx->dispatch, update_prop, prop);
-            } else {
-                const struct m_option *type = get_mp_type_get(prop->format);
-                prop->user_value_valid = prop->new_value_valid;
-                if (prop->new_value_valid)
-                    m_option_copy(type, &prop->user_value, &prop->new_value);
-                ctx->cur_property_event = (struct mpv_event_property){
-                    .name = prop->name,
-                    .format = prop->user_value_valid ? prop->format : 0,
-                };
-                if (prop->user_value_valid)
-                    ctx->cur_property_event.data = &prop->user_value;
-                *ctx->cur_event = (struct mpv_event){
-                    .event_id = MPV_EVENT_PROPERTY_CHANGE,
-                    .reply_userdata = prop->reply_id,
-                    .data = &ctx->cur_property_event,
-                };
-                return true;
-            }
+            const struct m_option *type = get_mp_type_get(prop->format);
+            prop->user_value_valid = prop->new_value_valid;
+            if (prop->new_value_valid)
+                m_option_copy(type, &prop->user_value, &prop->new_value);
+            ctx->cur_property_event = (struct mpv_event_property){
+                .name = prop->name,
+                .format = prop->user_value_valid ? prop->format : 0,
+            };
+            if (prop->user_value_valid)
+                ctx->cur_property_event.data = &prop->user_value;
+            *ctx->cur_event = (struct mpv_event){
+                .event_id = MPV_EVENT_PROPERTY_CHANGE,
+                .reply_userdata = prop->reply_id,
+                .data = &ctx->cur_property_event,
+            };
+            return true;
         }
     }
     return false;
 }
 
+int mpv_observe_property_rate(mpv_handle *ctx, uint64_t userdata,
+                              double max_rate)
+{
+    if (!(max_rate >= 0))
+        return MPV_ERROR_INVALID_PARAMETER;
+    int64_t interval = max_rate > 0 ? MPMAX(1e6 / max_rate, 1) : 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    int count = 0;
+    for (int n = 0; n < ctx->num_properties; n++) {
+        struct observe_property *prop = ctx->properties[n];
+        if (prop->reply_id == userdata) {
+            prop->min_interval = interval;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return count;
+}
+
 int mpv_hook_add(mpv_handle *ctx, uint64_t reply_userdata,
                  const char *name, int priority)
 {
@@ -1871,3 +2107,16 @@ bool mp_streamcb_lookup(struct mpv_global *g, const char *protocol,
     pthread_mutex_unlock(&clients->lock);
     return found;
 }
+
+// playback_state
+
+int mpv_get_playback_state_fd(mpv_handle *ctx)
+{
+    if (!ctx->mpctx->initialized)
+        return MPV_ERROR_UNINITIALIZED;
+
+    lock_core(ctx);
+    int r = mp_playback_state_get_fd(ctx->mpctx);
+    unlock_core(ctx);
+    return r;
+}
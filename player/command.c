@@ -38,7 +38,9 @@
 #include "common/codecs.h"
 #include "common/msg.h"
 #include "common/msg_control.h"
+#include "common/perf_counters.h"
 #include "filters/f_decoder_wrapper.h"
+#include "filters/f_output_chain.h"
 #include "command.h"
 #include "osdep/timer.h"
 #include "common/common.h"
@@ -72,6 +74,7 @@
 struct command_ctx {
     // All properties, terminated with a {0} item.
     struct m_property *properties;
+    struct m_property_index *property_index;
 
     bool is_idle;
 
@@ -289,7 +292,8 @@ int mp_on_set_option(void *ctx, struct m_config_option *co, void *data, int flag
     // property implementation is trivial, and can break some obscure features
     // like --profile and --include if non-trivial flags are involved (which
     // the bridge would drop).
-    struct m_property *prop = m_property_list_find(cmd->properties, name);
+    struct m_property *prop =
+        m_property_index_find(cmd->property_index, bstr0(name));
     if (prop && prop->is_option)
         goto direct_option;
 
@@ -978,6 +982,108 @@ static int mp_property_playback_abort(void *ctx, struct m_property *prop,
     return m_property_flag_ro(action, arg, !mpctx->playing || mpctx->stop_play);
 }
 
+static int mp_property_playlist_pos_x(void *ctx, struct m_property *prop,
+                                      int action, void *arg, int base)
+{
+    MPContext *mpctx = ctx;
+    struct playlist *pl = mpctx->playlist;
+    if (!pl->first)
+        return M_PROPERTY_UNAVAILABLE;
+
+    switch (action) {
+    case M_PROPERTY_GET: {
+        int pos = playlist_entry_to_index(pl, pl->current);
+        if (pos < 0)
+            return M_PROPERTY_UNAVAILABLE;
+        *(int *)arg = pos + base;
+        return M_PROPERTY_OK;
+    }
+    case M_PROPERTY_SET: {
+        int pos = *(int *)arg - base;
+        struct playlist_entry *e = playlist_entry_from_index(pl, pos);
+        if (!e)
+            return M_PROPERTY_ERROR;
+        mp_set_playlist_entry(mpctx, e);
+        return M_PROPERTY_OK;
+    }
+    case M_PROPERTY_GET_TYPE: {
+        struct m_option opt = {
+            .type = CONF_TYPE_INT,
+            .flags = CONF_RANGE,
+            .min = base,
+            .max = playlist_entry_count(pl) - 1 + base,
+        };
+        *(struct m_option *)arg = opt;
+        return M_PROPERTY_OK;
+    }
+    }
+    return M_PROPERTY_NOT_IMPLEMENTED;
+}
+
+static int mp_property_playlist_pos(void *ctx, struct m_property *prop,
+                                    int action, void *arg)
+{
+    return mp_property_playlist_pos_x(ctx, prop, action, arg, 0);
+}
+
+static int mp_property_playlist_pos_1(void *ctx, struct m_property *prop,
+                                      int action, void *arg)
+{
+    return mp_property_playlist_pos_x(ctx, prop, action, arg, 1);
+}
+
+static int get_playlist_entry(int item, int action, void *arg, void *ctx)
+{
+    struct MPContext *mpctx = ctx;
+
+    struct playlist_entry *e = playlist_entry_from_index(mpctx->playlist, item);
+    if (!e)
+        return M_PROPERTY_ERROR;
+
+    bool current = mpctx->playlist->current == e;
+    bool playing = mpctx->playing == e;
+    struct m_sub_property props[] = {
+        {"filename",    SUB_PROP_STR(e->filename)},
+        {"current",     SUB_PROP_FLAG(1), .unavailable = !current},
+        {"playing",     SUB_PROP_FLAG(1), .unavailable = !playing},
+        {"title",       SUB_PROP_STR(e->title), .unavailable = !e->title},
+        {0}
+    };
+
+    return m_property_read_sub(props, action, arg);
+}
+
+static int mp_property_playlist(void *ctx, struct m_property *prop,
+                                int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (action == M_PROPERTY_PRINT) {
+        char *res = talloc_strdup(NULL, "");
+
+        for (struct playlist_entry *e = mpctx->playlist->first; e; e = e->next)
+        {
+            const char *p = e->title;
+            if (!p) {
+                p = e->filename;
+                if (!mp_is_url(bstr0(p))) {
+                    const char *s = mp_basename(e->filename);
+                    if (s[0])
+                        p = s;
+                }
+            }
+            const char *m = mpctx->playlist->current == e ? "> " : "";
+            res = talloc_asprintf_append(res, "%s%s\n", m, p);
+        }
+
+        *(char **)arg = res;
+        return M_PROPERTY_OK;
+    }
+
+    return m_property_read_list(action, arg,
+                                playlist_entry_count(mpctx->playlist),
+                                get_playlist_entry, mpctx);
+}
+
 static int mp_property_cache_speed(void *ctx, struct m_property *prop,
                                    int action, void *arg)
 {
@@ -1096,6 +1202,102 @@ static int mp_property_demuxer_cache_state(void *ctx, struct m_property *prop,
     return M_PROPERTY_OK;
 }
 
+static int mp_property_perf_counters(void *ctx, struct m_property *prop,
+                                     int action, void *arg)
+{
+    if (action == M_PROPERTY_GET_TYPE) {
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    }
+    if (action != M_PROPERTY_GET)
+        return M_PROPERTY_NOT_IMPLEMENTED;
+
+    int64_t values[MP_PERF_COUNTER_COUNT];
+    mp_perf_read(values);
+
+    struct mpv_node *r = (struct mpv_node *)arg;
+    node_init(r, MPV_FORMAT_NODE_MAP, NULL);
+    for (int n = 0; n < MP_PERF_COUNTER_COUNT; n++)
+        node_map_add_int64(r, mp_perf_counter_names[n], values[n]);
+
+    return M_PROPERTY_OK;
+}
+
+static void add_latency_cmd(struct mpv_node *r, const char *name,
+                            struct latency_cmd_state *c)
+{
+    if (!c->issued)
+        return;
+    struct mpv_node *sub = node_map_add(r, name, MPV_FORMAT_NODE_MAP);
+    bool pending = c->time_to_audible < 0 && !c->unavailable;
+    node_map_add_flag(sub, "pending", pending);
+    node_map_add_flag(sub, "unavailable", c->unavailable);
+    if (c->time_to_audible >= 0)
+        node_map_add_double(sub, "time-to-audible", c->time_to_audible);
+}
+
+// Buffered audio per pipeline stage (in seconds of playback, ignoring speed),
+// and the time-to-audible of the last play/seek/volume commands.
+static int mp_property_audio_latency(void *ctx, struct m_property *prop,
+                                     int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    struct MPOpts *opts = mpctx->opts;
+    struct ao_chain *ao_c = mpctx->ao_chain;
+
+    if (action == M_PROPERTY_GET_TYPE) {
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    }
+    if (action != M_PROPERTY_GET)
+        return M_PROPERTY_NOT_IMPLEMENTED;
+
+    struct mpv_node *r = (struct mpv_node *)arg;
+    node_init(r, MPV_FORMAT_NODE_MAP, NULL);
+
+    if (mpctx->demuxer) {
+        struct demux_ctrl_reader_state s;
+        if (demux_control(mpctx->demuxer, DEMUXER_CTRL_GET_READER_STATE, &s) > 0
+            && s.ts_end != MP_NOPTS_VALUE && s.ts_reader != MP_NOPTS_VALUE)
+        {
+            // Not part of the total: this is readahead, not output delay.
+            node_map_add_double(r, "demuxer", MPMAX(s.ts_end - s.ts_reader, 0));
+        }
+    }
+
+    if (ao_c) {
+        void *tmp = talloc_new(NULL);
+        struct mp_output_filter_delay *delays;
+        int num = mp_output_get_measured_delays(ao_c->filter, tmp, &delays);
+        struct mpv_node *list =
+            node_map_add(r, "filter-list", MPV_FORMAT_NODE_ARRAY);
+        for (int n = 0; n < num; n++) {
+            struct mpv_node *sub = node_array_add(list, MPV_FORMAT_NODE_MAP);
+            node_map_add_string(sub, "name", delays[n].name);
+            node_map_add_double(sub, "delay", delays[n].delay);
+        }
+        talloc_free(tmp);
+    }
+
+    struct audio_latency l;
+    audio_get_latency(mpctx, &l);
+    node_map_add_double(r, "filters", l.filters);
+    node_map_add_double(r, "output-queue", l.output_queue);
+    node_map_add_double(r, "ao-chain", l.ao_chain);
+    node_map_add_double(r, "ao-buffer", l.ao_buffer);
+    node_map_add_double(r, "device", l.device);
+    node_map_add_double(r, "total", l.total);
+
+    if (opts->ao_opts->audio_latency_target > 0)
+        node_map_add_flag(r, "target-exceeded", mpctx->latency_target_exceeded);
+
+    add_latency_cmd(r, "play", &mpctx->latency_cmds[LATENCY_CMD_PLAY]);
+    add_latency_cmd(r, "seek", &mpctx->latency_cmds[LATENCY_CMD_SEEK]);
+    add_latency_cmd(r, "volume", &mpctx->latency_cmds[LATENCY_CMD_VOLUME]);
+
+    return M_PROPERTY_OK;
+}
+
 static int mp_property_demuxer_start_time(void *ctx, struct m_property *prop,
                                           int action, void *arg)
 {
@@ -1192,6 +1394,9 @@ static int mp_property_volume(void *ctx, struct m_property *prop,
     case M_PROPERTY_PRINT:
         *(char **)arg = talloc_asprintf(NULL, "%i", (int)opts->softvol_volume);
         return M_PROPERTY_OK;
+    case M_PROPERTY_SET:
+        audio_mark_latency_cmd(mpctx, LATENCY_CMD_VOLUME);
+        break;
     }
 
     return mp_property_generic_option(mpctx, prop, action, arg);
@@ -1208,6 +1413,8 @@ static int mp_property_mute(void *ctx, struct m_property *prop,
         return M_PROPERTY_OK;
     }
 
+    if (action == M_PROPERTY_SET)
+        audio_mark_latency_cmd(mpctx, LATENCY_CMD_VOLUME);
     int r = mp_property_generic_option(mpctx, prop, action, arg);
     if (action == M_PROPERTY_SET)
         audio_update_volume(mpctx);
@@ -1995,6 +2202,8 @@ static const struct m_property mp_properties_base[] = {
     {"demuxer-cache-idle", mp_property_demuxer_cache_idle},
     {"demuxer-start-time", mp_property_demuxer_start_time},
     {"demuxer-cache-state", mp_property_demuxer_cache_state},
+    {"perf-counters", mp_property_perf_counters},
+    {"audio-latency", mp_property_audio_latency},
     {"cache-buffering-state", mp_property_cache_buffering},
     {"paused-for-cache", mp_property_paused_for_cache},
     {"demuxer-via-network", mp_property_demuxer_is_network},
@@ -2003,6 +2212,9 @@ static const struct m_property mp_properties_base[] = {
     {"partially-seekable", mp_property_partially_seekable},
     {"idle-active", mp_property_idle},
 
+    {"playlist", mp_property_playlist},
+    {"playlist-pos", mp_property_playlist_pos},
+    {"playlist-pos-1", mp_property_playlist_pos_1},
     M_PROPERTY_ALIAS("playlist-count", "playlist/count"),
 
     // Audio
@@ -2148,11 +2360,14 @@ uint64_t mp_get_property_event_mask(const char *name)
 int mp_get_property_id(struct MPContext *mpctx, const char *name)
 {
     struct command_ctx *ctx = mpctx->command_ctx;
-    for (int n = 0; ctx->properties[n].name; n++) {
-        if (match_property(ctx->properties[n].name, name))
-            return n;
-    }
-    return -1;
+    // Same as match_property(): strip "options/" and sub-property paths.
+    bstr base = bstr0(name);
+    bstr_eatstart0(&base, "options/");
+    int sep = bstrchr(base, '/');
+    if (sep >= 0)
+        base = bstr_splice(base, 0, sep);
+    struct m_property *prop = m_property_index_find(ctx->property_index, base);
+    return prop ? prop - ctx->properties : -1;
 }
 
 static bool is_property_set(int action, void *val)
@@ -2173,22 +2388,49 @@ static bool is_property_set(int action, void *val)
     }
 }
 
-static int mp_property_do_silent(const char *name, int action, void *val,
-                                 struct MPContext *ctx)
+// Resolve the property name once, for use with mp_property_do_ref(). ref
+// points into name, so name must stay valid while ref is used.
+void mp_property_resolve(struct MPContext *mpctx, const char *name,
+                         struct m_property_ref *ref)
+{
+    struct command_ctx *cmd = mpctx->command_ctx;
+    m_property_resolve(cmd->properties, cmd->property_index, name, ref);
+}
+
+static int mp_property_do_silent_ref(const struct m_property_ref *ref,
+                                     int action, void *val,
+                                     struct MPContext *ctx)
 {
     struct command_ctx *cmd = ctx->command_ctx;
     cmd->silence_option_deprecations += 1;
-    int r = m_property_do(ctx->log, cmd->properties, name, action, val, ctx);
+    int r = m_property_do_ref(ctx->log, ref, action, val, ctx);
     cmd->silence_option_deprecations -= 1;
     if (r == M_PROPERTY_OK && is_property_set(action, val))
-        mp_notify_property(ctx, (char *)name);
+        mp_notify_property(ctx, ref->name);
     return r;
 }
 
+static int mp_property_do_silent(const char *name, int action, void *val,
+                                 struct MPContext *ctx)
+{
+    struct m_property_ref ref;
+    mp_property_resolve(ctx, name, &ref);
+    return mp_property_do_silent_ref(&ref, action, val, ctx);
+}
+
 int mp_property_do(const char *name, int action, void *val,
                    struct MPContext *ctx)
 {
-    int r = mp_property_do_silent(name, action, val, ctx);
+    struct m_property_ref ref;
+    mp_property_resolve(ctx, name, &ref);
+    return mp_property_do_ref(&ref, action, val, ctx);
+}
+
+int mp_property_do_ref(const struct m_property_ref *ref, int action, void *val,
+                       struct MPContext *ctx)
+{
+    const char *name = ref->name;
+    int r = mp_property_do_silent_ref(ref, action, val, ctx);
     if (mp_msg_test(ctx->log, MSGL_V) && is_property_set(action, val)) {
         struct m_option ot = {0};
         void *data = val;
@@ -2212,7 +2454,8 @@ int mp_property_do(const char *name, int action, void *val,
 char *mp_property_expand_string(struct MPContext *mpctx, const char *str)
 {
     struct command_ctx *ctx = mpctx->command_ctx;
-    return m_properties_expand_string(ctx->properties, str, mpctx);
+    return m_properties_expand_string(ctx->properties, ctx->property_index,
+                                      str, mpctx);
 }
 
 // Before expanding properties, parse C-style escapes like "\n"
@@ -3013,6 +3256,7 @@ static void cmd_playlist_move(void *p)
         return;
     }
 
+    mp_finish_playlist_load(mpctx);
     playlist_move(mpctx->playlist, e1, e2);
     mp_notify(mpctx, MP_EVENT_CHANGE_PLAYLIST, NULL);
 }
@@ -3022,6 +3266,7 @@ static void cmd_playlist_shuffle(void *p)
     struct mp_cmd_ctx *cmd = p;
     struct MPContext *mpctx = cmd->mpctx;
 
+    mp_finish_playlist_load(mpctx);
     playlist_shuffle(mpctx->playlist);
     mp_notify(mpctx, MP_EVENT_CHANGE_PLAYLIST, NULL);
 }
@@ -3728,6 +3973,10 @@ void command_init(struct MPContext *mpctx)
         talloc_zero_array(ctx, struct m_property, num_base + num_opts + 1);
     memcpy(ctx->properties, mp_properties_base, sizeof(mp_properties_base));
 
+    // Option names are unique, so they can only clash with the base list.
+    struct m_property_index *base_index =
+        m_property_index_new(NULL, ctx->properties);
+
     int count = num_base;
     for (int n = 0; n < num_opts; n++) {
         struct m_config_option *co = m_config_get_co_index(mpctx->mconfig, n);
@@ -3749,11 +3998,14 @@ void command_init(struct MPContext *mpctx)
         }
 
         // The option might be covered by a manual property already.
-        if (m_property_list_find(ctx->properties, prop.name))
+        if (m_property_index_find(base_index, bstr0(prop.name)))
             continue;
 
         ctx->properties[count++] = prop;
     }
+
+    talloc_free(base_index);
+    ctx->property_index = m_property_index_new(ctx, ctx->properties);
 }
 
 static void command_event(struct MPContext *mpctx, int event, void *arg)
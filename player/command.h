@@ -27,6 +27,7 @@ struct mp_cmd;
 struct mp_log;
 struct mpv_node;
 struct m_config_option;
+struct m_property_ref;
 
 void command_init(struct MPContext *mpctx);
 void command_uninit(struct MPContext *mpctx);
@@ -73,6 +74,10 @@ char *mp_property_expand_escaped_string(struct MPContext *mpctx, const char *str
 void property_print_help(struct MPContext *mpctx);
 int mp_property_do(const char* name, int action, void* val,
                    struct MPContext *mpctx);
+void mp_property_resolve(struct MPContext *mpctx, const char *name,
+                         struct m_property_ref *ref);
+int mp_property_do_ref(const struct m_property_ref *ref, int action, void *val,
+                       struct MPContext *mpctx);
 
 int mp_on_set_option(void *ctx, struct m_config_option *co, void *data, int flags);
 void mp_option_change_callback(void *ctx, struct m_config_option *co, int flags);
@@ -196,6 +196,32 @@ enum playback_status {
     STATUS_EOF,         // playback has ended, or is disabled
 };
 
+// Commands whose time-to-audible is measured (see audio_mark_latency_cmd()).
+enum latency_cmd {
+    LATENCY_CMD_PLAY,       // file start, or unpause
+    LATENCY_CMD_SEEK,
+    LATENCY_CMD_VOLUME,     // volume or mute change
+    LATENCY_CMD_COUNT
+};
+
+struct latency_cmd_state {
+    double issued;          // mp_time_sec() of the last command (0 if none)
+    bool wait_restart;      // target_pts is set on the next playback restart
+    double target_pts;      // first audio pts affected by the command
+    double time_to_audible; // seconds until target_pts played (-1: pending)
+    bool unavailable;       // no audio will play for it (not pending anymore)
+};
+
+// Audio buffered in each stage of the output path, in seconds.
+struct audio_latency {
+    double filters;         // measured delay of the filter chain
+    double output_queue;    // ao_chain->output_frame
+    double ao_chain;        // ao_chain->ao_buffer
+    double ao_buffer;       // AO soft buffer
+    double device;          // audio driver and device
+    double total;
+};
+
 #define NUM_PTRACKS 2
 
 typedef struct MPContext {
@@ -229,6 +255,8 @@ typedef struct MPContext {
     char *osd_msg_text;
 
     struct playlist *playlist;
+    // Set while the rest of a large playlist file is parsed in the background.
+    struct playlist_load_job *playlist_load_job;
     struct playlist_entry *playing; // currently playing file
     char *filename; // immutable copy of playing->filename (or NULL)
     char *stream_open_filename;
@@ -332,6 +360,11 @@ typedef struct MPContext {
     int64_t audio_stat_start;
     double written_audio;
 
+    struct latency_cmd_state latency_cmds[LATENCY_CMD_COUNT];
+    // PTS of the first audio written to the AO after the last (re)start.
+    double latency_start_pts;
+    bool latency_target_exceeded;
+
     int last_chapter;
 
     // Past timestamps etc.
@@ -386,6 +419,9 @@ typedef struct MPContext {
 
     struct mp_ipc_ctx *ipc_ctx;
 
+    // Shared memory copy of hot state (NULL until a client requests it).
+    struct mp_playback_state *playback_state;
+
     pthread_mutex_t abort_lock;
 
     // --- The following fields are protected by abort_lock
@@ -440,6 +476,11 @@ void reinit_audio_chain_src(struct MPContext *mpctx, struct track *track);
 void audio_update_volume(struct MPContext *mpctx);
 void audio_update_balance(struct MPContext *mpctx);
 void reload_audio_output(struct MPContext *mpctx);
+void audio_get_latency(struct MPContext *mpctx, struct audio_latency *l);
+void audio_mark_latency_cmd(struct MPContext *mpctx, enum latency_cmd type);
+void audio_latency_restart(struct MPContext *mpctx);
+void audio_update_latency(struct MPContext *mpctx);
+void audio_expire_latency_cmds(struct MPContext *mpctx, bool all);
 
 // configfiles.c
 void mp_parse_cfgfiles(struct MPContext *mpctx);
@@ -479,6 +520,9 @@ void update_demuxer_properties(struct MPContext *mpctx);
 void print_track_list(struct MPContext *mpctx, const char *msg);
 void reselect_demux_stream(struct MPContext *mpctx, struct track *track);
 void prepare_playlist(struct MPContext *mpctx, struct playlist *pl);
+void mp_update_playlist_load(struct MPContext *mpctx, bool wait);
+void mp_cancel_playlist_load(struct MPContext *mpctx);
+void mp_finish_playlist_load(struct MPContext *mpctx);
 struct track *select_default_track(struct MPContext *mpctx, int order,
                                    enum stream_type type);
 void prefetch_next(struct MPContext *mpctx);
@@ -508,6 +552,11 @@ bool set_osd_msg(struct MPContext *mpctx, int level, int time,
                  const char* fmt, ...) PRINTF_ATTRIBUTE(4,5);
 void set_osd_function(struct MPContext *mpctx, int osd_function);
 
+// playback_state.c
+int mp_playback_state_get_fd(struct MPContext *mpctx);
+void mp_playback_state_update(struct MPContext *mpctx);
+void mp_playback_state_destroy(struct MPContext *mpctx);
+
 // playloop.c
 void mp_wait_events(struct MPContext *mpctx);
 void mp_set_timeout(struct MPContext *mpctx, double sleeptime);
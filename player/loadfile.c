@@ -804,16 +804,228 @@ void prepare_playlist(struct MPContext *mpctx, struct playlist *pl)
         pl->current = pl->first;
 }
 
+// Number of entries appended to the playlist at once by background loading.
+#define PLAYLIST_LOAD_CHUNK 1000
+
+struct playlist_load_job {
+    struct MPContext *mpctx;
+    struct playlist_loader *loader;
+    struct mp_cancel *cancel;   // aborts the loader's I/O
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // --- protected by lock
+    struct playlist **chunks;   // parsed entries, not added to the playlist yet
+    int num_chunks;
+    bool done;                  // worker exited
+    bool detached;              // core forgot the job; worker frees it
+
+    // --- core thread only
+    struct playlist_entry *last; // new entries go after this (reserved)
+    int stream_flags;
+    char *redirect;
+};
+
+static void playlist_load_job_destroy(void *ptr)
+{
+    struct playlist_load_job *job = ptr;
+    // Before job->cancel, which the loader's cancels may be attached to.
+    TA_FREEP(&job->loader);
+    for (int n = 0; n < job->num_chunks; n++)
+        talloc_free(job->chunks[n]);
+    talloc_free(job->chunks);
+    pthread_cond_destroy(&job->wakeup);
+    pthread_mutex_destroy(&job->lock);
+}
+
+static void playlist_load_thread(void *ptr)
+{
+    struct playlist_load_job *job = ptr;
+
+    bool more = true;
+    while (more && !mp_cancel_test(job->cancel)) {
+        struct playlist *chunk = talloc_zero(NULL, struct playlist);
+        more = job->loader->load(job->loader, chunk, PLAYLIST_LOAD_CHUNK);
+
+        pthread_mutex_lock(&job->lock);
+        // (Not allocated under job, as the core thread frees it.)
+        MP_TARRAY_APPEND(NULL, job->chunks, job->num_chunks, chunk);
+        pthread_cond_broadcast(&job->wakeup);
+        if (!job->detached)
+            mp_wakeup_core(job->mpctx);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->done = true;
+    bool detached = job->detached;
+    if (!detached) {
+        pthread_cond_broadcast(&job->wakeup);
+        // (Within the lock, as job and mpctx can be destroyed right after it.)
+        mp_wakeup_core(job->mpctx);
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    if (detached)
+        talloc_free(job);
+}
+
+// Stop loading the rest of the playlist, and discard what's not added yet.
+// This doesn't wait for the loader; it's aborted, and finishes on its own.
+static void detach_playlist_load(struct MPContext *mpctx)
+{
+    struct playlist_load_job *job = mpctx->playlist_load_job;
+    if (!job)
+        return;
+    mpctx->playlist_load_job = NULL;
+
+    playlist_entry_unref(job->last);
+    job->last = NULL;
+
+    mp_cancel_trigger(job->cancel);
+    pthread_mutex_lock(&job->lock);
+    bool done = job->done;
+    job->detached = true;
+    pthread_mutex_unlock(&job->lock);
+
+    if (done)
+        talloc_free(job);
+}
+
+// Like detach_playlist_load(), but wait until the loader has stopped. Detached
+// loaders are waited for by freeing mpctx->thread_pool.
+void mp_cancel_playlist_load(struct MPContext *mpctx)
+{
+    struct playlist_load_job *job = mpctx->playlist_load_job;
+    if (!job)
+        return;
+
+    mp_cancel_trigger(job->cancel);
+    pthread_mutex_lock(&job->lock);
+    while (!job->done)
+        pthread_cond_wait(&job->wakeup, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+
+    playlist_entry_unref(job->last);
+    talloc_free(job);
+    mpctx->playlist_load_job = NULL;
+}
+
+// Add entries parsed by the background loader to the playlist. If wait is set,
+// wait until at least one chunk was added, or loading is done.
+void mp_update_playlist_load(struct MPContext *mpctx, bool wait)
+{
+    struct playlist_load_job *job = mpctx->playlist_load_job;
+    if (!job)
+        return;
+
+    pthread_mutex_lock(&job->lock);
+    while (wait && !job->num_chunks && !job->done)
+        pthread_cond_wait(&job->wakeup, &job->lock);
+    struct playlist **chunks = job->chunks;
+    int num_chunks = job->num_chunks;
+    job->chunks = NULL;
+    job->num_chunks = 0;
+    bool done = job->done;
+    pthread_mutex_unlock(&job->lock);
+
+    struct playlist *pl = mpctx->playlist;
+    bool changed = false;
+    for (int n = 0; n < num_chunks; n++) {
+        struct playlist *chunk = chunks[n];
+        // If the last entry was removed, the playlist was most likely cleared
+        // or replaced; don't add the rest of the old one.
+        if (chunk->first && job->last->pl == pl) {
+            for (struct playlist_entry *e = chunk->first; e; e = e->next)
+                e->stream_flags |= job->stream_flags;
+            if (job->redirect)
+                playlist_add_redirect(chunk, job->redirect);
+            struct playlist_entry *last = chunk->last;
+            playlist_transfer_entries_to(pl, job->last, chunk);
+            playlist_entry_unref(job->last);
+            job->last = last;
+            job->last->reserved += 1;
+            changed = true;
+        }
+        talloc_free(chunk);
+    }
+    talloc_free(chunks);
+
+    if (changed)
+        mp_notify_property(mpctx, "playlist");
+
+    if (done || job->last->pl != pl)
+        detach_playlist_load(mpctx);
+}
+
+// Add all remaining entries of the background loader to the playlist, so that
+// the playlist can be reordered as a whole (otherwise the rest would be added
+// after an entry that may have been moved anywhere).
+void mp_finish_playlist_load(struct MPContext *mpctx)
+{
+    while (mpctx->playlist_load_job)
+        mp_update_playlist_load(mpctx, true);
+}
+
+// Continue loading the remaining entries of pl after last (an entry on
+// mpctx->playlist) in the background.
+static void start_playlist_load(struct MPContext *mpctx, struct playlist *pl,
+                                struct playlist_entry *last, int stream_flags,
+                                const char *redirect)
+{
+    // Only one at a time; the previous one is for a replaced playlist entry.
+    detach_playlist_load(mpctx);
+
+    struct playlist_load_job *job = talloc_ptrtype(NULL, job);
+    *job = (struct playlist_load_job){
+        .mpctx = mpctx,
+        .loader = talloc_steal(job, pl->loader),
+        .cancel = mp_cancel_new(job),
+        .last = last,
+        .stream_flags = stream_flags,
+        .redirect = talloc_strdup(job, redirect),
+    };
+    pl->loader = NULL;
+    job->loader->cancel = job->cancel;
+    last->reserved += 1;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->wakeup, NULL);
+    talloc_set_destructor(job, playlist_load_job_destroy);
+    mpctx->playlist_load_job = job;
+
+    // Can block on I/O for a long time, so not on the global (CPU) pool.
+    if (!mp_thread_pool_queue(mpctx->thread_pool, playlist_load_thread, job))
+        playlist_load_thread(job);
+}
+
 // Replace the current playlist entry with playlist contents. Moves the entries
 // from the given playlist pl, so the entries don't actually need to be copied.
-static void transfer_playlist(struct MPContext *mpctx, struct playlist *pl)
+static void transfer_playlist(struct MPContext *mpctx, struct playlist *pl,
+                              int entry_stream_flags)
 {
+    struct MPOpts *opts = mpctx->opts;
+
+    // These need all entries.
+    if (opts->shuffle || opts->merge_files || opts->playlist_pos >= 0)
+        playlist_load_all(pl);
+
+    for (struct playlist_entry *e = pl->first; e; e = e->next)
+        e->stream_flags |= entry_stream_flags;
+
     if (pl->first) {
         prepare_playlist(mpctx, pl);
         struct playlist_entry *new = pl->current;
-        if (mpctx->playlist->current)
-            playlist_add_redirect(pl, mpctx->playlist->current->filename);
+        char *redirect = NULL;
+        if (mpctx->playlist->current) {
+            redirect = mpctx->playlist->current->filename;
+            playlist_add_redirect(pl, redirect);
+        }
+        struct playlist_entry *last = pl->last;
         playlist_transfer_entries(mpctx->playlist, pl);
+        if (pl->loader) {
+            start_playlist_load(mpctx, pl, last, entry_stream_flags,
+                                redirect);
+        }
         // current entry is replaced
         if (mpctx->playlist->current)
             playlist_remove(mpctx->playlist, mpctx->playlist->current);
@@ -1193,6 +1405,8 @@ static void play_current_file(struct MPContext *mpctx)
 
     reset_playback_state(mpctx);
 
+    audio_mark_latency_cmd(mpctx, LATENCY_CMD_PLAY);
+
     mpctx->playing = mpctx->playlist->current;
     if (!mpctx->playing || !mpctx->playing->filename)
         goto terminate_playback;
@@ -1258,9 +1472,7 @@ static void play_current_file(struct MPContext *mpctx)
             if (mpctx->demuxer->is_network)
                 entry_stream_flags |= STREAM_NETWORK_ONLY;
         }
-        for (struct playlist_entry *e = pl->first; e; e = e->next)
-            e->stream_flags |= entry_stream_flags;
-        transfer_playlist(mpctx, pl);
+        transfer_playlist(mpctx, pl, entry_stream_flags);
         mp_notify_property(mpctx, "playlist");
         mpctx->error_playing = 2;
         goto terminate_playback;
@@ -1397,6 +1609,9 @@ terminate_playback:
     if (!opts->gapless_audio && !mpctx->encode_lavc_ctx)
         uninit_audio_out(mpctx);
 
+    // Audio still queued in a gapless AO belongs to the next file.
+    audio_expire_latency_cmds(mpctx, true);
+
     mpctx->playback_initialized = false;
 
     uninit_demuxer(mpctx);
@@ -1478,6 +1693,13 @@ struct playlist_entry *mp_next_file(struct MPContext *mpctx, int direction,
                                     bool force, bool mutate)
 {
     struct playlist_entry *next = playlist_get_next(mpctx->playlist, direction);
+    // The next entries may still be loading.
+    while (!next && direction > 0 && mpctx->playlist->current &&
+           mpctx->playlist_load_job)
+    {
+        mp_update_playlist_load(mpctx, true);
+        next = playlist_get_next(mpctx->playlist, direction);
+    }
     if (next && direction < 0 && !force) {
         // Don't jump to files that would immediately go to next file anyway
         while (next && next->playback_short)
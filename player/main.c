@@ -24,6 +24,8 @@
 #include <pthread.h>
 #include <locale.h>
 
+#include <libavutil/cpu.h>
+
 #include "config.h"
 #include "mpa_talloc.h"
 
@@ -43,6 +45,7 @@
 #include "common/msg.h"
 #include "common/msg_control.h"
 #include "common/global.h"
+#include "common/tracing.h"
 #include "filters/f_decoder_wrapper.h"
 #include "options/parse_configfile.h"
 #include "options/parse_commandline.h"
@@ -107,6 +110,8 @@ void mp_update_logging(struct MPContext *mpctx, bool preinit)
 
     mp_msg_update_msglevels(mpctx->global, mpctx->opts);
 
+    mp_tracing_update(mpctx->global, mpctx->opts->trace_file);
+
     bool enable = mpctx->opts->use_terminal;
     bool enabled = cas_terminal_owner(mpctx, mpctx);
     if (enable != enabled) {
@@ -156,6 +161,15 @@ void mp_destroy(struct MPContext *mpctx)
 
     mp_clients_destroy(mpctx);
 
+    mp_cancel_playlist_load(mpctx);
+    // Waits for detached playlist loaders and other I/O jobs.
+    TA_FREEP(&mpctx->thread_pool);
+
+    // Waits for remaining jobs, which may still use the subsystems below.
+    TA_FREEP(&mpctx->global->thread_pool);
+
+    mp_playback_state_destroy(mpctx);
+
     if (cas_terminal_owner(mpctx, mpctx)) {
         terminal_uninit();
         cas_terminal_owner(mpctx, NULL);
@@ -165,6 +179,8 @@ void mp_destroy(struct MPContext *mpctx)
 
     uninit_libav(mpctx->global);
 
+    mp_tracing_update(mpctx->global, NULL);
+
     mp_msg_uninit(mpctx->global);
     assert(!mpctx->num_abort_list);
     talloc_free(mpctx->abort_list);
@@ -254,6 +270,8 @@ struct MPContext *mp_create(void)
     pthread_mutex_init(&mpctx->abort_lock, NULL);
 
     mpctx->global = talloc_zero(mpctx, struct mpv_global);
+    mpctx->global->thread_pool =
+        mp_thread_pool_create(mpctx, 0, 0, MPMAX(av_cpu_count(), 1));
 
     // Nothing must call mp_msg*() and related before this
     mp_msg_init(mpctx->global);
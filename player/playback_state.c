@@ -0,0 +1,293 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+#include "config.h"
+
+#include "osdep/atomic.h"
+
+// The seqlock needs real (lock-free) atomics, as it's shared between
+// processes. The emulation in atomic.h uses a process-local mutex.
+#define HAVE_PLAYBACK_STATE (HAVE_POSIX && HAVE_STDATOMIC)
+
+#if HAVE_PLAYBACK_STATE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "demux/demux.h"
+#include "libmpa/playback_state.h"
+#include "options/options.h"
+#include "osdep/timer.h"
+
+#include "core.h"
+
+#define SEGMENT_MAGIC "mpastate"
+#define SEGMENT_VERSION 1
+
+// Layout of the shared memory segment.
+struct segment {
+    char magic[8];              // SEGMENT_MAGIC
+    uint32_t version;           // SEGMENT_VERSION
+    uint32_t state_size;        // sizeof(mpv_playback_state) of the writer
+#if HAVE_PLAYBACK_STATE
+    atomic_ullong seq;          // odd while the state is being written
+#else
+    unsigned long long seq;
+#endif
+    mpv_playback_state state;
+};
+
+struct mp_playback_state {
+    int fd;                     // read/write, owned by the core
+    int ro_fd;                  // read-only, dup'ed for clients
+    struct segment *seg;
+    uint64_t generation;
+};
+
+#if HAVE_PLAYBACK_STATE
+
+static int create_shm(struct mp_log *log, int *ro_fd)
+{
+    int fd = -1;
+    *ro_fd = -1;
+
+#if HAVE_MEMFD_CREATE
+    fd = memfd_create("mpa-playback-state", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd >= 0) {
+        if (ftruncate(fd, MPV_PLAYBACK_STATE_MAP_SIZE) < 0)
+            goto error;
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+        // Reopening the memfd yields an independent read-only descriptor.
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        *ro_fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (*ro_fd >= 0)
+            return fd;
+        // A dup'ed descriptor would be writable, so clients could write to
+        // the segment. Fall back to a shm object, which can be opened
+        // read-only.
+        mp_verbose(log, "Could not reopen memfd read-only (%s).\n",
+                   mp_strerror(errno));
+        close(fd);
+    }
+#endif
+
+    // Unlinked right away, so it's anonymous as well.
+    static atomic_int counter;
+    char name[64];
+    snprintf(name, sizeof(name), "/mpa-state-%d-%d", (int)getpid(),
+             atomic_fetch_add(&counter, 1));
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        mp_err(log, "Could not create shared memory (%s).\n",
+               mp_strerror(errno));
+        return -1;
+    }
+    *ro_fd = shm_open(name, O_RDONLY, 0);
+    shm_unlink(name);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (*ro_fd >= 0)
+        fcntl(*ro_fd, F_SETFD, FD_CLOEXEC);
+    if (ftruncate(fd, MPV_PLAYBACK_STATE_MAP_SIZE) < 0 || *ro_fd < 0)
+        goto error;
+    return fd;
+
+error:
+    mp_err(log, "Could not set up shared memory (%s).\n", mp_strerror(errno));
+    if (*ro_fd >= 0)
+        close(*ro_fd);
+    *ro_fd = -1;
+    close(fd);
+    return -1;
+}
+
+static struct mp_playback_state *create_state(struct MPContext *mpctx)
+{
+    assert(sizeof(struct segment) <= MPV_PLAYBACK_STATE_MAP_SIZE);
+
+    int ro_fd;
+    int fd = create_shm(mpctx->log, &ro_fd);
+    if (fd < 0)
+        return NULL;
+
+    void *map = mmap(NULL, MPV_PLAYBACK_STATE_MAP_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        MP_ERR(mpctx, "Could not map shared memory (%s).\n",
+               mp_strerror(errno));
+        close(fd);
+        close(ro_fd);
+        return NULL;
+    }
+
+    struct mp_playback_state *p = talloc_ptrtype(NULL, p);
+    *p = (struct mp_playback_state){
+        .fd = fd,
+        .ro_fd = ro_fd,
+        .seg = map,
+    };
+    // The file is zero-filled; make it look valid only when it's complete.
+    p->seg->version = SEGMENT_VERSION;
+    p->seg->state_size = sizeof(mpv_playback_state);
+    atomic_thread_fence(memory_order_release);
+    memcpy(p->seg->magic, SEGMENT_MAGIC, sizeof(p->seg->magic));
+
+    MP_VERBOSE(mpctx, "Created playback state segment.\n");
+    return p;
+}
+
+// Return a new read-only fd for the segment (created on the first call),
+// or an MPV_ERROR_* code. Called from client threads with the core locked.
+int mp_playback_state_get_fd(struct MPContext *mpctx)
+{
+    if (!mpctx->playback_state) {
+        mpctx->playback_state = create_state(mpctx);
+        if (!mpctx->playback_state)
+            return MPV_ERROR_GENERIC;
+        mp_playback_state_update(mpctx);
+    }
+    int fd = fcntl(mpctx->playback_state->ro_fd, F_DUPFD_CLOEXEC, 0);
+    return fd < 0 ? MPV_ERROR_GENERIC : fd;
+}
+
+static void get_state(struct MPContext *mpctx, mpv_playback_state *st)
+{
+    struct MPOpts *opts = mpctx->opts;
+
+    double time_pos = get_current_time(mpctx);
+    double duration = get_time_length(mpctx);
+    double cache_duration = NAN;
+    if (mpctx->demuxer) {
+        struct demux_ctrl_reader_state s;
+        if (demux_control(mpctx->demuxer, DEMUXER_CTRL_GET_READER_STATE, &s) > 0 &&
+            s.ts_duration >= 0)
+            cache_duration = s.ts_duration;
+    }
+
+    *st = (mpv_playback_state){
+        .time_us = mp_time_us(),
+        .time_pos = mpctx->playback_initialized && time_pos != MP_NOPTS_VALUE
+                    ? time_pos : NAN,
+        .duration = duration >= 0 ? duration : NAN,
+        .speed = opts->playback_speed,
+        .volume = opts->softvol_volume,
+        .cache_duration = cache_duration,
+        .pause = opts->pause,
+        .paused_for_cache = mpctx->paused_for_cache,
+        .core_idle = !mpctx->playback_active,
+        .idle_active = !mpctx->playing,
+        .eof_reached = mpctx->playback_initialized &&
+                       mpctx->video_status == STATUS_EOF &&
+                       mpctx->audio_status == STATUS_EOF,
+        .seeking = mpctx->playback_initialized && !mpctx->restart_complete,
+        .mute = opts->softvol_mute == 1,
+    };
+}
+
+// Publish the current state. Called once per playloop iteration.
+void mp_playback_state_update(struct MPContext *mpctx)
+{
+    struct mp_playback_state *p = mpctx->playback_state;
+    if (!p)
+        return;
+
+    mpv_playback_state st;
+    get_state(mpctx, &st);
+    st.generation = ++p->generation;
+
+    struct segment *seg = p->seg;
+    unsigned long long seq = atomic_load_explicit(&seg->seq,
+                                                  memory_order_relaxed);
+    atomic_store_explicit(&seg->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&seg->state, &st, sizeof(st));
+    atomic_store_explicit(&seg->seq, seq + 2, memory_order_release);
+}
+
+void mp_playback_state_destroy(struct MPContext *mpctx)
+{
+    struct mp_playback_state *p = mpctx->playback_state;
+    if (!p)
+        return;
+
+    munmap(p->seg, MPV_PLAYBACK_STATE_MAP_SIZE);
+    close(p->fd);
+    close(p->ro_fd);
+    talloc_free(p);
+    mpctx->playback_state = NULL;
+}
+
+int mpv_read_playback_state(const void *map, mpv_playback_state *state)
+{
+    struct segment *seg = (struct segment *)map;
+
+    if (memcmp(seg->magic, SEGMENT_MAGIC, sizeof(seg->magic)) != 0)
+        return MPV_ERROR_UNSUPPORTED;
+    atomic_thread_fence(memory_order_acquire);
+    if (seg->version != SEGMENT_VERSION)
+        return MPV_ERROR_UNSUPPORTED;
+    size_t size = MPMIN(seg->state_size, sizeof(*state));
+
+    // An update takes a few nanoseconds; only yield if the writer seems to
+    // have been preempted in the middle of one.
+    for (int n = 0; n < 10000; n++) {
+        if (n >= 16)
+            sched_yield();
+        unsigned long long seq = atomic_load_explicit(&seg->seq,
+                                                      memory_order_acquire);
+        if (seq & 1)
+            continue;
+        memset(state, 0, sizeof(*state));
+        memcpy(state, &seg->state, size);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&seg->seq, memory_order_relaxed) == seq)
+            return 0;
+    }
+    return MPV_ERROR_GENERIC;
+}
+
+#else
+
+int mp_playback_state_get_fd(struct MPContext *mpctx)
+{
+    return MPV_ERROR_UNSUPPORTED;
+}
+
+void mp_playback_state_update(struct MPContext *mpctx)
+{
+}
+
+void mp_playback_state_destroy(struct MPContext *mpctx)
+{
+}
+
+int mpv_read_playback_state(const void *map, mpv_playback_state *state)
+{
+    return MPV_ERROR_UNSUPPORTED;
+}
+
+#endif
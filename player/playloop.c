@@ -27,6 +27,7 @@
 #include "common/msg.h"
 #include "options/options.h"
 #include "common/common.h"
+#include "common/tracing.h"
 #include "filters/f_decoder_wrapper.h"
 #include "options/m_config.h"
 #include "options/m_property.h"
@@ -51,14 +52,18 @@
 // mp_wait_events() was called.
 void mp_wait_events(struct MPContext *mpctx)
 {
+    mp_client_update_properties(mpctx);
+
     bool sleeping = mpctx->sleeptime > 0;
     if (sleeping)
         MP_STATS(mpctx, "start sleep");
+    mp_tracing_begin("playloop wait");
 
     mp_dispatch_queue_process(mpctx->dispatch, mpctx->sleeptime);
 
     mpctx->sleeptime = INFINITY;
 
+    mp_tracing_end("playloop wait");
     if (sleeping)
         MP_STATS(mpctx, "end sleep");
 }
@@ -138,6 +143,7 @@ void set_pause_state(struct MPContext *mpctx, bool user_pause)
 {
     struct MPOpts *opts = mpctx->opts;
     bool send_update = false;
+    bool user_unpause = opts->pause && !user_pause;
 
     if (opts->pause != user_pause)
         send_update = true;
@@ -156,6 +162,9 @@ void set_pause_state(struct MPContext *mpctx, bool user_pause)
             }
         }
 
+        if (!internal_paused && user_unpause)
+            audio_mark_latency_cmd(mpctx, LATENCY_CMD_PLAY);
+
 // HISONA ...
 //        if (mpctx->video_out)
 //            vo_set_paused(mpctx->video_out, internal_paused);
@@ -388,6 +397,9 @@ void queue_seek(struct MPContext *mpctx, enum seek_type type, double amount,
 
     mp_wakeup_core(mpctx);
 
+    if (type != MPSEEK_NONE)
+        audio_mark_latency_cmd(mpctx, LATENCY_CMD_SEEK);
+
     if (mpctx->stop_play == AT_END_OF_FILE)
         mpctx->stop_play = KEEP_PLAYING;
 
@@ -805,6 +817,8 @@ static void handle_playback_restart(struct MPContext *mpctx)
 
         mpctx->audio_status = STATUS_PLAYING;
 
+        // Nothing was written to the AO yet, so this is the first sample.
+        mpctx->latency_start_pts = written_audio_pts(mpctx);
         fill_audio_out_buffers(mpctx); // actually play prepared buffer
         mp_wakeup_core(mpctx);
     }
@@ -814,6 +828,7 @@ static void handle_playback_restart(struct MPContext *mpctx)
         mpctx->restart_complete = true;
         mpctx->current_seek = (struct seek_params){0};
         handle_playback_time(mpctx);
+        audio_latency_restart(mpctx);
         mp_notify(mpctx, MPV_EVENT_PLAYBACK_RESTART, NULL);
         update_core_idle_state(mpctx);
         if (!mpctx->playing_msg_shown) {
@@ -853,9 +868,12 @@ static void handle_eof(struct MPContext *mpctx)
 
 void run_playloop(struct MPContext *mpctx)
 {
+    mp_tracing_begin("playloop");
 
     update_demuxer_properties(mpctx);
 
+    mp_update_playlist_load(mpctx, false);
+
     handle_command_updates(mpctx);
 
     if (mpctx->lavfi && mp_filter_has_failed(mpctx->lavfi))
@@ -869,6 +887,8 @@ void run_playloop(struct MPContext *mpctx)
 
     handle_playback_time(mpctx);
 
+    audio_update_latency(mpctx);
+
     handle_dummy_ticks(mpctx);
 
     update_osd_msg(mpctx);
@@ -883,19 +903,29 @@ void run_playloop(struct MPContext *mpctx)
 
     update_core_idle_state(mpctx);
 
-    if (mpctx->stop_play)
+    mp_playback_state_update(mpctx);
+
+    if (mpctx->stop_play) {
+        mp_tracing_end("playloop");
         return;
+    }
 
     if (mp_filter_run(mpctx->filter_root))
         mp_wakeup_core(mpctx);
 
+    mp_tracing_end("playloop");
+
     mp_wait_events(mpctx);
 
+    mp_tracing_begin("playloop input");
+
     handle_pause_on_low_cache(mpctx);
 
     mp_process_input(mpctx);
 
     execute_queued_seek(mpctx);
+
+    mp_tracing_end("playloop input");
 }
 
 void mp_idle(struct MPContext *mpctx)
@@ -903,8 +933,10 @@ void mp_idle(struct MPContext *mpctx)
     handle_dummy_ticks(mpctx);
     mp_wait_events(mpctx);
     mp_process_input(mpctx);
+    mp_update_playlist_load(mpctx, false);
     handle_command_updates(mpctx);
     update_osd_msg(mpctx);
+    mp_playback_state_update(mpctx);
 }
 
 // Waiting for the slave master to send us a new file to play.
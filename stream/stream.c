@@ -51,6 +51,8 @@ extern const stream_info_t stream_info_ffmpeg;
 extern const stream_info_t stream_info_ffmpeg_unsafe;
 extern const stream_info_t stream_info_file;
 extern const stream_info_t stream_info_cb;
+extern const stream_info_t stream_info_push;
+extern const stream_info_t stream_info_shm;
 
 static const stream_info_t *const stream_list[] = {
     &stream_info_ffmpeg,
@@ -59,6 +61,8 @@ static const stream_info_t *const stream_list[] = {
     &stream_info_null,
     &stream_info_file,
     &stream_info_cb,
+    &stream_info_push,
+    &stream_info_shm,
     NULL
 };
 
@@ -54,6 +54,7 @@ enum stream_ctrl {
 
     // stream_memory.c
     STREAM_CTRL_SET_CONTENTS,
+    STREAM_CTRL_GET_DATA_REF,           // struct stream_data_ref*
 
     // stream_rar.c
     STREAM_CTRL_GET_BASE_FILENAME,
@@ -116,6 +117,13 @@ struct stream_dvd_info_req {
 #define TV_COLOR_SATURATION     3
 #define TV_COLOR_CONTRAST       4
 
+// for STREAM_CTRL_GET_DATA_REF: reference the stream contents without copying
+struct stream_data_ref {
+    int64_t pos;                // in: byte position
+    int len;                    // in: max. size, out: actual size (0 on EOF)
+    struct AVBufferRef *buf;    // out: new reference to the data (padded)
+};
+
 // for STREAM_CTRL_AVSEEK
 struct stream_avseek {
     int stream_index;
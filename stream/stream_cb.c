@@ -6,20 +6,48 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+#include <assert.h>
 
 #include "osdep/io.h"
 
 #include "common/common.h"
 #include "common/msg.h"
 #include "common/global.h"
+#include "misc/thread_tools.h"
 #include "stream.h"
 #include "options/m_option.h"
 #include "options/path.h"
 #include "player/client.h"
 #include "libmpa/stream_cb.h"
 
+// Number of async read requests kept pending.
+#define READAHEAD_REQUESTS 4
+
+struct mpv_stream_cb_read_request {
+    struct priv *p;
+    int64_t offset;
+    char *buf;
+    uint64_t size;
+    size_t consumed;        // bytes already returned by fill_buffer
+    // -- protected by priv.lock
+    bool done;
+    int64_t result;
+};
+
 struct priv {
     mpv_stream_cb_info info;
+
+    // For async reads. The request lists are accessed by the stream's thread
+    // only, the request state is protected by the lock.
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    struct mp_cancel *cancel;
+    struct mpv_stream_cb_read_request **queue;  // in offset order
+    int num_queue;
+    struct mpv_stream_cb_read_request **dropped; // waiting for completion
+    int num_dropped;
+    int64_t next_offset;    // offset of the next request to post
 };
 
 static int fill_buffer(stream_t *s, char *buffer, int max_len)
@@ -34,6 +62,124 @@ static int seek(stream_t *s, int64_t newpos)
     return p->info.seek_fn(p->info.cookie, newpos) >= 0;
 }
 
+void mpv_stream_cb_read_complete(mpv_stream_cb_read_request *req,
+                                 int64_t result)
+{
+    struct priv *p = req->p;
+    pthread_mutex_lock(&p->lock);
+    assert(!req->done);
+    req->done = true;
+    req->result = MPMIN(result, (int64_t)req->size);
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Free dropped requests that have been completed.
+static void collect_dropped(struct priv *p)
+{
+    pthread_mutex_lock(&p->lock);
+    for (int n = p->num_dropped - 1; n >= 0; n--) {
+        if (p->dropped[n]->done) {
+            talloc_free(p->dropped[n]);
+            MP_TARRAY_REMOVE_AT(p->dropped, p->num_dropped, n);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Drop all queued requests, and read from offset next.
+static void drop_requests(struct priv *p, int64_t offset)
+{
+    for (int n = 0; n < p->num_queue; n++) {
+        struct mpv_stream_cb_read_request *req = p->queue[n];
+        MP_TARRAY_APPEND(p, p->dropped, p->num_dropped, req);
+        if (p->info.cancel_read_fn) {
+            pthread_mutex_lock(&p->lock);
+            bool done = req->done;
+            pthread_mutex_unlock(&p->lock);
+            if (!done)
+                p->info.cancel_read_fn(p->info.cookie, req);
+        }
+    }
+    p->num_queue = 0;
+    p->next_offset = offset;
+    collect_dropped(p);
+}
+
+static void post_requests(stream_t *s)
+{
+    struct priv *p = s->priv;
+    while (p->num_queue < READAHEAD_REQUESTS) {
+        struct mpv_stream_cb_read_request *req =
+            talloc_zero(NULL, struct mpv_stream_cb_read_request);
+        req->p = p;
+        req->offset = p->next_offset;
+        req->size = s->read_chunk;
+        req->buf = talloc_size(req, req->size);
+        p->next_offset += req->size;
+        MP_TARRAY_APPEND(p, p->queue, p->num_queue, req);
+        // (May complete the request recursively.)
+        p->info.read_async_fn(p->info.cookie, req, req->offset, req->buf,
+                              req->size);
+    }
+}
+
+static int fill_buffer_async(stream_t *s, char *buffer, int max_len)
+{
+    struct priv *p = s->priv;
+
+    post_requests(s);
+
+    struct mpv_stream_cb_read_request *req = p->queue[0];
+    pthread_mutex_lock(&p->lock);
+    while (!req->done && !mp_cancel_test(p->cancel))
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    bool done = req->done;
+    int64_t result = req->result;
+    pthread_mutex_unlock(&p->lock);
+
+    if (!done)
+        return -1; // cancelled
+
+    if (result <= 0) {
+        drop_requests(p, req->offset);
+        return result < 0 ? -1 : 0;
+    }
+
+    int len = MPMIN(max_len, result - req->consumed);
+    memcpy(buffer, req->buf + req->consumed, len);
+    req->consumed += len;
+    if (req->consumed == result) {
+        MP_TARRAY_REMOVE_AT(p->queue, p->num_queue, 0);
+        // The following requests were posted at the wrong offsets.
+        if (result < req->size)
+            drop_requests(p, req->offset + result);
+        talloc_free(req);
+    }
+    return len;
+}
+
+static int seek_async(stream_t *s, int64_t newpos)
+{
+    struct priv *p = s->priv;
+    if (p->info.seek_fn(p->info.cookie, newpos) < 0)
+        return 0;
+    // Keep the requests if they are still useful (e.g. seeking to the current
+    // position after the stream buffer was dropped).
+    if (!p->num_queue || p->queue[0]->offset + p->queue[0]->consumed != newpos)
+        drop_requests(p, newpos);
+    return 1;
+}
+
+// Called by mp_cancel_trigger().
+static void wakeup_reader(void *ctx)
+{
+    struct priv *p = ctx;
+    pthread_mutex_lock(&p->lock);
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+}
+
 static int control(stream_t *s, int cmd, void *arg)
 {
     struct priv *p = s->priv;
@@ -55,12 +201,25 @@ static int control(stream_t *s, int cmd, void *arg)
 static void s_close(stream_t *s)
 {
     struct priv *p = s->priv;
+    if (p->info.read_async_fn) {
+        TA_FREEP(&p->cancel);
+        drop_requests(p, 0);
+        pthread_mutex_lock(&p->lock);
+        for (int n = 0; n < p->num_dropped; n++) {
+            while (!p->dropped[n]->done)
+                pthread_cond_wait(&p->wakeup, &p->lock);
+        }
+        pthread_mutex_unlock(&p->lock);
+        collect_dropped(p);
+        pthread_cond_destroy(&p->wakeup);
+        pthread_mutex_destroy(&p->lock);
+    }
     p->info.close_fn(p->info.cookie);
 }
 
 static int open_cb(stream_t *stream)
 {
-    struct priv *p = talloc_ptrtype(stream, p);
+    struct priv *p = talloc_zero(stream, struct priv);
     stream->priv = p;
 
     bstr bproto = mp_split_proto(bstr0(stream->url), NULL);
@@ -81,7 +240,7 @@ static int open_cb(stream_t *stream)
         return STREAM_ERROR;
     }
 
-    if (!info.read_fn || !info.close_fn) {
+    if ((!info.read_fn && !info.read_async_fn) || !info.close_fn) {
         MP_FATAL(stream, "required read_fn or close_fn callbacks not set.\n");
         return STREAM_ERROR;
     }
@@ -98,6 +257,18 @@ static int open_cb(stream_t *stream)
     stream->read_chunk = 64 * 1024;
     stream->close = s_close;
 
+    if (p->info.read_async_fn) {
+        pthread_mutex_init(&p->lock, NULL);
+        pthread_cond_init(&p->wakeup, NULL);
+        p->cancel = mp_cancel_new(p);
+        if (stream->cancel)
+            mp_cancel_set_parent(p->cancel, stream->cancel);
+        mp_cancel_set_cb(p->cancel, wakeup_reader, p);
+        stream->fill_buffer = fill_buffer_async;
+        if (stream->seekable)
+            stream->seek = seek_async;
+    }
+
     return STREAM_OK;
 }
 
@@ -15,11 +15,18 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
 #include <libavutil/common.h>
 
 #include "stream.h"
 
 struct priv {
+    // Refcounted, so that packets can reference the data even if the contents
+    // are replaced. Allocated with padding, like AVPacket data.
+    AVBufferRef *buf;
     bstr data;
 };
 
@@ -48,17 +55,45 @@ static int control(stream_t *s, int cmd, void *arg)
         return 1;
     case STREAM_CTRL_SET_CONTENTS: ;
         bstr *data = (bstr *)arg;
-        talloc_free(p->data.start);
-        p->data = bstrdup(s, *data);
+        av_buffer_unref(&p->buf);
+        p->data = (bstr){0};
+        if (data->len > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+            return STREAM_ERROR;
+        p->buf = av_buffer_alloc(data->len + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!p->buf)
+            return STREAM_ERROR;
+        memcpy(p->buf->data, data->start, data->len);
+        memset(p->buf->data + data->len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        p->data = (bstr){p->buf->data, data->len};
+        return 1;
+    case STREAM_CTRL_GET_DATA_REF: {
+        struct stream_data_ref *ref = arg;
+        if (!p->buf || ref->pos < 0 || ref->len < 0)
+            return STREAM_ERROR;
+        int64_t len = ref->pos < p->data.len ? p->data.len - ref->pos : 0;
+        ref->len = FFMIN(ref->len, len);
+        ref->buf = av_buffer_ref(p->buf);
+        if (!ref->buf)
+            return STREAM_ERROR;
+        ref->buf->data += ref->len ? ref->pos : 0;
+        ref->buf->size = ref->len;
         return 1;
     }
+    }
     return STREAM_UNSUPPORTED;
 }
 
+static void s_close(stream_t *s)
+{
+    struct priv *p = s->priv;
+    av_buffer_unref(&p->buf);
+}
+
 static int open_f(stream_t *stream)
 {
     stream->fill_buffer = fill_buffer;
     stream->seek = seek;
+    stream->close = s_close;
     stream->seekable = true;
     stream->control = control;
     stream->read_chunk = 1024 * 1024;
@@ -71,12 +106,15 @@ static int open_f(stream_t *stream)
     bool use_hex = bstr_eatstart0(&data, "hex://");
     if (!use_hex)
         bstr_eatstart0(&data, "memory://");
-    stream_control(stream, STREAM_CTRL_SET_CONTENTS, &data);
 
-    if (use_hex && !bstr_decode_hex(stream, p->data, &p->data)) {
+    if (use_hex && !bstr_decode_hex(p, data, &data)) {
         MP_FATAL(stream, "Invalid data.\n");
         return STREAM_ERROR;
     }
+    if (stream_control(stream, STREAM_CTRL_SET_CONTENTS, &data) != 1)
+        return STREAM_ERROR;
+    if (use_hex)
+        talloc_free(data.start);
 
     return STREAM_OK;
 }
@@ -0,0 +1,258 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "common/common.h"
+#include "common/global.h"
+#include "common/msg.h"
+#include "misc/bstr.h"
+#include "misc/thread_tools.h"
+#include "player/client.h"
+#include "libmpa/stream_push.h"
+#include "stream.h"
+
+struct mpv_push_stream {
+    // Constant after creation.
+    struct mp_client_api *owner;
+    char *name;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    // -- protected by lock
+    unsigned char *ring;
+    size_t size;
+    size_t rpos;            // read position in ring
+    size_t len;             // number of buffered bytes, starting at rpos
+    bool eof;               // no more writes
+    bool has_reader;        // opened by a stream
+    bool reader_closed;     // the last reader closed it (writes can't block)
+    int refcount;           // the client handle, and the reader
+};
+
+// All push streams of all mpv instances, by (owner, name).
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mpv_push_stream **registry;
+static int num_registry;
+
+static void push_stream_unref(struct mpv_push_stream *s)
+{
+    pthread_mutex_lock(&s->lock);
+    bool last = --s->refcount == 0;
+    pthread_mutex_unlock(&s->lock);
+    if (last) {
+        pthread_cond_destroy(&s->wakeup);
+        pthread_mutex_destroy(&s->lock);
+        talloc_free(s);
+    }
+}
+
+int mpv_push_stream_create(mpv_handle *ctx, const char *name,
+                           size_t buffer_size, mpv_push_stream **res)
+{
+    if (!name || !name[0] || !buffer_size)
+        return MPV_ERROR_INVALID_PARAMETER;
+
+    struct mp_client_api *owner = mp_client_get_global(ctx)->client_api;
+    int r = 0;
+    pthread_mutex_lock(&registry_lock);
+    for (int n = 0; n < num_registry; n++) {
+        if (registry[n]->owner == owner && strcmp(registry[n]->name, name) == 0)
+            r = MPV_ERROR_INVALID_PARAMETER;
+    }
+    if (r >= 0) {
+        struct mpv_push_stream *s = talloc_zero(NULL, struct mpv_push_stream);
+        s->owner = owner;
+        s->name = talloc_strdup(s, name);
+        s->ring = talloc_size(s, buffer_size);
+        s->size = buffer_size;
+        s->refcount = 1;
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_cond_init(&s->wakeup, NULL);
+        MP_TARRAY_APPEND(NULL, registry, num_registry, s);
+        *res = s;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return r;
+}
+
+int mpv_push_stream_write(mpv_push_stream *s, const void *data, size_t size)
+{
+    const unsigned char *src = data;
+    int r = 0;
+    pthread_mutex_lock(&s->lock);
+    while (size) {
+        if (s->eof) {
+            r = MPV_ERROR_INVALID_PARAMETER;
+            break;
+        }
+        if (s->len == s->size) {
+            // Nobody would ever make room.
+            if (s->reader_closed) {
+                r = MPV_ERROR_GENERIC;
+                break;
+            }
+            pthread_cond_wait(&s->wakeup, &s->lock);
+            continue;
+        }
+        size_t wpos = (s->rpos + s->len) % s->size;
+        size_t copy = MPMIN(size, s->size - s->len);
+        copy = MPMIN(copy, s->size - wpos); // up to the wrap-around
+        memcpy(s->ring + wpos, src, copy);
+        s->len += copy;
+        src += copy;
+        size -= copy;
+        pthread_cond_broadcast(&s->wakeup);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return r;
+}
+
+void mpv_push_stream_end(mpv_push_stream *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->eof = true;
+    pthread_cond_broadcast(&s->wakeup);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void mpv_push_stream_destroy(mpv_push_stream *s)
+{
+    if (!s)
+        return;
+    pthread_mutex_lock(&registry_lock);
+    for (int n = 0; n < num_registry; n++) {
+        if (registry[n] == s) {
+            MP_TARRAY_REMOVE_AT(registry, num_registry, n);
+            break;
+        }
+    }
+    if (!num_registry)
+        TA_FREEP(&registry);
+    pthread_mutex_unlock(&registry_lock);
+
+    mpv_push_stream_end(s);
+    push_stream_unref(s);
+}
+
+struct priv {
+    struct mpv_push_stream *ps;
+    struct mp_cancel *cancel;
+};
+
+static int fill_buffer(stream_t *s, char *buffer, int max_len)
+{
+    struct priv *p = s->priv;
+    struct mpv_push_stream *ps = p->ps;
+
+    pthread_mutex_lock(&ps->lock);
+    while (!ps->len && !ps->eof && !mp_cancel_test(p->cancel))
+        pthread_cond_wait(&ps->wakeup, &ps->lock);
+    size_t total = 0;
+    while (ps->len && total < max_len) {
+        size_t copy = MPMIN(ps->len, max_len - total);
+        copy = MPMIN(copy, ps->size - ps->rpos); // up to the wrap-around
+        memcpy(buffer + total, ps->ring + ps->rpos, copy);
+        ps->rpos = (ps->rpos + copy) % ps->size;
+        ps->len -= copy;
+        total += copy;
+    }
+    if (total)
+        pthread_cond_broadcast(&ps->wakeup);
+    pthread_mutex_unlock(&ps->lock);
+    return total;
+}
+
+// Called by mp_cancel_trigger().
+static void wakeup_reader(void *ctx)
+{
+    struct mpv_push_stream *ps = ctx;
+    pthread_mutex_lock(&ps->lock);
+    pthread_cond_broadcast(&ps->wakeup);
+    pthread_mutex_unlock(&ps->lock);
+}
+
+static void s_close(stream_t *s)
+{
+    struct priv *p = s->priv;
+    // Make sure the callback isn't running anymore before releasing ps.
+    TA_FREEP(&p->cancel);
+    pthread_mutex_lock(&p->ps->lock);
+    p->ps->has_reader = false;
+    p->ps->reader_closed = true;
+    pthread_cond_broadcast(&p->ps->wakeup);
+    pthread_mutex_unlock(&p->ps->lock);
+    push_stream_unref(p->ps);
+}
+
+static int open_f(stream_t *stream)
+{
+    struct priv *p = talloc_zero(stream, struct priv);
+    stream->priv = p;
+
+    bstr name = bstr0(stream->url);
+    bstr_eatstart0(&name, "push://");
+
+    struct mp_client_api *owner = stream->global->client_api;
+    struct mpv_push_stream *ps = NULL;
+    pthread_mutex_lock(&registry_lock);
+    for (int n = 0; n < num_registry; n++) {
+        struct mpv_push_stream *cur = registry[n];
+        if (owner && cur->owner == owner && bstr_equals0(name, cur->name)) {
+            pthread_mutex_lock(&cur->lock);
+            if (!cur->has_reader) {
+                cur->has_reader = true;
+                cur->reader_closed = false;
+                cur->refcount++;
+                ps = cur;
+            }
+            pthread_mutex_unlock(&cur->lock);
+            if (!ps) {
+                MP_ERR(stream, "Push stream is already being read.\n");
+                pthread_mutex_unlock(&registry_lock);
+                return STREAM_ERROR;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    if (!ps) {
+        MP_ERR(stream, "Push stream '%.*s' not found.\n", BSTR_P(name));
+        return STREAM_ERROR;
+    }
+    p->ps = ps;
+
+    p->cancel = mp_cancel_new(p);
+    if (stream->cancel)
+        mp_cancel_set_parent(p->cancel, stream->cancel);
+    mp_cancel_set_cb(p->cancel, wakeup_reader, ps);
+
+    stream->fill_buffer = fill_buffer;
+    stream->close = s_close;
+    stream->read_chunk = 64 * 1024;
+
+    return STREAM_OK;
+}
+
+const stream_info_t stream_info_push = {
+    .name = "push",
+    .open = open_f,
+    .protocols = (const char*const[]){ "push", NULL },
+};
@@ -0,0 +1,301 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Read from shared memory mapped read-only, e.g. filled by another process:
+//  memfd://<fd>    map the given file descriptor (memfd, shm, or any file that
+//                  can be mapped)
+//  shm://<name>    map the POSIX shared memory object (shm_open())
+//
+// If the memory starts with struct live_header, it is a live segment, which
+// the producer appends to while it is being read. Otherwise the whole mapping
+// is the data. In both cases, the producer must not shrink the memory while
+// it's mapped, and must not change data the reader may have seen.
+
+#include <limits.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "osdep/atomic.h"
+
+// The live header needs real (lock-free) atomics, as it's shared between
+// processes. The emulation in atomic.h uses a process-local mutex.
+#define HAVE_SHM_STREAM (HAVE_POSIX && HAVE_STDATOMIC)
+
+#if HAVE_SHM_STREAM
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#endif
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "misc/bstr.h"
+#include "misc/thread_tools.h"
+#include "stream.h"
+
+#if HAVE_SHM_STREAM
+
+#define LIVE_MAGIC "mpashm01"
+#define LIVE_HEADER_SIZE 64     // offset of the data
+#define LIVE_FLAG_EOF 1
+
+// How often to check a live segment for new data.
+#define POLL_TIMEOUT 0.005
+
+// Layout of the start of a live segment. The producer writes data at
+// LIVE_HEADER_SIZE + data_size, and then increases data_size (with a release
+// store). When done, it sets LIVE_FLAG_EOF. The segment can be grown with
+// ftruncate(), as long as data_size doesn't exceed the current size.
+struct live_header {
+    char magic[8];              // LIVE_MAGIC
+    atomic_ullong data_size;    // bytes available after the header
+    atomic_uint flags;          // LIVE_FLAG_*
+};
+
+// Refcounted, so that packets can reference it after remapping or closing.
+struct mapping {
+    atomic_int refcount;
+    unsigned char *ptr;
+    size_t size;
+};
+
+struct priv {
+    int fd;
+    struct mapping *map;
+    bool live;
+    struct mp_cancel *cancel;
+};
+
+static void mapping_unref(struct mapping *m)
+{
+    if (m && atomic_fetch_add(&m->refcount, -1) == 1) {
+        munmap(m->ptr, m->size);
+        talloc_free(m);
+    }
+}
+
+static struct mapping *map_fd(int fd, struct mp_log *log)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0 || st.st_size > SIZE_MAX) {
+        mp_err(log, "Can't map empty or invalid file descriptor.\n");
+        return NULL;
+    }
+    void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        mp_err(log, "mmap() failed: %s\n", mp_strerror(errno));
+        return NULL;
+    }
+    struct mapping *m = talloc_zero(NULL, struct mapping);
+    atomic_init(&m->refcount, 1);
+    m->ptr = ptr;
+    m->size = st.st_size;
+    return m;
+}
+
+static int64_t data_offset(struct priv *p)
+{
+    return p->live ? LIVE_HEADER_SIZE : 0;
+}
+
+// Return the number of bytes that can be read, and whether this is final.
+static int64_t get_avail(stream_t *s, bool *eof)
+{
+    struct priv *p = s->priv;
+    if (!p->live) {
+        *eof = true;
+        return p->map->size;
+    }
+
+    struct live_header *h = (void *)p->map->ptr;
+    // Reading the flags first guarantees that the size is final on EOF.
+    *eof = atomic_load_explicit(&h->flags, memory_order_acquire) & LIVE_FLAG_EOF;
+    uint64_t size = atomic_load_explicit(&h->data_size, memory_order_acquire);
+
+    // The producer grew the segment.
+    if (size > p->map->size - LIVE_HEADER_SIZE) {
+        struct mapping *m = map_fd(p->fd, s->log);
+        if (m && m->size > p->map->size) {
+            mapping_unref(p->map);
+            p->map = m;
+        } else {
+            mapping_unref(m);
+        }
+    }
+    return MPMIN(size, p->map->size - LIVE_HEADER_SIZE);
+}
+
+static int fill_buffer(stream_t *s, char *buffer, int max_len)
+{
+    struct priv *p = s->priv;
+    int64_t avail;
+    while (1) {
+        bool eof;
+        avail = get_avail(s, &eof);
+        if (s->pos < avail)
+            break;
+        if (eof)
+            return 0;
+        if (mp_cancel_wait(p->cancel, POLL_TIMEOUT))
+            return -1;
+    }
+    int len = MPMIN(max_len, avail - s->pos);
+    memcpy(buffer, p->map->ptr + data_offset(p) + s->pos, len);
+    return len;
+}
+
+static int seek(stream_t *s, int64_t newpos)
+{
+    return 1;
+}
+
+static void free_ref(void *opaque, uint8_t *data)
+{
+    mapping_unref(opaque);
+}
+
+static int control(stream_t *s, int cmd, void *arg)
+{
+    struct priv *p = s->priv;
+    switch (cmd) {
+    case STREAM_CTRL_GET_SIZE: {
+        bool eof;
+        int64_t size = get_avail(s, &eof);
+        if (!eof)
+            break;
+        *(int64_t *)arg = size;
+        return 1;
+    }
+    case STREAM_CTRL_GET_DATA_REF: {
+        struct stream_data_ref *ref = arg;
+        bool eof;
+        int64_t avail = get_avail(s, &eof);
+        if (ref->pos < 0 || ref->len < 0)
+            return STREAM_ERROR;
+        int64_t len = MPMIN(ref->len, MPMAX(avail - ref->pos, 0));
+        if (!len) {
+            if (!eof)
+                break; // wait for data with a normal read
+            ref->len = 0;
+            ref->buf = NULL;
+            return 1;
+        }
+        // The data must be followed by readable padding.
+        int64_t offset = data_offset(p) + ref->pos;
+        if (offset + len + AV_INPUT_BUFFER_PADDING_SIZE > p->map->size)
+            break;
+        atomic_fetch_add(&p->map->refcount, 1);
+        ref->buf = av_buffer_create(p->map->ptr + offset, len, free_ref,
+                                    p->map, AV_BUFFER_FLAG_READONLY);
+        if (!ref->buf) {
+            mapping_unref(p->map);
+            return STREAM_ERROR;
+        }
+        ref->len = len;
+        return 1;
+    }
+    }
+    return STREAM_UNSUPPORTED;
+}
+
+static void s_close(stream_t *s)
+{
+    struct priv *p = s->priv;
+    mapping_unref(p->map);
+    if (p->fd >= 0)
+        close(p->fd);
+}
+
+static int open_f(stream_t *stream)
+{
+    struct priv *p = talloc_zero(stream, struct priv);
+    stream->priv = p;
+    p->fd = -1;
+
+    bstr url = bstr0(stream->url);
+    if (bstr_eatstart0(&url, "memfd://")) {
+        bstr rest;
+        long long fd = bstrtoll(url, &rest, 10);
+        if (!url.len || rest.len || fd < 0 || fd > INT_MAX) {
+            MP_ERR(stream, "Invalid FD: %s\n", stream->url);
+            return STREAM_ERROR;
+        }
+        // Keep our own descriptor, so the caller's is not affected.
+        p->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    } else {
+        bstr_eatstart0(&url, "shm://");
+        char *name = talloc_asprintf(stream, "%s%.*s",
+                                     bstr_startswith0(url, "/") ? "" : "/",
+                                     BSTR_P(url));
+        p->fd = shm_open(name, O_RDONLY, 0);
+    }
+    if (p->fd < 0) {
+        MP_ERR(stream, "Can't open %s: %s\n", stream->url, mp_strerror(errno));
+        return STREAM_ERROR;
+    }
+
+    p->map = map_fd(p->fd, stream->log);
+    if (!p->map) {
+        s_close(stream);
+        return STREAM_ERROR;
+    }
+    p->live = p->map->size >= LIVE_HEADER_SIZE &&
+              memcmp(p->map->ptr, LIVE_MAGIC, 8) == 0;
+    if (!p->live) {
+        // Not needed anymore; the mapping stays valid.
+        close(p->fd);
+        p->fd = -1;
+    }
+    MP_VERBOSE(stream, "Mapped %zu bytes%s.\n", p->map->size,
+               p->live ? " (live segment)" : "");
+
+    p->cancel = mp_cancel_new(p);
+    if (stream->cancel)
+        mp_cancel_set_parent(p->cancel, stream->cancel);
+
+    stream->fill_buffer = fill_buffer;
+    stream->seek = seek;
+    stream->seekable = true;
+    stream->fast_skip = true;
+    stream->control = control;
+    stream->close = s_close;
+    stream->read_chunk = 1024 * 1024;
+
+    return STREAM_OK;
+}
+
+#else
+
+static int open_f(stream_t *stream)
+{
+    MP_ERR(stream, "Shared memory streams are not supported on this platform.\n");
+    return STREAM_ERROR;
+}
+
+#endif
+
+const stream_info_t stream_info_shm = {
+    .name = "shm",
+    .open = open_f,
+    .protocols = (const char*const[]){ "shm", "memfd", NULL },
+};
@@ -13,6 +13,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -64,12 +65,49 @@ struct ta_ext_header {
     struct ta_header *header;  // points back to normal header
     struct ta_header children; // list of children, with this as sentinel
     void (*destructor)(void *);
+    struct ta_arena *arena;    // set if this is an arena (see ta_new_arena())
 };
 
 // ta_ext_header.children.size is set to this
 #define CHILDREN_SENTINEL ((size_t)-1)
 
+#define ALIGN_SIZE(s) (((s) + MIN_ALIGN - 1) & ~(size_t)(MIN_ALIGN - 1))
+
+// Size of the first arena chunk, which is part of the arena allocation.
+#define ARENA_FIRST_CHUNK 2048
+// Size of further chunks. Larger allocations get a chunk of their own.
+#define ARENA_CHUNK (64 * 1024)
+
+struct ta_arena_chunk {
+    struct ta_arena_chunk *next;
+    size_t size;                // usable bytes after the (aligned) chunk header
+    size_t used;
+};
+
+struct ta_arena_dtor {
+    void *ptr;
+    void (*destructor)(void *);
+};
+
+// Allocations inside of an arena are carved out of chunks owned by the arena.
+// They have no ext header, and are not linked into a sibling list. Instead,
+// ta_header.ext points to the ta_arena, tagged with ARENA_TAG. (The sibling
+// links can't be used for this: allocating a sibling in another thread writes
+// them, while the arena pointer is read on every allocation.)
+struct ta_arena {
+    struct ta_arena_chunk *chunks;      // current chunk first
+    struct ta_arena_chunk *first;       // part of the arena allocation
+    struct ta_arena_dtor *dtors;        // malloc'ed
+    size_t num_dtors, alloc_dtors;
+};
+
+#define ARENA_TAG ((uintptr_t)1)
+#define IN_ARENA(h) ((uintptr_t)(h)->ext & ARENA_TAG)
+#define ARENA_OF(h) ((struct ta_arena *)((uintptr_t)(h)->ext & ~ARENA_TAG))
+#define CHUNK_DATA(c) ((char *)(c) + ALIGN_SIZE(sizeof(struct ta_arena_chunk)))
+
 static void ta_dbg_add(struct ta_header *h);
+static void ta_dbg_init(struct ta_header *h);
 static void ta_dbg_check_header(struct ta_header *h);
 static void ta_dbg_remove(struct ta_header *h);
 
@@ -80,11 +118,24 @@ static struct ta_header *get_header(void *ptr)
     return h;
 }
 
+// Return the arena ptr is allocated in, or the arena ptr is the root of.
+static struct ta_arena *get_arena(struct ta_header *h)
+{
+    if (!h)
+        return NULL;
+    if (IN_ARENA(h))
+        return ARENA_OF(h);
+    return h->ext ? h->ext->arena : NULL;
+}
+
 static struct ta_ext_header *get_or_alloc_ext_header(void *ptr)
 {
     struct ta_header *h = get_header(ptr);
     if (!h)
         return NULL;
+    // Children of arena allocations are attached to the arena itself.
+    if (IN_ARENA(h))
+        h = get_header(ARENA_OF(h));
     if (!h->ext) {
         h->ext = malloc(sizeof(struct ta_ext_header));
         if (!h->ext)
@@ -117,6 +168,9 @@ bool ta_set_parent(void *ptr, void *ta_parent)
     struct ta_header *ch = get_header(ptr);
     if (!ch)
         return true;
+    // Arena allocations can't leave their arena.
+    if (IN_ARENA(ch))
+        return get_arena(get_header(ta_parent)) == ARENA_OF(ch);
     struct ta_ext_header *parent_eh = get_or_alloc_ext_header(ta_parent);
     if (ta_parent && !parent_eh) // do nothing on OOM
         return false;
@@ -137,6 +191,141 @@ bool ta_set_parent(void *ptr, void *ta_parent)
     return true;
 }
 
+static void *arena_alloc(struct ta_arena *arena, size_t size)
+{
+    if (size >= MAX_ALLOC - MIN_ALIGN)
+        return NULL;
+    size_t need = sizeof(union aligned_header) + ALIGN_SIZE(size);
+    struct ta_arena_chunk *c = arena->chunks;
+    if (c->size - c->used < need) {
+        bool large = need > ARENA_CHUNK / 4;
+        size_t csize = large ? need : ARENA_CHUNK;
+        struct ta_arena_chunk *nc =
+            malloc(ALIGN_SIZE(sizeof(struct ta_arena_chunk)) + csize);
+        if (!nc)
+            return NULL;
+        *nc = (struct ta_arena_chunk){.size = csize};
+        if (large) {
+            // Keep using the current chunk for small allocations.
+            nc->next = c->next;
+            c->next = nc;
+        } else {
+            nc->next = c;
+            arena->chunks = nc;
+        }
+        c = nc;
+    }
+    struct ta_header *h = (struct ta_header *)(CHUNK_DATA(c) + c->used);
+    c->used += need;
+    *h = (struct ta_header) {
+        .size = size,
+        .ext = (struct ta_ext_header *)((uintptr_t)arena | ARENA_TAG),
+    };
+    ta_dbg_init(h);
+    return PTR_FROM_HEADER(h);
+}
+
+// Whether h is the most recent allocation in the current chunk.
+static bool arena_is_last(struct ta_arena *arena, struct ta_header *h)
+{
+    struct ta_arena_chunk *c = arena->chunks;
+    return (char *)PTR_FROM_HEADER(h) + ALIGN_SIZE(h->size) ==
+           CHUNK_DATA(c) + c->used;
+}
+
+// Free all allocations in the arena (but not the arena itself).
+static void arena_reset(struct ta_arena *arena)
+{
+    // Destructors can add more destructors.
+    while (arena->num_dtors) {
+        struct ta_arena_dtor d = arena->dtors[--arena->num_dtors];
+        d.destructor(d.ptr);
+    }
+    free(arena->dtors);
+    arena->dtors = NULL;
+    arena->alloc_dtors = 0;
+    struct ta_arena_chunk *c = arena->chunks;
+    while (c) {
+        struct ta_arena_chunk *next = c->next;
+        if (c != arena->first)
+            free(c);
+        c = next;
+    }
+    arena->chunks = arena->first;
+    arena->first->next = NULL;
+    arena->first->used = 0;
+}
+
+static bool arena_set_destructor(struct ta_arena *arena, void *ptr,
+                                 void (*destructor)(void *))
+{
+    for (size_t n = 0; n < arena->num_dtors; n++) {
+        if (arena->dtors[n].ptr == ptr) {
+            if (destructor) {
+                arena->dtors[n].destructor = destructor;
+            } else {
+                arena->dtors[n] = arena->dtors[--arena->num_dtors];
+            }
+            return true;
+        }
+    }
+    if (!destructor)
+        return true;
+    if (arena->num_dtors == arena->alloc_dtors) {
+        size_t count = arena->alloc_dtors ? arena->alloc_dtors * 2 : 8;
+        void *new = realloc(arena->dtors, count * sizeof(arena->dtors[0]));
+        if (!new)
+            return false;
+        arena->dtors = new;
+        arena->alloc_dtors = count;
+    }
+    arena->dtors[arena->num_dtors++] = (struct ta_arena_dtor){ptr, destructor};
+    return true;
+}
+
+/* Create an arena. This is an allocation which can be used as parent like any
+ * other, but all allocations that have the arena (or an allocation inside of
+ * the arena) as parent are carved out of larger memory blocks owned by the
+ * arena. Creating many small allocations, and freeing them all together with
+ * the arena, is much cheaper this way.
+ *
+ * Allocations inside of an arena behave like normal allocations, except:
+ *  - ta_free() on them runs the destructor, but the memory is released only
+ *    when the arena is freed. This includes their children.
+ *  - ta_realloc_size() may return a new pointer even if the size is reduced.
+ *  - they can't be moved to a parent outside of the arena (ta_set_parent()
+ *    fails, and talloc_steal() aborts).
+ *  - non-arena allocations attached to them are freed when the arena is
+ *    freed (not when their parent is freed).
+ * ta_free_children() on the arena frees everything allocated in it.
+ *
+ * If ta_parent is inside of an arena, the new arena is a plain allocation in
+ * the parent's arena.
+ *
+ * Returns NULL on OOM.
+ */
+void *ta_new_arena(void *ta_parent)
+{
+    if (get_arena(get_header(ta_parent)))
+        return ta_new_context(ta_parent);
+    size_t arena_size = ALIGN_SIZE(sizeof(struct ta_arena));
+    size_t chunk_size = ALIGN_SIZE(sizeof(struct ta_arena_chunk));
+    struct ta_arena *arena =
+        ta_alloc_size(ta_parent, arena_size + chunk_size + ARENA_FIRST_CHUNK);
+    if (!arena)
+        return NULL;
+    struct ta_ext_header *eh = get_or_alloc_ext_header(arena);
+    if (!eh) {
+        ta_free(arena);
+        return NULL;
+    }
+    struct ta_arena_chunk *first = (void *)((char *)arena + arena_size);
+    *first = (struct ta_arena_chunk){.size = ARENA_FIRST_CHUNK};
+    *arena = (struct ta_arena){.chunks = first, .first = first};
+    eh->arena = arena;
+    return arena;
+}
+
 /* Allocate size bytes of memory. If ta_parent is not NULL, this is used as
  * parent allocation (if ta_parent is freed, this allocation is automatically
  * freed as well). size==0 allocates a block of size 0 (i.e. returns non-NULL).
@@ -144,6 +333,9 @@ bool ta_set_parent(void *ptr, void *ta_parent)
  */
 void *ta_alloc_size(void *ta_parent, size_t size)
 {
+    struct ta_arena *arena = get_arena(get_header(ta_parent));
+    if (arena)
+        return arena_alloc(arena, size);
     if (size >= MAX_ALLOC)
         return NULL;
     struct ta_header *h = malloc(sizeof(union aligned_header) + size);
@@ -164,6 +356,13 @@ void *ta_alloc_size(void *ta_parent, size_t size)
  */
 void *ta_zalloc_size(void *ta_parent, size_t size)
 {
+    struct ta_arena *arena = get_arena(get_header(ta_parent));
+    if (arena) {
+        void *ptr = arena_alloc(arena, size);
+        if (ptr)
+            memset(ptr, 0, size);
+        return ptr;
+    }
     if (size >= MAX_ALLOC)
         return NULL;
     struct ta_header *h = calloc(1, sizeof(union aligned_header) + size);
@@ -205,6 +404,36 @@ void *ta_realloc_size(void *ta_parent, void *ptr, size_t size)
     struct ta_header *old_h = h;
     if (h->size == size)
         return ptr;
+    if (IN_ARENA(h)) {
+        struct ta_arena *arena = ARENA_OF(h);
+        if (arena_is_last(arena, h)) {
+            // Resize in place.
+            struct ta_arena_chunk *c = arena->chunks;
+            size_t old_size = ALIGN_SIZE(h->size);
+            if (size < MAX_ALLOC - MIN_ALIGN &&
+                ALIGN_SIZE(size) <= c->size - c->used + old_size)
+            {
+                c->used = c->used - old_size + ALIGN_SIZE(size);
+                h->size = size;
+                return ptr;
+            }
+        } else if (size < h->size) {
+            h->size = size;
+            return ptr;
+        }
+        void *new = arena_alloc(arena, size);
+        if (!new)
+            return NULL;
+        memcpy(new, ptr, h->size < size ? h->size : size);
+        // Keep the destructor, now for the new pointer.
+        for (size_t n = 0; n < arena->num_dtors; n++) {
+            if (arena->dtors[n].ptr == ptr)
+                arena->dtors[n].ptr = new;
+        }
+        return new;
+    }
+    // Arenas can't be moved.
+    assert(!(h->ext && h->ext->arena));
     ta_dbg_remove(h);
     h = realloc(h, sizeof(union aligned_header) + size);
     ta_dbg_add(h ? h : old_h);
@@ -243,11 +472,13 @@ size_t ta_get_size(void *ptr)
 void ta_free_children(void *ptr)
 {
     struct ta_header *h = get_header(ptr);
-    struct ta_ext_header *eh = h ? h->ext : NULL;
+    struct ta_ext_header *eh = h && !IN_ARENA(h) ? h->ext : NULL;
     if (!eh)
         return;
     while (eh->children.next != &eh->children)
         ta_free(PTR_FROM_HEADER(eh->children.next));
+    if (eh->arena)
+        arena_reset(eh->arena);
 }
 
 /* Free the given allocation, and all of its direct and indirect children.
@@ -257,6 +488,26 @@ void ta_free(void *ptr)
     struct ta_header *h = get_header(ptr);
     if (!h)
         return;
+    if (IN_ARENA(h)) {
+        struct ta_arena *arena = ARENA_OF(h);
+        if (arena->num_dtors) {
+            for (size_t n = 0; n < arena->num_dtors; n++) {
+                if (arena->dtors[n].ptr == ptr) {
+                    void (*destructor)(void *) = arena->dtors[n].destructor;
+                    arena->dtors[n] = arena->dtors[--arena->num_dtors];
+                    destructor(ptr);
+                    break;
+                }
+            }
+        }
+        // Reclaim the memory if nothing was allocated after it.
+        if (arena_is_last(arena, h)) {
+            arena->chunks->used -= sizeof(union aligned_header) +
+                                   ALIGN_SIZE(h->size);
+        }
+        ta_dbg_remove(h);
+        return;
+    }
     if (h->ext && h->ext->destructor)
         h->ext->destructor(ptr);
     ta_free_children(ptr);
@@ -284,6 +535,9 @@ void ta_free(void *ptr)
  */
 bool ta_set_destructor(void *ptr, void (*destructor)(void *))
 {
+    struct ta_header *h = get_header(ptr);
+    if (h && IN_ARENA(h))
+        return arena_set_destructor(ARENA_OF(h), ptr, destructor);
     struct ta_ext_header *eh = get_or_alloc_ext_header(ptr);
     if (!eh)
         return false;
@@ -291,13 +545,16 @@ bool ta_set_destructor(void *ptr, void (*destructor)(void *))
     return true;
 }
 
-/* Return the ptr's parent allocation, or NULL if there isn't any.
+/* Return the ptr's parent allocation, or NULL if there isn't any. For
+ * allocations inside of an arena, this returns the arena.
  *
  * Warning: this has O(N) runtime complexity with N sibling allocations!
  */
 void *ta_find_parent(void *ptr)
 {
     struct ta_header *h = get_header(ptr);
+    if (h && IN_ARENA(h))
+        return ARENA_OF(h);
     if (!h || !h->next)
         return NULL;
     for (struct ta_header *cur = h->next; cur != h; cur = cur->next) {
@@ -329,6 +586,12 @@ static void ta_dbg_add(struct ta_header *h)
     }
 }
 
+// For arena allocations, which are not tracked by the leak report.
+static void ta_dbg_init(struct ta_header *h)
+{
+    h->canary = CANARY;
+}
+
 static void ta_dbg_check_header(struct ta_header *h)
 {
     if (h)
@@ -436,6 +699,7 @@ void *ta_dbg_mark_as_string(void *ptr)
 #else
 
 static void ta_dbg_add(struct ta_header *h){}
+static void ta_dbg_init(struct ta_header *h){}
 static void ta_dbg_check_header(struct ta_header *h){}
 static void ta_dbg_remove(struct ta_header *h){}
 
@@ -136,12 +136,12 @@ char *ta_strndup(void *ta_parent, const char *str, size_t n)
 {
     if (!str)
         return NULL;
-    char *new = NULL;
+    // Allocate directly in ta_parent (instead of reparenting), so that the
+    // string can be placed in an arena.
+    char *new = ta_alloc_size(ta_parent, strnlen(str, n) + 1);
+    if (!new)
+        return NULL;
     strndup_append_at(&new, 0, str, n);
-    if (!ta_set_parent(new, ta_parent)) {
-        ta_free(new);
-        new = NULL;
-    }
     return new;
 }
 
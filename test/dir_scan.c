@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include "test_helpers.h"
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "misc/dir_scan.h"
+#include "misc/thread_pool.h"
+#include "options/path.h"
+
+static struct mp_thread_pool *pool;
+
+static char *make_path(void *ctx, const char *root, const char *name)
+{
+    return talloc_asprintf(ctx, "%s/%s", root, name);
+}
+
+static void make_file(const char *root, const char *name)
+{
+    char *path = make_path(NULL, root, name);
+    FILE *f = fopen(path, "w");
+    assert_true(f);
+    fclose(f);
+    talloc_free(path);
+}
+
+static void make_dir(const char *root, const char *name)
+{
+    char *path = make_path(NULL, root, name);
+    assert_int_equal(mkdir(path, 0700), 0);
+    talloc_free(path);
+}
+
+// Make the directory look older than the last scan, so that the snapshot
+// entry for it is trusted.
+static void age_dir(const char *root, const char *name)
+{
+    char *path = make_path(NULL, root, name);
+    struct utimbuf t = {.actime = 1000000000, .modtime = 1000000000};
+    assert_int_equal(utime(path, &t), 0);
+    talloc_free(path);
+}
+
+static void remove_tree(const char *path)
+{
+    char *cmd = talloc_asprintf(NULL, "rm -rf '%s'", path);
+    assert_int_equal(system(cmd), 0);
+    talloc_free(cmd);
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+// Check that the scan returns exactly the given files, in strcmp() order.
+static void check_scan(const char *root, const char *snapshot,
+                       const char **files, int num_files)
+{
+    void *tmp = talloc_new(NULL);
+    char **expected = talloc_array(tmp, char *, num_files);
+    for (int n = 0; n < num_files; n++)
+        expected[n] = make_path(tmp, root, files[n]);
+    qsort(expected, num_files, sizeof(expected[0]), cmp_str);
+
+    struct dir_scan *s =
+        dir_scan_create(tmp, mp_null_log, pool, root, snapshot);
+    for (int n = 0; n < num_files; n++) {
+        const char *file = dir_scan_next(s);
+        assert_true(file);
+        assert_string_equal(file, expected[n]);
+    }
+    assert_true(!dir_scan_next(s));
+    assert_true(!dir_scan_next(s));
+    talloc_free(tmp);
+}
+
+static const char *tree_files[] = {
+    "a.txt", "a/b", "a/c/d", "a-b", "a.c/x", "b", "b0/b1/b2/f", "z",
+};
+
+static char *make_tree(void)
+{
+    char *root = talloc_strdup(NULL, "/tmp/mpa-dir-scan-XXXXXX");
+    assert_true(mkdtemp(root));
+    make_dir(root, "a");
+    make_dir(root, "a/c");
+    make_dir(root, "a.c");
+    make_dir(root, "b0");
+    make_dir(root, "b0/b1");
+    make_dir(root, "b0/b1/b2");
+    make_dir(root, "empty");
+    for (int n = 0; n < MP_ARRAY_SIZE(tree_files); n++)
+        make_file(root, tree_files[n]);
+    make_file(root, ".hidden");
+    make_file(root, "a/.hidden");
+    return root;
+}
+
+static void test_dir_scan_order(void **state)
+{
+    char *root = make_tree();
+    check_scan(root, NULL, tree_files, MP_ARRAY_SIZE(tree_files));
+
+    // Directory loops are skipped.
+    char *link = make_path(root, root, "a/c/loop");
+    assert_int_equal(symlink(root, link), 0);
+    check_scan(root, NULL, tree_files, MP_ARRAY_SIZE(tree_files));
+
+    remove_tree(root);
+    talloc_free(root);
+}
+
+static void test_dir_scan_snapshot(void **state)
+{
+    char *root = make_tree();
+    char *snapshot = make_path(root, root, ".snapshot");
+    const char *more_files[MP_ARRAY_SIZE(tree_files) + 1];
+    memcpy(more_files, tree_files, sizeof(tree_files));
+
+    age_dir(root, "a");
+    age_dir(root, "b0/b1");
+    check_scan(root, snapshot, tree_files, MP_ARRAY_SIZE(tree_files));
+    assert_true(mp_path_exists(snapshot));
+
+    // The snapshot's scan time is "now", so new changes can't be detected,
+    // but the old listing of aged directories is used.
+    make_file(root, "a/new");
+    age_dir(root, "a");
+    check_scan(root, snapshot, tree_files, MP_ARRAY_SIZE(tree_files));
+
+    // Changed mtimes invalidate the listing.
+    make_file(root, "b0/b1/new");
+    more_files[MP_ARRAY_SIZE(tree_files)] = "b0/b1/new";
+    check_scan(root, snapshot, more_files, MP_ARRAY_SIZE(more_files));
+
+    // Invalid snapshots are ignored.
+    FILE *f = fopen(snapshot, "w");
+    fputs("garbage", f);
+    fclose(f);
+    unlink(make_path(root, root, "a/new"));
+    check_scan(root, snapshot, more_files, MP_ARRAY_SIZE(more_files));
+
+    remove_tree(root);
+    talloc_free(root);
+}
+
+static void test_dir_scan_cancel(void **state)
+{
+    char *root = make_tree();
+    // Freeing in the middle of the scan stops it.
+    for (int n = 0; n < 20; n++) {
+        struct dir_scan *s =
+            dir_scan_create(NULL, mp_null_log, pool, root, NULL);
+        for (int i = 0; i < n % 4; i++)
+            dir_scan_next(s);
+        talloc_free(s);
+    }
+    remove_tree(root);
+    talloc_free(root);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_dir_scan_order),
+        cmocka_unit_test(test_dir_scan_snapshot),
+        cmocka_unit_test(test_dir_scan_cancel),
+    };
+    pool = mp_thread_pool_create(NULL, 0, 0, 8);
+    int r = cmocka_run_group_tests(tests, NULL, NULL);
+    talloc_free(pool);
+    return r;
+}
@@ -0,0 +1,70 @@
+#include "test_helpers.h"
+
+#include "common/common.h"
+#include "misc/dispatch.h"
+#include "osdep/timer.h"
+
+struct ctx {
+    struct mp_dispatch_queue *queue;
+    int count;
+    int order[16];
+};
+
+struct item {
+    struct ctx *ctx;
+    int v;
+};
+
+static void append_fn(void *p)
+{
+    struct item *item = p;
+    item->ctx->order[item->ctx->count++] = item->v;
+}
+
+static void count_fn(void *p)
+{
+    struct ctx *ctx = p;
+    ctx->count++;
+}
+
+static void test_dispatch_order(void **state)
+{
+    struct ctx ctx = {.queue = mp_dispatch_create(NULL)};
+    struct item items[16];
+    for (int n = 0; n < 16; n++) {
+        items[n] = (struct item){&ctx, n};
+        mp_dispatch_enqueue(ctx.queue, append_fn, &items[n]);
+    }
+    mp_dispatch_cancel_fn(ctx.queue, append_fn, &items[3]);
+
+    // Pending items make it return without waiting for the timeout.
+    int64_t start = mp_time_us();
+    mp_dispatch_queue_process(ctx.queue, 10);
+    assert_true(mp_time_us() - start < 5 * 1000 * 1000);
+
+    assert_int_equal(ctx.count, 15);
+    for (int n = 0; n < 15; n++)
+        assert_int_equal(ctx.order[n], n < 3 ? n : n + 1);
+
+    // Notifications are merged.
+    ctx.count = 0;
+    mp_dispatch_enqueue_notify(ctx.queue, count_fn, &ctx);
+    mp_dispatch_enqueue_notify(ctx.queue, count_fn, &ctx);
+    mp_dispatch_queue_process(ctx.queue, 0);
+    assert_int_equal(ctx.count, 1);
+
+    // An interrupt before the call makes it return immediately.
+    mp_dispatch_interrupt(ctx.queue);
+    start = mp_time_us();
+    mp_dispatch_queue_process(ctx.queue, 10);
+    assert_true(mp_time_us() - start < 5 * 1000 * 1000);
+
+    talloc_free(ctx.queue);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_dispatch_order),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
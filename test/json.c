@@ -39,12 +39,25 @@ static const struct entry entries[] = {
     { "", .expect_fail = true},
     { "abc", .expect_fail = true},
     { "  123  ", "123", NODE_INT64(123)},
-    { "123.25", "123.250000", NODE_FLOAT(123.25)},
+    { "123.25", "123.25", NODE_FLOAT(123.25)},
+    { "1.0", "1.0", NODE_FLOAT(1.0)},
+    { "-0.0", "-0.0", NODE_FLOAT(-0.0)},
+    { "0.1", "0.1", NODE_FLOAT(0.1)},
+    { "1e300", "1e+300", NODE_FLOAT(1e300)},
+    { "0.30000000000000004", "0.30000000000000004",
+        NODE_FLOAT(0.30000000000000004)},
+    { "-9007199254740993", "-9007199254740993",
+        NODE_INT64(-9007199254740993LL)},
     { TEXT("a\n\\\/\\\""), TEXT("a\n\\/\\\""), NODE_STR("a\n\\/\\\"")},
     { TEXT("a\u2c29"), TEXT("aⰩ"), NODE_STR("a\342\260\251")},
+    { TEXT("0123456789abcdef0123456789\"\t\u0001\\"),
+        TEXT("0123456789abcdef0123456789\"\t\u0001\\"),
+        NODE_STR("0123456789abcdef0123456789\"\t\001\\")},
     { "[1,2,3]", "[1,2,3]",
         NODE_ARRAY(NODE_INT64(1), NODE_INT64(2), NODE_INT64(3))},
     { "[ ]", "[]", NODE_ARRAY()},
+    { "[\n                                   1\r\n\t ]", "[1]",
+        NODE_ARRAY(NODE_INT64(1))},
     { "[1,,2]", .expect_fail = true},
     { "[,]", .expect_fail = true},
     { TEXT({"a":1, "b":2}), TEXT({"a":1,"b":2}),
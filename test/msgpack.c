@@ -0,0 +1,135 @@
+#include "test_helpers.h"
+
+#include "common/common.h"
+#include "misc/msgpack.h"
+#include "misc/node.h"
+
+struct entry {
+    const char *enc;
+    int enc_len;
+    struct mpv_node data;
+};
+
+#define BYTES(s) s, sizeof(s) - 1
+
+#define VAL_LIST(...) (struct mpv_node[]){__VA_ARGS__}
+
+#define L(...) __VA_ARGS__
+
+#define NODE_INT64(v) {.format = MPV_FORMAT_INT64,  .u = { .int64 = (v) }}
+#define NODE_STR(v)   {.format = MPV_FORMAT_STRING, .u = { .string = (v) }}
+#define NODE_BOOL(v)  {.format = MPV_FORMAT_FLAG,   .u = { .flag = (bool)(v) }}
+#define NODE_FLOAT(v) {.format = MPV_FORMAT_DOUBLE, .u = { .double_ = (v) }}
+#define NODE_NONE()   {.format = MPV_FORMAT_NONE }
+#define NODE_EMPTY(f) {.format = (f), .u = { .list = &(struct mpv_node_list){0}}}
+#define NODE_ARRAY(...) {.format = MPV_FORMAT_NODE_ARRAY, .u = { .list =    \
+    &(struct mpv_node_list) {                                               \
+        .num = sizeof(VAL_LIST(__VA_ARGS__)) / sizeof(struct mpv_node),     \
+        .values = VAL_LIST(__VA_ARGS__)}}}
+#define NODE_MAP(k, v) {.format = MPV_FORMAT_NODE_MAP, .u = { .list =       \
+    &(struct mpv_node_list) {                                               \
+        .num = sizeof(VAL_LIST(v)) / sizeof(struct mpv_node),               \
+        .values = VAL_LIST(v),                                              \
+        .keys = (char**)(const char *[]){k}}}}
+
+// Encodings written by msgpack_write(), which must parse back to data.
+static const struct entry entries[] = {
+    { BYTES("\xc0"), NODE_NONE()},
+    { BYTES("\xc3"), NODE_BOOL(true)},
+    { BYTES("\xc2"), NODE_BOOL(false)},
+    { BYTES("\x00"), NODE_INT64(0)},
+    { BYTES("\x7f"), NODE_INT64(127)},
+    { BYTES("\xcc\x80"), NODE_INT64(128)},
+    { BYTES("\xcd\x01\x00"), NODE_INT64(256)},
+    { BYTES("\xce\x00\x01\x00\x00"), NODE_INT64(65536)},
+    { BYTES("\xcf\x7f\xff\xff\xff\xff\xff\xff\xff"), NODE_INT64(INT64_MAX)},
+    { BYTES("\xff"), NODE_INT64(-1)},
+    { BYTES("\xe0"), NODE_INT64(-32)},
+    { BYTES("\xd0\xdf"), NODE_INT64(-33)},
+    { BYTES("\xd1\xff\x7f"), NODE_INT64(-129)},
+    { BYTES("\xd3\x80\x00\x00\x00\x00\x00\x00\x00"), NODE_INT64(INT64_MIN)},
+    { BYTES("\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00"), NODE_FLOAT(1.5)},
+    { BYTES("\xa0"), NODE_STR("")},
+    { BYTES("\xa3" "abc"), NODE_STR("abc")},
+    { BYTES("\xd9\x20" "0123456789abcdef0123456789abcdef"),
+        NODE_STR("0123456789abcdef0123456789abcdef")},
+    { BYTES("\x90"), NODE_EMPTY(MPV_FORMAT_NODE_ARRAY)},
+    { BYTES("\x92\x01\xa1" "a"), NODE_ARRAY(NODE_INT64(1), NODE_STR("a"))},
+    { BYTES("\x81\xa1" "a\xa1" "b"), NODE_MAP(L("a"), L(NODE_STR("b")))},
+    { BYTES("\x82\xa1" "a\x91\xc3\xa1" "b\x80"),
+        NODE_MAP(L("a", "b"),
+                 L(NODE_ARRAY(NODE_BOOL(true)),
+                   NODE_EMPTY(MPV_FORMAT_NODE_MAP)))},
+};
+
+// Other encodings which must be accepted.
+static const struct entry parse_entries[] = {
+    { BYTES("\xca\x3f\xc0\x00\x00"), NODE_FLOAT(1.5)},
+    { BYTES("\xc4\x02" "ab"), NODE_STR("ab")},
+    { BYTES("\xda\x00\x01" "a"), NODE_STR("a")},
+    { BYTES("\xdc\x00\x01\x05"), NODE_ARRAY(NODE_INT64(5))},
+    { BYTES("\xdf\x00\x00\x00\x01\xa1" "k\x05"),
+        NODE_MAP(L("k"), L(NODE_INT64(5)))},
+};
+
+static const struct entry invalid_entries[] = {
+    { BYTES("")},
+    { BYTES("\xc1")},                           // reserved
+    { BYTES("\xd4\x01\x00")},                   // fixext 1
+    { BYTES("\xcf\x80\x00\x00\x00\x00\x00\x00\x00")}, // > INT64_MAX
+    { BYTES("\xa3" "ab")},                      // truncated
+    { BYTES("\xa3" "a\x00" "b")},               // embedded '\0'
+    { BYTES("\x81\x01\x02")},                   // non-string key
+    { BYTES("\xdd\xff\xff\xff\xff\xc0")},       // bogus count
+    { BYTES("\x91\x91\x91\x91\x91\x91\x91\x91\x91\x91\x91\xc0")}, // too deep
+};
+
+#define MAX_DEPTH 10
+
+static void test_msgpack(void **state)
+{
+    for (int n = 0; n < MP_ARRAY_SIZE(entries); n++) {
+        const struct entry *e = &entries[n];
+        print_message("%d\n", n);
+        void *tmp = talloc_new(NULL);
+        bstr d = {0};
+        assert_true(msgpack_write(tmp, &d, (struct mpv_node *)&e->data) >= 0);
+        assert_int_equal(d.len, e->enc_len);
+        assert_memory_equal(d.start, e->enc, e->enc_len);
+        struct mpv_node res;
+        bstr src = d;
+        assert_true(msgpack_parse(tmp, &res, &src, MAX_DEPTH) >= 0);
+        assert_int_equal(src.len, 0);
+        assert_true(equal_mpv_node(&e->data, &res));
+        talloc_free(tmp);
+    }
+
+    for (int n = 0; n < MP_ARRAY_SIZE(parse_entries); n++) {
+        const struct entry *e = &parse_entries[n];
+        print_message("parse %d\n", n);
+        void *tmp = talloc_new(NULL);
+        struct mpv_node res;
+        bstr src = {(unsigned char *)e->enc, e->enc_len};
+        assert_true(msgpack_parse(tmp, &res, &src, MAX_DEPTH) >= 0);
+        assert_int_equal(src.len, 0);
+        assert_true(equal_mpv_node(&e->data, &res));
+        talloc_free(tmp);
+    }
+
+    for (int n = 0; n < MP_ARRAY_SIZE(invalid_entries); n++) {
+        const struct entry *e = &invalid_entries[n];
+        print_message("invalid %d\n", n);
+        void *tmp = talloc_new(NULL);
+        struct mpv_node res;
+        bstr src = {(unsigned char *)e->enc, e->enc_len};
+        assert_true(msgpack_parse(tmp, &res, &src, MAX_DEPTH) < 0);
+        talloc_free(tmp);
+    }
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_msgpack),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,129 @@
+#include "test_helpers.h"
+
+#include "common/common.h"
+#include "common/playlist.h"
+
+// Check the lookups against a plain walk of the list.
+static void check_playlist(struct playlist *pl)
+{
+    int n = 0;
+    for (struct playlist_entry *e = pl->first; e; e = e->next) {
+        assert_int_equal(playlist_entry_to_index(pl, e), n);
+        n++;
+    }
+    assert_int_equal(playlist_entry_count(pl), n);
+    n = 0;
+    for (struct playlist_entry *e = pl->first; e; e = e->next)
+        assert_true(playlist_entry_from_index(pl, n++) == e);
+    assert_true(!playlist_entry_from_index(pl, n));
+    assert_true(!playlist_entry_from_index(pl, -1));
+}
+
+static void test_playlist_index(void **state)
+{
+    struct playlist *pl = talloc_zero(NULL, struct playlist);
+    check_playlist(pl);
+
+    // Enough entries for several blocks.
+    for (int n = 0; n < 1000; n++)
+        playlist_add_file(pl, "file");
+    check_playlist(pl);
+
+    struct playlist_entry *e50 = playlist_entry_from_index(pl, 50);
+    playlist_insert(pl, NULL, playlist_entry_new("first"));
+    assert_int_equal(playlist_entry_to_index(pl, e50), 51);
+    playlist_insert(pl, e50, playlist_entry_new("middle"));
+    check_playlist(pl);
+
+    playlist_move(pl, pl->last, pl->first);
+    playlist_move(pl, pl->first->next, NULL);
+    playlist_move(pl, e50, playlist_entry_from_index(pl, 10));
+    assert_int_equal(playlist_entry_to_index(pl, e50), 10);
+    check_playlist(pl);
+
+    playlist_remove(pl, pl->first);
+    playlist_remove(pl, pl->last);
+    e50->reserved++;
+    playlist_remove(pl, e50);
+    assert_int_equal(playlist_entry_to_index(pl, e50), -1);
+    playlist_entry_unref(e50);
+    check_playlist(pl);
+
+    for (int n = 0; n < 5000; n++) {
+        int count = playlist_entry_count(pl);
+        struct playlist_entry *e = playlist_entry_from_index(pl, rand() % count);
+        // Later remove more than insert, so that blocks get merged.
+        switch (rand() % (n < 2000 ? 3 : 4)) {
+        case 0:
+        case 3:
+            playlist_remove(pl, e);
+            break;
+        case 1:
+            playlist_insert(pl, e, playlist_entry_new("x"));
+            break;
+        case 2:
+            playlist_move(pl, e, playlist_entry_from_index(pl, rand() % count));
+            break;
+        }
+        if (!playlist_entry_count(pl))
+            playlist_add_file(pl, "file");
+        if (n % 100 == 0)
+            check_playlist(pl);
+    }
+    check_playlist(pl);
+
+    playlist_shuffle(pl);
+    check_playlist(pl);
+
+    struct playlist *other = talloc_zero(NULL, struct playlist);
+    playlist_add_file(other, "a");
+    playlist_add_file(other, "b");
+    pl->current = playlist_entry_from_index(pl, 5);
+    playlist_transfer_entries(pl, other);
+    assert_int_equal(playlist_entry_count(other), 0);
+    assert_string_equal(playlist_entry_from_index(pl, 7)->filename, "b");
+    check_playlist(pl);
+    check_playlist(other);
+
+    playlist_clear(pl);
+    check_playlist(pl);
+
+    talloc_free(other);
+    talloc_free(pl);
+}
+
+static void test_playlist_shared_strings(void **state)
+{
+    struct playlist *pl = talloc_zero(NULL, struct playlist);
+    struct playlist_strings *strings = playlist_strings_new();
+    for (int n = 0; n < 3; n++) {
+        char name[10];
+        snprintf(name, sizeof(name), "file%d", n);
+        struct playlist_entry *e = playlist_entry_new_shared(strings, bstr0(name));
+        e->title = talloc_strdup(strings->arena, "title");
+        playlist_add(pl, e);
+    }
+    playlist_strings_unref(strings);
+    assert_int_equal(strings->refs, 3);
+
+    // Entries can be moved elsewhere, and the strings stay valid.
+    struct playlist *other = talloc_zero(NULL, struct playlist);
+    playlist_add_file(other, "a");
+    playlist_transfer_entries_to(other, other->first, pl);
+    talloc_free(pl);
+    assert_string_equal(playlist_entry_from_index(other, 0)->filename, "a");
+    assert_string_equal(playlist_entry_from_index(other, 1)->filename, "file0");
+    assert_string_equal(playlist_entry_from_index(other, 3)->title, "title");
+
+    // Freed with the last entry (checked by ASAN/leak reports).
+    playlist_clear(other);
+    talloc_free(other);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_playlist_index),
+        cmocka_unit_test(test_playlist_shared_strings),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
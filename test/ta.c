@@ -0,0 +1,103 @@
+#include "test_helpers.h"
+
+#include "common/common.h"
+#include "misc/json.h"
+#include "misc/node.h"
+
+static int destructor_calls;
+
+static void count_destructor(void *p)
+{
+    destructor_calls++;
+}
+
+static void *destructed;
+
+static void record_destructor(void *p)
+{
+    destructed = p;
+}
+
+static void test_arena(void **state)
+{
+    void *root = talloc_new(NULL);
+    void *arena = talloc_new_arena(root);
+
+    // Small allocations come from the arena, and keep their size.
+    int *a = talloc_array(arena, int, 4);
+    char *s = talloc_strdup(a, "abc");
+    assert_int_equal(talloc_get_size(a), sizeof(int) * 4);
+    assert_string_equal(s, "abc");
+    assert_true(((uintptr_t)a & 15) == 0);
+    assert_true(ta_find_parent(s) == arena);
+
+    // Growing the most recent allocation, and appending to strings.
+    for (int n = 0; n < 1000; n++)
+        s = talloc_asprintf_append(s, "%d", n % 10);
+    assert_int_equal(strlen(s), 1003);
+    assert_true(!strncmp(s, "abc0123", 7));
+
+    // Larger than a chunk.
+    char *big = talloc_zero_size(arena, 1024 * 1024);
+    assert_int_equal(big[1024 * 1024 - 1], 0);
+
+    // Destructors run when freeing the arena, or the allocation itself.
+    destructor_calls = 0;
+    void *d1 = talloc_size(arena, 10);
+    talloc_set_destructor(d1, count_destructor);
+    void *d2 = talloc_size(a, 10);
+    talloc_set_destructor(d2, count_destructor);
+    talloc_free(d2);
+    assert_int_equal(destructor_calls, 1);
+
+    // Normal allocations can be attached to arena allocations.
+    void *ctx = talloc_new(a);
+    assert_true(talloc_strdup(ctx, "x"));
+
+    // Can't leave the arena.
+    assert_true(ta_set_parent(s, a));
+    assert_true(!ta_set_parent(s, root));
+
+    // Destructors follow allocations moved by realloc.
+    void *d3 = talloc_size(arena, 10);
+    talloc_set_destructor(d3, record_destructor);
+    assert_true(talloc_size(arena, 10));
+    d3 = talloc_realloc_size(arena, d3, 100);
+    destructed = NULL;
+    talloc_free(d3);
+    assert_true(destructed == d3);
+
+    talloc_free_children(arena);
+    assert_int_equal(destructor_calls, 2);
+    assert_true(talloc_strdup(arena, "reused"));
+
+    talloc_free(root);
+}
+
+static void test_arena_json(void **state)
+{
+    void *arena = talloc_new_arena(NULL);
+    char *src = talloc_strdup(arena,
+        "{\"command\": [\"get_property\", \"time-pos\"], \"request_id\": 42,"
+        " \"list\": [1, 2.5, true, null, {\"a\": \"b\"}]}");
+    struct mpv_node node;
+    assert_true(json_parse(arena, &node, &src, 10) >= 0);
+    assert_int_equal(node.format, MPV_FORMAT_NODE_MAP);
+    node_map_add_string(&node, "error", "success");
+
+    char *out = talloc_strdup(NULL, "");
+    assert_true(json_write(&out, &node) >= 0);
+    talloc_free(arena);
+    assert_string_equal(out,
+        "{\"command\":[\"get_property\",\"time-pos\"],\"request_id\":42,"
+        "\"list\":[1,2.5,true,null,{\"a\":\"b\"}],\"error\":\"success\"}");
+    talloc_free(out);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_arena),
+        cmocka_unit_test(test_arena_json),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
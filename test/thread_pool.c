@@ -0,0 +1,82 @@
+#include "test_helpers.h"
+
+#include "common/common.h"
+#include "misc/thread_pool.h"
+#include "osdep/atomic.h"
+
+struct ctx {
+    struct mp_thread_pool *pool;
+    atomic_int count;
+    int depth;
+};
+
+static void count_fn(void *p)
+{
+    struct ctx *ctx = p;
+    atomic_fetch_add(&ctx->count, 1);
+}
+
+// Fork into a tree of nested groups; every node waits for its children while
+// running on a worker thread.
+struct node {
+    struct ctx *ctx;
+    int depth;
+};
+
+static void tree_fn(void *p)
+{
+    struct node *node = p;
+    atomic_fetch_add(&node->ctx->count, 1);
+    if (node->depth == node->ctx->depth)
+        return;
+
+    struct mp_task_group *group = mp_task_group_create(NULL, node->ctx->pool);
+    struct node children[4];
+    for (int n = 0; n < 4; n++) {
+        children[n] = (struct node){node->ctx, node->depth + 1};
+        mp_task_group_add(group, tree_fn, &children[n]);
+    }
+    mp_task_group_wait(group);
+    talloc_free(group);
+}
+
+static void test_thread_pool_groups(void **state)
+{
+    struct ctx ctx = {.pool = mp_thread_pool_create(NULL, 0, 0, 4)};
+    assert_true(ctx.pool);
+
+    struct mp_task_group *group = mp_task_group_create(NULL, ctx.pool);
+    for (int n = 0; n < 1000; n++)
+        mp_task_group_add(group, count_fn, &ctx);
+    mp_task_group_wait(group);
+    assert_int_equal(atomic_load(&ctx.count), 1000);
+
+    // Nested groups must not deadlock, even with more waiters than threads.
+    atomic_store(&ctx.count, 0);
+    ctx.depth = 4;
+    struct node root = {&ctx, 0};
+    mp_task_group_add(group, tree_fn, &root);
+    mp_task_group_wait(group);
+    assert_int_equal(atomic_load(&ctx.count), 1 + 4 + 16 + 64 + 256);
+
+    // Freeing the group waits as well.
+    atomic_store(&ctx.count, 0);
+    for (int n = 0; n < 100; n++)
+        mp_task_group_add(group, count_fn, &ctx);
+    talloc_free(group);
+    assert_int_equal(atomic_load(&ctx.count), 100);
+
+    // Plain queue calls still work, and are done before the pool is gone.
+    atomic_store(&ctx.count, 0);
+    for (int n = 0; n < 100; n++)
+        assert_true(mp_thread_pool_queue(ctx.pool, count_fn, &ctx));
+    talloc_free(ctx.pool);
+    assert_int_equal(atomic_load(&ctx.count), 100);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_thread_pool_groups),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -92,8 +92,10 @@ def build(ctx):
         ( "common/codecs.c" ),
         ( "common/common.c" ),
         ( "common/msg.c" ),
+        ( "common/perf_counters.c" ),
         ( "common/playlist.c" ),
         ( "common/tags.c" ),
+        ( "common/tracing.c" ),
         ( "common/version.c" ),
 
         ## Demuxers
@@ -103,10 +105,12 @@ def build(ctx):
         ( "demux/demux_cue.c" ),
         ( "demux/demux_lavf.c" ),
         ( "demux/demux_null.c" ),
+        ( "demux/demux_pcm.c" ),
         ( "demux/demux_playlist.c" ),
         ( "demux/demux_raw.c" ),
         ( "demux/demux_timeline.c" ),
         ( "demux/packet.c" ),
+        ( "demux/probe_cache.c" ),
         ( "demux/timeline.c" ),
 
         ( "filters/f_auto_filters.c" ),
@@ -132,8 +136,10 @@ def build(ctx):
         ## Misc
         ( "misc/bstr.c" ),
         ( "misc/charset_conv.c" ),
+        ( "misc/dir_scan.c" ),
         ( "misc/dispatch.c" ),
         ( "misc/json.c" ),
+        ( "misc/msgpack.c" ),
         ( "misc/node.c" ),
         ( "misc/rendezvous.c" ),
         ( "misc/ring.c" ),
@@ -158,6 +164,7 @@ def build(ctx):
         ( "player/main.c" ),
         ( "player/misc.c" ),
         ( "player/osd.c" ),
+        ( "player/playback_state.c" ),
         ( "player/playloop.c" ),
 
         ## Streams
@@ -168,6 +175,8 @@ def build(ctx):
         ( "stream/stream_lavf.c" ),
         ( "stream/stream_memory.c" ),
         ( "stream/stream_null.c" ),
+        ( "stream/stream_push.c" ),
+        ( "stream/stream_shm.c" ),
 
         ## osdep
         ( getch2_c ),
@@ -349,7 +358,8 @@ def build(ctx):
             PRIV_LIBS    = get_deps(),
         )
 
-        headers = ["client.h", "qthelper.hpp", "stream_cb.h"]
+        headers = ["client.h", "qthelper.hpp", "stream_cb.h", "playback_state.h",
+                   "stream_push.h"]
         for f in headers:
             ctx.install_as(ctx.env.INCLUDEDIR + '/mpa/' + f, 'libmpa/' + f)
 